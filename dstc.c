@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/time.h>
@@ -19,8 +20,13 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 
 
+#if defined(__linux__) || defined(__ANDROID__)
+#include <sys/eventfd.h>
+#endif
+
 #if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
 #include <sys/epoll.h>
 #else
@@ -34,6 +40,11 @@
 #define SUSPEND_TRAFFIC_THRESHOLD 3000
 #define RESTART_TRAFFIC_THRESHOLD 2800
 
+// Max number of outbound packet buffers. RMC suspends traffic once
+// SUSPEND_TRAFFIC_THRESHOLD packets are in flight, after which
+// we only need the buffer that calls are being queued to.
+#define DSTC_PACKET_POOL_SIZE (SUSPEND_TRAFFIC_THRESHOLD + 2)
+
 
 // Default context to use if caller does not supply one.
 //
@@ -44,32 +55,159 @@ dstc_context_t _dstc_default_context = {
 #else
     .lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER,
 #endif
+    .lock_depth = 0,
+    .dispatch_depth = 0,
 
-    .remote_node = { { 0, { 0 } } },
+    .remote_node = 0,
     .remote_node_ind = 0,
+    .remote_node_size = 0,
+    .callback_slot = 0,
+    .callback_slot_ind = 0,
+    .callback_slot_size = 0,
+    .callback_slot_free = 0,
     .local_callback = { {0,0 } },
 
 #if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
     .epoll_fd = -1,
+    .epoll_fd_owned = 0,
 #else
     .poll_hash = 0,
 #endif
 
-    .client_func = { { { 0 }, 0 } },
+    .client_func = { { { 0 }, 0, DSTC_FUNC_ID_NONE } },
     .client_func_ind = 0 ,
+    .func_id_gen = 0,
     .client_callback_count = 0,
-    .server_func = { { { 0 }, 0 } },
+    .server_func = 0,
     .server_func_ind = 0,
+    .server_func_size = 0,
+    .publisher = 0,
+    .publisher_ind = 0,
+    .publisher_size = 0,
+    .publisher_cache = 0,
+    .server_func_hash = 0,
+    .server_func_hash_mask = 0,
+    .sub_filter = 0,
+    .sub_packets_skipped = 0,
     .sub_ctx = 0,
     .pub_ctx = 0,
-    .pub_buffer = { 0 },
+    .pub_buffer = 0,
     .pub_buffer_ind = 0,
-    .pub_is_buffering= 0
+    .pub_filter_record = 0,
+    .pub_filter = 0,
+    .pub_block_ind = 0,
+    .pub_compact_calls = 0,
+    .reply_buffer = 0,
+    .reply_ind = 0,
+    .reply_count = 0,
+    .reply_node_id = 0,
+    .reply_reserved = 0,
+    .pub_direct_callbacks = 0,
+    .reply_node_ind = 0,
+    .reply_node_free_head = 0,
+    .reply_node_free_tail = 0,
+    .pub_queue_head = 0,
+    .pub_queue_tail = 0,
+    .pub_queue_len = 0,
+    .pub_queue_bytes = 0,
+    .pub_queue_budget = DEFAULT_PUB_QUEUE_BUDGET,
+    .pub_queue_high_water = 0,
+    .pub_queue_budget_exhausted = 0,
+    .pub_pool_free = 0,
+    .pub_pool_allocated = 0,
+    .pub_pool_in_use = 0,
+    .pub_pool_high_water = 0,
+    .pub_pool_reused = 0,
+    .pub_packets_queued = 0,
+    .pub_is_buffering= 0,
+    .pub_flush_usec = 0,
+    .pub_flush_bytes = 0,
+    .pub_flush_deadline = 0,
+    .pub_flush_adaptive = 0,
+    .pub_flush_window_changes = 0,
+    .pub_flush_rate = 0,
+    .pub_flush_latency_usec = 0,
+    .pub_last_queue_usec = 0,
+    .pub_suspended = 0,
+    .pub_suspended_count = 0,
+    .group_suspended = 0,
+    .flow_suspended = 0,
+    .flow_fd = { -1, -1 },
+    .flow_control_cb = 0,
+    .flow_cond = PTHREAD_COND_INITIALIZER,
+    .flow_waiters = 0,
+    .event_wait_threads = 0,
+    .wake_fd = { -1, -1 },
+    .pub_bulk_depth = 0,
+    .sub_pool_free = { 0 },
+    .sub_pool_in_use = 0,
+    .sub_pool_heap_allocs = 0,
+    .sub_pool_reused = 0,
+    .sub_batches = 0,
+    .sub_batched_calls = 0,
+    .exec_lock = PTHREAD_MUTEX_INITIALIZER,
+    .exec_space_cond = PTHREAD_COND_INITIALIZER,
+    .exec_worker = 0,
+    .exec_worker_count = 0,
+    .exec_next_worker = 0,
+    .exec_ordering = DSTC_EXECUTOR_ORDER_FUNCTION,
+    .exec_stopping = 0,
+    .exec_pending = 0,
+    .exec_call_free = 0,
+    .exec_packets = 0,
+    .exec_max_packets = 0,
+    .exec_calls = 0,
+    .exec_stolen = 0,
+    .exec_stalls = 0,
+    .thread_buffer = 0,
+    .thread_buffer_stranded = 0,
+    .group_count = 0,
+    .group_root = 0,
+    .group_map = 0
 };
 
+// Context bound to the calling thread by dstc_use_context().
+// 0 if the thread uses the default context.
+static __thread dstc_context_t* _dstc_thread_context = 0;
+
+// Context of the call last reserved by the calling thread, to be
+// completed by dstc_commit_call(). Differs from the context the call
+// was made in if functions are spread across multicast groups.
+// Only set while a reserved call is pending, and cleared by a failed
+// reservation.
+static __thread dstc_context_t* _dstc_reserved_context = 0;
+
+static int _dstc_setup_default(dstc_context_t* ctx);
+static int _dstc_process_timeout(dstc_context_t* ctx);
+static int _dstc_setup_executor(dstc_context_t* ctx,
+                                uint32_t thread_count,
+                                int ordering,
+                                uint32_t max_packets);
+
+dstc_context_t* _dstc_current_context(void)
+{
+    return _dstc_thread_context?_dstc_thread_context:&_dstc_default_context;
+}
+
+// Return the context bound to the calling thread, or the root
+// context that created it if it is a group context. See
+// dstc_setup_groups().
+static dstc_context_t* _dstc_root_context(void)
+{
+    dstc_context_t* ctx = _dstc_current_context();
+
+    return ctx->group_root?ctx->group_root:ctx;
+}
+
 
 
 
+// Function registration sent by a server to a client.
+// name is followed by its null terminator and a byte of
+// DSTC_CAP_XXX flags. Older nodes always send 0 as flags.
+// An empty name carries direct callback replies, or announces a
+// node that serves no functions.
+//
 typedef struct {
     rmc_node_id_t node_id;
     char name[256];
@@ -137,8 +275,10 @@ static int _dstc_context_initialized(dstc_context_t* ctx)
 int _dstc_lock_context_timeout(dstc_context_t* ctx, struct timespec* abs_timeout, int line)
 {
 
-    if (!pthread_mutex_trylock(&ctx->lock))
+    if (!pthread_mutex_trylock(&ctx->lock)) {
+        ctx->lock_depth++;
         return ENOTBLK;
+    }
 
 // Apple does not have pthread_mutex_timedlock(), so we have
 // to emulate it using stupid busy wait.
@@ -154,6 +294,9 @@ int _dstc_lock_context_timeout(dstc_context_t* ctx, struct timespec* abs_timeout
         int status = -1;
 
         result = pthread_mutex_trylock(&ctx->lock);
+        if (!result)
+            ctx->lock_depth++;
+
         if (!result || result != EBUSY)
             return result;
 
@@ -174,6 +317,7 @@ int _dstc_lock_context_timeout(dstc_context_t* ctx, struct timespec* abs_timeout
     if (pthread_mutex_timedlock(&ctx->lock, abs_timeout)) {
         return ETIME;
     }
+    ctx->lock_depth++;
     return 0;
 #endif
 }
@@ -181,12 +325,14 @@ int _dstc_lock_context_timeout(dstc_context_t* ctx, struct timespec* abs_timeout
 int __dstc_lock_context(dstc_context_t* ctx, int line)
 {
     pthread_mutex_lock(&ctx->lock);
+    ctx->lock_depth++;
     return 0;
 }
 
 
 void __dstc_unlock_context(dstc_context_t* ctx, int line)
 {
+    ctx->lock_depth--;
     pthread_mutex_unlock(&ctx->lock);
 }
 
@@ -200,7 +346,7 @@ int __dstc_lock_and_init_context_timeout(dstc_context_t* ctx, struct timespec* a
         return ret;
 
     if (!_dstc_context_initialized(ctx))
-        return dstc_setup();
+        return _dstc_setup_default(ctx);
 
     return ret;
 }
@@ -215,11 +361,30 @@ int __dstc_lock_and_init_context(dstc_context_t* ctx, int line)
         return ret;
 
     if (!_dstc_context_initialized(ctx))
-        return dstc_setup();
+        return _dstc_setup_default(ctx);
 
     return 0;
 }
 
+// Fully release ctx, held by the calling thread, returning the
+// number of times it was locked for _dstc_reacquire_context().
+static uint32_t _dstc_release_context(dstc_context_t* ctx)
+{
+    uint32_t depth = ctx->lock_depth;
+    uint32_t ind = depth;
+
+    while(ind--)
+        _dstc_unlock_context(ctx);
+
+    return depth;
+}
+
+static void _dstc_reacquire_context(dstc_context_t* ctx, uint32_t depth)
+{
+    while(depth--)
+        _dstc_lock_context(ctx);
+}
+
 
 // ctx must be non-null and locked
 static uint32_t _dstc_payload_buffer_in_use(dstc_context_t* ctx)
@@ -234,10 +399,163 @@ static uint32_t _dstc_get_socket_count(dstc_context_t* ctx)
         rmc_pub_get_socket_count(ctx->pub_ctx);
 }
 
+// Return the number of bytes that the DSTC_RECORD_FILTER record
+// takes at the start of the payload buffer, if the next allocation
+// is the first one. Packets of buffered calls start with a filter
+// record. Unbuffered calls are usually sent one per packet, where a
+// filter saves little next to its size.
+//
+// ctx must be non-null and locked
+static uint32_t _dstc_payload_buffer_filter_len(dstc_context_t* ctx)
+{
+    if (ctx->pub_buffer_ind || (!ctx->pub_is_buffering && !ctx->pub_bulk_depth))
+        return 0;
+
+    return DSTC_FILTER_RECORD_LEN;
+}
+
 // ctx must be non-null and locked
 static uint32_t _dstc_payload_buffer_available(dstc_context_t* ctx)
 {
-    return  sizeof(ctx->pub_buffer) - ctx->pub_buffer_ind;
+    return  RMC_MAX_PAYLOAD - ctx->pub_buffer_ind - _dstc_payload_buffer_filter_len(ctx);
+}
+
+// Allocate a new packet buffer, adding it to the pool.
+// Returns 0 if the pool is at its max size, which grows with the
+// outbound queue.
+//
+// ctx must be non-null and locked
+static dstc_packet_buffer_t* _dstc_packet_buffer_new(dstc_context_t* ctx)
+{
+    dstc_packet_buffer_t* buf = 0;
+    int res = 0;
+
+    if (ctx->pub_pool_allocated >= DSTC_PACKET_POOL_SIZE + ctx->pub_queue_len) {
+        RMC_LOG_WARNING("All %d packet buffers in use", ctx->pub_pool_allocated);
+        return 0;
+    }
+
+    res = posix_memalign((void**) &buf,
+                         DSTC_CACHE_LINE_SIZE,
+                         sizeof(dstc_packet_buffer_t) + RMC_MAX_PAYLOAD);
+
+    if (res) {
+        RMC_LOG_FATAL("posix_memalign(%d): %s",
+                      sizeof(dstc_packet_buffer_t) + RMC_MAX_PAYLOAD, strerror(res));
+        exit(255);
+    }
+
+    ctx->pub_pool_allocated++;
+    buf->next_free = 0;
+    return buf;
+}
+
+// Retrieve a packet buffer from the pool, growing it if needed.
+// Returns a pointer to the buffer payload, or 0 if all buffers are
+// in use.
+//
+// ctx must be non-null and locked
+static uint8_t* _dstc_packet_buffer_get(dstc_context_t* ctx)
+{
+    dstc_packet_buffer_t* buf = ctx->pub_pool_free;
+
+    if (buf) {
+        ctx->pub_pool_free = buf->next_free;
+        ctx->pub_pool_reused++;
+    } else if (!(buf = _dstc_packet_buffer_new(ctx)))
+        return 0;
+
+    if (++ctx->pub_pool_in_use > ctx->pub_pool_high_water)
+        ctx->pub_pool_high_water = ctx->pub_pool_in_use;
+
+    return buf->payload;
+}
+
+// Return a packet buffer, as provided by _dstc_packet_buffer_get(),
+// to the pool.
+//
+// ctx must be non-null and locked
+static void _dstc_packet_buffer_put(dstc_context_t* ctx, uint8_t* payload)
+{
+    dstc_packet_buffer_t* buf = DSTC_PACKET_BUFFER(payload);
+
+    buf->next_free = ctx->pub_pool_free;
+    ctx->pub_pool_free = buf;
+    ctx->pub_pool_in_use--;
+}
+
+// Return the receive pool size class for a payload of len bytes.
+// Returns DSTC_RX_POOL_CLASS_COUNT if the payload is too large to be
+// pooled.
+static uint32_t _dstc_rx_pool_class(payload_len_t len)
+{
+    uint32_t size_class = 0;
+
+    while(size_class < DSTC_RX_POOL_CLASS_COUNT &&
+          (DSTC_RX_POOL_MIN_SIZE << size_class) < len)
+        size_class++;
+
+    return size_class;
+}
+
+// Retrieve an inbound payload buffer of at least len bytes from the
+// receive pool, allocating it from the heap if its size class has
+// no free buffers.
+//
+// ctx must be non-null and locked
+static uint8_t* _dstc_rx_buffer_get(dstc_context_t* ctx, payload_len_t len)
+{
+    uint32_t size_class = _dstc_rx_pool_class(len);
+    dstc_packet_buffer_t* buf = 0;
+    size_t size = len;
+    int res = 0;
+
+    ctx->sub_pool_in_use++;
+
+    if (size_class < DSTC_RX_POOL_CLASS_COUNT && ctx->sub_pool_free[size_class]) {
+        buf = ctx->sub_pool_free[size_class];
+        ctx->sub_pool_free[size_class] = buf->next_free;
+        ctx->sub_pool_reused++;
+        return buf->payload;
+    }
+
+    if (size_class < DSTC_RX_POOL_CLASS_COUNT)
+        size = DSTC_RX_POOL_MIN_SIZE << size_class;
+
+    res = posix_memalign((void**) &buf,
+                         DSTC_CACHE_LINE_SIZE,
+                         sizeof(dstc_packet_buffer_t) + size);
+
+    if (res) {
+        RMC_LOG_FATAL("posix_memalign(%d): %s",
+                      sizeof(dstc_packet_buffer_t) + size, strerror(res));
+        exit(255);
+    }
+
+    ctx->sub_pool_heap_allocs++;
+    buf->next_free = 0;
+    return buf->payload;
+}
+
+// Return an inbound payload buffer, as provided by
+// _dstc_rx_buffer_get() for the same len, to the receive pool.
+//
+// ctx must be non-null and locked
+static void _dstc_rx_buffer_put(dstc_context_t* ctx, void* payload, payload_len_t len)
+{
+    uint32_t size_class = _dstc_rx_pool_class(len);
+    dstc_packet_buffer_t* buf = DSTC_PACKET_BUFFER(payload);
+
+    ctx->sub_pool_in_use--;
+
+    // Oversized payloads are not pooled.
+    if (size_class == DSTC_RX_POOL_CLASS_COUNT) {
+        free(buf);
+        return;
+    }
+
+    buf->next_free = ctx->sub_pool_free[size_class];
+    ctx->sub_pool_free[size_class] = buf;
 }
 
 // ctx must be non-null and locked
@@ -246,41 +564,241 @@ static uint8_t* _dstc_payload_buffer(dstc_context_t* ctx)
     return ctx->pub_buffer;
 }
 
+// Make wake_fd[0] readable, so that a thread waiting for events
+// observes a flush deadline set after it computed its timeout.
+// wake_fd only changes while ctx is set up or destroyed, and ctx
+// does not need to be locked.
+//
+// ctx must be non-null
+static void _dstc_wake_event_waiters(dstc_context_t* ctx)
+{
+    uint64_t val = 1;
+
+    if (ctx->wake_fd[1] == -1)
+        return;
+
+    // A full pipe is readable already.
+    if (write(ctx->wake_fd[1], &val, sizeof(val)) != sizeof(val) && errno != EAGAIN)
+        RMC_LOG_WARNING("write(wake fd %d): %s", ctx->wake_fd[1], strerror(errno));
+}
+
+// Make wake_fd[0] non-readable again once the event set reported it.
+//
+// ctx must be non-null and locked
+void _dstc_wake_fd_drain(dstc_context_t* ctx)
+{
+    uint64_t val = 0;
+
+    while(read(ctx->wake_fd[0], &val, sizeof(val)) == sizeof(val))
+        ;
+}
+
 // ctx must be non-null and locked
 static uint8_t* _dstc_payload_buffer_alloc(dstc_context_t* ctx, uint32_t size)
 {
+    uint32_t filter_len = _dstc_payload_buffer_filter_len(ctx);
     uint8_t* res = 0;
-    if (_dstc_payload_buffer_available(ctx) < size)
+
+    // A call that only fits in a packet of its own is sent without
+    // a filter.
+    if (filter_len && size > RMC_MAX_PAYLOAD - filter_len)
+        filter_len = 0;
+
+    if (RMC_MAX_PAYLOAD - ctx->pub_buffer_ind - filter_len < size)
+        return 0;
+
+    // Grab a new packet buffer if the last one was handed to RMC.
+    if (!ctx->pub_buffer && !(ctx->pub_buffer = _dstc_packet_buffer_get(ctx)))
         return 0;
 
+    // The filter record is written once the buffer is queued.
+    if (filter_len) {
+        ctx->pub_filter_record = 1;
+        ctx->pub_buffer_ind = filter_len;
+    }
+
+    // Start the flush timer with the first call in the buffer, and
+    // wake a thread waiting for events to observe it, unless the call
+    // reaches the flush threshold and is queued right away.
+    if (ctx->pub_flush_usec && !ctx->pub_flush_deadline) {
+        ctx->pub_flush_deadline = rmc_usec_monotonic_timestamp() + ctx->pub_flush_usec;
+        if (!ctx->pub_flush_bytes ||
+            _dstc_payload_buffer_in_use(ctx) + size < ctx->pub_flush_bytes)
+            _dstc_wake_event_waiters(ctx);
+    }
+
     res = _dstc_payload_buffer(ctx) + _dstc_payload_buffer_in_use(ctx);
     ctx->pub_buffer_ind += size;
     return res;
 }
 
+// Return the length of the DSTC_RECORD_PAD record to write at offset
+// ind of a buffer, for the next record to start at the same offset
+// as align_ind modulo DSTC_RECORD_ALIGNMENT. 0 if none is needed.
+static uint32_t _dstc_pad_record_len(uint32_t ind, uint32_t align_ind)
+{
+    uint32_t len = (align_ind - ind) & (DSTC_RECORD_ALIGNMENT - 1);
+
+    if (len && len < DSTC_PAD_RECORD_MIN_LEN)
+        len += DSTC_RECORD_ALIGNMENT;
+
+    return len;
+}
+
+// Write a DSTC_RECORD_PAD record of len bytes to buf.
+static void _dstc_pad_record_put(uint8_t* buf, uint32_t len, rmc_node_id_t node_id)
+{
+    dstc_header_t* rec = (dstc_header_t*) buf;
+
+    rec->node_id = node_id;
+    rec->payload_len = len - sizeof(dstc_header_t);
+    memset(rec->payload, 0, rec->payload_len);
+    rec->payload[0] = DSTC_RECORD_PAD;
+}
+
+// Same as _dstc_payload_buffer_alloc(), but the returned buffer is at
+// the same offset as align_ind modulo DSTC_RECORD_ALIGNMENT, preceded
+// by a DSTC_RECORD_PAD record if needed. Calls moved there from
+// another buffer keep the alignment that their arguments were
+// serialized with.
+//
+// ctx must be non-null and locked
+static uint8_t* _dstc_payload_buffer_alloc_at(dstc_context_t* ctx,
+                                              uint32_t size,
+                                              uint32_t align_ind)
+{
+    uint32_t pad_len = _dstc_pad_record_len(_dstc_payload_buffer_in_use(ctx), align_ind);
+    uint8_t* res = _dstc_payload_buffer_alloc(ctx, pad_len + size);
+
+    if (!res)
+        return 0;
+
+    if (pad_len)
+        _dstc_pad_record_put(res, pad_len, rmc_pub_node_id(ctx->pub_ctx));
+
+    return res + pad_len;
+}
+
 
 // ctx must be non-null and locked
 static uint8_t* _dstc_payload_buffer_empty(dstc_context_t* ctx)
 {
     ctx->pub_buffer_ind = 0;
+    ctx->pub_block_ind = 0;
+    ctx->pub_filter_record = 0;
+    ctx->pub_filter = 0;
+    return 0;
+}
+
+// Write the DSTC_RECORD_FILTER record at the start of the payload
+// buffer, if any, before the buffer is queued.
+//
+// ctx must be non-null and locked
+static void _dstc_payload_buffer_seal(dstc_context_t* ctx)
+{
+    dstc_header_t* rec = (dstc_header_t*) ctx->pub_buffer;
+
+    if (!ctx->pub_filter_record)
+        return;
+
+    rec->node_id = rmc_pub_node_id(ctx->pub_ctx);
+    rec->payload_len = DSTC_FILTER_RECORD_LEN - sizeof(dstc_header_t);
+    rec->payload[0] = DSTC_RECORD_FILTER;
+    rec->payload[1] = 0;
+    memcpy(rec->payload + 2, &ctx->pub_filter, sizeof(uint64_t));
+}
+
+// Encode val as a varint in buf.
+// Returns the number of bytes written.
+static uint32_t _dstc_varint_put(uint8_t* buf, uint32_t val)
+{
+    uint32_t len = 0;
+
+    while(val >= 0x80) {
+        buf[len++] = (uint8_t) val | 0x80;
+        val >>= 7;
+    }
+
+    buf[len++] = (uint8_t) val;
+    return len;
+}
+
+// Return the number of bytes needed to encode val as a varint.
+static uint32_t _dstc_varint_len(uint32_t val)
+{
+    uint32_t len = 1;
+
+    while(val >= 0x80) {
+        val >>= 7;
+        len++;
+    }
+    return len;
+}
+
+// Decode a varint from the first len bytes of buf into *val.
+// Returns the number of bytes decoded, or 0 if the varint is
+// truncated or longer than DSTC_VARINT_MAX_LEN bytes.
+static uint32_t _dstc_varint_get(uint8_t* buf, uint32_t len, uint32_t* val)
+{
+    uint32_t res = 0;
+    uint32_t ind = 0;
+
+    while(ind < len && ind < DSTC_VARINT_MAX_LEN) {
+        res |= (uint32_t) (buf[ind] & 0x7F) << (7 * ind);
+
+        if (!(buf[ind++] & 0x80)) {
+            *val = res;
+            return ind;
+        }
+    }
     return 0;
 }
 
-static msec_timestamp_t _dstc_get_next_timeout_abs(void)
+// Return the earliest flush deadline of the payload buffer and the
+// thread buffers, or 0 if no flush timer is running.
+//
+// ctx must be non-null and locked
+static usec_timestamp_t _dstc_get_flush_deadline(dstc_context_t* ctx)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    usec_timestamp_t res = 0;
+    dstc_thread_buffer_t* tb = 0;
+
+    if (!ctx->pub_flush_usec)
+        return 0;
+
+    if (_dstc_payload_buffer_in_use(ctx) > 0 || ctx->reply_ind)
+        res = ctx->pub_flush_deadline;
+
+    for(tb = ctx->thread_buffer; tb; tb = tb->next) {
+        pthread_mutex_lock(&tb->lock);
+        if (tb->ind && tb->flush_deadline &&
+            (!res || tb->flush_deadline < res))
+            res = tb->flush_deadline;
+        pthread_mutex_unlock(&tb->lock);
+    }
+    return res;
+}
 
+// ctx must be non-null
+static msec_timestamp_t _dstc_get_context_timeout_abs(dstc_context_t* ctx)
+{
     usec_timestamp_t sub_event_tout_ts = 0;
     usec_timestamp_t pub_event_tout_ts = 0;
+    usec_timestamp_t flush_tout_ts = 0;
 
     _dstc_lock_and_init_context(ctx);
 
     rmc_pub_timeout_get_next(ctx->pub_ctx, &pub_event_tout_ts);
     rmc_sub_timeout_get_next(ctx->sub_ctx, &sub_event_tout_ts);
+    flush_tout_ts = _dstc_get_flush_deadline(ctx);
 
     _dstc_unlock_context(ctx);
 
+    // Buffered calls are flushed by _dstc_process_timeout().
+    if (flush_tout_ts &&
+        (pub_event_tout_ts == -1 || flush_tout_ts < pub_event_tout_ts))
+        pub_event_tout_ts = flush_tout_ts;
+
     // Figure out the shortest event timeout between pub and sub context
     if (pub_event_tout_ts == -1 && sub_event_tout_ts == -1)
         return -1;
@@ -295,1067 +813,5307 @@ static msec_timestamp_t _dstc_get_next_timeout_abs(void)
         (pub_event_tout_ts / 1000):(sub_event_tout_ts / 1000);
 }
 
-// Retrieve a function pointer by name previously registered with
-// dstc_register_server_function()
+// Same as _dstc_get_context_timeout_abs(), but also covering the
+// group contexts of ctx.
 //
-// ctx must be non-null and locked
-static dstc_internal_dispatch_t _dstc_find_server_function(dstc_context_t* ctx,
-                                                           char* name)
+// ctx must be non-null, and not held by the calling thread if it has
+// group contexts.
+static msec_timestamp_t _dstc_get_next_timeout_abs(dstc_context_t* ctx)
 {
-    int i = ctx->server_func_ind;
-    while(i--) {
-        if (!strcmp(ctx->server_func[i].func_name, name)) {
-            return ctx->server_func[i].server_func;
-        }
+    msec_timestamp_t res = _dstc_get_context_timeout_abs(ctx);
+    uint32_t ind = 0;
+
+    for(ind = 1; ind < ctx->group_count; ++ind) {
+        msec_timestamp_t group_res = 0;
+
+        if (!ctx->group_ctx[ind])
+            continue;
+
+        group_res = _dstc_get_context_timeout_abs(ctx->group_ctx[ind]);
+        if (group_res != -1 && (res == -1 || group_res < res))
+            res = group_res;
     }
+    return res;
+}
 
-    return (dstc_internal_dispatch_t) 0;
+// FNV-1a hash of a null terminated function name.
+// At most max_len bytes of name are scanned. The length of the name,
+// excluding the null terminator, is stored in *name_len. If no null
+// terminator was found within max_len bytes, *name_len is set to
+// max_len.
+//
+static uint32_t _dstc_hash_name(const char* name,
+                                uint32_t max_len,
+                                uint32_t* name_len)
+{
+    uint32_t hash = 0x811C9DC5;
+    uint32_t len = 0;
+
+    while(len < max_len && name[len]) {
+        hash ^= (uint8_t) name[len++];
+        hash *= 0x01000193;
+    }
+
+    *name_len = len;
+    return hash;
 }
 
+// Return the multicast group carrying calls to function name, as
+// given by the group map of dstc_setup_groups(), or by the hash of
+// name if it is not mapped. The map is not changed once groups are
+// setup.
+//
+// ctx must be non-null
+static uint8_t _dstc_function_group(dstc_context_t* ctx, const char* name)
+{
+    dstc_context_t* root = ctx->group_root?ctx->group_root:ctx;
+    uint32_t name_len = 0;
+    uint32_t ind = 0;
+
+    if (root->group_count < 2)
+        return 0;
+
+    for(ind = 0; ind < root->group_map_ind; ++ind)
+        if (!strcmp(root->group_map[ind].func_name, name))
+            return root->group_map[ind].group;
 
+    return _dstc_hash_name(name, UINT32_MAX, &name_len) % root->group_count;
+}
+
+// (Re)build the open addressing index over all functions registered
+// with dstc_register_server_function() and carried by the multicast
+// group of ctx.
+// Called when the context is setup, at which point all
+// DSTC_SERVER() constructor functions have executed. The index is not
+// touched by the incoming call path, making lookups a single hash
+// probe sequence.
+//
+// If the same name has been registered several times, the last
+// registration wins.
+//
 // ctx must be non-null and locked
-static int _queue_pending_calls(dstc_context_t* ctx)
+static void _dstc_build_server_func_index(dstc_context_t* ctx)
 {
+    uint32_t size = SERVER_FUNC_HASH_MIN_SIZE;
+    uint32_t ind = 0;
 
-    // If we have pending data, and we are not suspended, queue the
-    // payload with reliable multicast.
-    if (rmc_pub_traffic_suspended(ctx->pub_ctx) == 0 &&
-        // Do we have data that we need to queue?
-        _dstc_payload_buffer_in_use(ctx) > 0) {
-        uint8_t* rmc_data = malloc(_dstc_payload_buffer_in_use(&_dstc_default_context));
+    // Keep load factor at or below 50%
+    while(size < ctx->server_func_ind * 2)
+        size <<= 1;
 
-        if (!rmc_data) {
-            RMC_LOG_FATAL("malloc(%d): %s", _dstc_payload_buffer_in_use(&_dstc_default_context), strerror(errno));
-            exit(255);
-        }
+    free(ctx->server_func_hash);
+    ctx->server_func_hash = calloc(size, sizeof(uint32_t));
 
-        memcpy(rmc_data, _dstc_payload_buffer(&_dstc_default_context), _dstc_payload_buffer_in_use(&_dstc_default_context));
-        // This should never fail since we are not suspended.
-        if (rmc_pub_queue_packet(_dstc_default_context.pub_ctx,
-                                 rmc_data,
-                                 _dstc_payload_buffer_in_use(&_dstc_default_context),
-                                 0) != 0) {
-            RMC_LOG_FATAL("Failed to queue packet.");
-            exit(255);
+    if (!ctx->server_func_hash) {
+        RMC_LOG_FATAL("calloc(%zu): %s", size * sizeof(uint32_t), strerror(errno));
+        exit(255);
+    }
+
+    ctx->server_func_hash_mask = size - 1;
+    ctx->sub_filter = 0;
+
+    for(ind = 0; ind < ctx->server_func_ind; ++ind) {
+        dstc_server_func_t* func = &ctx->server_func[ind];
+        uint32_t slot = func->name_hash & ctx->server_func_hash_mask;
+
+        // Calls to functions of other groups are never seen by ctx.
+        func->group = _dstc_function_group(ctx, func->func_name);
+        if (func->group != ctx->group)
+            continue;
+
+        ctx->sub_filter |= DSTC_FILTER_NAME_BIT(func->name_hash);
+
+        while(ctx->server_func_hash[slot]) {
+            dstc_server_func_t* prev = &ctx->server_func[ctx->server_func_hash[slot] - 1];
+
+            if (prev->name_hash == func->name_hash &&
+                !strcmp(prev->func_name, func->func_name))
+                break;
+
+            slot = (slot + 1) & ctx->server_func_hash_mask;
         }
+        ctx->server_func_hash[slot] = ind + 1;
+    }
 
-        // Was the queueing successful?
-        RMC_LOG_DEBUG("Queued %d bytes from payload buffer.", _dstc_payload_buffer_in_use(&_dstc_default_context));
-        // Empty payload buffer.
-        _dstc_payload_buffer_empty(&_dstc_default_context);
+    RMC_LOG_COMMENT("Indexed %d server functions in %d slots",
+                    ctx->server_func_ind, size);
+}
+
+// Retrieve the server_func index + 1 of a function by name previously
+// registered with dstc_register_server_function(), or 0 if not found.
+// name_hash is the _dstc_hash_name() value of name.
+//
+// ctx must be non-null and locked
+static uint32_t _dstc_find_server_function(dstc_context_t* ctx,
+                                           char* name,
+                                           uint32_t name_hash)
+{
+    uint32_t slot = name_hash & ctx->server_func_hash_mask;
+
+    if (!ctx->server_func_hash)
+        return 0;
+
+    while(ctx->server_func_hash[slot]) {
+        dstc_server_func_t* func = &ctx->server_func[ctx->server_func_hash[slot] - 1];
+
+        if (func->name_hash == name_hash && !strcmp(func->func_name, name))
+            return ctx->server_func_hash[slot];
+
+        slot = (slot + 1) & ctx->server_func_hash_mask;
     }
+
     return 0;
 }
 
 
-// Retrieve a callback function. Each time it is invoked, it will be deleted.
-// dstc_register_server_function()
+// Retrieve the function ID bindings of a remote publisher,
+// creating them if create is set and they do not exist.
+// Returns 0 if the publisher has not bound any function IDs, and
+// create is not set.
 //
 // ctx must be non-null and locked
-static dstc_internal_dispatch_t _dstc_find_callback_by_func(dstc_context_t* ctx,
-                                                            dstc_internal_dispatch_t func)
+static dstc_publisher_t* _dstc_find_publisher(dstc_context_t* ctx,
+                                              rmc_node_id_t node_id,
+                                              uint8_t create)
 {
-    int i = 0;
+    uint32_t ind = ctx->publisher_ind;
+    dstc_publisher_t* publ = 0;
 
-    while(i < ctx->callback_ind) {
-        if (ctx->local_callback[i].callback == func) {
-            dstc_internal_dispatch_t res = ctx->local_callback[i].callback;
-            // Nil out the callback since it is a one-time shot thing.
-            ctx->local_callback[i].callback = 0;
-            ctx->local_callback[i].callback_ref = 0;
-            return res;
+    // All calls in a packet are from the same node.
+    if (ctx->publisher_cache && ctx->publisher_cache->node_id == node_id)
+        return ctx->publisher_cache;
+
+    while(ind--) {
+        if (ctx->publisher[ind].node_id == node_id) {
+            ctx->publisher_cache = &ctx->publisher[ind];
+            return ctx->publisher_cache;
         }
-        ++i;
     }
-    RMC_LOG_COMMENT("Did not find callback [%p]\n", func);
-    return (dstc_internal_dispatch_t) 0;
+
+    if (!create)
+        return 0;
+
+    // Grow the publisher table if needed.
+    if (ctx->publisher_ind == ctx->publisher_size) {
+        uint32_t new_size = ctx->publisher_size?(ctx->publisher_size * 2):DEFAULT_MAX_DSTC_NODES;
+        dstc_publisher_t* new_publ = realloc(ctx->publisher,
+                                             new_size * sizeof(dstc_publisher_t));
+
+        if (!new_publ) {
+            RMC_LOG_FATAL("Out of memory trying to add publisher [0x%X]", node_id);
+            exit(255);
+        }
+        ctx->publisher = new_publ;
+        ctx->publisher_size = new_size;
+    }
+
+    publ = &ctx->publisher[ctx->publisher_ind++];
+    publ->node_id = node_id;
+    publ->address = 0;
+    publ->port = 0;
+    publ->func_size = 0;
+    publ->func = 0;
+    ctx->publisher_cache = publ;
+    return publ;
 }
 
+// Return the reply_node_hash entry of node_id, or the empty entry
+// it would be added at.
+//
 // ctx must be non-null and locked
-static dstc_internal_dispatch_t _dstc_find_callback_by_ref(dstc_context_t* ctx,
-                                                           dstc_callback_t callback_ref)
+static uint32_t _dstc_reply_node_hash_slot(dstc_context_t* ctx,
+                                           rmc_node_id_t node_id)
 {
-    int i = 0;
+    uint32_t slot = DSTC_REPLY_NODE_HASH(node_id);
 
-    while(i < ctx->callback_ind) {
-        if (ctx->local_callback[i].callback_ref == callback_ref) {
-            dstc_internal_dispatch_t res = ctx->local_callback[i].callback;
-            // Nil out the callback since it is a one-time shot thing.
-            ctx->local_callback[i].callback = 0;
-            ctx->local_callback[i].callback_ref = 0;
-            return res;
-        }
-        ++i;
-    }
-    RMC_LOG_COMMENT("Did not find callback [%lX]", callback_ref);
-    return (dstc_internal_dispatch_t) 0;
+    while(ctx->reply_node_hash[slot] &&
+          ctx->reply_node[ctx->reply_node_hash[slot] - 1] != node_id)
+        slot = (slot + 1) & (DSTC_REPLY_NODE_HASH_SIZE - 1);
+
+    return slot;
 }
 
-// Activate a client-side callback that can be invoked from a remote
-// DSTC function called from the client.  Called by the
-// CLIENT_CALLBACK_ARG() macro to register a relationship between a
-// callback reference integer and a pointer to the dispatch function
-// that handles the incoming callback from the remote DSTC function.
-// callback_ref is a pointer to the callback function, but can be any
-// unique uint64_t. This integer is passed as a reference to the
-// remote DSTC function, which will send it back to the client
-// in order to invoke the local callback.
-//
-// client-side dstc_process_function_call() will detect that
-// a callback is being invoked and will use _dstc_find_callback_by_ref()
-// to map the provided reference callback integer to a dispatch function,
-// which is then called.
-// _dstc_find_callback_by_ref() will also de-activate the callback,
-// stopping it from being invoked multiple time.
+// Return the reply_node index of node_id, adding the node if needed.
+// Returns DSTC_CALLBACK_REF_NODE_COUNT if all slots are in use.
 //
-dstc_callback_t dstc_activate_callback(dstc_context_t* ctx,
-                                       dstc_callback_t callback_ref,
-                                       dstc_internal_dispatch_t callback)
+// ctx must be non-null and locked
+static uint32_t _dstc_get_reply_node(dstc_context_t* ctx,
+                                     rmc_node_id_t node_id)
 {
-    int ind = 0;
+    uint32_t slot = _dstc_reply_node_hash_slot(ctx, node_id);
+    uint32_t ind = 0;
+
+    if (ctx->reply_node_hash[slot])
+        return ctx->reply_node_hash[slot] - 1;
+
+    // Reuse the slot released longest ago, giving references to
+    // the node that held it as much time as possible to go out of
+    // use.
+    if (ctx->reply_node_free_head) {
+        ind = ctx->reply_node_free_head - 1;
+        ctx->reply_node_free_head = ctx->reply_node_next[ind];
+        if (!ctx->reply_node_free_head)
+            ctx->reply_node_free_tail = 0;
+    } else if (ctx->reply_node_ind < DSTC_CALLBACK_REF_NODE_COUNT)
+        ind = ctx->reply_node_ind++;
+    else
+        return DSTC_CALLBACK_REF_NODE_COUNT;
 
-    // If a null pointer was provided as a callback, just pass a 0
-    // around. The callback server will simply not do a callback if
-    // (dstc_callback_t) 0 is presented to it.
-    //
-    if (!callback)
-        return (dstc_callback_t) 0;
+    ctx->reply_node[ind] = node_id;
+    ctx->reply_node_hash[slot] = ind + 1;
+    return ind;
+}
 
-    if (!ctx)
-        ctx = &_dstc_default_context;
+// Release the reply_node slot of node_id, if it has one. Replies
+// through references still holding the slot are multicast, also
+// once the slot is reused, since their reuse count no longer matches.
+//
+// ctx must be non-null and locked
+static void _dstc_release_reply_node(dstc_context_t* ctx,
+                                     rmc_node_id_t node_id)
+{
+    uint32_t slot = _dstc_reply_node_hash_slot(ctx, node_id);
+    uint32_t next = slot;
+    uint32_t ind = 0;
+
+    if (!ctx->reply_node_hash[slot])
+        return;
+
+    ind = ctx->reply_node_hash[slot] - 1;
+    ctx->reply_node[ind] = 0;
+    ctx->reply_node_reuse[ind] = (ctx->reply_node_reuse[ind] + 1) % DSTC_CALLBACK_REF_REUSE_COUNT;
+    ctx->reply_node_next[ind] = 0;
+    if (ctx->reply_node_free_tail)
+        ctx->reply_node_next[ctx->reply_node_free_tail - 1] = ind + 1;
+    else
+        ctx->reply_node_free_head = ind + 1;
+    ctx->reply_node_free_tail = ind + 1;
 
-    // Find a previously freed slot, or allocate a new one
-    while(ind < ctx->callback_ind) {
-        if (!ctx->local_callback[ind].callback)
-            break;
-        ++ind;
-    }
+    // Move later entries of the probe sequence into the emptied entry
+    // unless that would take them past their home entry.
+    ctx->reply_node_hash[slot] = 0;
+    while(1) {
+        uint32_t home = 0;
 
-    // Are we out of memory
-    if (ind == SYMTAB_SIZE) {
-        RMC_LOG_FATAL("Out of memory trying to register callback. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
-        exit(255);
-    }
-    ctx->local_callback[ind].callback_ref = callback_ref;
-    ctx->local_callback[ind].callback = callback;
-    RMC_LOG_COMMENT("Registered server callback [%llX] to %p. Index[%d]",
-                    callback_ref, callback, ind);
+        next = (next + 1) & (DSTC_REPLY_NODE_HASH_SIZE - 1);
+        if (!ctx->reply_node_hash[next])
+            break;
 
-    // If we are allocating a new slot (not reusing an earlier one).
-    // then bump callback_ind to the new max index in use.
-    if (ind == ctx->callback_ind)
-        ctx->callback_ind++;
+        home = DSTC_REPLY_NODE_HASH(ctx->reply_node[ctx->reply_node_hash[next] - 1]);
+        if (((next - home) & (DSTC_REPLY_NODE_HASH_SIZE - 1)) <
+            ((next - slot) & (DSTC_REPLY_NODE_HASH_SIZE - 1)))
+            continue;
 
-    return callback_ref;
+        ctx->reply_node_hash[slot] = ctx->reply_node_hash[next];
+        ctx->reply_node_hash[next] = 0;
+        slot = next;
+    }
 }
 
-// Register a remote function as provided by the remote DSTC server
-// through a control message call processed by
-// dstc_subscriber_control_message_cb()
+// Release the function ID bindings and the callback reply slots of
+// all remote publishers whose control connection is the given one.
 //
-
 // ctx must be non-null and locked
-static void dstc_register_remote_function(dstc_context_t* ctx,
-                                          rmc_node_id_t node_id,
-                                          char* func_name)
+static void _dstc_release_publishers(dstc_context_t* ctx,
+                                     uint32_t address,
+                                     uint16_t port)
 {
-    int ind = 0;
-    dstc_remote_node_t* remote = 0;
+    uint32_t ind = ctx->publisher_ind;
 
-    // See if the node has registered any prior functions
-    // If so, check that we don't have a duplicate and then register
-    // the new function.
-    ind = ctx->remote_node_ind;
     while(ind--) {
-        if (node_id == ctx->remote_node[ind].node_id &&
-            !strcmp(func_name, ctx->remote_node[ind].func_name)) {
-            RMC_LOG_WARNING("Remote function [%s] registered several times by node [0x%X]",
-                            func_name, node_id);
-            return;
-        }
-    }
+        dstc_publisher_t* publ = &ctx->publisher[ind];
 
-    if (ctx->remote_node_ind == SYMTAB_SIZE) {
-        RMC_LOG_FATAL("Out of memory trying to register remote func. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
-        exit(255);
-    }
+        if (publ->address != address || publ->port != port)
+            continue;
 
-    remote = &ctx->remote_node[ctx->remote_node_ind];
-    remote->node_id = node_id;
-    strcpy(remote->func_name, func_name);
+        RMC_LOG_COMMENT("Releasing function ids bound by node [0x%X]", publ->node_id);
+        _dstc_release_reply_node(ctx, publ->node_id);
+        free(publ->func);
 
-    ctx->remote_node_ind++;
-    RMC_LOG_INFO("Remote [%s] now supported by new node [0x%X]",
-                 func_name, node_id);
-    return;
+        // Move the last entry into the freed slot.
+        *publ = ctx->publisher[--ctx->publisher_ind];
+    }
+    ctx->publisher_cache = 0;
 }
 
-
-// Remove all functions previously registered by node_id through
-// the dstc_register_remote_function() call.
+// Bind a remote publisher's function ID to the local server function
+// with the given name. Called when a DSTC_RECORD_BIND record is received.
+// If the function is not served locally, the ID is bound to 0,
+// meaning that calls made with it will be ignored.
 //
 // ctx must be non-null and locked
-static void dstc_unregister_remote_node(dstc_context_t* ctx,
-                                        rmc_node_id_t node_id)
+static void _dstc_bind_function_id(dstc_context_t* ctx,
+                                   rmc_node_id_t node_id,
+                                   uint16_t func_id,
+                                   char* name,
+                                   uint32_t name_hash)
 {
-    int ind = ctx->remote_node_ind;
+    dstc_publisher_t* publ = _dstc_find_publisher(ctx, node_id, 1);
 
-    while(ind--) {
-        if (node_id == ctx->remote_node[ind].node_id) {
-            RMC_LOG_INFO("Uhregistering node [0x%X] function [%s]",
-                         ctx->remote_node[ind].node_id,
-                         ctx->remote_node[ind].func_name);
+    if (func_id >= publ->func_size) {
+        uint32_t new_size = publ->func_size?publ->func_size:SYMTAB_SIZE;
+        uint32_t* new_func = 0;
 
-            ctx->remote_node[ind].node_id = 0;
-            ctx->remote_node[ind].func_name[0] = 0;
+        while(new_size <= func_id)
+            new_size *= 2;
+
+        new_func = realloc(publ->func, new_size * sizeof(uint32_t));
+
+        if (!new_func) {
+            RMC_LOG_FATAL("Out of memory trying to bind function [%s]", name);
+            exit(255);
         }
+
+        memset(new_func + publ->func_size, 0,
+               (new_size - publ->func_size) * sizeof(uint32_t));
+        publ->func = new_func;
+        publ->func_size = new_size;
     }
+
+    publ->func[func_id] = _dstc_find_server_function(ctx, name, name_hash);
+
+    RMC_LOG_COMMENT("Node [0x%X] bound function id [%d] to [%s]%s",
+                    node_id, func_id, name,
+                    publ->func[func_id]?"":" (not loaded)");
 }
 
 
-// ctx must be set and locked.
-static uint32_t dstc_process_function_call(dstc_context_t* ctx,
-                                           uint8_t* data,
-                                           uint32_t data_len)
+// Update the outbound rate and flush latency of adaptive mode as the
+// payload buffer is queued. The rate is the bytes of calls queued
+// since the previous packet, over the time since then. The latency
+// is the time the oldest call in the payload buffer has waited for
+// it to be queued.
+//
+// ctx must be non-null and locked
+static void _dstc_sample_flush(dstc_context_t* ctx)
 {
-    dstc_header_t* call = (dstc_header_t*) data;
-    dstc_internal_dispatch_t local_func_ptr = 0;
-    dstc_callback_t callback_ref = 0;
+    usec_timestamp_t now = rmc_usec_monotonic_timestamp();
+    usec_timestamp_t interval = now - ctx->pub_last_queue_usec;
+    usec_timestamp_t latency = 0;
 
-    if (data_len < sizeof(dstc_header_t)) {
-        RMC_LOG_WARNING("Packet header too short! Wanted %ld bytes, got %d",
-                        sizeof(dstc_header_t), data_len);
-        return data_len; // Emtpy buffer
-    }
+    if (ctx->pub_flush_deadline)
+        latency = now - (ctx->pub_flush_deadline - ctx->pub_flush_usec);
 
-    if (data_len - sizeof(dstc_header_t) < call->payload_len) {
-        RMC_LOG_WARNING("Packet payload too short! Wanted %d bytes, got %d",
-                        call->payload_len, data_len - sizeof(dstc_header_t));
-        return data_len; // Emtpy buffer
-    }
+    if (latency < 0)
+        latency = 0;
 
-    // Retrieve function pointer from name, as previously
-    // registered with dstc_register_server_function()
-    RMC_LOG_DEBUG("DSTC Serve: node_id[%lu] name[%s] payload_len[%d]",
-                  call->node_id,
-                  call->payload,
-                  call->payload_len - strlen((char*) call->payload) - 1);
+    if (interval < 1)
+        interval = 1;
 
-    // If the name is not nil-len, then we have an actual server function we need
-    // to find and invoke.
-    if (call->payload[0]) {
-        size_t name_len = strlen((char*) call->payload);
-        local_func_ptr = _dstc_find_server_function(ctx, (char*) call->payload);
+    // Average over the last few packets.
+    if (ctx->pub_last_queue_usec)
+        ctx->pub_flush_rate = (ctx->pub_flush_rate * (DSTC_ADAPTIVE_SAMPLES - 1) +
+                               (uint64_t) _dstc_payload_buffer_in_use(ctx) * 1000000 / interval) /
+            DSTC_ADAPTIVE_SAMPLES;
 
-        if (!local_func_ptr) {
-            RMC_LOG_DEBUG("Function [%s] not loaded. Ignored", call->payload);
-            return sizeof(dstc_header_t) + call->payload_len;
-        }
+    ctx->pub_flush_latency_usec = (ctx->pub_flush_latency_usec * (DSTC_ADAPTIVE_SAMPLES - 1) +
+                                   latency) / DSTC_ADAPTIVE_SAMPLES;
+    ctx->pub_last_queue_usec = now;
+}
+
+// Adjust the flush threshold of adaptive mode before the payload
+// buffer is queued. Packet buffers in use, except the payload buffer
+// itself, are packets in flight. timer_flush is set if the flush
+// timer expired before the threshold was reached.
+//
+// ctx must be non-null and locked
+static void _dstc_adapt_flush_window(dstc_context_t* ctx, uint8_t timer_flush)
+{
+    uint32_t in_flight = ctx->pub_pool_in_use - (ctx->pub_buffer?1:0);
+    uint32_t window = ctx->pub_flush_bytes;
+    uint64_t fill_bytes = 0;
+
+    if (!ctx->pub_flush_adaptive || !ctx->pub_is_buffering)
+        return;
+
+    // The timer flush is followed by the queueing of the payload
+    // buffer, which takes the sample.
+    if (!timer_flush)
+        _dstc_sample_flush(ctx);
+
+    // Bytes of calls made within half the hold time at the current
+    // rate. A larger window would hold calls until the timer expires.
+    fill_bytes = ctx->pub_flush_rate * ctx->pub_flush_usec / 2000000;
+
+    // Packets are backing up, and calls come in fast enough to fill
+    // larger packets. Collect more calls into each of them.
+    if (!timer_flush && in_flight > DSTC_ADAPTIVE_BUSY_PACKETS && window < fill_bytes)
+        window = (window < RMC_MAX_PAYLOAD / 2)?(window * 2):RMC_MAX_PAYLOAD;
+    // Traffic has drained, or calls are too sparse to fill the
+    // window in time, or have recently waited more than half the
+    // hold time. Send calls sooner.
+    else if (timer_flush || !in_flight ||
+             ctx->pub_flush_latency_usec > ctx->pub_flush_usec / 2)
+        window = (window / 2 > DSTC_ADAPTIVE_MIN_WINDOW)?(window / 2):DSTC_ADAPTIVE_MIN_WINDOW;
+
+    if (window == ctx->pub_flush_bytes)
+        return;
+
+    __atomic_store_n(&ctx->pub_flush_bytes, window, __ATOMIC_RELAXED);
+    ctx->pub_flush_window_changes++;
+}
 
-        RMC_LOG_DEBUG("Making local function call node_id[%u] func_name[%s] payload_len[%u]",
-                      call->node_id,
-                      call->payload,
-                      call->payload_len - name_len - 1);
+// Make flow_fd[0] readable by adding to the eventfd counter, or by
+// writing to the pipe.
+//
+// ctx must be non-null and locked
+static void _dstc_flow_fd_signal(dstc_context_t* ctx)
+{
+    uint64_t val = 1;
 
-        (*local_func_ptr)(0, // Callback ref is 0
-                          call->node_id,
-                          call->payload, // function name
-                          call->payload + name_len + 1, // Payload
-                          call->payload_len - name_len - 1);  // Payload len
+    if (ctx->flow_fd[1] == -1)
+        return;
 
-        return sizeof(dstc_header_t) + call->payload_len;
-    }
+    if (write(ctx->flow_fd[1], &val, sizeof(val)) != sizeof(val))
+        RMC_LOG_WARNING("write(flow control fd %d): %s", ctx->flow_fd[1], strerror(errno));
+}
 
-    // If name is nil-len, then the eight bytes after the initial \0 is
-    // the callback reference value
-    callback_ref = *((dstc_callback_t*)(call->payload + 1));
-    local_func_ptr = _dstc_find_callback_by_ref(ctx, callback_ref);
+// Make flow_fd[0] non-readable again.
+//
+// ctx must be non-null and locked
+static void _dstc_flow_fd_drain(dstc_context_t* ctx)
+{
+    uint64_t val = 0;
 
-    if (!local_func_ptr) {
-        RMC_LOG_COMMENT("Callback [%llu] not loaded. Ignored", (long long unsigned) callback_ref);
-        return sizeof(dstc_header_t) + call->payload_len;
-    }
-    (*local_func_ptr)(callback_ref,
-                      call->node_id,
-                      call->payload, // Funcation name. Always ""
-                      call->payload + 1 + sizeof(uint64_t),// Payload after nil name and uint64_t
-                      call->payload_len - 1 - sizeof(uint64_t));  // Payload len
+    if (ctx->flow_fd[0] == -1)
+        return;
 
-    return sizeof(dstc_header_t) + call->payload_len;
+    while(read(ctx->flow_fd[0], &val, sizeof(val)) == sizeof(val))
+        ;
 }
 
-static void dstc_subscription_complete(rmc_sub_context_t* sub_ctx,
-                                       uint32_t listen_ip,
-                                       in_port_t listen_port,
-                                       rmc_node_id_t node_id)
+// Notify flow control fd, waiters in dstc_wait_for_capacity(), and
+// the flow control callback if outbound traffic of ctx or any of its
+// group contexts has been suspended, or has resumed in all of them.
+//
+// ctx must be non-null, locked, and not a group context
+static void _dstc_notify_flow_control(dstc_context_t* ctx)
 {
-    dstc_context_t* ctx = (dstc_context_t*) rmc_sub_user_data(sub_ctx).ptr;
-    int ind = 0;
+    uint8_t suspended = (ctx->pub_suspended || ctx->group_suspended)?1:0;
+
+    if (suspended == ctx->flow_suspended)
+        return;
+
+    ctx->flow_suspended = suspended;
+    if (suspended)
+        _dstc_flow_fd_drain(ctx);
+    else {
+        _dstc_flow_fd_signal(ctx);
+        if (ctx->flow_waiters)
+            pthread_cond_broadcast(&ctx->flow_cond);
+    }
 
-    _dstc_lock_context(ctx);
-    ind = ctx->server_func_ind;
+    if (ctx->flow_control_cb)
+        (*ctx->flow_control_cb)(suspended);
+}
 
+// Check if RMC has suspended or resumed traffic since the last call,
+// and notify the root context of the transition. See
+// _dstc_notify_flow_control().
+//
+// ctx must be non-null and locked
+static void _dstc_update_flow_control(dstc_context_t* ctx)
+{
+    dstc_context_t* root = ctx->group_root;
+    uint8_t suspended = 0;
 
-    RMC_LOG_COMMENT("Subscription complete. Sending supported functions.");
+    if (!ctx->pub_ctx)
+        return;
 
-    // Retrieve function pointer from name, as previously
-    // registered with dstc_registerctx->local_function()
-    // Include null terminator for an easier life.
-    while(ind--) {
-        RMC_LOG_COMMENT("  [%s]", ctx->server_func[ind].func_name);
-        dstc_control_message_t ctl = {
-            .node_id = rmc_pub_node_id(ctx->pub_ctx)
-        };
+    suspended = rmc_pub_traffic_suspended(ctx->pub_ctx)?1:0;
 
-        strcpy(ctl.name, ctx->server_func[ind].func_name);
+    if (suspended == ctx->pub_suspended)
+        return;
 
-        rmc_sub_write_control_message_by_node_id(sub_ctx,
-                                                 node_id,
-                                                 &ctl,
-                                                 sizeof(rmc_node_id_t) +
-                                                 sizeof(uint8_t) +
-                                                 strlen(ctl.name) + 1);
+    ctx->pub_suspended = suspended;
+    if (suspended)
+        ctx->pub_suspended_count++;
 
+    if (!root) {
+        _dstc_notify_flow_control(ctx);
+        return;
     }
 
-    _dstc_unlock_context(ctx);
-    RMC_LOG_COMMENT("Done sending functions");
-    return;
+    _dstc_lock_context(root);
+    if (suspended)
+        root->group_suspended |= 1U << ctx->group;
+    else
+        root->group_suspended &= ~(1U << ctx->group);
+
+    _dstc_notify_flow_control(root);
+    _dstc_unlock_context(root);
 }
 
-static void dstc_process_incoming(rmc_sub_context_t* sub_ctx)
+// Hand packets waiting in the outbound queue over to RMC, oldest
+// first, until the queue is empty or RMC suspends traffic.
+//
+// ctx must be non-null and locked
+static void _dstc_drain_pub_queue(dstc_context_t* ctx)
 {
-    rmc_sub_packet_t* pack = 0;
-    dstc_context_t* ctx = (dstc_context_t*) rmc_sub_user_data(sub_ctx).ptr;
-
-    RMC_LOG_DEBUG("Processing incoming");
+    while(ctx->pub_queue_head &&
+          rmc_pub_traffic_suspended(ctx->pub_ctx) == 0) {
+        dstc_packet_buffer_t* buf = ctx->pub_queue_head;
 
-    _dstc_lock_context(ctx);
-    while((pack = rmc_sub_get_next_dispatch_ready(sub_ctx))) {
-        uint32_t ind = 0;
-        void* payload = rmc_sub_packet_payload(pack);
-        payload_len_t payload_len = rmc_sub_packet_payload_len(pack);
+        ctx->pub_queue_head = buf->next_free;
+        if (!ctx->pub_queue_head)
+            ctx->pub_queue_tail = 0;
 
-        RMC_LOG_DEBUG("Got packet. payload_len[%d]", payload_len);
-
-        // We need to mark the packet as dispatched before we make the function calls,
-        // Since any calls to dstc_process_events() from inside the invoked funciton
-        // would lead to recursion.
-        //
-        rmc_sub_packet_dispatched_keep_payload(sub_ctx, pack);
+        ctx->pub_queue_len--;
+        ctx->pub_queue_bytes -= buf->len;
+        buf->next_free = 0;
 
-        while(ind < payload_len) {
-            RMC_LOG_DEBUG("Processing function call. ind[%d]", ind);
-            ind += dstc_process_function_call(ctx,
-                                              ((uint8_t*) payload + ind),
-                                              payload_len - ind);
+        if (rmc_pub_queue_packet(ctx->pub_ctx, buf->payload, buf->len, 0) != 0) {
+            RMC_LOG_FATAL("Failed to queue packet.");
+            exit(255);
         }
-        free(payload);
+
+        RMC_LOG_DEBUG("Queued %d bytes from outbound queue.", buf->len);
+        ctx->pub_packets_queued++;
     }
-    _dstc_unlock_context(ctx);
-    return;
 }
 
-
-static void dstc_subscriber_control_message_cb(rmc_pub_context_t* pub_ctx,
-                                               uint32_t publisher_address,
-                                               uint16_t publisher_port,
-                                               rmc_node_id_t node_id,
-                                               void* payload,
-                                               payload_len_t payload_len)
+// Send the pending callback replies to their node as a single
+// control message.
+// If that fails, they are multicast through the payload buffer
+// instead, at the same alignment as in the reply buffer.
+//
+// Returns EBUSY if the payload buffer has no room for the replies.
+//
+// ctx must be non-null and locked
+static int _dstc_flush_replies(dstc_context_t* ctx)
 {
-    dstc_context_t* ctx = (dstc_context_t*) rmc_pub_user_data(pub_ctx).ptr;
+    uint32_t len = ctx->reply_ind - DSTC_REPLY_HEADER_LEN;
+    uint8_t* buf = 0;
 
-    RMC_LOG_DEBUG("Processing incoming");
+    if (!ctx->reply_ind)
+        return 0;
 
-    _dstc_lock_context(ctx);
-    dstc_control_message_t *ctl = (dstc_control_message_t*) payload;
+    if (!rmc_sub_write_control_message_by_node_id(ctx->sub_ctx,
+                                                  ctx->reply_node_id,
+                                                  ctx->reply_buffer,
+                                                  ctx->reply_ind)) {
+        ctx->pub_direct_callbacks += ctx->reply_count;
+        ctx->reply_ind = 0;
+        ctx->reply_count = 0;
 
-    dstc_register_remote_function(ctx, ctl->node_id, ctl->name);
-    _dstc_unlock_context(ctx);
-    return;
+        if (!_dstc_payload_buffer_in_use(ctx))
+            ctx->pub_flush_deadline = 0;
+        return 0;
+    }
+
+    RMC_LOG_COMMENT("Could not send %d callbacks to node [%u]. Multicasting them.",
+                    ctx->reply_count, ctx->reply_node_id);
+
+    if (_dstc_payload_buffer_available(ctx) < len ||
+        !(buf = _dstc_payload_buffer_alloc_at(ctx, len, DSTC_REPLY_HEADER_LEN)))
+        return EBUSY;
+
+    ctx->pub_filter |= DSTC_FILTER_CALLBACK;
+    memcpy(buf, ctx->reply_buffer + DSTC_REPLY_HEADER_LEN, len);
+    ctx->reply_ind = 0;
+    ctx->reply_count = 0;
+    return 0;
 }
 
-static void dstc_subscriber_disconnect_cb(rmc_pub_context_t* pub_ctx,
-                                          uint32_t publisher_address,
-                                          uint16_t publisher_port)
+// ctx must be non-null and locked
+static int _queue_pending_calls(dstc_context_t* ctx)
 {
-    dstc_context_t* ctx = (dstc_context_t*) rmc_pub_user_data(pub_ctx).ptr;
+    // Packets queued while traffic was suspended go out first.
+    _dstc_drain_pub_queue(ctx);
 
-    RMC_LOG_DEBUG("Processing incoming");
+    // Callback replies are sent directly to their node, or added
+    // to the payload buffer if that fails.
+    _dstc_flush_replies(ctx);
 
-    _dstc_lock_context(ctx);
+    // If we have pending data, and we are not suspended, queue the
+    // payload with reliable multicast.
+    if (!ctx->pub_queue_head &&
+        rmc_pub_traffic_suspended(ctx->pub_ctx) == 0 &&
+        // Do we have data that we need to queue?
+        _dstc_payload_buffer_in_use(ctx) > 0) {
 
-    dstc_unregister_remote_node(ctx, rmc_pub_node_id(pub_ctx));
-    _dstc_unlock_context(ctx);
-    return;
-}
+        _dstc_adapt_flush_window(ctx, 0);
+        _dstc_payload_buffer_seal(ctx);
 
-static void free_published_packets(void* pl, payload_len_t len, user_data_t dt)
-{
-    RMC_LOG_DEBUG("Freeing %p", pl);
-    free(pl);
-}
+        // Hand the packet buffer itself over to RMC. It will be
+        // returned to the pool by free_published_packets() once
+        // delivery has been confirmed.
+        // This should never fail since we are not suspended.
+        if (rmc_pub_queue_packet(ctx->pub_ctx,
+                                 _dstc_payload_buffer(ctx),
+                                 _dstc_payload_buffer_in_use(ctx),
+                                 0) != 0) {
+            RMC_LOG_FATAL("Failed to queue packet.");
+            exit(255);
+        }
 
-static msec_timestamp_t _dstc_msec_monotonic_timestamp(struct timespec* abs_time_res)
-{
-    clock_gettime(CLOCK_MONOTONIC, abs_time_res);
-    return (msec_timestamp_t) abs_time_res->tv_sec * 1000 + abs_time_res->tv_nsec / 1000000;
+        // Was the queueing successful?
+        RMC_LOG_DEBUG("Queued %d bytes from payload buffer.", _dstc_payload_buffer_in_use(ctx));
+        ctx->pub_packets_queued++;
+
+        // Empty payload buffer. A new one will be retrieved from the
+        // pool by the next call.
+        ctx->pub_buffer = 0;
+        ctx->pub_flush_deadline = 0;
+        _dstc_payload_buffer_empty(ctx);
+    }
+
+    _dstc_update_flow_control(ctx);
+    return 0;
 }
 
-static int _dstc_get_timeout_msec_rel(msec_timestamp_t current_time)
+// Make room for more calls by handing the payload buffer over to
+// RMC, or by moving it to the outbound queue if RMC traffic is
+// suspended.
+// Returns EBUSY if the payload buffer is still in use since the
+// outbound queue has reached its byte budget.
+//
+// ctx must be non-null and locked
+static int _dstc_retire_payload_buffer(dstc_context_t* ctx)
 {
-    msec_timestamp_t tout = _dstc_get_next_timeout_abs();
-
-    if (tout == -1)
-        return -1;
+    dstc_packet_buffer_t* buf = 0;
+    uint32_t in_use = 0;
 
-    // Convert to relative timestamp.
-    tout -= current_time;
+    _queue_pending_calls(ctx);
 
-    if (tout < 0)
+    in_use = _dstc_payload_buffer_in_use(ctx);
+    if (!in_use)
         return 0;
 
-    return tout + 1;
-}
+    if (ctx->pub_queue_bytes + in_use > ctx->pub_queue_budget) {
+        ctx->pub_queue_budget_exhausted++;
+        return EBUSY;
+    }
 
-// ctx must be set and locked
-static int dstc_setup_internal(dstc_context_t* ctx,
-                               rmc_node_id_t node_id,
-                               int max_dstc_nodes,
-                               char* multicast_group_addr,
-                               int multicast_port,
-                               char* multicast_iface_addr,
-                               int mcast_ttl,
-                               char* control_listen_iface_addr,
-                               int control_listen_port,
-                               int epoll_fd_arg) // Ignored by non Linux/Android
-{
+    _dstc_payload_buffer_seal(ctx);
+    buf = DSTC_PACKET_BUFFER(ctx->pub_buffer);
+    buf->len = in_use;
+    buf->next_free = 0;
 
-#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
-    if (!ctx || epoll_fd_arg == -1)
-        return EINVAL;
+    if (ctx->pub_queue_tail)
+        ctx->pub_queue_tail->next_free = buf;
+    else
+        ctx->pub_queue_head = buf;
 
-    ctx->epoll_fd = epoll_fd_arg;
+    ctx->pub_queue_tail = buf;
+    ctx->pub_queue_bytes += in_use;
+    if (++ctx->pub_queue_len > ctx->pub_queue_high_water)
+        ctx->pub_queue_high_water = ctx->pub_queue_len;
 
-#else
-    // Setup a poll vector to use.
-    int ind = sizeof(ctx->poll_elem_array) / sizeof(ctx->poll_elem_array[0]);
-    if (!ctx)
-        return EINVAL;
+    RMC_LOG_DEBUG("Moved %d bytes to outbound queue. %d packets queued.",
+                  in_use, ctx->pub_queue_len);
 
-    ctx->poll_hash  = (poll_elem_t*) 0;
+    ctx->pub_buffer = 0;
+    ctx->pub_flush_deadline = 0;
+    _dstc_payload_buffer_empty(ctx);
+    return 0;
+}
 
-    while(ind--)
-        ctx->poll_elem_array[ind]  = (poll_elem_t) {
-            .pfd = {
-                .fd = -1, // Indicates that element is not allocated
-                .events = 0x00,
-                .revents = 0x00},
-            .user_data = 0
-        };
-#endif
 
-    ctx->remote_node_ind = 0;
-    ctx->callback_ind = 0;
-    ctx->pub_buffer_ind = 0;
-    ctx->pub_ctx = 0;
-    ctx->sub_ctx = 0;
+// Queue the payload buffer with RMC once buffered calls have reached
+// the flush threshold set by dstc_buffer_client_calls_timed().
+//
+// ctx must be non-null and locked
+static void _dstc_check_flush_threshold(dstc_context_t* ctx)
+{
+    if (ctx->pub_flush_bytes &&
+        _dstc_payload_buffer_in_use(ctx) >= ctx->pub_flush_bytes)
+        _queue_pending_calls(ctx);
+}
 
-    // Do not touch server_func* and client_func* members.
-    // since they may have been updated by register_[client,server]_function()
-    // constructor functions.
+// Return the DSTC_RECORD_COMPACT block at offset block_ind - 1 of
+// buf that calls can be added to, or 0 if block_ind is 0, or if the
+// block is not the last record of the buf_ind bytes of buf, or is
+// full.
+static dstc_header_t* _dstc_compact_block(uint8_t* buf,
+                                          uint32_t buf_ind,
+                                          uint32_t block_ind)
+{
+    dstc_header_t* block = 0;
+    uint16_t count = 0;
 
-    rmc_log_set_start_time();
-    rmc_pub_init_context(&ctx->pub_ctx,
-                         node_id, // Node ID
-                         multicast_group_addr, multicast_port,
-                         multicast_iface_addr,  // Use any NIC address for multicast transmit.
-                         control_listen_iface_addr, // Use any NIC address for listen control port.
-                         control_listen_port, // Use ephereal tcp port for tcp control
-                         user_data_ptr(ctx),
-                         // Different versions of
-                         // poll_(add|modify|remote) used depending on
-                         // Linux/Android/other See poll.c and epoll.c
-                         poll_add_pub, poll_modify_pub, poll_remove,
-                         DSTC_MAX_CONNECTIONS,
-                         free_published_packets);
+    if (!block_ind)
+        return 0;
 
-    // Setup a callback for subscriber disconnect, meaning that remote nodes
-    // with functions that we can call can no longer be used.
-    rmc_pub_set_subscriber_disconnect_callback(ctx->pub_ctx,
-                                               dstc_subscriber_disconnect_cb);
+    block = (dstc_header_t*) (buf + block_ind - 1);
 
-    // Setup a subscriber callback, allowing us to know when a subscribe that can
-    // execute the function has attached.
-    rmc_pub_set_control_message_callback(ctx->pub_ctx, dstc_subscriber_control_message_cb);
+    // Any other record stored after the block closes it, keeping
+    // the calls in order.
+    if (block_ind - 1 + sizeof(dstc_header_t) + block->payload_len != buf_ind)
+        return 0;
 
-    rmc_pub_throttling(ctx->pub_ctx,
-                       SUSPEND_TRAFFIC_THRESHOLD,
-                       RESTART_TRAFFIC_THRESHOLD);
+    memcpy(&count, block->payload + 2, sizeof(uint16_t));
+    if (count == DSTC_COMPACT_MAX_CALLS)
+        return 0;
 
-    // Subscriber init.
-    rmc_sub_init_context(&ctx->sub_ctx,
-                         // Reuse pub node id to detect and avoid loopback messages
-                         rmc_pub_node_id(ctx->pub_ctx),
-                         multicast_group_addr, multicast_port,
-                         multicast_iface_addr,  // Use any NIC address for multicast transmit.
-                         user_data_ptr(ctx),
-                         // Different versions of
-                         // poll_(add|modify|remote) used depending on
-                         // Linux/Android/other See poll.c and epoll.c
-                         poll_add_sub, poll_modify_sub, poll_remove,
-                         DSTC_MAX_CONNECTIONS,
-                         0,0);
+    return block;
+}
 
-    rmc_sub_set_packet_ready_callback(ctx->sub_ctx, dstc_process_incoming);
-    rmc_sub_set_subscription_complete_callback(ctx->sub_ctx, dstc_subscription_complete);
+// Return the number of bytes needed to store a call by function ID
+// in a compact block, including the block header if open_block is
+// set.
+static uint32_t _dstc_compact_call_len(uint16_t func_id,
+                                       uint32_t arg_sz,
+                                       uint8_t open_block)
+{
+    uint32_t rec_len = _dstc_varint_len(func_id) + arg_sz;
 
-    rmc_pub_set_multicast_ttl(ctx->pub_ctx, mcast_ttl);
-    rmc_pub_activate_context(ctx->pub_ctx);
-    rmc_sub_activate_context(ctx->sub_ctx);
+    return (open_block?(sizeof(dstc_header_t) + DSTC_COMPACT_HEADER_LEN):0) +
+        _dstc_varint_len(rec_len) + rec_len;
+}
 
+// Store a call by function ID at rec, which directly follows block.
+// If block is 0, a new block is first opened at rec.
+// Returns the address where the arg_sz bytes of arguments are to be
+// stored.
+static uint8_t* _dstc_compact_store(dstc_header_t* block,
+                                    uint8_t* rec,
+                                    rmc_node_id_t node_id,
+                                    uint16_t func_id,
+                                    uint32_t arg_sz)
+{
+    uint8_t* start = 0;
+    uint16_t count = 0;
+
+    if (!block) {
+        block = (dstc_header_t*) rec;
+        block->node_id = node_id;
+        block->payload_len = DSTC_COMPACT_HEADER_LEN;
+        block->payload[0] = DSTC_RECORD_COMPACT;
+        block->payload[1] = DSTC_COMPACT_VERSION;
+        memcpy(block->payload + 2, &count, sizeof(uint16_t));
+        rec = block->payload + DSTC_COMPACT_HEADER_LEN;
+    }
 
-    RMC_LOG_COMMENT("sub[%d] pub[%d] node[%d] pub[%p] sub[%p]",
-                    rmc_sub_get_socket_count(ctx->sub_ctx),
-                    rmc_pub_get_socket_count(ctx->pub_ctx),
-                    max_dstc_nodes,
-                    ctx->sub_ctx,
-                    ctx->pub_ctx);
+    memcpy(&count, block->payload + 2, sizeof(uint16_t));
+    count++;
+    memcpy(block->payload + 2, &count, sizeof(uint16_t));
 
-    RMC_LOG_INFO("Node ID[0x%X]", rmc_sub_node_id(ctx->sub_ctx));
-    // Start ticking announcements as a client that the server will connect back to.
-    // Only do announce if we have client services that requires servers to connect
-    // back to us as a subsriber in order to make their remote functions available.
-    if (ctx->client_func_ind || ctx->client_callback_count) {
-        RMC_LOG_INFO("There are %d DSTC_CLIENT() and %d DSTC_CALLBACK() functions declared. Will send out announce.",
-                     ctx->client_func_ind, ctx->client_callback_count);
-        rmc_pub_set_announce_interval(ctx->pub_ctx, 200000); // Start ticking announces.
+    start = rec;
+    rec += _dstc_varint_put(rec, _dstc_varint_len(func_id) + arg_sz);
+    rec += _dstc_varint_put(rec, func_id);
+    block->payload_len += rec - start + arg_sz;
+    return rec;
+}
+
+// Reserve space for a call by function ID in a compact block at the
+// end of the payload buffer, opening a new block if needed.
+// arg_sz must be at most DSTC_COMPACT_MAX_ARG_SIZE.
+// See _dstc_reserve() for arguments.
+//
+// Returns EBUSY if the payload buffer is full and could not be
+// queued.
+//
+// ctx must be non-null and locked
+static int _dstc_reserve_compact(dstc_context_t* ctx,
+                                 uint16_t func_id,
+                                 uint32_t arg_sz,
+                                 uint8_t** arg)
+{
+    dstc_header_t* block = _dstc_compact_block(ctx->pub_buffer,
+                                               ctx->pub_buffer_ind,
+                                               ctx->pub_block_ind);
+    uint8_t* rec = _dstc_payload_buffer_alloc(ctx,
+                                              _dstc_compact_call_len(func_id, arg_sz, !block));
+
+    // Queue a full payload buffer, and open a new block in an
+    // empty one.
+    if (!rec) {
+        if (_dstc_retire_payload_buffer(ctx))
+            return EBUSY;
+
+        block = 0;
+        if (!(rec = _dstc_payload_buffer_alloc(ctx,
+                                               _dstc_compact_call_len(func_id, arg_sz, 1))))
+            return EBUSY;
     }
-    else
-        RMC_LOG_INFO("No DSTC_CLIENT() or DSTC_CALLBACK() functions declared. Will not send out announce.");
 
+    if (!block)
+        ctx->pub_block_ind = rec - ctx->pub_buffer + 1;
 
+    *arg = _dstc_compact_store(block, rec, rmc_pub_node_id(ctx->pub_ctx), func_id, arg_sz);
+    ctx->pub_filter |= ctx->client_func[func_id].filter;
+    ctx->pub_compact_calls++;
     return 0;
 }
 
-static int _dstc_queue(dstc_context_t* ctx,
-                       char* name,
-                       dstc_callback_t callback_ref,
-                       uint8_t* arg,
-                       uint32_t arg_sz)
+// Return the number of bytes of calls at the start of a compact
+// block that fit in len bytes together with the block header, and
+// the number of calls in *count.
+static uint32_t _dstc_compact_block_split(dstc_header_t* block,
+                                          uint32_t len,
+                                          uint16_t* count)
 {
-    // Will be freed by RMC on confirmed delivery
-    dstc_header_t *call = 0;
-    uint16_t id_len = 0;
-    size_t name_len = name?strlen(name):0;;
+    uint8_t* data = block->payload + DSTC_COMPACT_HEADER_LEN;
+    uint32_t data_len = block->payload_len - DSTC_COMPACT_HEADER_LEN;
+    uint32_t ind = 0;
+    uint16_t cnt = 0;
 
-    if ((!name || name[0] == 0) && !callback_ref) {
-        RMC_LOG_ERROR("dstc_queue() needs either name or callback_ref to be set.");
-        return EINVAL;
+    if (len < sizeof(dstc_header_t) + DSTC_COMPACT_HEADER_LEN)
+        return 0;
+
+    len -= sizeof(dstc_header_t) + DSTC_COMPACT_HEADER_LEN;
+    while(ind < data_len) {
+        uint32_t rec_len = 0;
+        uint32_t len_len = _dstc_varint_get(data + ind, data_len - ind, &rec_len);
+
+        if (ind + len_len + rec_len > len)
+            break;
+
+        ind += len_len + rec_len;
+        cnt++;
     }
 
-    if (!_dstc_context_initialized(ctx))
-        dstc_setup();
+    *count = cnt;
+    return ind;
+}
 
-    // FIXME: Stuff multiple calls into a single packet. Queue packet
-    //        either at timeout (1-2 msec) or when packet is full
-    //        (RMC_MAX_PAYLOAD)
+// Copy the calls staged in a thread buffer to the payload buffer,
+// queueing full packets with RMC as needed.
+// A compact block that does not fit in the payload buffer is split
+// in two, with the calls that fit moved in a block of their own.
+// Returns the number of bytes at the start of tb->data that have been
+// moved, which is less than tb->ind if RMC traffic is suspended.
+//
+// ctx must be non-null and locked, and tb->lock must be held.
+static uint32_t _dstc_thread_buffer_move(dstc_context_t* ctx, dstc_thread_buffer_t* tb)
+{
+    uint32_t ind = 0;
 
-    id_len = callback_ref?(sizeof(uint64_t) + 1):(name_len+1);
-    call = (dstc_header_t*) _dstc_payload_buffer_alloc(ctx,
-                                                       sizeof(dstc_header_t) + id_len + arg_sz);
+    while(ind < tb->ind) {
+        uint32_t pad_len = _dstc_pad_record_len(_dstc_payload_buffer_in_use(ctx), ind);
+        uint32_t available = _dstc_payload_buffer_available(ctx);
+        uint32_t len = 0;
+        uint8_t* buf = 0;
+        dstc_header_t* call = 0;
 
-    // If alloc failed, then we do not have enough space in the
-    // payload buffer to store the new call.  Return EBUSY, telling
-    // the calling program to run dstc_process_events() or
-    // dstc_process_events() for a bit and try again.
-    //
-    // We will ignore buffer mode here and send the data out via RMC
-    // since we need to get our buffer space back.
-    // t
-    if (!call) {
-        // Try to empty buffer.
-        _queue_pending_calls(ctx);
-        return EBUSY;
-    }
+        available = (available > pad_len)?(available - pad_len):0;
 
-    call->node_id = dstc_get_node_id();
+        // Find the calls that fit in the payload buffer.
+        while(ind + len < tb->ind) {
+            uint32_t call_len = 0;
+            uint16_t count = 0;
 
-    // If this is a regular function call, then copy in the function
-    // name, including terminating null character, followed by the
-    // payload.
-    //
-    // If this is a invocation of a previously registered callback, then
-    // install a null character as the first byte of payload, followed by
-    // the eight bytes of the callback reference that we want invoked,
-    // followed by the payload
-    //
-    if (name) {
-        memcpy(call->payload, name, name_len + 1);
-        call->payload_len = name_len + 1 + arg_sz;
-        memcpy(call->payload + name_len + 1, arg, arg_sz);
-    } else {
-        call->payload[0] = 0;
-        memcpy(call->payload + 1, (uint64_t*) &callback_ref, sizeof(uint64_t));
-        call->payload_len = 1 + sizeof(uint64_t) + arg_sz;
-        memcpy(call->payload + 1 + sizeof(uint64_t), arg, arg_sz);
-    }
+            call = (dstc_header_t*) (tb->data + ind + len);
+            call_len = sizeof(dstc_header_t) + call->payload_len;
 
-    RMC_LOG_DEBUG("DSTC Queue: node_id[%lu] name[%s]/callback_ref[%llu] payload_len[%d] in_use[%d]",
-                  call->node_id,
-                  name?name:"nil",
-                  callback_ref,
-                  call->payload_len,
-                  _dstc_payload_buffer_in_use(ctx));
+            if (len + call_len > available)
+                break;
 
+            if (call->payload[0] == DSTC_RECORD_COMPACT) {
+                memcpy(&count, call->payload + 2, sizeof(uint16_t));
+                ctx->pub_compact_calls += count;
+            }
 
-    // If we have pending calls in the DSTC circular buffer, try to
-    // queue them with RMC.  This may fail if we are currently
-    // suspended from sending traffic over RMC due to congestion.
-    //
-    // If we are in buffered mode, trying to collect as many calls
-    // as possible into a single RMC (UDP multicast) packet,
-    // then we will not try to queue the call for now.
-    // Please see above for queueing calls when our DSTC outbound
-    // buffer is full.
-    if (!ctx->pub_is_buffering)
-        _queue_pending_calls(ctx);
+            len += call_len;
+        }
+
+        if (len) {
+            if (!(buf = _dstc_payload_buffer_alloc_at(ctx, len, ind)))
+                break;
+
+            memcpy(buf, tb->data + ind, len);
+            ctx->pub_filter |= tb->filter;
+            ind += len;
+            continue;
+        }
 
+        // Move the calls of a compact block that fit, and leave the
+        // rest as a new block, whose header replaces the calls moved.
+        if (call->payload[0] == DSTC_RECORD_COMPACT) {
+            uint16_t count = 0;
+            uint16_t split_count = 0;
+            uint32_t split_len = _dstc_compact_block_split(call, available, &split_count);
+            uint16_t payload_len = call->payload_len;
+            dstc_header_t* rest = 0;
+
+            // Calls moved take at least DSTC_PAD_RECORD_MIN_LEN bytes,
+            // as any other record, leaving room for the
+            // DSTC_RECORD_PAD record of the calls left behind.
+            if (split_count && split_len >= DSTC_PAD_RECORD_MIN_LEN &&
+                (buf = _dstc_payload_buffer_alloc_at(ctx,
+                                                     sizeof(dstc_header_t) +
+                                                     DSTC_COMPACT_HEADER_LEN + split_len,
+                                                     ind))) {
+                memcpy(&count, call->payload + 2, sizeof(uint16_t));
+                memcpy(buf, call, sizeof(dstc_header_t) + DSTC_COMPACT_HEADER_LEN + split_len);
+                ctx->pub_filter |= tb->filter;
+                ((dstc_header_t*) buf)->payload_len = DSTC_COMPACT_HEADER_LEN + split_len;
+                memcpy(((dstc_header_t*) buf)->payload + 2, &split_count, sizeof(uint16_t));
+                ctx->pub_compact_calls += split_count;
+
+                rest = (dstc_header_t*) (tb->data + ind + split_len);
+                memmove(rest, call, sizeof(dstc_header_t) + DSTC_COMPACT_HEADER_LEN);
+                rest->payload_len = payload_len - split_len;
+                count -= split_count;
+                memcpy(rest->payload + 2, &count, sizeof(uint16_t));
+                ind += split_len;
+            }
+        }
+
+        // Queue the full payload buffer and retry with an empty one.
+        if (_dstc_retire_payload_buffer(ctx))
+            break;
+    }
+
+    return ind;
+}
+
+// Copy a call to client function func_id, whose arg_sz bytes of
+// arguments are at offset arg_ind of tb->data, to the payload buffer
+// as a call by name. The arguments keep their offset modulo
+// DSTC_RECORD_ALIGNMENT.
+// Returns EBUSY if the payload buffer is full and could not be
+// queued.
+//
+// ctx must be non-null and locked, and tb->lock must be held.
+static int _dstc_thread_buffer_put_by_name(dstc_context_t* ctx,
+                                           dstc_thread_buffer_t* tb,
+                                           uint32_t func_id,
+                                           uint32_t arg_ind,
+                                           uint32_t arg_sz)
+{
+    dstc_client_func_t* func = &ctx->client_func[func_id];
+    uint32_t id_len = strlen(func->func_name) + 1;
+    uint32_t len = sizeof(dstc_header_t) + id_len + arg_sz;
+    dstc_header_t* call = (dstc_header_t*)
+        _dstc_payload_buffer_alloc_at(ctx, len, arg_ind - sizeof(dstc_header_t) - id_len);
+
+    if (!call &&
+        (_dstc_retire_payload_buffer(ctx) ||
+         !(call = (dstc_header_t*)
+           _dstc_payload_buffer_alloc_at(ctx, len, arg_ind - sizeof(dstc_header_t) - id_len))))
+        return EBUSY;
+
+    call->node_id = rmc_pub_node_id(ctx->pub_ctx);
+    call->payload_len = id_len + arg_sz;
+    memcpy(call->payload, func->func_name, id_len);
+    memcpy(call->payload + id_len, tb->data + arg_ind, arg_sz);
+    ctx->pub_filter |= func->filter;
     return 0;
 }
 
+// Same as _dstc_thread_buffer_move(), but calls by function ID are
+// sent by name. Used once the function ID state of a client function
+// has changed since the calls were staged, leaving remote nodes that
+// cannot resolve their IDs.
 //
-// ---------------------------------------------------------
-// Functions invoked by DSTC_*() macros
-// ---------------------------------------------------------
+// A compact block is copied in one go if its calls fit in the
+// payload buffer by name, or else in an empty one. The calls of a
+// block left behind are thus preceded by at least a full packet of
+// calls, and take their block header with them.
+//
+// ctx must be non-null and locked, and tb->lock must be held.
+static uint32_t _dstc_thread_buffer_reencode(dstc_context_t* ctx, dstc_thread_buffer_t* tb)
+{
+    uint32_t ind = 0;
+
+    while(ind < tb->ind) {
+        dstc_header_t* call = (dstc_header_t*) (tb->data + ind);
+        uint32_t call_len = sizeof(dstc_header_t) + call->payload_len;
+        uint8_t* data = call->payload + DSTC_COMPACT_HEADER_LEN;
+        uint32_t data_len = call->payload_len - DSTC_COMPACT_HEADER_LEN;
+        uint32_t data_ind = 0;
+        uint32_t room = 0;
+        uint16_t count = 0;
+        uint8_t* buf = 0;
+
+        if (call->payload[0] == DSTC_RECORD_PAD) {
+            ind += call_len;
+            continue;
+        }
+
+        if (call->payload[0] == DSTC_RECORD_FUNC_ID) {
+            uint16_t func_id = 0;
+
+            memcpy(&func_id, call->payload + 1, sizeof(uint16_t));
+            if (_dstc_thread_buffer_put_by_name(ctx, tb, func_id,
+                                                ind + sizeof(dstc_header_t) + 1 + sizeof(uint16_t),
+                                                call->payload_len - 1 - sizeof(uint16_t)))
+                break;
+
+            ind += call_len;
+            continue;
+        }
+
+        // Calls by name are moved as they are.
+        if (call->payload[0] != DSTC_RECORD_COMPACT) {
+            if (!(buf = _dstc_payload_buffer_alloc_at(ctx, call_len, ind)) &&
+                (_dstc_retire_payload_buffer(ctx) ||
+                 !(buf = _dstc_payload_buffer_alloc_at(ctx, call_len, ind))))
+                break;
+
+            memcpy(buf, call, call_len);
+            ctx->pub_filter |= tb->filter;
+            ind += call_len;
+            continue;
+        }
+
+        // Room needed by the calls of the block, sent by name.
+        memcpy(&count, call->payload + 2, sizeof(uint16_t));
+        while(data_ind < data_len) {
+            uint32_t rec_len = 0;
+            uint32_t func_id = 0;
+            uint32_t len_len = _dstc_varint_get(data + data_ind, data_len - data_ind, &rec_len);
+            uint32_t id_len = _dstc_varint_get(data + data_ind + len_len, rec_len, &func_id);
+
+            room += DSTC_PAD_RECORD_MIN_LEN + DSTC_RECORD_ALIGNMENT - 1 +
+                sizeof(dstc_header_t) + strlen(ctx->client_func[func_id].func_name) + 1 +
+                rec_len - id_len;
+            data_ind += len_len + rec_len;
+        }
+
+        if (room > _dstc_payload_buffer_available(ctx) &&
+            _dstc_retire_payload_buffer(ctx))
+            break;
+
+        data_ind = 0;
+        while(data_ind < data_len) {
+            uint32_t rec_len = 0;
+            uint32_t func_id = 0;
+            uint32_t len_len = _dstc_varint_get(data + data_ind, data_len - data_ind, &rec_len);
+            uint32_t id_len = _dstc_varint_get(data + data_ind + len_len, rec_len, &func_id);
+
+            if (_dstc_thread_buffer_put_by_name(ctx, tb, func_id,
+                                                (data + data_ind + len_len + id_len) - tb->data,
+                                                rec_len - id_len))
+                break;
+
+            data_ind += len_len + rec_len;
+            count--;
+        }
+
+        if (data_ind == data_len) {
+            ind += call_len;
+            continue;
+        }
+
+        // Leave the calls not copied as a block of their own.
+        if (data_ind) {
+            dstc_header_t* rest = (dstc_header_t*) (tb->data + ind + data_ind);
+            uint16_t payload_len = call->payload_len;
+
+            memmove(rest, call, sizeof(dstc_header_t) + DSTC_COMPACT_HEADER_LEN);
+            rest->payload_len = payload_len - data_ind;
+            memcpy(rest->payload + 2, &count, sizeof(uint16_t));
+            ind += data_ind;
+        }
+        break;
+    }
+
+    return ind;
+}
+
+// Move calls staged in a thread buffer to the payload buffer,
+// queueing full packets with RMC as needed. See
+// _dstc_thread_buffer_move().
+//
+// Calls staged with function IDs that are no longer valid for all
+// remote nodes serving their functions are sent by name instead. See
+// _dstc_thread_buffer_reencode().
 //
+// Returns EBUSY if calls were left in the thread buffer since RMC
+// traffic is suspended.
+//
+// ctx must be non-null and locked, and tb->lock must be held.
+static int _dstc_thread_buffer_merge(dstc_context_t* ctx, dstc_thread_buffer_t* tb)
+{
+    uint32_t ind = 0;
+
+    if (tb->func_id_gen != ctx->func_id_gen)
+        ind = _dstc_thread_buffer_reencode(ctx, tb);
+    else
+        ind = _dstc_thread_buffer_move(ctx, tb);
+
+    // Merged calls keep the flush deadline they were staged with.
+    if (tb->flush_deadline && _dstc_payload_buffer_in_use(ctx) > 0 &&
+        tb->flush_deadline < ctx->pub_flush_deadline)
+        ctx->pub_flush_deadline = tb->flush_deadline;
+
+    // Calls left behind keep their alignment, behind a
+    // DSTC_RECORD_PAD record if needed. The records merged take at
+    // least DSTC_PAD_RECORD_MIN_LEN bytes, leaving room for it.
+    if (ind < tb->ind) {
+        uint32_t pad_len = _dstc_pad_record_len(0, ind);
 
+        memmove(tb->data + pad_len, tb->data + ind, tb->ind - ind);
+        if (pad_len)
+            _dstc_pad_record_put(tb->data, pad_len, rmc_pub_node_id(ctx->pub_ctx));
+
+        ind -= pad_len;
+    }
+
+    tb->ind -= ind;
+    tb->block_ind = 0;
+    if (!tb->ind) {
+        tb->flush_deadline = 0;
+        tb->filter = 0;
+    }
+
+    return tb->ind?EBUSY:0;
+}
+
+// Merge the calls staged by the calling thread, which must be sent
+// before any call that it queues directly to the payload buffer.
+// Returns EBUSY if calls were left in the thread buffer.
 //
-// Register a function name - pointer relationship.
-// Called by file constructor function _dstc_register_server_[name]()
-// generated by DSTC_SERVER() macro.
+// ctx must be non-null, setup and locked
+static int _dstc_thread_buffer_merge_own(dstc_context_t* ctx)
+{
+    dstc_thread_buffer_t* tb = (dstc_thread_buffer_t*)
+        pthread_getspecific(ctx->thread_buffer_key);
+    int res = 0;
+
+    // tb->ind is only updated by the owner, or with ctx locked.
+    if (!tb || !tb->ind)
+        return 0;
+
+    pthread_mutex_lock(&tb->lock);
+    res = _dstc_thread_buffer_merge(ctx, tb);
+    pthread_mutex_unlock(&tb->lock);
+    return res;
+}
+
+// Merge the calls staged by all threads, and free the buffers of
+// exited threads once they are empty.
+// Returns EBUSY if calls were left in any thread buffer.
 //
-// ctx can be unlocked and/or null (for default context)
-void dstc_register_server_function(dstc_context_t* ctx,
-                                   char* name,
-                                   dstc_internal_dispatch_t server_func)
+// ctx must be non-null and locked
+static int _dstc_thread_buffer_merge_all(dstc_context_t* ctx)
 {
-    int ind = 0;
+    dstc_thread_buffer_t** tb_ptr = &ctx->thread_buffer;
+    int res = 0;
 
-    if (!ctx)
-        ctx = &_dstc_default_context;
+    while(*tb_ptr) {
+        dstc_thread_buffer_t* tb = *tb_ptr;
+
+        pthread_mutex_lock(&tb->lock);
+        if (tb->ind && _dstc_thread_buffer_merge(ctx, tb))
+            res = EBUSY;
+        pthread_mutex_unlock(&tb->lock);
+
+        if (tb->orphaned && !tb->ind) {
+            *tb_ptr = tb->next;
+            pthread_mutex_destroy(&tb->lock);
+            free(tb);
+            continue;
+        }
+        tb_ptr = &tb->next;
+    }
+    return res;
+}
+
+// Destructor of dstc_context_t::thread_buffer_key, invoked when a
+// thread that has staged calls exits. Its remaining calls are
+// merged now, or by the next flush if RMC traffic is suspended.
+static void _dstc_thread_buffer_exit(void* arg)
+{
+    dstc_thread_buffer_t* tb = (dstc_thread_buffer_t*) arg;
+    dstc_context_t* ctx = tb->ctx;
+
+    _dstc_lock_context(ctx);
+    tb->orphaned = 1;
+    if (_dstc_thread_buffer_merge_all(ctx) && !ctx->pub_is_buffering)
+        ctx->thread_buffer_stranded = 1;
+    _dstc_unlock_context(ctx);
+}
+
+// Retrieve the calling thread's buffer, creating it on first use.
+//
+// ctx must be non-null, setup and unlocked
+static dstc_thread_buffer_t* _dstc_thread_buffer(dstc_context_t* ctx)
+{
+    dstc_thread_buffer_t* tb = (dstc_thread_buffer_t*)
+        pthread_getspecific(ctx->thread_buffer_key);
+    int res = 0;
+
+    if (tb)
+        return tb;
+
+    res = posix_memalign((void**) &tb,
+                         DSTC_CACHE_LINE_SIZE,
+                         sizeof(dstc_thread_buffer_t));
+
+    if (res) {
+        RMC_LOG_FATAL("posix_memalign(%d): %s",
+                      sizeof(dstc_thread_buffer_t), strerror(res));
+        exit(255);
+    }
+
+    tb->ctx = ctx;
+    tb->ind = 0;
+    tb->block_ind = 0;
+    tb->reserved = 0;
+    tb->orphaned = 0;
+    tb->flush_deadline = 0;
+    tb->filter = 0;
+    pthread_mutex_init(&tb->lock, 0);
+    pthread_setspecific(ctx->thread_buffer_key, tb);
+
+    _dstc_lock_context(ctx);
+    tb->next = ctx->thread_buffer;
+    ctx->thread_buffer = tb;
+    _dstc_unlock_context(ctx);
+    return tb;
+}
+
+// Stage a call to a DSTC_CLIENT() function in the calling thread's
+// buffer. See _dstc_reserve() for arguments.
+//
+// On success, tb->lock is held until dstc_commit_call() is called.
+// Returns EAGAIN if the call is to be queued directly to the payload
+// buffer instead, and EBUSY if the thread buffer is full and could
+// not be merged since RMC traffic is suspended.
+//
+// ctx must be non-null, setup and unlocked
+static int _dstc_thread_reserve(dstc_context_t* ctx,
+                                dstc_thread_buffer_t* tb,
+                                char* name,
+                                dstc_client_func_t* client_func,
+                                uint32_t arg_sz,
+                                uint8_t** arg)
+{
+    dstc_header_t* call = 0;
+    // Read the generation first. A change of the function ID state
+    // after this is caught below, or by _dstc_thread_buffer_merge().
+    uint32_t func_id_gen = __atomic_load_n(&ctx->func_id_gen, __ATOMIC_ACQUIRE);
+    uint8_t id_state = __atomic_load_n(&client_func->id_state, __ATOMIC_RELAXED);
+    uint16_t func_id = (uint16_t) (client_func - ctx->client_func);
+    uint32_t flush_bytes = __atomic_load_n(&ctx->pub_flush_bytes, __ATOMIC_RELAXED);
+    uint32_t flush_usec = __atomic_load_n(&ctx->pub_flush_usec, __ATOMIC_RELAXED);
+    size_t name_len = 0;
+    uint32_t id_len = 0;
+    uint32_t call_len = 0;
+    uint8_t compact = 0;
+    int res = 0;
+
+    // Function IDs are bound through the payload buffer.
+    if (id_state == DSTC_FUNC_ID_BIND_PENDING)
+        return EAGAIN;
+
+    if (id_state == DSTC_FUNC_ID_BOUND) {
+        id_len = 1 + sizeof(uint16_t);
+        compact = __atomic_load_n(&client_func->compact, __ATOMIC_RELAXED);
+    } else {
+        name_len = strlen(name);
+        id_len = name_len + 1;
+    }
+
+    // Calls by ID are staged in compact blocks if supported. Room
+    // is checked for opening a new block.
+    if (compact)
+        call_len = _dstc_compact_call_len(func_id, arg_sz, 1);
+    else
+        call_len = sizeof(dstc_header_t) + id_len + arg_sz;
+
+    if (call_len > DSTC_THREAD_BUFFER_SIZE)
+        return EAGAIN;
+
+    pthread_mutex_lock(&tb->lock);
+
+    // A call reaching the flush threshold is queued directly,
+    // together with the calls staged before it.
+    if (flush_bytes && tb->ind + call_len >= flush_bytes) {
+        pthread_mutex_unlock(&tb->lock);
+        return EAGAIN;
+    }
+
+    if (tb->ind + call_len > DSTC_THREAD_BUFFER_SIZE) {
+        pthread_mutex_unlock(&tb->lock);
+        _dstc_lock_context(ctx);
+        pthread_mutex_lock(&tb->lock);
+        res = _dstc_thread_buffer_merge(ctx, tb);
+        _dstc_check_flush_threshold(ctx);
+        _dstc_unlock_context(ctx);
+
+        if (res) {
+            pthread_mutex_unlock(&tb->lock);
+            return res;
+        }
+    }
+
+    // Buffered mode may have been left by another thread, which
+    // will have merged our buffer.
+    if (!__atomic_load_n(&ctx->pub_is_buffering, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&tb->lock);
+        return EAGAIN;
+    }
+
+    // All staged calls are encoded with the same function ID state.
+    // Calls staged before it changed are merged, re-encoded, before
+    // this one is queued directly.
+    if (!tb->ind)
+        tb->func_id_gen = func_id_gen;
+    else if (tb->func_id_gen != func_id_gen) {
+        pthread_mutex_unlock(&tb->lock);
+        return EAGAIN;
+    }
+
+    // Start the flush timer with the first staged call.
+    if (!tb->ind && flush_usec) {
+        tb->flush_deadline = rmc_usec_monotonic_timestamp() + flush_usec;
+        _dstc_wake_event_waiters(ctx);
+    }
+
+    tb->filter |= client_func->filter;
+
+    if (compact) {
+        dstc_header_t* block = _dstc_compact_block(tb->data, tb->ind, tb->block_ind);
+
+        if (!block)
+            tb->block_ind = tb->ind + 1;
+
+        *arg = _dstc_compact_store(block, tb->data + tb->ind,
+                                   rmc_pub_node_id(ctx->pub_ctx),
+                                   func_id, arg_sz);
+
+        tb->ind = *arg + arg_sz - tb->data;
+        tb->reserved = 1;
+        return 0;
+    }
+
+    call = (dstc_header_t*) (tb->data + tb->ind);
+    call->node_id = rmc_pub_node_id(ctx->pub_ctx);
+
+    if (id_state == DSTC_FUNC_ID_BOUND) {
+        call->payload[0] = DSTC_RECORD_FUNC_ID;
+        memcpy(call->payload + 1, &func_id, sizeof(uint16_t));
+    } else
+        memcpy(call->payload, name, name_len + 1);
+
+    call->payload_len = id_len + arg_sz;
+    *arg = call->payload + id_len;
+
+    tb->ind += call_len;
+    tb->reserved = 1;
+    return 0;
+}
+
+// Queue buffered calls once their flush deadline has passed.
+// Calls that cannot be queued since RMC traffic is suspended are
+// retried after another pub_flush_usec.
+//
+// ctx must be non-null and locked
+static void _dstc_process_flush_timeout(dstc_context_t* ctx)
+{
+    usec_timestamp_t deadline = _dstc_get_flush_deadline(ctx);
+    usec_timestamp_t now = 0;
+    dstc_thread_buffer_t* tb = 0;
+
+    if (!deadline || deadline > (now = rmc_usec_monotonic_timestamp()))
+        return;
+
+    _dstc_adapt_flush_window(ctx, 1);
+
+    if (_dstc_thread_buffer_merge_all(ctx) == EBUSY) {
+        for(tb = ctx->thread_buffer; tb; tb = tb->next) {
+            pthread_mutex_lock(&tb->lock);
+            if (tb->ind)
+                tb->flush_deadline = now + ctx->pub_flush_usec;
+            pthread_mutex_unlock(&tb->lock);
+        }
+    }
+
+    _queue_pending_calls(ctx);
+    if (_dstc_payload_buffer_in_use(ctx) > 0 || ctx->reply_ind)
+        ctx->pub_flush_deadline = now + ctx->pub_flush_usec;
+}
+
+// Queue calls left in the payload buffer or in thread buffers while
+// traffic was suspended.
+// Calls made in buffered mode are left alone until flushed by
+// the application.
+//
+// ctx must be non-null and locked
+void _dstc_resume_pending_calls(dstc_context_t* ctx)
+{
+    _dstc_drain_pub_queue(ctx);
+    _dstc_update_flow_control(ctx);
+
+    if (ctx->pub_is_buffering || ctx->pub_bulk_depth)
+        return;
+
+    if (ctx->thread_buffer_stranded)
+        ctx->thread_buffer_stranded = (_dstc_thread_buffer_merge_all(ctx) == EBUSY);
+
+    if (_dstc_payload_buffer_in_use(ctx) > 0)
+        _queue_pending_calls(ctx);
+}
+
+// Return a callback slot to the free list, bumping its generation
+// so that any later reply carrying the old reference is ignored.
+//
+// ctx must be non-null and locked
+static void _dstc_release_callback_slot(dstc_context_t* ctx, uint32_t slot)
+{
+    dstc_callback_slot_t* cb = &ctx->callback_slot[slot];
+
+    cb->callback = 0;
+    cb->user_data = 0;
+    cb->generation = (cb->generation + 1) & DSTC_CALLBACK_GENERATION_MASK;
+
+    // The callback is no longer outstanding with the node it was
+    // sent to in a targeted call.
+    if (cb->remote_ind) {
+        dstc_remote_node_t* remote = &ctx->remote_node[cb->remote_ind - 1];
+
+        if (remote->node_id == cb->remote_node_id && remote->outstanding)
+            remote->outstanding--;
+        cb->remote_ind = 0;
+    }
+
+    // Generation 0 is never used, making 0 an invalid callback_ref.
+    if (!cb->generation)
+        cb->generation = 1;
+
+    cb->next_free = ctx->callback_slot_free;
+    ctx->callback_slot_free = slot + 1;
+}
+
+// Retrieve the slot of a pending callback reference previously
+// returned by dstc_activate_callback(), or 0 if the reference
+// is not pending.
+// If consumed is set, a slot whose callback is being dispatched is
+// also returned.
+//
+// ctx must be non-null and locked
+static dstc_callback_slot_t* _dstc_find_callback_slot(dstc_context_t* ctx,
+                                                      dstc_callback_t callback_ref,
+                                                      uint8_t consumed)
+{
+    uint32_t slot = DSTC_CALLBACK_REF_SLOT(callback_ref);
+    dstc_callback_slot_t* cb = 0;
+
+    if (slot >= ctx->callback_slot_ind)
+        return 0;
+
+    cb = &ctx->callback_slot[slot];
+    if (cb->generation != DSTC_CALLBACK_REF_GENERATION(callback_ref) ||
+        (!cb->callback && !consumed))
+        return 0;
+
+    return cb;
+}
+
+// Retrieve a callback function. Each time it is invoked, it will be deleted.
+// dstc_register_server_function()
+//
+// ctx must be non-null and locked
+static dstc_internal_dispatch_t _dstc_find_callback_by_func(dstc_context_t* ctx,
+                                                            dstc_internal_dispatch_t func)
+{
+    int i = 0;
+
+    while(i < ctx->callback_slot_ind) {
+        if (ctx->callback_slot[i].callback == func) {
+            _dstc_release_callback_slot(ctx, i);
+            return func;
+        }
+        ++i;
+    }
+
+    i = 0;
+    while(i < ctx->callback_ind) {
+        if (ctx->local_callback[i].callback == func) {
+            dstc_internal_dispatch_t res = ctx->local_callback[i].callback;
+            // Nil out the callback since it is a one-time shot thing.
+            ctx->local_callback[i].callback = 0;
+            ctx->local_callback[i].callback_ref = 0;
+            return res;
+        }
+        ++i;
+    }
+    RMC_LOG_COMMENT("Did not find callback [%p]\n", func);
+    return (dstc_internal_dispatch_t) 0;
+}
+
+// Retrieve the callback function of a reference, marking the callback
+// as consumed so that it cannot be invoked again.
+// A consumed slot is kept out of the free list, and its user data
+// available through dstc_callback_user_data(), until
+// _dstc_release_callback_by_ref() is called after the callback has
+// been dispatched.
+//
+// ctx must be non-null and locked
+static dstc_internal_dispatch_t _dstc_find_callback_by_ref(dstc_context_t* ctx,
+                                                           dstc_callback_t callback_ref)
+{
+    dstc_callback_slot_t* cb = _dstc_find_callback_slot(ctx, callback_ref, 0);
+    int i = 0;
+
+    if (cb) {
+        dstc_internal_dispatch_t res = cb->callback;
+        cb->callback = 0;
+        return res;
+    }
+
+    // Check callbacks registered with application-provided references.
+    while(i < ctx->callback_ind) {
+        if (ctx->local_callback[i].callback_ref == callback_ref) {
+            dstc_internal_dispatch_t res = ctx->local_callback[i].callback;
+            // Nil out the callback since it is a one-time shot thing.
+            ctx->local_callback[i].callback = 0;
+            ctx->local_callback[i].callback_ref = 0;
+            return res;
+        }
+        ++i;
+    }
+    RMC_LOG_COMMENT("Did not find callback [%lX]", callback_ref);
+    return (dstc_internal_dispatch_t) 0;
+}
+
+// Release a callback consumed by _dstc_find_callback_by_ref()
+//
+// ctx must be non-null and locked
+static void _dstc_release_callback_by_ref(dstc_context_t* ctx,
+                                          dstc_callback_t callback_ref)
+{
+    dstc_callback_slot_t* cb = _dstc_find_callback_slot(ctx, callback_ref, 1);
+
+    if (cb && !cb->callback)
+        _dstc_release_callback_slot(ctx, cb - ctx->callback_slot);
+}
+
+// Activate a client-side callback that can be invoked from a remote
+// DSTC function called from the client.  Called by the
+// CLIENT_CALLBACK_ARG() macro to register a pointer to the dispatch
+// function that handles the incoming callback from the remote DSTC
+// function.
+//
+// A unique callback reference integer is returned for each
+// activation, even if the same callback is activated several
+// times. This integer is passed as a reference to the remote DSTC
+// function, which will send it back to the client in order to
+// invoke the local callback.
+//
+// user_data is made available to the callback through
+// dstc_callback_user_data() while it executes.
+//
+// client-side dstc_process_function_call() will detect that
+// a callback is being invoked and will use _dstc_find_callback_by_ref()
+// to map the provided reference callback integer to a dispatch function,
+// which is then called.
+// _dstc_find_callback_by_ref() will also de-activate the callback,
+// stopping it from being invoked multiple time.
+//
+dstc_callback_t dstc_activate_callback(dstc_context_t* ctx,
+                                       dstc_internal_dispatch_t callback,
+                                       void* user_data)
+{
+    uint32_t slot = 0;
+    dstc_callback_slot_t* cb = 0;
+
+    // If a null pointer was provided as a callback, just pass a 0
+    // around. The callback server will simply not do a callback if
+    // (dstc_callback_t) 0 is presented to it.
+    //
+    if (!callback)
+        return (dstc_callback_t) 0;
+
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    // Group contexts hand the callbacks they receive over to their
+    // root context.
+    if (ctx->group_root)
+        ctx = ctx->group_root;
+
+    _dstc_lock_context(ctx);
+
+    // Reuse a previously freed slot, or allocate a new one
+    if (ctx->callback_slot_free) {
+        slot = ctx->callback_slot_free - 1;
+        ctx->callback_slot_free = ctx->callback_slot[slot].next_free;
+    } else {
+        if (ctx->callback_slot_ind == ctx->callback_slot_size) {
+            uint32_t new_size = ctx->callback_slot_size?
+                (ctx->callback_slot_size * 2):SYMTAB_SIZE;
+            dstc_callback_slot_t* new_slot = realloc(ctx->callback_slot,
+                                                     new_size * sizeof(dstc_callback_slot_t));
+
+            if (!new_slot) {
+                RMC_LOG_FATAL("Out of memory trying to register callback. Slots: %d",
+                              ctx->callback_slot_size);
+                exit(255);
+            }
+            ctx->callback_slot = new_slot;
+            ctx->callback_slot_size = new_size;
+        }
+        slot = ctx->callback_slot_ind++;
+        ctx->callback_slot[slot].generation = 1;
+    }
+
+    cb = &ctx->callback_slot[slot];
+    cb->callback = callback;
+    cb->user_data = user_data;
+    cb->next_free = 0;
+    cb->remote_ind = 0;
+    ctx->callback_slot_last = slot + 1;
+
+    RMC_LOG_COMMENT("Registered callback %p. Slot[%d] generation[%d]",
+                    callback, slot, cb->generation);
+
+    _dstc_unlock_context(ctx);
+
+    // Replies to callbacks in the first slots can be sent directly
+    // to us. See dstc_import_callback_ref().
+    if (slot < DSTC_CALLBACK_TARGETED_SLOTS)
+        return (dstc_callback_t) ((uint64_t) DSTC_CALLBACK_REF(cb->generation, slot) |
+                                  DSTC_CALLBACK_REF_TARGETED);
+
+    return DSTC_CALLBACK_REF(cb->generation, slot);
+}
+
+// Tag a DSTC_CALLBACK_REF_TARGETED reference received in a call
+// from node_id with the node, as a DSTC_CALLBACK_REF_REPLY reference.
+// Replies through it are sent directly to the node by
+// _dstc_reserve_reply() instead of being multicast.
+// Called by the code generated by DSTC_SERVER() and friends for
+// each callback argument received.
+//
+// References that cannot be tagged are returned without
+// DSTC_CALLBACK_REF_TARGETED, and replies through them are multicast.
+dstc_callback_t dstc_import_callback_ref(dstc_context_t* ctx,
+                                         rmc_node_id_t node_id,
+                                         dstc_callback_t callback_ref)
+{
+    uint64_t ref = (uint64_t) callback_ref;
+    uint32_t ind = 0;
+    uint32_t reuse = 0;
+
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    _dstc_lock_context(ctx);
+    ind = _dstc_get_reply_node(ctx, node_id);
+    if (ind != DSTC_CALLBACK_REF_NODE_COUNT)
+        reuse = ctx->reply_node_reuse[ind];
+    _dstc_unlock_context(ctx);
+
+    if (ind == DSTC_CALLBACK_REF_NODE_COUNT ||
+        (ref & (DSTC_CALLBACK_REF_REPLY |
+                DSTC_CALLBACK_REF_NODE_MASK |
+                DSTC_CALLBACK_REF_REUSE_MASK)))
+        return (dstc_callback_t) (ref & ~DSTC_CALLBACK_REF_TARGETED);
+
+    return (dstc_callback_t) (ref | DSTC_CALLBACK_REF_REPLY |
+                              ((uint64_t) ind << DSTC_CALLBACK_REF_NODE_SHIFT) |
+                              ((uint64_t) reuse << DSTC_CALLBACK_REF_REUSE_SHIFT));
+}
+
+// Return a reference tagged by dstc_import_callback_ref() as it was
+// sent by the calling node. Other references are returned as is.
+// Called by the code generated by DSTC_CLIENT() and friends, leaving
+// replies from the nodes a reference is passed on to multicast since
+// they do not know the calling node.
+dstc_callback_t dstc_export_callback_ref(dstc_callback_t callback_ref)
+{
+    if (!DSTC_CALLBACK_REF_IS_REPLY(callback_ref))
+        return callback_ref;
+
+    return (dstc_callback_t) ((uint64_t) callback_ref &
+                              ~(DSTC_CALLBACK_REF_TARGETED |
+                                DSTC_CALLBACK_REF_REPLY |
+                                DSTC_CALLBACK_REF_NODE_MASK |
+                                DSTC_CALLBACK_REF_REUSE_MASK));
+}
+
+// Called by the code generated by DSTC_SERVER_ALIGNED() and friends
+// for a call from node_id whose arguments are not aligned in memory.
+// The call is dropped, since the node did not send it with the
+// layout of DSTC_CLIENT_ALIGNED().
+void dstc_drop_misaligned_call(rmc_node_id_t node_id)
+{
+    RMC_LOG_WARNING("Misaligned arguments in call from node [%u]. Ignored", node_id);
+}
+
+// Set the function ID state and compact flag of func. Calls staged
+// in thread buffers before the change are re-encoded when merged.
+// See _dstc_thread_buffer_merge().
+//
+// ctx must be non-null and locked
+static void _dstc_set_func_id_state(dstc_context_t* ctx,
+                                    dstc_client_func_t* func,
+                                    uint8_t id_state,
+                                    uint8_t compact)
+{
+    if (id_state == func->id_state && compact == func->compact)
+        return;
+
+    __atomic_store_n(&func->id_state, id_state, __ATOMIC_RELAXED);
+    __atomic_store_n(&func->compact, compact, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->func_id_gen, 1, __ATOMIC_RELEASE);
+}
+
+// Update the function ID state of the DSTC_CLIENT-registered function
+// func_name after the set of remote nodes serving it has changed.
+//
+// Function IDs are only used if all remote nodes serving the function
+// support them. If rebind is set, a node that has not yet seen our
+// binding for the function has been added, and the next call must
+// be preceeded by a new DSTC_RECORD_BIND record.
+// The same goes for compact blocks, which only carry calls by ID.
+//
+// ctx must be non-null and locked
+static void _dstc_update_func_id_state(dstc_context_t* ctx,
+                                       char* func_name,
+                                       uint8_t rebind)
+{
+    dstc_client_func_t* func = 0;
+    uint32_t served = 0;
+    uint8_t compact = 1;
+    int ind = ctx->client_func_ind;
+
+    while(ind--) {
+        if (!strcmp(ctx->client_func[ind].func_name, func_name)) {
+            func = &ctx->client_func[ind];
+            break;
+        }
+    }
+
+    // We do not call the function ourselves.
+    if (!func)
+        return;
+
+    ind = ctx->remote_node_ind;
+    while(ind--) {
+        if (!ctx->remote_node[ind].node_id ||
+            strcmp(ctx->remote_node[ind].func_name, func_name))
+            continue;
+
+        // Fall back to names if any node serving the function
+        // does not support IDs.
+        if (!(ctx->remote_node[ind].caps & DSTC_CAP_FUNC_ID)) {
+            _dstc_set_func_id_state(ctx, func, DSTC_FUNC_ID_NONE, 0);
+            return;
+        }
+
+        if (!(ctx->remote_node[ind].caps & DSTC_CAP_COMPACT))
+            compact = 0;
+        ++served;
+    }
+
+    if (!served) {
+        _dstc_set_func_id_state(ctx, func, DSTC_FUNC_ID_NONE, 0);
+        return;
+    }
+
+    _dstc_set_func_id_state(ctx, func,
+                            (rebind || func->id_state == DSTC_FUNC_ID_NONE)?
+                            DSTC_FUNC_ID_BIND_PENDING:func->id_state,
+                            compact);
+}
+
+// Register a remote function as provided by the remote DSTC server
+// through a control message call processed by
+// dstc_subscriber_control_message_cb()
+// caps are the DSTC_CAP_XXX flags provided by the remote node.
+// address and port identify the control connection the message
+// was received over.
+//
+
+// ctx must be non-null and locked
+static void dstc_register_remote_function(dstc_context_t* ctx,
+                                          rmc_node_id_t node_id,
+                                          char* func_name,
+                                          uint8_t caps,
+                                          uint32_t address,
+                                          uint16_t port)
+{
+    int ind = 0;
+    dstc_remote_node_t* remote = 0;
+
+    // See if the node has registered any prior functions
+    // If so, check that we don't have a duplicate and then register
+    // the new function.
+    // Reuse slots freed by dstc_unregister_remote_node(), if any.
+    ind = ctx->remote_node_ind;
+    while(ind--) {
+        if (!ctx->remote_node[ind].node_id) {
+            remote = &ctx->remote_node[ind];
+            continue;
+        }
+
+        if (node_id == ctx->remote_node[ind].node_id &&
+            !strcmp(func_name, ctx->remote_node[ind].func_name)) {
+            RMC_LOG_WARNING("Remote function [%s] registered several times by node [0x%X]",
+                            func_name, node_id);
+            return;
+        }
+    }
+
+    if (!remote) {
+        // Grow the remote node table if needed.
+        if (ctx->remote_node_ind == ctx->remote_node_size) {
+            uint32_t new_size = ctx->remote_node_size?
+                (ctx->remote_node_size * 2):SYMTAB_SIZE;
+            dstc_remote_node_t* new_remote = realloc(ctx->remote_node,
+                                                     new_size * sizeof(dstc_remote_node_t));
+
+            if (!new_remote) {
+                RMC_LOG_FATAL("Out of memory trying to register remote func %s", func_name);
+                exit(255);
+            }
+            ctx->remote_node = new_remote;
+            ctx->remote_node_size = new_size;
+        }
+        remote = &ctx->remote_node[ctx->remote_node_ind++];
+    }
+
+    remote->node_id = node_id;
+    remote->caps = caps;
+    remote->address = address;
+    remote->port = port;
+    remote->outstanding = 0;
+    strcpy(remote->func_name, func_name);
+
+    _dstc_update_func_id_state(ctx, func_name, 1);
+
+    RMC_LOG_INFO("Remote [%s] now supported by new node [0x%X]. Capabilities [0x%X]",
+                 func_name, node_id, caps);
+    return;
+}
+
+
+// Remove all functions previously registered by node_id through
+// the dstc_register_remote_function() call.
+//
+// ctx must be non-null and locked
+static void dstc_unregister_remote_node(dstc_context_t* ctx,
+                                        rmc_node_id_t node_id)
+{
+    int ind = ctx->remote_node_ind;
+
+    while(ind--) {
+        if (node_id == ctx->remote_node[ind].node_id) {
+            RMC_LOG_INFO("Uhregistering node [0x%X] function [%s]",
+                         ctx->remote_node[ind].node_id,
+                         ctx->remote_node[ind].func_name);
+
+            ctx->remote_node[ind].node_id = 0;
+            _dstc_update_func_id_state(ctx, ctx->remote_node[ind].func_name, 0);
+            ctx->remote_node[ind].func_name[0] = 0;
+        }
+    }
+}
+
+
+// ctx must be set and locked.
+// Check if the calling thread is an executor worker.
+//
+// ctx must be non-null and locked
+static int _dstc_executor_is_worker(dstc_context_t* ctx)
+{
+    uint32_t ind = ctx->exec_worker_count;
+    pthread_t self = pthread_self();
+
+    while(ind--)
+        if (pthread_equal(ctx->exec_worker[ind].thread, self))
+            return 1;
+
+    return 0;
+}
+
+// Reserve room in the executor for the calls of an inbound packet.
+// Returns 0 if the executor already holds its max number of packets.
+//
+// ctx must be non-null and locked
+static int _dstc_executor_reserve(dstc_context_t* ctx, uint8_t* packet)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&ctx->exec_lock);
+    if (ctx->exec_packets < ctx->exec_max_packets) {
+        ctx->exec_packets++;
+        DSTC_PACKET_BUFFER(packet)->exec_reserved = 1;
+        res = 1;
+    } else
+        ctx->exec_stalls++;
+
+    pthread_mutex_unlock(&ctx->exec_lock);
+    return res;
+}
+
+// Wait, with ctx->lock released, until the executor has room for
+// another packet or has been shut down.
+//
+// ctx must be non-null and locked
+static void _dstc_executor_wait(dstc_context_t* ctx)
+{
+    uint32_t depth = ctx->lock_depth;
+    uint32_t ind = depth;
+
+    while(ind--)
+        _dstc_unlock_context(ctx);
+
+    pthread_mutex_lock(&ctx->exec_lock);
+    while(ctx->exec_worker_count && ctx->exec_packets >= ctx->exec_max_packets)
+        pthread_cond_wait(&ctx->exec_space_cond, &ctx->exec_lock);
+    pthread_mutex_unlock(&ctx->exec_lock);
+
+    while(depth--)
+        _dstc_lock_context(ctx);
+}
+
+// Release a reference to an inbound packet, returning it to the
+// receive pool once all of its calls have been executed.
+//
+// ctx must be non-null and locked
+static void _dstc_release_packet(dstc_context_t* ctx, uint8_t* packet, payload_len_t packet_len)
+{
+    dstc_packet_buffer_t* buf = DSTC_PACKET_BUFFER(packet);
+
+    if (--buf->ref_count)
+        return;
+
+    if (buf->exec_reserved) {
+        buf->exec_reserved = 0;
+        pthread_mutex_lock(&ctx->exec_lock);
+        ctx->exec_packets--;
+        pthread_cond_broadcast(&ctx->exec_space_cond);
+        pthread_mutex_unlock(&ctx->exec_lock);
+    }
+
+    _dstc_rx_buffer_put(ctx, packet, packet_len);
+}
+
+// Queue a server function call to an executor worker, selected by the
+// ordering policy. The call holds a reference to its packet until
+// it has been executed.
+//
+// ctx must be non-null and locked
+static void _dstc_executor_queue(dstc_context_t* ctx,
+                                 dstc_internal_dispatch_t server_func,
+                                 uint32_t func_ind,
+                                 rmc_node_id_t node_id,
+                                 uint8_t* name,
+                                 uint8_t* payload,
+                                 uint16_t payload_len,
+                                 uint8_t* packet,
+                                 payload_len_t packet_len)
+{
+    dstc_exec_worker_t* worker = 0;
+    dstc_exec_call_t* call = 0;
+
+    DSTC_PACKET_BUFFER(packet)->ref_count++;
+
+    pthread_mutex_lock(&ctx->exec_lock);
+    call = ctx->exec_call_free;
+    if (call)
+        ctx->exec_call_free = call->next;
+    else if (!(call = (dstc_exec_call_t*) malloc(sizeof(dstc_exec_call_t)))) {
+        RMC_LOG_FATAL("Out of memory trying to queue call to executor");
+        exit(255);
+    }
+
+    *call = (dstc_exec_call_t) {
+        .next = 0,
+        .server_func = server_func,
+        .node_id = node_id,
+        .name = name,
+        .payload = payload,
+        .payload_len = payload_len,
+        .packet = packet,
+        .packet_len = packet_len
+    };
+
+    switch(ctx->exec_ordering) {
+    case DSTC_EXECUTOR_ORDER_FUNCTION:
+        worker = &ctx->exec_worker[func_ind % ctx->exec_worker_count];
+        break;
+
+    case DSTC_EXECUTOR_ORDER_NODE:
+        worker = &ctx->exec_worker[node_id % ctx->exec_worker_count];
+        break;
+
+    default:
+        worker = &ctx->exec_worker[ctx->exec_next_worker++ % ctx->exec_worker_count];
+        break;
+    }
+
+    if (worker->tail)
+        worker->tail->next = call;
+    else
+        worker->head = call;
+
+    worker->tail = call;
+    ctx->exec_calls++;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&ctx->exec_lock);
+}
+
+// Invoke a dispatch function with ctx->lock released, allowing other
+// threads to use the context while user code executes.
+// The lock is re-acquired to its previous recursion depth before
+// returning. Any state read from ctx before the call must be re-read
+// afterwards.
+//
+// ctx must be non-null and locked
+static void _dstc_dispatch_unlocked(dstc_context_t* ctx,
+                                    dstc_internal_dispatch_t func,
+                                    dstc_callback_t callback_ref,
+                                    rmc_node_id_t node_id,
+                                    uint8_t* name,
+                                    uint8_t* payload,
+                                    uint16_t payload_len)
+{
+    dstc_context_t* prev_ctx = _dstc_thread_context;
+    uint32_t depth = ctx->lock_depth;
+    uint32_t ind = depth;
+
+    while(ind--)
+        _dstc_unlock_context(ctx);
+
+    // Calls made by func go out through ctx.
+    _dstc_thread_context = ctx;
+    (*func)(callback_ref, node_id, name, payload, payload_len);
+    _dstc_thread_context = prev_ctx;
+
+    while(depth--)
+        _dstc_lock_context(ctx);
+}
+
+// Same as _dstc_dispatch_unlocked(), but for the batch function of
+// a DSTC_SERVER_BATCH-registered function.
+//
+// ctx must be non-null and locked
+static void _dstc_dispatch_batch_unlocked(dstc_context_t* ctx,
+                                          dstc_internal_batch_dispatch_t func,
+                                          rmc_node_id_t node_id,
+                                          dstc_batch_call_t* calls,
+                                          uint32_t count)
+{
+    dstc_context_t* prev_ctx = _dstc_thread_context;
+    uint32_t depth = ctx->lock_depth;
+    uint32_t ind = depth;
+
+    while(ind--)
+        _dstc_unlock_context(ctx);
+
+    _dstc_thread_context = ctx;
+    (*func)(node_id, calls, count);
+    _dstc_thread_context = prev_ctx;
+
+    while(depth--)
+        _dstc_lock_context(ctx);
+}
+
+// Resolve the local server function called by a DSTC_RECORD_FUNC_ID
+// record or by a record calling a function by name, and locate the
+// function name and arguments of the call.
+// Returns the server_func index + 1 of the function, or 0 if the
+// call is to be ignored.
+//
+// ctx must be non-null and locked
+static uint32_t _dstc_resolve_call(dstc_context_t* ctx,
+                                   dstc_record_t* call,
+                                   uint8_t** name,
+                                   uint8_t** payload,
+                                   uint16_t* payload_len)
+{
+    uint32_t name_len = 0;
+    uint32_t name_hash = 0;
+    uint32_t func_ind = 0;
+
+    if (call->type == DSTC_RECORD_FUNC_ID) {
+        dstc_publisher_t* publ = _dstc_find_publisher(ctx, call->node_id, 0);
+
+        // Unbound IDs can only occur if we missed the bind record
+        // by subscribing to the publisher after it was sent.
+        // The publisher will re-send its bindings once it has
+        // processed our function registrations.
+        if (!publ || call->func_id >= publ->func_size || !publ->func[call->func_id]) {
+            RMC_LOG_DEBUG("Function id [%d] from node [0x%X] not bound. Ignored",
+                          call->func_id, call->node_id);
+            return 0;
+        }
+
+        func_ind = publ->func[call->func_id];
+
+        // func_name is never freed, and can be passed on to the
+        // executor.
+        *name = (uint8_t*) ctx->server_func[func_ind - 1].func_name;
+        *payload = call->payload;
+        *payload_len = call->payload_len;
+
+        RMC_LOG_DEBUG("Making local function call node_id[%u] func_id[%d] func_name[%s] payload_len[%u]",
+                      call->node_id, call->func_id, *name, *payload_len);
+        return func_ind;
+    }
+
+    // Function called by name.
+    name_hash = _dstc_hash_name((char*) call->payload,
+                                call->payload_len,
+                                &name_len);
+
+    // Name must be null terminated inside the payload.
+    if (name_len == call->payload_len) {
+        RMC_LOG_WARNING("Function name not terminated in payload. Ignored");
+        return 0;
+    }
+
+    func_ind = _dstc_find_server_function(ctx, (char*) call->payload, name_hash);
+
+    if (!func_ind) {
+        RMC_LOG_DEBUG("Function [%s] not loaded. Ignored", call->payload);
+        return 0;
+    }
+
+    *name = call->payload;
+    *payload = call->payload + name_len + 1;
+    *payload_len = call->payload_len - name_len - 1;
+
+    RMC_LOG_DEBUG("Making local function call node_id[%u] func_name[%s] payload_len[%u]",
+                  call->node_id, *name, *payload_len);
+    return func_ind;
+}
+
+// Invoke a server function, together with the calls to regular
+// server functions that directly follow it in the inbound packet,
+// with ctx->lock released once for all of them instead of once per
+// call.
+// The run ends at the first record that is not such a call, or that
+// calls a DSTC_SERVER_BATCH function. Calls that are to be ignored
+// are skipped.
+// next and next_count are the index entries of the records following
+// the call, as located by _dstc_index_calls().
+// Returns the number of entries of next consumed by the run.
+//
+// ctx must be non-null and locked
+static uint32_t _dstc_dispatch_run(dstc_context_t* ctx,
+                                   dstc_internal_dispatch_t server_func,
+                                   rmc_node_id_t node_id,
+                                   uint8_t* name,
+                                   uint8_t* payload,
+                                   uint16_t payload_len,
+                                   dstc_record_t* next,
+                                   uint32_t next_count)
+{
+    dstc_run_call_t run[DSTC_DISPATCH_RUN_SIZE];
+    dstc_context_t* prev_ctx = _dstc_thread_context;
+    uint32_t depth = ctx->lock_depth;
+    uint32_t count = 1;
+    uint32_t ind = 0;
+    uint32_t lock_ind = depth;
+
+    run[0] = (dstc_run_call_t) {
+        .server_func = server_func,
+        .node_id = node_id,
+        .name = name,
+        .payload = payload,
+        .payload_len = payload_len
+    };
+
+    while(count < DSTC_DISPATCH_RUN_SIZE && ind < next_count) {
+        dstc_record_t* call = &next[ind];
+        dstc_run_call_t* run_call = &run[count];
+        uint32_t func_ind = 0;
+
+        if (!DSTC_RECORD_IS_CALL(call->type))
+            break;
+
+        func_ind = _dstc_resolve_call(ctx, call,
+                                      &run_call->name,
+                                      &run_call->payload,
+                                      &run_call->payload_len);
+
+        if (func_ind && ctx->server_func[func_ind - 1].batch_func)
+            break;
+
+        if (func_ind) {
+            run_call->server_func = ctx->server_func[func_ind - 1].server_func;
+            run_call->node_id = call->node_id;
+            count++;
+        }
+        ind++;
+    }
+
+    // Same as _dstc_dispatch_unlocked(), for all calls in the run.
+    while(lock_ind--)
+        _dstc_unlock_context(ctx);
+
+    _dstc_thread_context = ctx;
+    for(lock_ind = 0; lock_ind < count; ++lock_ind)
+        (*run[lock_ind].server_func)(0,
+                                     run[lock_ind].node_id,
+                                     run[lock_ind].name,
+                                     run[lock_ind].payload,
+                                     run[lock_ind].payload_len);
+    _dstc_thread_context = prev_ctx;
+
+    while(depth--)
+        _dstc_lock_context(ctx);
+
+    return ind;
+}
+
+// Dispatch a call to the DSTC_SERVER_BATCH-registered function
+// func_ind, together with the calls to the same function that
+// directly follow it in the inbound packet, through a single
+// invocation of its batch function.
+// next and next_count are the index entries of the records following
+// the call, as located by _dstc_index_calls().
+// Returns the number of entries of next added to the batch.
+//
+// ctx must be non-null and locked
+static uint32_t _dstc_dispatch_batch(dstc_context_t* ctx,
+                                     uint32_t func_ind,
+                                     rmc_node_id_t node_id,
+                                     uint8_t* payload,
+                                     uint16_t payload_len,
+                                     dstc_record_t* next,
+                                     uint32_t next_count)
+{
+    dstc_batch_call_t calls[DSTC_BATCH_MAX_CALLS];
+    dstc_internal_batch_dispatch_t batch_func = ctx->server_func[func_ind].batch_func;
+    dstc_publisher_t* publ = _dstc_find_publisher(ctx, node_id, 0);
+    uint32_t count = 1;
+    uint32_t ind = 0;
+
+    calls[0] = (dstc_batch_call_t) {
+        .payload = payload,
+        .payload_len = payload_len
+    };
+
+    while(count < DSTC_BATCH_MAX_CALLS && ind < next_count) {
+        dstc_record_t* call = &next[ind];
+        uint32_t next_func_ind = 0;
+        uint8_t* name = 0;
+
+        if (call->node_id != node_id || !DSTC_RECORD_IS_CALL(call->type))
+            break;
+
+        // Fast path for calls by ID to the same function, which is
+        // what a batch mostly consists of.
+        if (call->type == DSTC_RECORD_FUNC_ID && publ &&
+            call->func_id < publ->func_size &&
+            publ->func[call->func_id] == func_ind + 1) {
+            calls[count].payload = call->payload;
+            calls[count].payload_len = call->payload_len;
+            count++;
+            ind++;
+            continue;
+        }
+
+        next_func_ind = _dstc_resolve_call(ctx, call, &name,
+                                           &calls[count].payload,
+                                           &calls[count].payload_len);
+
+        if (next_func_ind && next_func_ind != func_ind + 1)
+            break;
+
+        // Calls that are to be ignored are skipped.
+        if (next_func_ind)
+            count++;
+        ind++;
+    }
+
+    ctx->sub_batches++;
+    ctx->sub_batched_calls += count;
+    _dstc_dispatch_batch_unlocked(ctx, batch_func, node_id, calls, count);
+    return ind;
+}
+
+// Execute a server function, either directly or through the
+// executor if it is running.
+// next and next_count are the index entries of the records following
+// the call, from which calls are added to the batch of a
+// DSTC_SERVER_BATCH-registered function.
+// Returns the number of entries of next dispatched together with the
+// call.
+//
+// ctx must be non-null and locked
+static uint32_t _dstc_dispatch_server_function(dstc_context_t* ctx,
+                                               uint32_t func_ind,
+                                               rmc_node_id_t node_id,
+                                               uint8_t* name,
+                                               uint8_t* payload,
+                                               uint16_t payload_len,
+                                               dstc_record_t* next,
+                                               uint32_t next_count,
+                                               uint8_t* packet,
+                                               payload_len_t packet_len)
+{
+    dstc_internal_dispatch_t server_func = ctx->server_func[func_ind].server_func;
+
+    // The executor runs calls one by one.
+    if (ctx->exec_worker_count && DSTC_PACKET_BUFFER(packet)->exec_reserved) {
+        _dstc_executor_queue(ctx, server_func, func_ind, node_id,
+                             name, payload, payload_len,
+                             packet, packet_len);
+        return 0;
+    }
+
+    if (ctx->server_func[func_ind].batch_func)
+        return _dstc_dispatch_batch(ctx, func_ind, node_id,
+                                    payload, payload_len,
+                                    next, next_count);
+
+    return _dstc_dispatch_run(ctx, server_func, node_id,
+                              name, payload, payload_len,
+                              next, next_count);
+}
+
+// Locate the calls of a DSTC_RECORD_COMPACT block, and store up to
+// max of them in index.
+// A malformed call ends the block, and the rest of it is dropped.
+// Returns the number of entries stored in index.
+static uint32_t _dstc_index_compact_block(dstc_header_t* block,
+                                          dstc_record_t* index,
+                                          uint32_t max)
+{
+    uint8_t* data = block->payload + DSTC_COMPACT_HEADER_LEN;
+    rmc_node_id_t node_id = block->node_id;
+    uint32_t data_len = 0;
+    uint32_t ind = 0;
+    uint32_t cnt = 0;
+
+    if (block->payload_len < DSTC_COMPACT_HEADER_LEN) {
+        RMC_LOG_WARNING("Compact block too short. Ignored");
+        return 0;
+    }
+
+    // Versions we do not announce support for are never sent to us.
+    if (block->payload[1] != DSTC_COMPACT_VERSION) {
+        RMC_LOG_WARNING("Compact block version [%d] not supported. Ignored",
+                        block->payload[1]);
+        return 0;
+    }
+
+    data_len = block->payload_len - DSTC_COMPACT_HEADER_LEN;
+    while(cnt < max && ind < data_len) {
+        dstc_record_t* call = &index[cnt];
+        uint32_t rec_len = data[ind];
+        uint32_t func_id = 0;
+        uint32_t len_len = 1;
+        uint32_t id_len = 1;
+
+        // Small calls to the first 128 functions have single byte
+        // varints.
+        if (rec_len < 0x80 && rec_len && rec_len < data_len - ind &&
+            data[ind + 1] < 0x80)
+            func_id = data[ind + 1];
+        else if (!(len_len = _dstc_varint_get(data + ind, data_len - ind, &rec_len)) ||
+                 rec_len > data_len - ind - len_len ||
+                 !(id_len = _dstc_varint_get(data + ind + len_len, rec_len, &func_id)) ||
+                 func_id > UINT16_MAX) {
+            RMC_LOG_WARNING("Malformed call in compact block. Rest of block ignored");
+            break;
+        }
+
+        call->node_id = node_id;
+        call->type = DSTC_RECORD_FUNC_ID;
+        call->func_id = (uint16_t) func_id;
+        call->payload = data + ind + len_len + id_len;
+        call->payload_len = rec_len - id_len;
+
+        ind += len_len + rec_len;
+        cnt++;
+    }
+
+    if (cnt == max && ind < data_len)
+        RMC_LOG_WARNING("Compact block holds more than %u calls. Rest of block ignored", max);
+
+    return cnt;
+}
+
+// Locate the records in data, up to max of them, in a single sweep
+// that validates their lengths, and store the non-empty ones in index.
+// Calls are then dispatched from the index without re-checking the
+// record boundaries.
+// The calls of a compact block are stored as separate entries, and
+// are always indexed together.
+// Targeted calls are stored as the call they carry if addressed to
+// own_node_id, and skipped otherwise.
+// A truncated record ends the sweep, and the rest of data is dropped.
+// Returns the number of bytes of data swept, and the number of
+// entries stored in *count.
+static uint32_t _dstc_index_calls(uint8_t* data,
+                                  uint32_t data_len,
+                                  rmc_node_id_t own_node_id,
+                                  dstc_record_t* index,
+                                  uint32_t max,
+                                  uint32_t* count)
+{
+    uint32_t ind = 0;
+    uint32_t cnt = 0;
+
+    while(cnt < max && data_len - ind >= sizeof(dstc_header_t)) {
+        dstc_header_t* call = (dstc_header_t*) (data + ind);
+        dstc_record_t* rec = &index[cnt];
+        uint8_t* payload = call->payload;
+        uint16_t payload_len = call->payload_len;
+
+        if (data_len - ind - sizeof(dstc_header_t) < call->payload_len) {
+            RMC_LOG_WARNING("Packet payload too short! Wanted %d bytes, got %d",
+                            call->payload_len, data_len - ind - sizeof(dstc_header_t));
+            ind = data_len;
+            break;
+        }
+
+        ind += sizeof(dstc_header_t) + call->payload_len;
+
+        // Empty records carry no type.
+        if (!call->payload_len)
+            continue;
+
+        if (call->payload[0] == DSTC_RECORD_COMPACT) {
+            uint16_t block_count = 0;
+
+            // Leave a block that does not fit in the rest of the
+            // index to the next sweep.
+            if (call->payload_len >= DSTC_COMPACT_HEADER_LEN)
+                memcpy(&block_count, call->payload + 2, sizeof(uint16_t));
+
+            if (cnt && cnt + block_count > max) {
+                ind -= sizeof(dstc_header_t) + call->payload_len;
+                break;
+            }
+
+            cnt += _dstc_index_compact_block(call, rec, max - cnt);
+            continue;
+        }
+
+        // The filter has been checked by dstc_process_incoming().
+        if (payload[0] == DSTC_RECORD_FILTER || payload[0] == DSTC_RECORD_PAD)
+            continue;
+
+        // Drop calls addressed to other nodes without looking any
+        // further into them.
+        if (payload[0] == DSTC_RECORD_TARGET) {
+            rmc_node_id_t target = 0;
+
+            if (payload_len <= DSTC_TARGET_HEADER_LEN) {
+                RMC_LOG_WARNING("Targeted call record too short. Ignored");
+                continue;
+            }
+
+            memcpy(&target, payload + 1, sizeof(rmc_node_id_t));
+            if (target != own_node_id)
+                continue;
+
+            payload += DSTC_TARGET_HEADER_LEN;
+            payload_len -= DSTC_TARGET_HEADER_LEN;
+            if (!DSTC_RECORD_IS_CALL(payload[0])) {
+                RMC_LOG_WARNING("Targeted record type [%d] is not a call. Ignored",
+                                payload[0]);
+                continue;
+            }
+        }
+
+        rec->node_id = call->node_id;
+        rec->type = payload[0];
+        rec->func_id = 0;
+        rec->payload = payload;
+        rec->payload_len = payload_len;
+
+        // Calls by ID are dispatched from their arguments.
+        if (rec->type == DSTC_RECORD_FUNC_ID) {
+            if (payload_len < 1 + sizeof(uint16_t)) {
+                RMC_LOG_WARNING("Function ID record too short. Ignored");
+                continue;
+            }
+
+            memcpy(&rec->func_id, payload + 1, sizeof(uint16_t));
+            rec->payload += 1 + sizeof(uint16_t);
+            rec->payload_len -= 1 + sizeof(uint16_t);
+        }
+        cnt++;
+    }
+
+    if (ind < data_len && data_len - ind < sizeof(dstc_header_t)) {
+        RMC_LOG_WARNING("Packet header too short! Wanted %ld bytes, got %d",
+                        sizeof(dstc_header_t), data_len - ind);
+        ind = data_len;
+    }
+
+    *count = cnt;
+    return ind;
+}
+
+// Invoke a callback received by a group context in the root context
+// that activated it. The group context is released while the root
+// context is held.
+//
+// ctx must be non-null and locked
+static void _dstc_dispatch_root_callback(dstc_context_t* ctx,
+                                         dstc_record_t* call,
+                                         dstc_callback_t callback_ref)
+{
+    dstc_context_t* root = ctx->group_root;
+    dstc_internal_dispatch_t local_func_ptr = 0;
+    uint32_t depth = _dstc_release_context(ctx);
+
+    _dstc_lock_context(root);
+    local_func_ptr = _dstc_find_callback_by_ref(root, callback_ref);
+
+    if (local_func_ptr) {
+        _dstc_dispatch_unlocked(root,
+                                local_func_ptr,
+                                callback_ref,
+                                call->node_id,
+                                call->payload,
+                                call->payload + 1 + sizeof(uint64_t),
+                                call->payload_len - 1 - sizeof(uint64_t));
+
+        _dstc_release_callback_by_ref(root, callback_ref);
+    } else
+        RMC_LOG_COMMENT("Callback [%llX] not loaded. Ignored", (long long unsigned) callback_ref);
+
+    _dstc_unlock_context(root);
+    _dstc_reacquire_context(ctx, depth);
+}
+
+// Process a single call in an inbound packet, or a batch of calls to
+// a DSTC_SERVER_BATCH-registered function.
+// index and count are the records located by _dstc_index_calls(),
+// starting with the call to process.
+// packet and packet_len are the entire packet that the records are
+// part of, referenced by calls handed over to the executor.
+// Returns the number of index entries processed.
+//
+// ctx must be non-null and locked
+static uint32_t dstc_process_function_call(dstc_context_t* ctx,
+                                           dstc_record_t* index,
+                                           uint32_t count,
+                                           uint8_t* packet,
+                                           payload_len_t packet_len)
+{
+    dstc_record_t* call = &index[0];
+    dstc_internal_dispatch_t local_func_ptr = 0;
+    dstc_callback_t callback_ref = 0;
+    uint16_t func_id = 0;
+    uint32_t extra_count = 0;
+
+    // Retrieve function pointer from name or function ID, as previously
+    // registered with dstc_register_server_function()
+    RMC_LOG_DEBUG("DSTC Serve: node_id[%lu] payload_len[%d]",
+                  call->node_id,
+                  call->payload_len);
+
+    switch(call->type) {
+    case DSTC_RECORD_CALLBACK:
+        // The eight bytes after the initial \0 is the callback
+        // reference value
+        if (call->payload_len < 1 + sizeof(dstc_callback_t)) {
+            RMC_LOG_WARNING("Callback record too short. Ignored");
+            break;
+        }
+
+        callback_ref = *((dstc_callback_t*)(call->payload + 1));
+
+        // Callbacks are activated in the root context of group
+        // contexts.
+        if (ctx->group_root) {
+            _dstc_dispatch_root_callback(ctx, call, callback_ref);
+            break;
+        }
+
+        local_func_ptr = _dstc_find_callback_by_ref(ctx, callback_ref);
+
+        // Callback has already been invoked, cancelled, or the
+        // reply is stale.
+        if (!local_func_ptr) {
+            RMC_LOG_COMMENT("Callback [%llX] not loaded. Ignored", (long long unsigned) callback_ref);
+            break;
+        }
+        _dstc_dispatch_unlocked(ctx,
+                                local_func_ptr,
+                                callback_ref,
+                                call->node_id,
+                                call->payload, // Funcation name. Always ""
+                                call->payload + 1 + sizeof(uint64_t),// Payload after nil name and uint64_t
+                                call->payload_len - 1 - sizeof(uint64_t));  // Payload len
+
+        _dstc_release_callback_by_ref(ctx, callback_ref);
+        break;
+
+    case DSTC_RECORD_BIND: {
+        uint32_t name_len = 0;
+        uint32_t name_hash = 0;
+
+        if (call->payload_len < 1 + sizeof(uint16_t) + 1) {
+            RMC_LOG_WARNING("Bind record too short. Ignored");
+            break;
+        }
+
+        memcpy(&func_id, call->payload + 1, sizeof(uint16_t));
+        name_hash = _dstc_hash_name((char*) call->payload + 1 + sizeof(uint16_t),
+                                    call->payload_len - 1 - sizeof(uint16_t),
+                                    &name_len);
+
+        if (name_len == call->payload_len - 1 - sizeof(uint16_t)) {
+            RMC_LOG_WARNING("Bind record function name not terminated in payload. Ignored");
+            break;
+        }
+
+        _dstc_bind_function_id(ctx, call->node_id, func_id,
+                               (char*) call->payload + 1 + sizeof(uint16_t),
+                               name_hash);
+        break;
+    }
+
+    default: {
+        // Function called by ID or by name.
+        uint8_t* name = 0;
+        uint8_t* payload = 0;
+        uint16_t payload_len = 0;
+        uint32_t func_ind = _dstc_resolve_call(ctx, call, &name, &payload, &payload_len);
+
+        if (!func_ind)
+            break;
+
+        extra_count = _dstc_dispatch_server_function(ctx,
+                                                     func_ind - 1,
+                                                     call->node_id,
+                                                     name,
+                                                     payload,
+                                                     payload_len,
+                                                     index + 1, // Next records
+                                                     count - 1,
+                                                     packet,
+                                                     packet_len);
+        break;
+    }
+    }
+
+    return 1 + extra_count;
+}
+
+static void dstc_subscription_complete(rmc_sub_context_t* sub_ctx,
+                                       uint32_t listen_ip,
+                                       in_port_t listen_port,
+                                       rmc_node_id_t node_id)
+{
+    dstc_context_t* ctx = (dstc_context_t*) rmc_sub_user_data(sub_ctx).ptr;
+    int ind = 0;
+    uint8_t announced = 0;
+
+    _dstc_lock_context(ctx);
+    ind = ctx->server_func_ind;
+
+
+    RMC_LOG_COMMENT("Subscription complete. Sending supported functions.");
+
+    // Retrieve function pointer from name, as previously
+    // registered with dstc_registerctx->local_function()
+    // Include null terminator for an easier life, followed
+    // by our capability flags.
+    while(ind--) {
+        // Functions of other multicast groups are registered by
+        // their group context.
+        if (ctx->server_func[ind].group != ctx->group)
+            continue;
+
+        size_t name_len = strlen(ctx->server_func[ind].func_name);
+        RMC_LOG_COMMENT("  [%s]", ctx->server_func[ind].func_name);
+        dstc_control_message_t ctl = {
+            .node_id = rmc_pub_node_id(ctx->pub_ctx)
+        };
+
+        if (name_len > sizeof(ctl.name) - 2) {
+            RMC_LOG_WARNING("Function name [%s] too long to register. Skipped",
+                            ctx->server_func[ind].func_name);
+            continue;
+        }
+
+        memcpy(ctl.name, ctx->server_func[ind].func_name, name_len + 1);
+        ctl.name[name_len + 1] = DSTC_LOCAL_CAPABILITIES;
+
+        rmc_sub_write_control_message_by_node_id(sub_ctx,
+                                                 node_id,
+                                                 &ctl,
+                                                 sizeof(rmc_node_id_t) +
+                                                 sizeof(uint8_t) +
+                                                 name_len + 1);
+        announced = 1;
+    }
+
+    // Without any functions to register, announce ourselves with an
+    // empty name, so that the publisher can release our function ID
+    // bindings once we disconnect.
+    if (!announced) {
+        dstc_control_message_t ctl = {
+            .node_id = rmc_pub_node_id(ctx->pub_ctx)
+        };
+
+        rmc_sub_write_control_message_by_node_id(sub_ctx,
+                                                 node_id,
+                                                 &ctl,
+                                                 DSTC_REPLY_HEADER_LEN);
+    }
+
+    _dstc_unlock_context(ctx);
+    RMC_LOG_COMMENT("Done sending functions");
+    return;
+}
+
+// Return 1 if the filter record at the start of a packet shows that
+// it holds no calls to our server functions, and no callbacks if we
+// use any. Packets without a filter record are never skipped.
+//
+// ctx must be non-null and locked
+static int _dstc_packet_skippable(dstc_context_t* ctx,
+                                  uint8_t* payload,
+                                  payload_len_t payload_len)
+{
+    dstc_header_t* rec = (dstc_header_t*) payload;
+    uint64_t local = ctx->sub_filter;
+    uint64_t filter = 0;
+
+    if (payload_len < DSTC_FILTER_RECORD_LEN ||
+        rec->payload_len != DSTC_FILTER_RECORD_LEN - sizeof(dstc_header_t) ||
+        rec->payload[0] != DSTC_RECORD_FILTER)
+        return 0;
+
+    if (ctx->callback_slot_ind || ctx->callback_ind)
+        local |= DSTC_FILTER_CALLBACK;
+
+    memcpy(&filter, rec->payload + 2, sizeof(uint64_t));
+    return !(filter & local);
+}
+
+static void dstc_process_incoming(rmc_sub_context_t* sub_ctx)
+{
+    rmc_sub_packet_t* pack = 0;
+    dstc_context_t* ctx = (dstc_context_t*) rmc_sub_user_data(sub_ctx).ptr;
+
+    RMC_LOG_DEBUG("Processing incoming");
+
+    _dstc_lock_context(ctx);
+
+    // The lock is released while calls are dispatched. If another
+    // thread is dispatching, leave the packets to it in order to
+    // keep them in sequence. It will pick them up once its current
+    // call returns.
+    // Calls to dstc_process_events() made from a dispatched function
+    // are processed recursively by the same thread, as before.
+    if (ctx->dispatch_depth && !pthread_equal(ctx->dispatch_thread, pthread_self())) {
+        RMC_LOG_DEBUG("Dispatch in progress by other thread");
+        _dstc_unlock_context(ctx);
+        return;
+    }
+
+    ctx->dispatch_thread = pthread_self();
+    ctx->dispatch_depth++;
+
+    while((pack = rmc_sub_get_next_dispatch_ready(sub_ctx))) {
+        uint32_t ind = 0;
+        uint8_t* payload = (uint8_t*) rmc_sub_packet_payload(pack);
+        payload_len_t payload_len = rmc_sub_packet_payload_len(pack);
+
+        RMC_LOG_DEBUG("Got packet. payload_len[%d]", payload_len);
+
+        DSTC_PACKET_BUFFER(payload)->ref_count = 1;
+        DSTC_PACKET_BUFFER(payload)->exec_reserved = 0;
+
+        if (_dstc_packet_skippable(ctx, payload, payload_len)) {
+            RMC_LOG_DEBUG("No calls for us in packet. Skipped");
+            rmc_sub_packet_dispatched_keep_payload(sub_ctx, pack);
+            _dstc_release_packet(ctx, payload, payload_len);
+            ctx->sub_packets_skipped++;
+            continue;
+        }
+
+        // Leave the packet with RMC until the executor has room for
+        // its calls. Worker threads cannot wait for themselves, and
+        // leave remaining packets to be picked up by the worker that
+        // executes the next call.
+        if (ctx->exec_worker_count && !_dstc_executor_reserve(ctx, payload)) {
+            if (_dstc_executor_is_worker(ctx)) {
+                ctx->exec_pending = 1;
+                break;
+            }
+            _dstc_executor_wait(ctx);
+            continue;
+        }
+
+        // We need to mark the packet as dispatched before we make the function calls,
+        // Since any calls to dstc_process_events() from inside the invoked funciton
+        // would lead to recursion.
+        //
+        rmc_sub_packet_dispatched_keep_payload(sub_ctx, pack);
+
+        // Index a chunk of records at a time, and dispatch from the
+        // index.
+        while(ind < payload_len) {
+            dstc_record_t index[DSTC_CALL_INDEX_SIZE];
+            uint32_t count = 0;
+            uint32_t next = 0;
+
+            ind += _dstc_index_calls(payload + ind, payload_len - ind,
+                                     rmc_pub_node_id(ctx->pub_ctx),
+                                     index, DSTC_CALL_INDEX_SIZE, &count);
+
+            while(next < count) {
+                RMC_LOG_DEBUG("Processing function call. ind[%d]", next);
+                next += dstc_process_function_call(ctx,
+                                                   index + next,
+                                                   count - next,
+                                                   payload,
+                                                   payload_len);
+            }
+        }
+        _dstc_release_packet(ctx, payload, payload_len);
+    }
+    ctx->dispatch_depth--;
+
+    // Send the callback replies made by the dispatched calls.
+    if (!ctx->dispatch_depth && ctx->reply_ind &&
+        !ctx->pub_is_buffering && !ctx->pub_bulk_depth)
+        _queue_pending_calls(ctx);
+
+    _dstc_unlock_context(ctx);
+    return;
+}
+
+// Retrieve the next call for an executor worker to execute.
+// Calls are taken from the worker's own queue. If that is empty and
+// calls are unordered, a call is stolen from another worker.
+// Returns 0 if there are no calls to execute.
+//
+// ctx->exec_lock must be held
+static dstc_exec_call_t* _dstc_executor_next_call(dstc_context_t* ctx,
+                                                  dstc_exec_worker_t* worker)
+{
+    dstc_exec_worker_t* victim = worker;
+    dstc_exec_call_t* call = 0;
+    uint32_t ind = 0;
+
+    if (!worker->head && ctx->exec_ordering == DSTC_EXECUTOR_UNORDERED) {
+        // Search the other workers, which are all still in
+        // ctx->exec_worker while this worker is running.
+        uint32_t worker_ind = worker - ctx->exec_worker;
+        uint32_t worker_count = ctx->exec_stopping?0:ctx->exec_worker_count;
+
+        for(ind = 1; ind < worker_count; ++ind) {
+            victim = &ctx->exec_worker[(worker_ind + ind) % worker_count];
+            if (victim->head) {
+                ctx->exec_stolen++;
+                break;
+            }
+        }
+    }
+
+    call = victim->head;
+    if (!call)
+        return 0;
+
+    victim->head = call->next;
+    if (!victim->head)
+        victim->tail = 0;
+
+    return call;
+}
+
+static void* _dstc_executor_worker(void* arg)
+{
+    dstc_exec_worker_t* worker = (dstc_exec_worker_t*) arg;
+    dstc_context_t* ctx = worker->ctx;
+    dstc_exec_call_t* call = 0;
+
+    // Calls made by server functions go out through ctx.
+    _dstc_thread_context = ctx;
+
+    pthread_mutex_lock(&ctx->exec_lock);
+    while(1) {
+        call = _dstc_executor_next_call(ctx, worker);
+
+        if (!call) {
+            // Queued calls are executed before the worker stops.
+            if (ctx->exec_stopping)
+                break;
+
+            pthread_cond_wait(&worker->cond, &ctx->exec_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ctx->exec_lock);
+
+        (*call->server_func)(0, // Callback ref is 0
+                             call->node_id,
+                             call->name,
+                             call->payload,
+                             call->payload_len);
+
+        _dstc_lock_context(ctx);
+        _dstc_release_packet(ctx, call->packet, call->packet_len);
+
+        // Pick up any packets left with RMC by a worker that
+        // found the executor full.
+        if (ctx->exec_pending) {
+            ctx->exec_pending = 0;
+            dstc_process_incoming(ctx->sub_ctx);
+        }
+        _dstc_unlock_context(ctx);
+
+        pthread_mutex_lock(&ctx->exec_lock);
+        call->next = ctx->exec_call_free;
+        ctx->exec_call_free = call;
+    }
+    pthread_mutex_unlock(&ctx->exec_lock);
+    return 0;
+}
+
+
+// Dispatch the callback records of a control message sent by
+// _dstc_flush_replies().
+//
+// ctx must be non-null and unlocked
+static void _dstc_process_replies(dstc_context_t* ctx,
+                                  uint8_t* payload,
+                                  payload_len_t payload_len)
+{
+    uint32_t ind = DSTC_REPLY_HEADER_LEN;
+    uint8_t* copy = 0;
+
+    _dstc_lock_context(ctx);
+
+    // The arguments of DSTC_SERVER_CALLBACK_ALIGNED() replies are
+    // aligned to their offset in the message. Move it to a receive
+    // buffer if RMC did not hand it over at that alignment.
+    if ((uintptr_t) payload & (DSTC_RECORD_ALIGNMENT - 1)) {
+        copy = _dstc_rx_buffer_get(ctx, payload_len);
+        memcpy(copy, payload, payload_len);
+        payload = copy;
+    }
+
+    while(ind < payload_len) {
+        dstc_record_t index[DSTC_REPLY_INDEX_SIZE];
+        uint32_t count = 0;
+        uint32_t next = 0;
+
+        ind += _dstc_index_calls(payload + ind, payload_len - ind,
+                                 rmc_pub_node_id(ctx->pub_ctx),
+                                 index, DSTC_REPLY_INDEX_SIZE, &count);
+
+        for(next = 0; next < count; ++next) {
+            if (index[next].type != DSTC_RECORD_CALLBACK) {
+                RMC_LOG_WARNING("Callback control message with other records. Ignored");
+                continue;
+            }
+            dstc_process_function_call(ctx, index + next, 1, payload, payload_len);
+        }
+    }
+
+    if (copy)
+        _dstc_rx_buffer_put(ctx, copy, payload_len);
+
+    _dstc_unlock_context(ctx);
+}
+
+static void dstc_subscriber_control_message_cb(rmc_pub_context_t* pub_ctx,
+                                               uint32_t publisher_address,
+                                               uint16_t publisher_port,
+                                               rmc_node_id_t node_id,
+                                               void* payload,
+                                               payload_len_t payload_len)
+{
+    dstc_context_t* ctx = (dstc_context_t*) rmc_pub_user_data(pub_ctx).ptr;
+
+    RMC_LOG_DEBUG("Processing incoming");
+
+    dstc_control_message_t *ctl = (dstc_control_message_t*) payload;
+    dstc_publisher_t* publ = 0;
+    uint32_t name_len = 0;
+    uint8_t caps = 0;
+
+    if (payload_len <= sizeof(rmc_node_id_t)) {
+        RMC_LOG_WARNING("Control message too short. Ignored");
+        return;
+    }
+
+    name_len = strnlen(ctl->name, payload_len - sizeof(rmc_node_id_t));
+    if (name_len == payload_len - sizeof(rmc_node_id_t)) {
+        RMC_LOG_WARNING("Control message function name not terminated. Ignored");
+        return;
+    }
+
+    // Remember the node's control connection, so that its function
+    // ID bindings can be released once it disconnects.
+    _dstc_lock_context(ctx);
+    publ = _dstc_find_publisher(ctx, ctl->node_id, 1);
+    publ->address = publisher_address;
+    publ->port = publisher_port;
+    _dstc_unlock_context(ctx);
+
+    // Callback replies sent directly to us carry an empty name, as
+    // do announcements from nodes that serve no functions.
+    if (!name_len) {
+        _dstc_process_replies(ctx, (uint8_t*) payload, payload_len);
+        return;
+    }
+
+    // Capability flags follow the name's null terminator.
+    if (payload_len > sizeof(rmc_node_id_t) + name_len + 1)
+        caps = (uint8_t) ctl->name[name_len + 1];
+
+    _dstc_lock_context(ctx);
+    dstc_register_remote_function(ctx, ctl->node_id, ctl->name, caps,
+                                  publisher_address, publisher_port);
+    _dstc_unlock_context(ctx);
+    return;
+}
+
+static void dstc_subscriber_disconnect_cb(rmc_pub_context_t* pub_ctx,
+                                          uint32_t publisher_address,
+                                          uint16_t publisher_port)
+{
+    dstc_context_t* ctx = (dstc_context_t*) rmc_pub_user_data(pub_ctx).ptr;
+    int ind = 0;
+
+    RMC_LOG_DEBUG("Processing incoming");
+
+    _dstc_lock_context(ctx);
+
+    // Unregister the node whose functions were registered over the
+    // disconnected control connection.
+    ind = ctx->remote_node_ind;
+    while(ind--) {
+        if (ctx->remote_node[ind].node_id &&
+            ctx->remote_node[ind].address == publisher_address &&
+            ctx->remote_node[ind].port == publisher_port) {
+            dstc_unregister_remote_node(ctx, ctx->remote_node[ind].node_id);
+            break;
+        }
+    }
+
+    _dstc_release_publishers(ctx, publisher_address, publisher_port);
+    _dstc_unlock_context(ctx);
+    return;
+}
+
+static void free_published_packets(void* pl, payload_len_t len, user_data_t dt)
+{
+    dstc_context_t* ctx = (dstc_context_t*) dt.ptr;
+
+    RMC_LOG_DEBUG("Recycling %p", pl);
+    _dstc_lock_context(ctx);
+    _dstc_packet_buffer_put(ctx, (uint8_t*) pl);
+    _dstc_unlock_context(ctx);
+}
+
+static void* alloc_received_packet(payload_len_t len, user_data_t dt)
+{
+    dstc_context_t* ctx = (dstc_context_t*) dt.ptr;
+    void* res = 0;
+
+    _dstc_lock_context(ctx);
+    res = _dstc_rx_buffer_get(ctx, len);
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+static void free_received_packet(void* pl, payload_len_t len, user_data_t dt)
+{
+    dstc_context_t* ctx = (dstc_context_t*) dt.ptr;
+
+    _dstc_lock_context(ctx);
+    _dstc_rx_buffer_put(ctx, pl, len);
+    _dstc_unlock_context(ctx);
+}
+
+static msec_timestamp_t _dstc_msec_monotonic_timestamp(struct timespec* abs_time_res)
+{
+    clock_gettime(CLOCK_MONOTONIC, abs_time_res);
+    return (msec_timestamp_t) abs_time_res->tv_sec * 1000 + abs_time_res->tv_nsec / 1000000;
+}
+
+static int _dstc_get_timeout_msec_rel(dstc_context_t* ctx,
+                                      msec_timestamp_t current_time)
+{
+    msec_timestamp_t tout = _dstc_get_next_timeout_abs(ctx);
+
+    if (tout == -1)
+        return -1;
+
+    // Convert to relative timestamp.
+    tout -= current_time;
+
+    if (tout < 0)
+        return 0;
+
+    return tout + 1;
+}
+
+// ctx must be set and locked
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+static int _dstc_setup_group_contexts(dstc_context_t* ctx,
+                                      int max_dstc_nodes,
+                                      char* multicast_group_addr,
+                                      int multicast_port,
+                                      char* multicast_iface_addr,
+                                      int mcast_ttl,
+                                      char* control_listen_iface_addr,
+                                      int control_listen_port);
+#endif
+
+// Create the descriptor that _dstc_wake_event_waiters() makes
+// readable and add it to the event set of ctx, which must be set up
+// already.
+//
+// ctx must be non-null and locked
+static int _dstc_setup_wake_fd(dstc_context_t* ctx)
+{
+#if defined(__linux__) || defined(__ANDROID__)
+    ctx->wake_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->wake_fd[0] == -1) {
+        RMC_LOG_ERROR("eventfd(): %s", strerror(errno));
+        return errno;
+    }
+    ctx->wake_fd[1] = ctx->wake_fd[0];
+#else
+    if (pipe(ctx->wake_fd) == -1) {
+        RMC_LOG_ERROR("pipe(): %s", strerror(errno));
+        return errno;
+    }
+    fcntl(ctx->wake_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->wake_fd[1], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->wake_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ctx->wake_fd[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    poll_add_wake(user_data_ptr(ctx), ctx->wake_fd[0]);
+    return 0;
+}
+
+static int dstc_setup_internal(dstc_context_t* ctx,
+                               rmc_node_id_t node_id,
+                               int max_dstc_nodes,
+                               char* multicast_group_addr,
+                               int multicast_port,
+                               char* multicast_iface_addr,
+                               int mcast_ttl,
+                               char* control_listen_iface_addr,
+                               int control_listen_port,
+                               int epoll_fd_arg) // Ignored by non Linux/Android
+{
+    int res = 0;
+
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+    if (!ctx || epoll_fd_arg == -1)
+        return EINVAL;
+
+    ctx->epoll_fd = epoll_fd_arg;
+
+#else
+    // Setup a poll vector to use.
+    int ind = sizeof(ctx->poll_elem_array) / sizeof(ctx->poll_elem_array[0]);
+    if (!ctx)
+        return EINVAL;
+
+    ctx->poll_hash  = (poll_elem_t*) 0;
+
+    while(ind--)
+        ctx->poll_elem_array[ind]  = (poll_elem_t) {
+            .pfd = {
+                .fd = -1, // Indicates that element is not allocated
+                .events = 0x00,
+                .revents = 0x00},
+            .user_data = 0
+        };
+#endif
+
+    res = _dstc_setup_wake_fd(ctx);
+    if (res)
+        return res;
+
+    pthread_key_create(&ctx->thread_buffer_key, _dstc_thread_buffer_exit);
+
+    // Prime the packet buffer pool.
+    while(ctx->pub_pool_allocated < DSTC_PACKET_POOL_PREALLOC) {
+        dstc_packet_buffer_t* buf = _dstc_packet_buffer_new(ctx);
+
+        buf->next_free = ctx->pub_pool_free;
+        ctx->pub_pool_free = buf;
+    }
+
+    ctx->remote_node_ind = 0;
+    ctx->publisher_ind = 0;
+    ctx->publisher_cache = 0;
+    ctx->callback_ind = 0;
+    ctx->pub_buffer_ind = 0;
+    ctx->pub_block_ind = 0;
+    ctx->reply_ind = 0;
+    ctx->reply_count = 0;
+    ctx->pub_ctx = 0;
+    ctx->sub_ctx = 0;
+
+    // Do not touch server_func* and client_func* members.
+    // since they may have been updated by register_[client,server]_function()
+    // constructor functions.
+    // All constructors have executed at this point, so we can
+    // build the lookup index for incoming calls.
+    _dstc_build_server_func_index(ctx);
+
+    rmc_log_set_start_time();
+    rmc_pub_init_context(&ctx->pub_ctx,
+                         node_id, // Node ID
+                         multicast_group_addr, multicast_port,
+                         multicast_iface_addr,  // Use any NIC address for multicast transmit.
+                         control_listen_iface_addr, // Use any NIC address for listen control port.
+                         control_listen_port, // Use ephereal tcp port for tcp control
+                         user_data_ptr(ctx),
+                         // Different versions of
+                         // poll_(add|modify|remote) used depending on
+                         // Linux/Android/other See poll.c and epoll.c
+                         poll_add_pub, poll_modify_pub, poll_remove,
+                         DSTC_MAX_CONNECTIONS,
+                         free_published_packets);
+
+    // Setup a callback for subscriber disconnect, meaning that remote nodes
+    // with functions that we can call can no longer be used.
+    rmc_pub_set_subscriber_disconnect_callback(ctx->pub_ctx,
+                                               dstc_subscriber_disconnect_cb);
+
+    // Setup a subscriber callback, allowing us to know when a subscribe that can
+    // execute the function has attached.
+    rmc_pub_set_control_message_callback(ctx->pub_ctx, dstc_subscriber_control_message_cb);
+
+    rmc_pub_throttling(ctx->pub_ctx,
+                       SUSPEND_TRAFFIC_THRESHOLD,
+                       RESTART_TRAFFIC_THRESHOLD);
+
+    // Subscriber init.
+    rmc_sub_init_context(&ctx->sub_ctx,
+                         // Reuse pub node id to detect and avoid loopback messages
+                         rmc_pub_node_id(ctx->pub_ctx),
+                         multicast_group_addr, multicast_port,
+                         multicast_iface_addr,  // Use any NIC address for multicast transmit.
+                         user_data_ptr(ctx),
+                         // Different versions of
+                         // poll_(add|modify|remote) used depending on
+                         // Linux/Android/other See poll.c and epoll.c
+                         poll_add_sub, poll_modify_sub, poll_remove,
+                         DSTC_MAX_CONNECTIONS,
+                         alloc_received_packet,
+                         free_received_packet);
+
+    rmc_sub_set_packet_ready_callback(ctx->sub_ctx, dstc_process_incoming);
+    rmc_sub_set_subscription_complete_callback(ctx->sub_ctx, dstc_subscription_complete);
+
+    rmc_pub_set_multicast_ttl(ctx->pub_ctx, mcast_ttl);
+    rmc_pub_activate_context(ctx->pub_ctx);
+    rmc_sub_activate_context(ctx->sub_ctx);
+
+
+    RMC_LOG_COMMENT("sub[%d] pub[%d] node[%d] pub[%p] sub[%p]",
+                    rmc_sub_get_socket_count(ctx->sub_ctx),
+                    rmc_pub_get_socket_count(ctx->pub_ctx),
+                    max_dstc_nodes,
+                    ctx->sub_ctx,
+                    ctx->pub_ctx);
+
+    RMC_LOG_INFO("Node ID[0x%X]", rmc_sub_node_id(ctx->sub_ctx));
+    // Start ticking announcements as a client that the server will connect back to.
+    // Only do announce if we have client services that requires servers to connect
+    // back to us as a subsriber in order to make their remote functions available.
+    if (ctx->client_func_ind || ctx->client_callback_count) {
+        RMC_LOG_INFO("There are %d DSTC_CLIENT() and %d DSTC_CALLBACK() functions declared. Will send out announce.",
+                     ctx->client_func_ind, ctx->client_callback_count);
+        rmc_pub_set_announce_interval(ctx->pub_ctx, 200000); // Start ticking announces.
+    }
+    else
+        RMC_LOG_INFO("No DSTC_CLIENT() or DSTC_CALLBACK() functions declared. Will not send out announce.");
+
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+    // Setup the contexts carrying the other multicast groups.
+    if (ctx->group_count > 1 && !ctx->group_root)
+        return _dstc_setup_group_contexts(ctx,
+                                          max_dstc_nodes,
+                                          multicast_group_addr,
+                                          multicast_port,
+                                          multicast_iface_addr,
+                                          mcast_ttl,
+                                          control_listen_iface_addr,
+                                          control_listen_port);
+#endif
+
+    return 0;
+}
+
+// Create a context inheriting the client and server functions of
+// src. Client functions keep their index, since it is the function
+// ID used by the code generated by DSTC_CLIENT(). Used by
+// dstc_create_context() to inherit the functions registered by
+// constructor functions, and by _dstc_setup_group_contexts() to
+// inherit those of the root context.
+//
+// src must be non-null and locked
+static dstc_context_t* _dstc_create_context_from(dstc_context_t* src)
+{
+    dstc_context_t* ctx = (dstc_context_t*) calloc(1, sizeof(dstc_context_t));
+    pthread_mutexattr_t attr;
+    uint32_t ind = 0;
+
+    if (!ctx) {
+        RMC_LOG_FATAL("Out of memory trying to create context");
+        exit(255);
+    }
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ctx->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    pthread_mutex_init(&ctx->exec_lock, 0);
+    pthread_cond_init(&ctx->exec_space_cond, 0);
+    ctx->exec_ordering = DSTC_EXECUTOR_ORDER_FUNCTION;
+
+    pthread_cond_init(&ctx->flow_cond, 0);
+    ctx->flow_fd[0] = -1;
+    ctx->flow_fd[1] = -1;
+    ctx->wake_fd[0] = -1;
+    ctx->wake_fd[1] = -1;
+    ctx->pub_queue_budget = DEFAULT_PUB_QUEUE_BUDGET;
+
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+    ctx->epoll_fd = -1;
+#endif
+
+    for(ind = 0; ind < src->client_func_ind; ++ind) {
+        ctx->client_func[ind] = src->client_func[ind];
+        ctx->client_func[ind].id_state = DSTC_FUNC_ID_NONE;
+        ctx->client_func[ind].compact = 0;
+        ctx->client_func[ind].anycast_last = 0;
+    }
+    ctx->client_func_ind = src->client_func_ind;
+    ctx->client_callback_count = src->client_callback_count;
+
+    for(ind = 0; ind < src->server_func_ind; ++ind)
+        dstc_register_server_batch_function(ctx,
+                                            src->server_func[ind].func_name,
+                                            src->server_func[ind].server_func,
+                                            src->server_func[ind].batch_func);
+    return ctx;
+}
+
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+// Create and setup a context for each multicast group, beyond group
+// 0, carrying any of the functions served or called by ctx. Group N
+// uses the multicast address and port of ctx plus N, and the node ID
+// of ctx. The epoll descriptor of each group context is added to
+// that of ctx, so that its events are processed through ctx.
+//
+// ctx must be non-null and locked
+static int _dstc_setup_group_contexts(dstc_context_t* ctx,
+                                      int max_dstc_nodes,
+                                      char* multicast_group_addr,
+                                      int multicast_port,
+                                      char* multicast_iface_addr,
+                                      int mcast_ttl,
+                                      char* control_listen_iface_addr,
+                                      int control_listen_port)
+{
+    uint8_t used[DSTC_MAX_GROUPS] = { 0 };
+    struct in_addr group_addr;
+    uint32_t ind = 0;
+    int res = 0;
+
+    if (!inet_aton(multicast_group_addr, &group_addr)) {
+        RMC_LOG_ERROR("Multicast group address [%s] is not an IPv4 address", multicast_group_addr);
+        return EINVAL;
+    }
+
+    // Server function groups were set when the index was built.
+    for(ind = 0; ind < ctx->server_func_ind; ++ind)
+        used[ctx->server_func[ind].group] = 1;
+
+    for(ind = 0; ind < ctx->client_func_ind; ++ind) {
+        ctx->client_func[ind].group = _dstc_function_group(ctx, ctx->client_func[ind].func_name);
+        used[ctx->client_func[ind].group] = 1;
+    }
+
+    for(ind = 1; ind < ctx->group_count; ++ind) {
+        struct in_addr addr = { .s_addr = htonl(ntohl(group_addr.s_addr) + ind) };
+        char addr_str[INET_ADDRSTRLEN];
+        dstc_context_t* group_ctx = 0;
+        struct epoll_event ev = {
+            .data.u32 = DSTC_EVENT_FLAG | USER_DATA_GROUP_FLAG | ind,
+            .events = EPOLLIN
+        };
+
+        if (!used[ind])
+            continue;
+
+        inet_ntop(AF_INET, &addr, addr_str, sizeof(addr_str));
+        RMC_LOG_INFO("Group [%d] carried by [%s:%d]", ind, addr_str, multicast_port + ind);
+
+        group_ctx = _dstc_create_context_from(ctx);
+        group_ctx->group_root = ctx;
+        group_ctx->group = ind;
+        group_ctx->group_count = ctx->group_count;
+        group_ctx->pub_queue_budget = ctx->pub_queue_budget;
+
+        _dstc_lock_context(group_ctx);
+        res = dstc_setup_internal(group_ctx,
+                                  rmc_pub_node_id(ctx->pub_ctx),
+                                  max_dstc_nodes,
+                                  addr_str,
+                                  multicast_port + ind,
+                                  multicast_iface_addr,
+                                  mcast_ttl,
+                                  control_listen_iface_addr,
+                                  control_listen_port?(control_listen_port + ind):0,
+                                  epoll_create(1));
+        if (!res)
+            group_ctx->epoll_fd_owned = 1;
+        _dstc_unlock_context(group_ctx);
+
+        if (res) {
+            dstc_destroy_context(group_ctx);
+            return res;
+        }
+
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, group_ctx->epoll_fd, &ev) == -1) {
+            RMC_LOG_FATAL("epoll_ctl(add group %d): %s", ind, strerror(errno));
+            exit(255);
+        }
+
+        // Calls received by the group are executed the same way as
+        // those received by ctx.
+        if (ctx->exec_worker_count)
+            _dstc_setup_executor(group_ctx,
+                                 ctx->exec_worker_count,
+                                 ctx->exec_ordering,
+                                 ctx->exec_max_packets);
+
+        ctx->group_ctx[ind] = group_ctx;
+    }
+
+    return 0;
+}
+#endif
+
+static int _dstc_reserve(dstc_context_t* ctx,
+                         char* name,
+                         dstc_client_func_t* client_func,
+                         dstc_callback_t callback_ref,
+                         uint64_t key,
+                         uint32_t arg_sz,
+                         uint8_t** arg);
+
+// Return the remote_node index of node_id serving name, or -1 if
+// node_id does not serve it.
+//
+// ctx must be non-null and locked
+static int _dstc_find_remote_node(dstc_context_t* ctx,
+                                  rmc_node_id_t node_id,
+                                  char* name)
+{
+    int ind = ctx->remote_node_ind;
+
+    while(ind--)
+        if (ctx->remote_node[ind].node_id == node_id &&
+            !strcmp(ctx->remote_node[ind].func_name, name))
+            break;
+
+    return ind;
+}
+
+// Mix the bits of a 64 bit value. Used for rendezvous hashing of
+// anycast keys onto nodes.
+static inline uint64_t _dstc_mix64(uint64_t val)
+{
+    val ^= val >> 33;
+    val *= 0xFF51AFD7ED558CCDULL;
+    val ^= val >> 33;
+    val *= 0xC4CEB9FE1A85EC53ULL;
+    val ^= val >> 33;
+    return val;
+}
+
+// Return the key of a call to client_func with first argument
+// key_len bytes at key, or 0 if client_func does not pick its server
+// by key. The FNV-1a hash of the argument is mixed, since short keys
+// such as small integers otherwise differ in their low bits only.
+static uint64_t _dstc_anycast_key(dstc_client_func_t* client_func,
+                                  const void* key,
+                                  uint32_t key_len)
+{
+    const uint8_t* data = (const uint8_t*) key;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    if (!client_func || client_func->anycast != DSTC_ANYCAST_KEY_HASH)
+        return 0;
+
+    while(key_len--) {
+        hash ^= *data++;
+        hash *= 0x100000001B3ULL;
+    }
+
+    return _dstc_mix64(hash);
+}
+
+// Pick the server of the DSTC_CLIENT-registered client_func to send
+// an anycast call to, among the remote nodes serving it that can
+// dispatch targeted calls.
+//
+// DSTC_ANYCAST_ROUND_ROBIN takes the next node after the last one
+// picked. DSTC_ANYCAST_LEAST_OUTSTANDING takes the node with the
+// fewest pending callbacks, going round robin between equals.
+// DSTC_ANYCAST_KEY_HASH hashes key onto the nodes, moving as few keys
+// as possible when nodes come and go.
+//
+// Returns the remote_node index of the node, or -1 if there is none.
+//
+// ctx must be non-null and locked
+static int _dstc_anycast_pick(dstc_context_t* ctx,
+                              dstc_client_func_t* client_func,
+                              uint8_t policy,
+                              uint64_t key)
+{
+    uint32_t ind = client_func->anycast_last;
+    uint32_t cnt = ctx->remote_node_ind;
+    uint64_t best_score = 0;
+    int best = -1;
+
+    while(cnt--) {
+        dstc_remote_node_t* remote = 0;
+        uint64_t score = 0;
+
+        if (++ind >= ctx->remote_node_ind)
+            ind = 0;
+
+        remote = &ctx->remote_node[ind];
+        if (!remote->node_id ||
+            !(remote->caps & DSTC_CAP_TARGET) ||
+            strcmp(remote->func_name, client_func->func_name))
+            continue;
+
+        if (policy == DSTC_ANYCAST_ROUND_ROBIN) {
+            best = ind;
+            break;
+        }
+
+        if (policy == DSTC_ANYCAST_KEY_HASH)
+            score = _dstc_mix64(key ^ _dstc_mix64(remote->node_id));
+        else
+            score = UINT32_MAX - remote->outstanding;
+
+        if (best == -1 || score > best_score) {
+            best = ind;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+// Reserve space for a call to the DSTC_CLIENT-registered client_func,
+// addressed to the node of the remote_node entry remote_ind only.
+// The call is sent by function ID once bound, and by name otherwise,
+// inside a DSTC_RECORD_TARGET record that all other nodes drop
+// unread. The node must announce DSTC_CAP_TARGET.
+// See _dstc_reserve() for the other arguments.
+//
+// The call is multicast in the same stream as all other calls, and
+// is dispatched in the order it was made.
+//
+// Returns EBUSY or EMSGSIZE as _dstc_reserve().
+//
+// ctx must be non-null and locked
+static int _dstc_reserve_targeted(dstc_context_t* ctx,
+                                  int remote_ind,
+                                  dstc_client_func_t* client_func,
+                                  uint32_t arg_sz,
+                                  uint8_t** arg)
+{
+    dstc_remote_node_t* remote = &ctx->remote_node[remote_ind];
+    dstc_header_t *call = 0;
+    char* name = client_func->func_name;
+    size_t name_len = strlen(name);
+    uint16_t func_id = (uint16_t) (client_func - ctx->client_func);
+    uint16_t id_len = 0;
+    uint32_t len = 0;
+
+    // Calls staged by this thread must be sent first.
+    if (_dstc_thread_buffer_merge_own(ctx))
+        return EBUSY;
+
+    // Bind records are left to regular calls.
+    if (client_func->id_state == DSTC_FUNC_ID_BOUND)
+        id_len = 1 + sizeof(uint16_t);
+    else
+        id_len = name_len + 1;
+
+    len = sizeof(dstc_header_t) + DSTC_TARGET_HEADER_LEN + id_len + arg_sz;
+    if (len > RMC_MAX_PAYLOAD) {
+        RMC_LOG_ERROR("Call to [%s] with %u bytes of arguments does not fit in a packet",
+                      name, arg_sz);
+        return EMSGSIZE;
+    }
+
+    // See _dstc_reserve() for how a full payload buffer is handled.
+    call = (dstc_header_t*) _dstc_payload_buffer_alloc(ctx, len);
+    if (!call &&
+        (_dstc_retire_payload_buffer(ctx) ||
+         !(call = (dstc_header_t*) _dstc_payload_buffer_alloc(ctx, len))))
+        return EBUSY;
+
+    ctx->pub_filter |= client_func->filter;
+    call->node_id = rmc_pub_node_id(ctx->pub_ctx);
+    call->payload_len = len - sizeof(dstc_header_t);
+    call->payload[0] = DSTC_RECORD_TARGET;
+    memcpy(call->payload + 1, &remote->node_id, sizeof(rmc_node_id_t));
+
+    if (id_len == name_len + 1)
+        memcpy(call->payload + DSTC_TARGET_HEADER_LEN, name, name_len + 1);
+    else {
+        call->payload[DSTC_TARGET_HEADER_LEN] = DSTC_RECORD_FUNC_ID;
+        memcpy(call->payload + DSTC_TARGET_HEADER_LEN + 1, &func_id, sizeof(uint16_t));
+    }
+
+    // Count the callback activated for the arguments of this call,
+    // if any, as outstanding with the node.
+    if (ctx->callback_slot_last) {
+        dstc_callback_slot_t* cb = &ctx->callback_slot[ctx->callback_slot_last - 1];
+
+        if (cb->callback && !cb->remote_ind) {
+            cb->remote_ind = remote_ind + 1;
+            cb->remote_node_id = remote->node_id;
+            remote->outstanding++;
+        }
+        ctx->callback_slot_last = 0;
+    }
+
+    client_func->anycast_last = remote_ind;
+    *arg = call->payload + DSTC_TARGET_HEADER_LEN + id_len;
+    return 0;
+}
+
+// Reserve space for a callback through a DSTC_CALLBACK_REF_REPLY
+// reference in the reply buffer, to be sent directly to the node the
+// reference was received from. Pending replies to another node are
+// sent first. Replies that do not fit in the reply buffer are
+// multicast.
+// See _dstc_reserve() for arguments.
+//
+// Returns EBUSY if pending replies could not be sent.
+//
+// ctx must be non-null and locked
+static int _dstc_reserve_reply(dstc_context_t* ctx,
+                               dstc_callback_t callback_ref,
+                               uint32_t arg_sz,
+                               uint8_t** arg)
+{
+    uint32_t node_ind = DSTC_CALLBACK_REF_NODE(callback_ref);
+    uint32_t reuse = DSTC_CALLBACK_REF_REUSE(callback_ref);
+    uint32_t len = sizeof(dstc_header_t) + 1 + sizeof(dstc_callback_t) + arg_sz;
+    rmc_node_id_t node_id = 0;
+    dstc_header_t* call = 0;
+    int res = 0;
+
+    // The node gets the reference back as it sent it.
+    callback_ref = dstc_export_callback_ref(callback_ref);
+
+    // The node the reference came from has gone away if the slot
+    // has been released since, whether or not another node holds it
+    // now.
+    if (node_ind >= ctx->reply_node_ind || !ctx->reply_node[node_ind] ||
+        ctx->reply_node_reuse[node_ind] != reuse ||
+        DSTC_REPLY_HEADER_LEN + len > DSTC_REPLY_BUFFER_SIZE)
+        return _dstc_reserve(ctx, 0, 0, callback_ref, 0, arg_sz, arg);
+
+    node_id = ctx->reply_node[node_ind];
+
+    // Make room in the payload buffer if the pending replies have to
+    // be multicast.
+    if (ctx->reply_ind &&
+        (node_id != ctx->reply_node_id ||
+         ctx->reply_ind + len > DSTC_REPLY_BUFFER_SIZE) &&
+        _dstc_flush_replies(ctx) &&
+        (_dstc_retire_payload_buffer(ctx) || _dstc_flush_replies(ctx)))
+        return EBUSY;
+
+    if (!ctx->reply_buffer) {
+        res = posix_memalign((void**) &ctx->reply_buffer,
+                             DSTC_CACHE_LINE_SIZE,
+                             DSTC_REPLY_BUFFER_SIZE);
+
+        if (res) {
+            RMC_LOG_FATAL("posix_memalign(%d): %s",
+                          DSTC_REPLY_BUFFER_SIZE, strerror(res));
+            exit(255);
+        }
+    }
+
+    // Start a new control message, with an empty function name
+    // telling it apart from function registrations.
+    if (!ctx->reply_ind) {
+        rmc_node_id_t own_node_id = rmc_pub_node_id(ctx->pub_ctx);
+
+        memcpy(ctx->reply_buffer, &own_node_id, sizeof(rmc_node_id_t));
+        ctx->reply_buffer[sizeof(rmc_node_id_t)] = 0;
+        ctx->reply_ind = DSTC_REPLY_HEADER_LEN;
+        ctx->reply_node_id = node_id;
+
+        // Buffered replies are sent by the flush timer as well.
+        if (ctx->pub_flush_usec && !ctx->pub_flush_deadline) {
+            ctx->pub_flush_deadline = rmc_usec_monotonic_timestamp() + ctx->pub_flush_usec;
+            _dstc_wake_event_waiters(ctx);
+        }
+    }
+
+    call = (dstc_header_t*) (ctx->reply_buffer + ctx->reply_ind);
+    call->node_id = rmc_pub_node_id(ctx->pub_ctx);
+    call->payload_len = 1 + sizeof(dstc_callback_t) + arg_sz;
+    call->payload[0] = DSTC_RECORD_CALLBACK;
+    memcpy(call->payload + 1, &callback_ref, sizeof(dstc_callback_t));
+    *arg = call->payload + 1 + sizeof(dstc_callback_t);
+
+    ctx->reply_ind += len;
+    ctx->reply_count++;
+    ctx->reply_reserved = 1;
+    return 0;
+}
+
+// Reserve space for a call by name, by the function ID of client_func,
+// or a callback by callback_ref, with arg_sz bytes of arguments.
+// The call header is written and *arg is set to point to the
+// arguments area in the payload buffer, where the caller is to
+// serialize the arguments before invoking _dstc_commit().
+//
+// If client_func is set, name must be its function name. The
+// function ID is used if all remote nodes serving the function
+// support it. See _dstc_update_func_id_state().
+// key is the hash of the first argument of the call, used to pick
+// the server of DSTC_ANYCAST_KEY_HASH functions. See _dstc_anycast_key().
+//
+// Returns EBUSY if the payload buffer is full, and EMSGSIZE if the
+// call does not fit in a packet.
+//
+// ctx must be non-null and locked
+static int _dstc_reserve(dstc_context_t* ctx,
+                         char* name,
+                         dstc_client_func_t* client_func,
+                         dstc_callback_t callback_ref,
+                         uint64_t key,
+                         uint32_t arg_sz,
+                         uint8_t** arg)
+{
+    dstc_header_t *call = 0;
+    uint16_t id_len = 0;
+    uint16_t bind_len = 0;
+    uint16_t func_id = 0;
+    uint8_t id_state = DSTC_FUNC_ID_NONE;
+    uint32_t name_hash_len = 0;
+    size_t name_len = name?strlen(name):0;;
+
+    if ((!name || name[0] == 0) && !callback_ref) {
+        RMC_LOG_ERROR("dstc_queue() needs either name or callback_ref to be set.");
+        return EINVAL;
+    }
+
+    if (!_dstc_context_initialized(ctx))
+        _dstc_setup_default(ctx);
+
+    // Calls staged by this thread must be sent first.
+    if (_dstc_thread_buffer_merge_own(ctx))
+        return EBUSY;
+
+    if (!name && DSTC_CALLBACK_REF_IS_REPLY(callback_ref))
+        return _dstc_reserve_reply(ctx, callback_ref, arg_sz, arg);
+
+    // Send anycast calls to a single server. Functions with no
+    // server able to dispatch targeted calls are called on all
+    // servers.
+    if (client_func && client_func->anycast) {
+        int remote_ind = _dstc_anycast_pick(ctx, client_func, client_func->anycast, key);
+
+        if (remote_ind != -1)
+            return _dstc_reserve_targeted(ctx, remote_ind, client_func, arg_sz, arg);
+    }
+
+    if (client_func) {
+        id_state = client_func->id_state;
+        func_id = (uint16_t) (client_func - ctx->client_func);
+    }
+
+    // Buffered calls by ID go into compact blocks, which save
+    // space once they hold more than one call.
+    if (name && id_state == DSTC_FUNC_ID_BOUND && client_func->compact &&
+        (ctx->pub_is_buffering || ctx->pub_bulk_depth) &&
+        arg_sz <= DSTC_COMPACT_MAX_ARG_SIZE)
+        return _dstc_reserve_compact(ctx, func_id, arg_sz, arg);
+
+    if (!name)
+        id_len = sizeof(uint64_t) + 1;
+    else if (id_state == DSTC_FUNC_ID_NONE)
+        id_len = name_len + 1;
+    else
+        id_len = 1 + sizeof(uint16_t);
+
+    // Bind our function ID to the function name before its first
+    // use. The bind record is stored in the same buffer
+    // allocation as the call itself so that both end up in the
+    // same packet.
+    if (id_state == DSTC_FUNC_ID_BIND_PENDING) {
+        bind_len = sizeof(dstc_header_t) + 1 + sizeof(uint16_t) + name_len + 1;
+
+        // Send call by name if there is no room for both.
+        if (bind_len + sizeof(dstc_header_t) + id_len + arg_sz > RMC_MAX_PAYLOAD) {
+            bind_len = 0;
+            id_state = DSTC_FUNC_ID_NONE;
+            id_len = name_len + 1;
+        }
+    }
+
+    if (sizeof(dstc_header_t) + id_len + arg_sz > RMC_MAX_PAYLOAD ||
+        id_len + arg_sz > UINT16_MAX) {
+        RMC_LOG_ERROR("Call to [%s] with %u bytes of arguments does not fit in a packet",
+                      name?name:"callback", arg_sz);
+        return EMSGSIZE;
+    }
+
+    call = (dstc_header_t*) _dstc_payload_buffer_alloc(ctx,
+                                                       bind_len + sizeof(dstc_header_t) + id_len + arg_sz);
+
+    // If alloc failed, then we do not have enough space in the
+    // payload buffer to store the new call. Send the buffer out via
+    // RMC, or move it to the outbound queue if traffic is suspended,
+    // and retry with an empty one. This ignores buffered mode since
+    // we need to get our buffer space back.
+    //
+    // If the outbound queue is full as well, return EBUSY, telling
+    // the calling program to run dstc_process_events() for a bit and
+    // try again.
+    if (!call &&
+        (_dstc_retire_payload_buffer(ctx) ||
+         !(call = (dstc_header_t*) _dstc_payload_buffer_alloc(ctx,
+                                                              bind_len + sizeof(dstc_header_t) + id_len + arg_sz))))
+        return EBUSY;
+
+    if (bind_len) {
+        call->node_id = rmc_pub_node_id(ctx->pub_ctx);
+        call->payload[0] = DSTC_RECORD_BIND;
+        memcpy(call->payload + 1, &func_id, sizeof(uint16_t));
+        memcpy(call->payload + 1 + sizeof(uint16_t), name, name_len + 1);
+        call->payload_len = 1 + sizeof(uint16_t) + name_len + 1;
+
+        __atomic_store_n(&client_func->id_state, DSTC_FUNC_ID_BOUND, __ATOMIC_RELAXED);
+        RMC_LOG_COMMENT("Bound function id [%d] to [%s]", func_id, name);
+        call = (dstc_header_t*) ((uint8_t*) call + bind_len);
+    }
+
+    call->node_id = rmc_pub_node_id(ctx->pub_ctx);
+
+    // If this is a regular function call, then copy in the function
+    // name, including terminating null character, followed by the
+    // payload.
+    //
+    // If the function has been bound to a function ID, install
+    // DSTC_RECORD_FUNC_ID as the first byte of payload, followed by
+    // the two bytes of the function ID and the payload.
+    //
+    // If this is a invocation of a previously registered callback, then
+    // install a null character as the first byte of payload, followed by
+    // the eight bytes of the callback reference that we want invoked,
+    // followed by the payload
+    //
+    if (!name) {
+        call->payload[0] = DSTC_RECORD_CALLBACK;
+        memcpy(call->payload + 1, (uint64_t*) &callback_ref, sizeof(uint64_t));
+        ctx->pub_filter |= DSTC_FILTER_CALLBACK;
+    } else if (id_state == DSTC_FUNC_ID_NONE)
+        memcpy(call->payload, name, name_len + 1);
+    else {
+        call->payload[0] = DSTC_RECORD_FUNC_ID;
+        memcpy(call->payload + 1, &func_id, sizeof(uint16_t));
+    }
+
+    // The bind record, if any, is covered by the bit of the call.
+    if (client_func)
+        ctx->pub_filter |= client_func->filter;
+    else if (name)
+        ctx->pub_filter |= DSTC_FILTER_NAME_BIT(_dstc_hash_name(name, UINT32_MAX, &name_hash_len));
+
+    call->payload_len = id_len + arg_sz;
+    *arg = call->payload + id_len;
+
+    RMC_LOG_DEBUG("DSTC Queue: node_id[%lu] name[%s]/callback_ref[%llu] payload_len[%d] in_use[%d]",
+                  call->node_id,
+                  name?name:"nil",
+                  callback_ref,
+                  call->payload_len,
+                  _dstc_payload_buffer_in_use(ctx));
+
+    return 0;
+}
+
+// Complete a call whose arguments have been serialized into the
+// space provided by _dstc_reserve().
+//
+// ctx must be non-null and locked
+static void _dstc_commit(dstc_context_t* ctx)
+{
+    // Replies made while dispatching inbound calls are sent together
+    // once the packet has been processed. See dstc_process_incoming().
+    if (ctx->reply_reserved) {
+        ctx->reply_reserved = 0;
+        if (!ctx->dispatch_depth && !ctx->pub_is_buffering && !ctx->pub_bulk_depth)
+            _queue_pending_calls(ctx);
+        return;
+    }
+
+    // If we have pending calls in the DSTC circular buffer, try to
+    // queue them with RMC.  This may fail if we are currently
+    // suspended from sending traffic over RMC due to congestion.
+    //
+    // If we are in buffered mode, trying to collect as many calls
+    // as possible into a single RMC (UDP multicast) packet,
+    // then we will not try to queue the call for now.
+    // Please see above for queueing calls when our DSTC outbound
+    // buffer is full.
+    // The same goes for calls queued by a generated
+    // dstc_[name]_bulk() function, which are queued by dstc_bulk_end().
+    if (!ctx->pub_is_buffering && !ctx->pub_bulk_depth) {
+        _queue_pending_calls(ctx);
+        return;
+    }
+
+    if (!ctx->pub_bulk_depth)
+        _dstc_check_flush_threshold(ctx);
+}
+
+// Queue a call with already serialized arguments.
+// See _dstc_reserve() for arguments.
+//
+// ctx must be non-null and locked
+static int _dstc_queue(dstc_context_t* ctx,
+                       char* name,
+                       dstc_client_func_t* client_func,
+                       dstc_callback_t callback_ref,
+                       uint8_t* arg,
+                       uint32_t arg_sz)
+{
+    uint8_t* arg_buf = 0;
+    int res = _dstc_reserve(ctx, name, client_func, callback_ref, 0, arg_sz, &arg_buf);
+
+    if (res)
+        return res;
+
+    memcpy(arg_buf, arg, arg_sz);
+    _dstc_commit(ctx);
+    return 0;
+}
+
+//
+// ---------------------------------------------------------
+// Functions invoked by DSTC_*() macros
+// ---------------------------------------------------------
+//
+
+//
+// Register a function name - pointer relationship.
+// Called by file constructor function _dstc_register_server_[name]()
+// generated by DSTC_SERVER() macro.
+//
+// ctx can be unlocked and/or null (for default context)
+void dstc_register_server_function(dstc_context_t* ctx,
+                                   char* name,
+                                   dstc_internal_dispatch_t server_func)
+{
+    dstc_register_server_batch_function(ctx, name, server_func, 0);
+}
+
+// Same as dstc_register_server_function(), but consecutive calls in
+// a packet are dispatched through batch_func.
+// Called by file constructor function _dstc_register_server_[name]()
+// generated by DSTC_SERVER_BATCH() macro.
+//
+// ctx can be unlocked and/or null (for default context)
+void dstc_register_server_batch_function(dstc_context_t* ctx,
+                                         char* name,
+                                         dstc_internal_dispatch_t server_func,
+                                         dstc_internal_batch_dispatch_t batch_func)
+{
+    dstc_server_func_t* func = 0;
+    uint32_t name_len = 0;
+
+    if (!ctx)
+        ctx = &_dstc_default_context;
+
+    _dstc_lock_context(ctx);
+
+    // Grow the function table if needed.
+    if (ctx->server_func_ind == ctx->server_func_size) {
+        uint32_t new_size = ctx->server_func_size?
+            (ctx->server_func_size * 2):SERVER_FUNC_INITIAL_SIZE;
+        dstc_server_func_t* new_func = realloc(ctx->server_func,
+                                               new_size * sizeof(dstc_server_func_t));
+
+        if (!new_func) {
+            RMC_LOG_FATAL("Out of memory trying to register server function %s", name);
+            exit(255);
+        }
+        ctx->server_func = new_func;
+        ctx->server_func_size = new_size;
+    }
+
+    func = &ctx->server_func[ctx->server_func_ind];
+    func->name_hash = _dstc_hash_name(name, UINT32_MAX, &name_len);
+    func->func_name = strdup(name);
+    func->server_func = server_func;
+    func->batch_func = batch_func;
+
+    if (!func->func_name) {
+        RMC_LOG_FATAL("Out of memory trying to register server function %s", name);
+        exit(255);
+    }
+
+    ctx->server_func_ind++;
+
+    // Registrations are normally done by constructor functions before the
+    // context is setup, in which case the index is built by
+    // dstc_setup_internal(). If we get a late registration, rebuild the index.
+    if (_dstc_context_initialized(ctx))
+        _dstc_build_server_func_index(ctx);
+
+    _dstc_unlock_context(ctx);
+}
+
+// ctx can be unlocked and/or null (for default context)
+// Called by file constructor function _dstc_register_client_[name]()
+// generated by DSTC_CLIENT() macro.
+
+//
+// Returns the function ID to provide to dstc_queue_client_func()
+// when calling the function.
+//
+uint32_t dstc_register_client_function(dstc_context_t* ctx,
+                                       char* name,
+                                       void *client_func)
+{
+    uint32_t name_len = 0;
+    int ind = 0;
+
+    if (!ctx)
+        ctx = &_dstc_default_context;
+
+    _dstc_lock_context(ctx);
+
+    ind = ctx->client_func_ind;
+    if (ind == SYMTAB_SIZE - 1) {
+        RMC_LOG_FATAL("Out of memory trying to register client function. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
+        exit(255);
+    }
+
+    strcpy(ctx->client_func[ind].func_name, name);
+    ctx->client_func[ind].client_func = client_func;
+    ctx->client_func[ind].id_state = DSTC_FUNC_ID_NONE;
+    ctx->client_func[ind].compact = 0;
+    ctx->client_func[ind].anycast = DSTC_ANYCAST_NONE;
+    ctx->client_func[ind].anycast_last = 0;
+    ctx->client_func[ind].filter =
+        DSTC_FILTER_NAME_BIT(_dstc_hash_name(name, UINT32_MAX, &name_len));
+    __atomic_store_n(&ctx->client_func_ind, ind + 1, __ATOMIC_RELEASE);
+    _dstc_unlock_context(ctx);
+    return ind;
+}
+
+
+// Register a function name - pointer relationship.
+//
+// Called by file constructor function
+// _dstc_register_callback_sedrver_[name]() generated by
+// DSTC_CLIENT_CALLBACK_ARG() macro.
+//
+void dstc_register_callback_server(dstc_context_t* ctx,
+                                   dstc_callback_t callback_ref,
+                                   dstc_internal_dispatch_t callback)
+{
+
+    int ind = 0;
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    _dstc_lock_context(ctx);
+
+
+    // Find a previously freed slot, or allocate a new one
+    while(ind < ctx->callback_ind) {
+        if (!ctx->local_callback[ind].callback)
+            break;
+        ++ind;
+    }
+
+    // Are we out of memory
+    if (ind == SYMTAB_SIZE) {
+        RMC_LOG_FATAL("Out of memory trying to register callback. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
+        exit(255);
+    }
+    ctx->local_callback[ind].callback_ref = callback_ref;
+    ctx->local_callback[ind].callback = callback;
+    RMC_LOG_COMMENT("Registered server callback [%llX] to %p. Index[%d]",
+                    callback_ref, callback, ind);
+
+    // If we are allocating a new slot (not reusing an earlier one).
+    // then bump callback_ind to the new max index in use.
+    if (ind == ctx->callback_ind)
+        ctx->callback_ind++;
+
+    _dstc_unlock_context(ctx);
+    return;
+}
+
+// Register a callback function name - pointer relationship.
+//
+// Called by file constructor function
+// _dstc_register_callback_[name]() generated by DSTC_CALLBACK()
+// macro.
+//
+// For now, we just bump a counter to figure out if we should
+// send out announce messages or not.
+//
+void dstc_register_callback_client(dstc_context_t* ctx,
+                                   char* name, void* callback)
+{
+    if (!ctx)
+        ctx = &_dstc_default_context;
+
+    _dstc_lock_context(ctx);
+    ctx->client_callback_count++;
+    _dstc_unlock_context(ctx);
+}
+
+
+// Return the context carrying calls to the DSTC_CLIENT() function
+// client_func_id, or to function name if client_func_id is not
+// registered. This is ctx itself, unless dstc_setup_groups() has
+// spread the functions of ctx across multicast groups, in which case
+// it is the context of the group carrying the function.
+//
+// ctx must be non-null
+static dstc_context_t* _dstc_group_context(dstc_context_t* ctx,
+                                           uint32_t client_func_id,
+                                           char* name)
+{
+    dstc_context_t* root = ctx->group_root?ctx->group_root:ctx;
+    uint8_t group = 0;
+
+    // Group contexts are created when the context is setup.
+    if (!_dstc_context_initialized(root)) {
+        _dstc_lock_and_init_context(root);
+        _dstc_unlock_context(root);
+    }
+
+    if (root->group_count < 2)
+        return ctx;
+
+    if (client_func_id < root->client_func_ind)
+        group = root->client_func[client_func_id].group;
+    else if (name)
+        group = _dstc_function_group(root, name);
+
+    return root->group_ctx[group]?root->group_ctx[group]:root;
+}
+
+// Returns EBUSY if outbound queues are full
+int dstc_queue_callback(dstc_context_t* ctx, dstc_callback_t addr, uint8_t* arg, uint32_t arg_sz)
+{
+    int res = 0;
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    _dstc_lock_and_init_context(ctx);
+
+    // Call with zero namelen to treat name as a 64bit integer.
+    // This integer will be mapped by the received through the
+    // ctx->local_callback
+    // table to a pending callback function.
+    res = _dstc_queue(ctx, 0, 0, addr, arg, arg_sz);
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+// Returns EBUSY if outbound queues are full
+int dstc_queue_func(dstc_context_t* ctx, char* name, uint8_t* arg, uint32_t arg_sz)
+{
+    int res = 0;
+
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    ctx = _dstc_group_context(ctx, UINT32_MAX, name);
+    _dstc_lock_context(ctx);
+    res = _dstc_queue(ctx, name, 0, 0, arg, arg_sz);
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+// Returns EBUSY if outbound queues are full
+// client_func_id is the value returned by
+// dstc_register_client_function() for name. If it is not a
+// registered ID, the call is sent by name.
+int dstc_queue_client_func(dstc_context_t* ctx,
+                           uint32_t client_func_id,
+                           char* name,
+                           uint8_t* arg,
+                           uint32_t arg_sz)
+{
+    int res = 0;
+
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    ctx = _dstc_group_context(ctx, client_func_id, name);
+    _dstc_lock_context(ctx);
+    res = _dstc_queue(ctx,
+                      name,
+                      (client_func_id < ctx->client_func_ind)?
+                      &ctx->client_func[client_func_id]:0,
+                      0, arg, arg_sz);
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+// Lock ctx, the context of the multicast group carrying calls to
+// client_func_id, and reserve space for a call in its payload buffer.
+// See dstc_reserve_client_func() for arguments.
+//
+// ctx is left locked on success.
+static int _dstc_reserve_client_func(dstc_context_t* ctx,
+                                     uint32_t client_func_id,
+                                     char* name,
+                                     const void* key,
+                                     uint32_t key_len,
+                                     uint32_t arg_sz,
+                                     uint8_t** arg_buf)
+{
+    dstc_client_func_t* func = 0;
+    int res = 0;
+
+    _dstc_lock_context(ctx);
+    if (client_func_id < ctx->client_func_ind)
+        func = &ctx->client_func[client_func_id];
+
+    res = _dstc_reserve(ctx,
+                        name,
+                        func,
+                        0,
+                        _dstc_anycast_key(func, key, key_len),
+                        arg_sz, arg_buf);
+    if (res)
+        _dstc_unlock_context(ctx);
+
+    _dstc_reserved_context = res?0:ctx;
+    return res;
+}
+
+// Reserve space for a call to a DSTC_CLIENT() function in the
+// outbound packet, allowing the generated code to serialize its
+// arguments straight into the packet.
+//
+// On success, *arg_buf is set to point to arg_sz bytes where the
+// arguments are to be serialized, and ctx is kept locked until the
+// call is completed by dstc_commit_call().
+//
+// client_func_id is the value returned by
+// dstc_register_client_function() for name. If it is not a
+// registered ID, the call is sent by name.
+//
+// key and key_len are the first argument of the call, provided by
+// ANYCAST_KEY_ARGUMENTS(). They are only read for functions with the
+// DSTC_ANYCAST_KEY_HASH policy.
+//
+// Returns EBUSY if outbound queues are full, and EMSGSIZE if the
+// arguments are too large to fit in a packet.
+int dstc_reserve_client_func(dstc_context_t* ctx,
+                             uint32_t client_func_id,
+                             char* name,
+                             const void* key,
+                             uint32_t key_len,
+                             uint32_t arg_sz,
+                             uint8_t** arg_buf)
+{
+    int res = 0;
+
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    ctx = _dstc_group_context(ctx, client_func_id, name);
+
+    // In buffered mode, calls are staged in a buffer owned by the
+    // calling thread, keeping producer threads off the context lock.
+    // Anycast calls pick their server under the lock. Buffered mode
+    // is checked again by _dstc_thread_reserve() once the thread
+    // buffer is locked.
+    if (__atomic_load_n(&ctx->pub_is_buffering, __ATOMIC_ACQUIRE) && name &&
+        client_func_id < __atomic_load_n(&ctx->client_func_ind, __ATOMIC_ACQUIRE) &&
+        !__atomic_load_n(&ctx->client_func[client_func_id].anycast, __ATOMIC_RELAXED)) {
+        res = _dstc_thread_reserve(ctx,
+                                   _dstc_thread_buffer(ctx),
+                                   name,
+                                   &ctx->client_func[client_func_id],
+                                   arg_sz, arg_buf);
+        if (res != EAGAIN) {
+            _dstc_reserved_context = res?0:ctx;
+            return res;
+        }
+    }
+
+    return _dstc_reserve_client_func(ctx, client_func_id, name,
+                                     key, key_len, arg_sz, arg_buf);
+}
+
+// Same as dstc_reserve_client_func(), but the call is never staged
+// in a thread buffer, and is only dispatched by the remote node
+// node_id. Used by the generated dstc_[name]_to() functions.
+//
+// Returns ENOENT if node_id does not serve the function, and ENOTSUP
+// if it runs a DSTC version that cannot dispatch targeted calls.
+int dstc_reserve_targeted_client_func(dstc_context_t* ctx,
+                                      rmc_node_id_t node_id,
+                                      uint32_t client_func_id,
+                                      char* name,
+                                      uint32_t arg_sz,
+                                      uint8_t** arg_buf)
+{
+    int remote_ind = 0;
+    int res = 0;
+
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    ctx = _dstc_group_context(ctx, client_func_id, name);
+
+    _dstc_lock_and_init_context(ctx);
+    if (client_func_id >= ctx->client_func_ind) {
+        RMC_LOG_ERROR("Targeted call to unregistered client function [%s]", name);
+        res = EINVAL;
+    } else if ((remote_ind = _dstc_find_remote_node(ctx, node_id, name)) == -1) {
+        RMC_LOG_DEBUG("Node [0x%X] does not serve [%s]", node_id, name);
+        res = ENOENT;
+    } else if (!(ctx->remote_node[remote_ind].caps & DSTC_CAP_TARGET)) {
+        RMC_LOG_WARNING("Node [0x%X] cannot dispatch targeted calls to [%s]",
+                        node_id, name);
+        res = ENOTSUP;
+    } else
+        res = _dstc_reserve_targeted(ctx, remote_ind,
+                                     &ctx->client_func[client_func_id],
+                                     arg_sz, arg_buf);
+
+    if (res)
+        _dstc_unlock_context(ctx);
+
+    _dstc_reserved_context = res?0:ctx;
+    return res;
+}
+
+// Same as dstc_reserve_client_func(), but for a callback invoked
+// through a DSTC_SERVER_CALLBACK()-generated function.
+int dstc_reserve_callback(dstc_context_t* ctx,
+                          dstc_callback_t addr,
+                          uint32_t arg_sz,
+                          uint8_t** arg_buf)
+{
+    int res = 0;
+
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    _dstc_lock_and_init_context(ctx);
+    res = _dstc_reserve(ctx, 0, 0, addr, 0, arg_sz, arg_buf);
+    if (res)
+        _dstc_unlock_context(ctx);
+
+    _dstc_reserved_context = res?0:ctx;
+    return res;
+}
+
+// Complete a call reserved by dstc_reserve_client_func() or
+// dstc_reserve_callback() and unlock ctx.
+// The call is completed in the context it was reserved in, which is
+// a group context of ctx if functions are spread across multicast
+// groups.
+void dstc_commit_call(dstc_context_t* ctx)
+{
+    dstc_thread_buffer_t* tb = 0;
+
+    if (_dstc_reserved_context)
+        ctx = _dstc_reserved_context;
+    else if (!ctx)
+        ctx = _dstc_current_context();
+
+    _dstc_reserved_context = 0;
+
+    // Staged calls are merged into the payload buffer later.
+    tb = (dstc_thread_buffer_t*) pthread_getspecific(ctx->thread_buffer_key);
+    if (tb && tb->reserved) {
+        tb->reserved = 0;
+        pthread_mutex_unlock(&tb->lock);
+        return;
+    }
+
+    _dstc_commit(ctx);
+    _dstc_unlock_context(ctx);
+}
+
+// Lock ctx and start queueing a sequence of calls with
+// dstc_bulk_reserve_client_func(). Called by the generated
+// dstc_[name]_bulk() functions.
+// The lock is held until dstc_bulk_end() is called.
+//
+// Returns the context to provide to dstc_bulk_reserve_client_func()
+// and dstc_bulk_end().
+dstc_context_t* dstc_bulk_begin(dstc_context_t* ctx)
+{
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    _dstc_lock_and_init_context(ctx);
+    ctx->pub_bulk_depth++;
+    return ctx;
+}
+
+// Same as dstc_bulk_begin(), but for a sequence of calls to the
+// DSTC_CLIENT() function client_func_id, which are queued in the
+// context of the multicast group carrying it.
+dstc_context_t* dstc_bulk_begin_client_func(dstc_context_t* ctx,
+                                            uint32_t client_func_id)
+{
+    if (!ctx)
+        ctx = _dstc_current_context();
+
+    return dstc_bulk_begin(_dstc_group_context(ctx, client_func_id, 0));
+}
+
+// Reserve space for a call inside a dstc_bulk_begin() /
+// dstc_bulk_end() sequence. Arguments are serialized into *arg_buf
+// without any further commit, since the bulk sequence is queued by
+// dstc_bulk_end().
+// If the payload buffer is full, it is queued with RMC as a packet
+// and the reservation is retried in an empty buffer.
+// See dstc_reserve_client_func() for key and key_len.
+//
+// Returns EBUSY if the call could not be queued since RMC traffic
+// is suspended, and EMSGSIZE if the arguments are too large to fit
+// in a packet.
+// ctx must be provided by dstc_bulk_begin()
+int dstc_bulk_reserve_client_func(dstc_context_t* ctx,
+                                  uint32_t client_func_id,
+                                  char* name,
+                                  const void* key,
+                                  uint32_t key_len,
+                                  uint32_t arg_sz,
+                                  uint8_t** arg_buf)
+{
+    dstc_client_func_t* func = (client_func_id < ctx->client_func_ind)?
+        &ctx->client_func[client_func_id]:0;
+    uint64_t anycast_key = _dstc_anycast_key(func, key, key_len);
+    int res = _dstc_reserve(ctx, name, func, 0, anycast_key, arg_sz, arg_buf);
+
+    // _dstc_reserve() will have tried to send out the full buffer.
+    if (res == EBUSY && _dstc_payload_buffer_in_use(ctx) == 0)
+        res = _dstc_reserve(ctx, name, func, 0, anycast_key, arg_sz, arg_buf);
+
+    return res;
+}
+
+// Queue all calls of a bulk sequence with RMC, unless we are in
+// buffered mode, and unlock ctx.
+// ctx must be provided by dstc_bulk_begin()
+void dstc_bulk_end(dstc_context_t* ctx)
+{
+    if (!--ctx->pub_bulk_depth && !ctx->pub_is_buffering)
+        _queue_pending_calls(ctx);
+
+    _dstc_unlock_context(ctx);
+}
+
+//
+// ---------------------------------------------------------
+// Externally callable functions
+ // ---------------------------------------------------------
+//
+
+void dstc_cancel_callback(dstc_internal_dispatch_t callback)
+{
+    dstc_context_t* ctx = _dstc_root_context();
+
+    _dstc_lock_and_init_context(ctx);
+
+    // Will delete the callback.
+
+
+    _dstc_find_callback_by_func(ctx, callback);
+    _dstc_unlock_context(ctx);
+}
+
+int dstc_cancel_callback_ref(dstc_callback_t callback_ref)
+{
+    dstc_context_t* ctx = _dstc_root_context();
+    dstc_callback_slot_t* cb = 0;
+
+    _dstc_lock_context(ctx);
+
+    cb = _dstc_find_callback_slot(ctx, callback_ref, 0);
+    if (!cb) {
+        _dstc_unlock_context(ctx);
+        return ENOENT;
+    }
+
+    _dstc_release_callback_slot(ctx, cb - ctx->callback_slot);
+    _dstc_unlock_context(ctx);
+    return 0;
+}
+
+void* dstc_callback_user_data(dstc_callback_t callback_ref)
+{
+    dstc_context_t* ctx = _dstc_root_context();
+    dstc_callback_slot_t* cb = 0;
+    void* res = 0;
+
+    _dstc_lock_context(ctx);
+
+    cb = _dstc_find_callback_slot(ctx, callback_ref, 1);
+    if (cb)
+        res = cb->user_data;
+
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+// Return 1 if a remote node has registered func_name with ctx.
+//
+// ctx must be non-null and locked
+static uint8_t _dstc_remote_function_available(dstc_context_t* ctx,
+                                               char* func_name)
+{
+    int ind = 0;
+
+    // Scan all remotely registered nodes and their functions
+    // to see if you can find one with a matching na,e
+    ind = ctx->remote_node_ind;
+    while(ind--) {
+        if (ctx->remote_node[ind].node_id != 0 &&
+            !strcmp(func_name, ctx->remote_node[ind].func_name))
+            return 1;
+    }
+    RMC_LOG_DEBUG("Could not find a remote node that had registered function %s", func_name);
+    return 0;
+}
+
+// Return the DSTC_CLIENT-registered function of the dstc_[name]
+// function pointer client_func, or 0 if not registered.
+//
+// ctx must be non-null and locked
+static dstc_client_func_t* _dstc_find_client_func(dstc_context_t* ctx,
+                                                  void* client_func)
+{
+    int ind = ctx->client_func_ind;
+
+    while(ind--)
+        if (ctx->client_func[ind].client_func == client_func)
+            return &ctx->client_func[ind];
+
+    return 0;
+}
+
+// Return the context carrying calls to the dstc_[name] function
+// pointer client_func. See _dstc_group_context().
+static dstc_context_t* _dstc_client_func_context(void* client_func)
+{
+    dstc_context_t* ctx = _dstc_current_context();
+    dstc_client_func_t* func = 0;
+
+    _dstc_lock_and_init_context(ctx);
+    func = _dstc_find_client_func(ctx, client_func);
+    _dstc_unlock_context(ctx);
+
+    if (!func)
+        return ctx;
+
+    return _dstc_group_context(ctx, func - ctx->client_func, 0);
+}
+
+uint8_t dstc_remote_function_available_by_name(char* func_name)
+{
+    dstc_context_t* ctx = _dstc_group_context(_dstc_current_context(),
+                                              UINT32_MAX, func_name);
+    uint8_t res = 0;
+
+    _dstc_lock_and_init_context(ctx);
+    res = _dstc_remote_function_available(ctx, func_name);
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+
+uint8_t dstc_remote_function_available(void* client_func)
+{
+    dstc_context_t* ctx = _dstc_client_func_context(client_func);
+    dstc_client_func_t* func = 0;
+    uint8_t res = 0;
+
+    _dstc_lock_and_init_context(ctx);
+
+    // Find the string name for the dstc_[func_name] function
+    // pointer provided in client_func
+    func = _dstc_find_client_func(ctx, client_func);
+    if (func)
+        res = _dstc_remote_function_available(ctx, func->func_name);
+
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+int dstc_set_anycast_policy(void* client_func, uint8_t policy)
+{
+    dstc_context_t* ctx = _dstc_client_func_context(client_func);
+    dstc_client_func_t* func = 0;
+
+    if (policy != DSTC_ANYCAST_NONE &&
+        policy != DSTC_ANYCAST_ROUND_ROBIN &&
+        policy != DSTC_ANYCAST_LEAST_OUTSTANDING &&
+        policy != DSTC_ANYCAST_KEY_HASH)
+        return EINVAL;
+
+    _dstc_lock_and_init_context(ctx);
+
+    func = _dstc_find_client_func(ctx, client_func);
+    if (!func) {
+        _dstc_unlock_context(ctx);
+        return ENOENT;
+    }
+
+    // Calls already staged by threads in buffered mode keep the
+    // policy they were made with.
+    __atomic_store_n(&func->anycast, policy, __ATOMIC_RELAXED);
+    _dstc_unlock_context(ctx);
+    return 0;
+}
+
+rmc_node_id_t dstc_anycast_node(void* client_func, uint64_t key)
+{
+    dstc_context_t* ctx = _dstc_client_func_context(client_func);
+    dstc_client_func_t* func = 0;
+    rmc_node_id_t res = 0;
+    int ind = 0;
+
+    _dstc_lock_and_init_context(ctx);
+
+    func = _dstc_find_client_func(ctx, client_func);
+    if (func &&
+        (ind = _dstc_anycast_pick(ctx, func, DSTC_ANYCAST_KEY_HASH, key)) != -1)
+        res = ctx->remote_node[ind].node_id;
+
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+msec_timestamp_t dstc_msec_monotonic_timestamp(void)
+{
+    struct timespec res;
+    return _dstc_msec_monotonic_timestamp(&res);
+}
+
+
+
+int dstc_get_timeout_msec_rel(void)
+{
+    return _dstc_get_timeout_msec_rel(_dstc_current_context(),
+                                      dstc_msec_monotonic_timestamp());
+}
+
+static int _dstc_process_timeout(dstc_context_t* ctx)
+{
+    uint32_t ind = 0;
+
+    // Group contexts have timeouts of their own.
+    for(ind = 1; ind < ctx->group_count; ++ind)
+        _dstc_process_group_events(ctx, ind, 1);
+
+    // If either of the timeout processor fails in with EAGAIN, then they
+    // tried resending un-acknolwedged packets but encountered full transmissions
+    // queues in rmc.
+    // In that case process events until the queues are sent out on the network
+    // and are cleared up.
+    if (rmc_pub_timeout_process(ctx->pub_ctx) == EAGAIN ||
+        rmc_sub_timeout_process(ctx->sub_ctx) == EAGAIN) {
+         return EAGAIN;
+    }
+
+    _dstc_process_flush_timeout(ctx);
+    _dstc_update_flow_control(ctx);
+    return 0;
+}
+
+
+static int _dstc_process_pending_events(dstc_context_t* ctx)
+{
+    while(_dstc_process_single_event(ctx, 0) != ETIME)
+       ;
+    return 0;
+}
+
+// Process the pending events of the group context of ctx carrying
+// group, and its timeouts if timeout is set. Called when the epoll
+// descriptor of the group context, added to that of ctx, is readable.
+// ctx is released while the group context is locked.
+//
+// ctx must be non-null and locked
+void _dstc_process_group_events(dstc_context_t* ctx,
+                                uint32_t group,
+                                uint8_t timeout)
+{
+    dstc_context_t* group_ctx = (group < ctx->group_count)?ctx->group_ctx[group]:0;
+    uint32_t depth = 0;
+
+    if (!group_ctx)
+        return;
+
+    depth = _dstc_release_context(ctx);
+    _dstc_lock_context(group_ctx);
+    _dstc_process_pending_events(group_ctx);
+    if (timeout)
+        _dstc_process_timeout(group_ctx);
+    _dstc_unlock_context(group_ctx);
+    _dstc_reacquire_context(ctx, depth);
+}
+
+
+int dstc_process_pending_events(void)
+{
+    dstc_context_t* ctx = _dstc_current_context();
+    _dstc_lock_and_init_context(ctx);
+    _dstc_process_pending_events(ctx);
+    _dstc_unlock_context(ctx);
+
+    return 0;
+}
+
+int dstc_process_events(int timeout_rel)
+{
+    dstc_context_t* ctx = _dstc_current_context();
+    struct timespec abs_time = { 0 };
+    msec_timestamp_t start_time = 0;
+    int next_dstc_timeout_rel = 0;
+    int next_dstc_timeout_abs = 0;
+    int retval = 0;
+    int lock_res = 0;
+
+    if (timeout_rel == 0) {
+        while(1) {
+            _dstc_lock_context(ctx);
+            if (_dstc_process_single_event(ctx, 0) == ETIME) {
+                _dstc_process_timeout(ctx);
+                _dstc_unlock_context(ctx);
+                return ETIME;
+            }
+            _dstc_unlock_context(ctx);
+        }
+    }
+
+    start_time = _dstc_msec_monotonic_timestamp(&abs_time);
+    next_dstc_timeout_rel = _dstc_get_timeout_msec_rel(ctx, start_time);
+    next_dstc_timeout_abs = start_time + next_dstc_timeout_rel;
 
-    _dstc_lock_context(ctx);
+//    printf("Timeout_rel[%d]\n", timeout_rel);
 
-    ind = ctx->server_func_ind;
-    if (ind == SYMTAB_SIZE - 1) {
-        RMC_LOG_FATAL("Out of memory trying to register server function. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
-        exit(255);
+    // If we have infinite timeout, and no pending dstc timeouts,
+    // wait forever for incoming traffic.
+    if (timeout_rel == -1 && next_dstc_timeout_rel == -1) {
+        _dstc_lock_context(ctx);
+        _dstc_process_single_event(ctx, -1);
+        _dstc_unlock_context(ctx);
+        return 0;
     }
 
-    strcpy(ctx->server_func[ind].func_name, name);
-    ctx->server_func[ind].server_func = server_func;
-    ctx->server_func_ind++;
-    _dstc_unlock_context(ctx);
-}
+    // We have specified infinite timeout, however DSTC has
+    // its own timeout that we need to adhere to.
+    if (timeout_rel == -1)
+        timeout_rel = next_dstc_timeout_rel;
+    else
+        // We have an actual timeout specified, pick the shortest
+        // timeout of that and the next DSTC timeout.
+        timeout_rel = (next_dstc_timeout_rel != -1 &&
+                       next_dstc_timeout_rel < timeout_rel)?
+            next_dstc_timeout_rel:timeout_rel;
 
-// ctx can be unlocked and/or null (for default context)
-// Called by file constructor function _dstc_register_client_[name]()
-// generated by DSTC_CLIENT() macro.
+    // At this point, we are guarnteed that timeout_rel is not -1 (infinite)
+    // and specifies a timeout duration, which may be 0.
 
-//
-void dstc_register_client_function(dstc_context_t* ctx,
-                                   char* name,
-                                   void *client_func)
-{
-    int ind = 0;
+    // Do we have a zero timeout, or a timeout that has already
+    // expired?
+    if (timeout_rel <= 0) {
+        _dstc_lock_context(ctx);
+        _dstc_process_single_event(ctx, 0);
+        _dstc_process_timeout(ctx);
+        _dstc_unlock_context(ctx);
+        return ETIME;
+    }
 
-    if (!ctx)
-        ctx = &_dstc_default_context;
+    // We have an actual timeout value
+    // Adjust absolute time to the time
+    // when we need the mutex lock to stop
+    // waiting for acquisition.
+    //
+    abs_time.tv_nsec += timeout_rel * 1000000;
+    abs_time.tv_sec += abs_time.tv_nsec / 1000000000;
+    abs_time.tv_nsec = abs_time.tv_nsec % 1000000000;
 
-    _dstc_lock_context(ctx);
+    // Lock with the given timeout.
+    lock_res = _dstc_lock_and_init_context_timeout(ctx, &abs_time);
 
-    ind = ctx->client_func_ind;
-    if (ind == SYMTAB_SIZE - 1) {
-        RMC_LOG_FATAL("Out of memory trying to register client function. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
-        exit(255);
+    // Did we time out?
+    if (lock_res == ETIME) {
+        _dstc_process_timeout(ctx);
+        _dstc_unlock_context(ctx);
+        return ETIME;
     }
 
-    strcpy(ctx->client_func[ind].func_name, name);
-    ctx->client_func[ind].client_func = client_func;
-    ctx->client_func_ind++;
+    // Did we not get the lock immediately, and had to wait for it?
+    // If so recalcuate how much time we have left.
+    if (lock_res != ENOTBLK)
+        timeout_rel = next_dstc_timeout_abs - dstc_msec_monotonic_timestamp();
+
+    if (timeout_rel < 0)
+        timeout_rel = 0;
+    retval = _dstc_process_single_event(ctx, timeout_rel);
+
+    // Did we time out?
+    if (retval == ETIME)
+        _dstc_process_timeout(ctx);
+    else
+        // Keep the flush timer running under constant traffic.
+        _dstc_process_flush_timeout(ctx);
+
     _dstc_unlock_context(ctx);
+    return retval;
 }
 
-
-// Register a function name - pointer relationship.
-//
-// Called by file constructor function
-// _dstc_register_callback_sedrver_[name]() generated by
-// DSTC_CLIENT_CALLBACK_ARG() macro.
-//
-void dstc_register_callback_server(dstc_context_t* ctx,
-                                   dstc_callback_t callback_ref,
-                                   dstc_internal_dispatch_t callback)
+int dstc_process_timeout(void)
 {
+    dstc_context_t* ctx = _dstc_current_context();
+    int res = 0;
 
-    int ind = 0;
-    if (!ctx)
-        ctx = &_dstc_default_context;
+   _dstc_lock_and_init_context(ctx);
 
-    _dstc_lock_context(ctx);
+    res = _dstc_process_timeout(ctx);
+    _dstc_unlock_context(ctx);
+    return res;
+}
 
+void dstc_buffer_client_calls(void)
+{
+    dstc_buffer_client_calls_timed(0, 0);
+}
 
-    // Find a previously freed slot, or allocate a new one
-    while(ind < ctx->callback_ind) {
-        if (!ctx->local_callback[ind].callback)
-            break;
-        ++ind;
-    }
+// ctx must be non-null
+static void _dstc_buffer_client_calls(dstc_context_t* ctx,
+                                      uint32_t max_hold_usec,
+                                      uint32_t flush_bytes,
+                                      uint8_t adaptive)
+{
+    uint32_t ind = 0;
 
-    // Are we out of memory
-    if (ind == SYMTAB_SIZE) {
-        RMC_LOG_FATAL("Out of memory trying to register callback. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
-        exit(255);
+    _dstc_lock_and_init_context(ctx);
+    __atomic_store_n(&ctx->pub_flush_usec, max_hold_usec, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->pub_flush_bytes, flush_bytes, __ATOMIC_RELAXED);
+    ctx->pub_flush_adaptive = adaptive;
+    ctx->pub_flush_rate = 0;
+    ctx->pub_flush_latency_usec = 0;
+    ctx->pub_last_queue_usec = 0;
+
+    // Calls already buffered are held no longer than max_hold_usec
+    // from now.
+    if (max_hold_usec && _dstc_payload_buffer_in_use(ctx) > 0) {
+        ctx->pub_flush_deadline = rmc_usec_monotonic_timestamp() + max_hold_usec;
+        _dstc_wake_event_waiters(ctx);
     }
-    ctx->local_callback[ind].callback_ref = callback_ref;
-    ctx->local_callback[ind].callback = callback;
-    RMC_LOG_COMMENT("Registered server callback [%llX] to %p. Index[%d]",
-                    callback_ref, callback, ind);
-
-    // If we are allocating a new slot (not reusing an earlier one).
-    // then bump callback_ind to the new max index in use.
-    if (ind == ctx->callback_ind)
-        ctx->callback_ind++;
 
+    __atomic_store_n(&ctx->pub_is_buffering, 1, __ATOMIC_RELEASE);
     _dstc_unlock_context(ctx);
-    return;
+
+    // Group contexts buffer their calls the same way.
+    for(ind = 1; ind < ctx->group_count; ++ind)
+        if (ctx->group_ctx[ind])
+            _dstc_buffer_client_calls(ctx->group_ctx[ind],
+                                      max_hold_usec, flush_bytes, adaptive);
 }
 
-// Register a callback function name - pointer relationship.
-//
-// Called by file constructor function
-// _dstc_register_callback_[name]() generated by DSTC_CALLBACK()
-// macro.
-//
-// For now, we just bump a counter to figure out if we should
-// send out announce messages or not.
-//
-void dstc_register_callback_client(dstc_context_t* ctx,
-                                   char* name, void* callback)
+void dstc_buffer_client_calls_timed(uint32_t max_hold_usec, uint32_t flush_bytes)
 {
-    if (!ctx)
-        ctx = &_dstc_default_context;
-
-    _dstc_lock_context(ctx);
-    ctx->client_callback_count++;
-    _dstc_unlock_context(ctx);
+    _dstc_buffer_client_calls(_dstc_root_context(),
+                              max_hold_usec, flush_bytes, 0);
 }
 
+void dstc_buffer_client_calls_adaptive(uint32_t max_hold_usec)
+{
+    // Start out sending calls immediately.
+    _dstc_buffer_client_calls(_dstc_root_context(),
+                              max_hold_usec?max_hold_usec:DSTC_ADAPTIVE_DEFAULT_HOLD_USEC,
+                              DSTC_ADAPTIVE_MIN_WINDOW, 1);
+}
 
-// Returns EBUSY if outbound queues are full
-int dstc_queue_callback(dstc_context_t* ctx, dstc_callback_t addr, uint8_t* arg, uint32_t arg_sz)
+// ctx must be non-null
+static void _dstc_flush_client_calls(dstc_context_t* ctx)
 {
-    int res = 0;
-    if (!ctx)
-        ctx = &_dstc_default_context;
+    uint32_t ind = 0;
 
     _dstc_lock_and_init_context(ctx);
 
-    // Call with zero namelen to treat name as a 64bit integer.
-    // This integer will be mapped by the received through the
-    // ctx->local_callback
-    // table to a pending callback function.
-    res = _dstc_queue(ctx, 0, addr, arg, arg_sz);
+    // Dump thread buffers and payload buffer into RMC
+    _dstc_thread_buffer_merge_all(ctx);
+    _queue_pending_calls(ctx);
     _dstc_unlock_context(ctx);
-    return res;
+
+    for(ind = 1; ind < ctx->group_count; ++ind)
+        if (ctx->group_ctx[ind])
+            _dstc_flush_client_calls(ctx->group_ctx[ind]);
 }
 
-// Returns EBUSY if outbound queues are full
-int dstc_queue_func(dstc_context_t* ctx, char* name, uint8_t* arg, uint32_t arg_sz)
+void dstc_flush_client_calls(void)
 {
-    int res = 0;
-
-    if (!ctx)
-        ctx = &_dstc_default_context;
-
-    _dstc_lock_context(ctx);
-    res = _dstc_queue(ctx, name, 0, arg, arg_sz);
-    _dstc_unlock_context(ctx);
-    return res;
+    _dstc_flush_client_calls(_dstc_root_context());
 }
 
-//
-// ---------------------------------------------------------
-// Externally callable functions
- // ---------------------------------------------------------
-//
-
-void dstc_cancel_callback(dstc_internal_dispatch_t callback)
+// ctx must be non-null
+static void _dstc_unbuffer_client_calls(dstc_context_t* ctx)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    uint32_t ind = 0;
 
     _dstc_lock_and_init_context(ctx);
+    __atomic_store_n(&ctx->pub_is_buffering, 0, __ATOMIC_RELEASE);
 
-    // Will delete the callback.
-
-
-    _dstc_find_callback_by_func(ctx, callback);
+    // Dump thread buffers and payload buffer into RMC. Calls left
+    // since traffic is suspended are sent by
+    // _dstc_resume_pending_calls().
+    ctx->thread_buffer_stranded = (_dstc_thread_buffer_merge_all(ctx) == EBUSY);
+    _queue_pending_calls(ctx);
     _dstc_unlock_context(ctx);
+
+    for(ind = 1; ind < ctx->group_count; ++ind)
+        if (ctx->group_ctx[ind])
+            _dstc_unbuffer_client_calls(ctx->group_ctx[ind]);
 }
 
-uint8_t dstc_remote_function_available_by_name(char* func_name)
+void dstc_unbuffer_client_calls(void)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    _dstc_unbuffer_client_calls(_dstc_root_context());
+}
 
-    int ind = 0;
+void dstc_set_queue_budget(uint32_t max_bytes)
+{
+    dstc_context_t* ctx = _dstc_root_context();
+    uint32_t ind = 0;
 
-    _dstc_lock_and_init_context(ctx);
+    _dstc_lock_context(ctx);
+    ctx->pub_queue_budget = max_bytes;
+    _dstc_unlock_context(ctx);
 
-    // Scan all remotely registered nodes and their functions
-    // to see if you can find one with a matching na,e
-    ind = ctx->remote_node_ind;
-    while(ind--) {
-        if (ctx->remote_node[ind].node_id != 0 &&
-            !strcmp(func_name, ctx->remote_node[ind].func_name)) {
-            _dstc_unlock_context(ctx);
-            return 1;
-        }
+    for(ind = 1; ind < ctx->group_count; ++ind) {
+        if (!ctx->group_ctx[ind])
+            continue;
 
+        _dstc_lock_context(ctx->group_ctx[ind]);
+        ctx->group_ctx[ind]->pub_queue_budget = max_bytes;
+        _dstc_unlock_context(ctx->group_ctx[ind]);
     }
-    RMC_LOG_DEBUG("Could not find a remote node that had registered function %s", func_name);
-    _dstc_unlock_context(ctx);
-    return 0;
 }
 
-
-uint8_t dstc_remote_function_available(void* client_func)
+int dstc_get_flow_control_fd(void)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
-
-    int ind = 0;
-    uint8_t res = 0;
+    dstc_context_t* ctx = _dstc_current_context();
+    int res = -1;
 
     _dstc_lock_and_init_context(ctx);
+    if (ctx->flow_fd[0] != -1) {
+        res = ctx->flow_fd[0];
+        _dstc_unlock_context(ctx);
+        return res;
+    }
 
-    // Find the string name for the dstc_[func_name] function
-    // pointer provided in client_func
-
-    ind = ctx->client_func_ind;
-    while(ind--)
-        if (ctx->client_func[ind].client_func == client_func)
-            break;
-
-    // No hit?
-    if (ind == -1) {
+#if defined(__linux__) || defined(__ANDROID__)
+    ctx->flow_fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->flow_fd[0] == -1) {
+        RMC_LOG_ERROR("eventfd(): %s", strerror(errno));
         _dstc_unlock_context(ctx);
-        return 0;
+        return -1;
+    }
+    ctx->flow_fd[1] = ctx->flow_fd[0];
+#else
+    if (pipe(ctx->flow_fd) == -1) {
+        RMC_LOG_ERROR("pipe(): %s", strerror(errno));
+        _dstc_unlock_context(ctx);
+        return -1;
     }
+    fcntl(ctx->flow_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->flow_fd[1], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->flow_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ctx->flow_fd[1], F_SETFD, FD_CLOEXEC);
+#endif
 
-    res = dstc_remote_function_available_by_name(ctx->client_func[ind].func_name);
+    _dstc_update_flow_control(ctx);
+    if (!ctx->flow_suspended)
+        _dstc_flow_fd_signal(ctx);
+
+    res = ctx->flow_fd[0];
     _dstc_unlock_context(ctx);
     return res;
 }
 
-msec_timestamp_t dstc_msec_monotonic_timestamp(void)
+void dstc_set_flow_control_callback(void (*callback)(uint8_t suspended))
 {
-    struct timespec res;
-    return _dstc_msec_monotonic_timestamp(&res);
+    dstc_context_t* ctx = _dstc_current_context();
+
+    _dstc_lock_context(ctx);
+    ctx->flow_control_cb = callback;
+    _dstc_unlock_context(ctx);
 }
 
+// Return 1 if outbound traffic of any group context of ctx is
+// suspended. ctx is released while the group contexts are locked.
+//
+// ctx must be non-null and locked
+static int _dstc_groups_suspended(dstc_context_t* ctx)
+{
+    uint32_t depth = 0;
+    uint32_t ind = 0;
+    int res = 0;
+
+    if (ctx->group_count < 2)
+        return 0;
 
+    depth = _dstc_release_context(ctx);
+    for(ind = 1; ind < ctx->group_count; ++ind) {
+        dstc_context_t* group_ctx = ctx->group_ctx[ind];
 
-int dstc_get_timeout_msec_rel(void)
-{
-    return _dstc_get_timeout_msec_rel(dstc_msec_monotonic_timestamp());
-}
+        if (!group_ctx)
+            continue;
 
-static int _dstc_process_timeout(dstc_context_t* ctx)
-{
-    // If either of the timeout processor fails in with EAGAIN, then they
-    // tried resending un-acknolwedged packets but encountered full transmissions
-    // queues in rmc.
-    // In that case process events until the queues are sent out on the network
-    // and are cleared up.
-    if (rmc_pub_timeout_process(ctx->pub_ctx) == EAGAIN ||
-        rmc_sub_timeout_process(ctx->sub_ctx) == EAGAIN) {
-         return EAGAIN;
+        _dstc_lock_context(group_ctx);
+        _dstc_update_flow_control(group_ctx);
+        res |= group_ctx->pub_suspended;
+        _dstc_unlock_context(group_ctx);
     }
-    return 0;
+    _dstc_reacquire_context(ctx, depth);
+    return res;
 }
 
-
-static int _dstc_process_pending_events(dstc_context_t* ctx)
+// Wait on flow_cond for a traffic resumption, or for the thread
+// waiting for events to return, whichever comes first.
+//
+// ctx must be non-null and locked exactly once by the caller.
+static void _dstc_flow_wait(dstc_context_t* ctx, int timeout_msec)
 {
-    while(_dstc_process_single_event(ctx, 0) != ETIME)
-       ;
-    return 0;
-}
+    struct timespec abs_time;
+
+    ctx->flow_waiters++;
+    ctx->lock_depth--;
+
+    if (timeout_msec == -1)
+        pthread_cond_wait(&ctx->flow_cond, &ctx->lock);
+    else {
+        clock_gettime(CLOCK_REALTIME, &abs_time);
+        abs_time.tv_sec += timeout_msec / 1000;
+        abs_time.tv_nsec += (timeout_msec % 1000) * 1000000;
+        abs_time.tv_sec += abs_time.tv_nsec / 1000000000;
+        abs_time.tv_nsec = abs_time.tv_nsec % 1000000000;
+        pthread_cond_timedwait(&ctx->flow_cond, &ctx->lock, &abs_time);
+    }
 
+    ctx->lock_depth++;
+    ctx->flow_waiters--;
+}
 
-int dstc_process_pending_events(void)
+int dstc_wait_for_capacity(int timeout_msec)
 {
-    dstc_context_t* ctx = &_dstc_default_context;
-    _dstc_lock_and_init_context(ctx);
-    _dstc_process_pending_events(ctx);
-    _dstc_unlock_context(ctx);
+    if (timeout_msec == -1)
+        return dstc_wait_for_capacity_until(0);
 
-    return 0;
+    return dstc_wait_for_capacity_until(dstc_msec_monotonic_timestamp() +
+                                        (timeout_msec > 0?timeout_msec:0));
 }
 
-int dstc_process_events(int timeout_rel)
+int dstc_wait_for_capacity_until(msec_timestamp_t deadline)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
-    struct timespec abs_time = { 0 };
-    msec_timestamp_t start_time = 0;
-    int next_dstc_timeout_rel = 0;
-    int next_dstc_timeout_abs = 0;
-    int retval = 0;
-    int lock_res = 0;
-
-    if (timeout_rel == 0) {
-        while(1) {
-            _dstc_lock_context(ctx);
-            if (_dstc_process_single_event(ctx, 0) == ETIME) {
-                _dstc_process_timeout(ctx);
-                _dstc_unlock_context(ctx);
-                return ETIME;
-            }
-            _dstc_unlock_context(ctx);
-        }
-    }
-
-    start_time = _dstc_msec_monotonic_timestamp(&abs_time);
-    next_dstc_timeout_rel = _dstc_get_timeout_msec_rel(start_time);
-    next_dstc_timeout_abs = start_time + next_dstc_timeout_rel;
+    dstc_context_t* ctx = _dstc_root_context();
+    int res = 0;
 
-//    printf("Timeout_rel[%d]\n", timeout_rel);
+    _dstc_lock_and_init_context(ctx);
 
-    // If we have infinite timeout, and no pending dstc timeouts,
-    // wait forever for incoming traffic.
-    if (timeout_rel == -1 && next_dstc_timeout_rel == -1) {
-        _dstc_lock_context(ctx);
-        _dstc_process_single_event(ctx, -1);
+    // We cannot release a lock held further up the call stack.
+    if (ctx->lock_depth > 1) {
         _dstc_unlock_context(ctx);
-        return 0;
+        return EDEADLK;
     }
 
-    // We have specified infinite timeout, however DSTC has
-    // its own timeout that we need to adhere to.
-    if (timeout_rel == -1)
-        timeout_rel = next_dstc_timeout_rel;
-    else
-        // We have an actual timeout specified, pick the shortest
-        // timeout of that and the next DSTC timeout.
-        timeout_rel = (next_dstc_timeout_rel != -1 &&
-                       next_dstc_timeout_rel < timeout_rel)?
-            next_dstc_timeout_rel:timeout_rel;
+    while(1) {
+        msec_timestamp_t now = 0;
+        int wait_msec = -1;
+        int dstc_timeout = 0;
 
-    // At this point, we are guarnteed that timeout_rel is not -1 (infinite)
-    // and specifies a timeout duration, which may be 0.
+        // Calls may be queued in any multicast group.
+        _dstc_update_flow_control(ctx);
+        if (!ctx->pub_suspended && !_dstc_groups_suspended(ctx))
+            break;
 
-    // Do we have a zero timeout, or a timeout that has already
-    // expired?
-    if (timeout_rel <= 0) {
-        _dstc_lock_context(ctx);
-        _dstc_process_single_event(ctx, 0);
-        _dstc_process_timeout(ctx);
+        now = dstc_msec_monotonic_timestamp();
+        if (deadline) {
+            if (now >= deadline) {
+                res = ETIME;
+                break;
+            }
+            wait_msec = (int) (deadline - now);
+        }
+
+        // Is another thread waiting for events, or are the events
+        // owned by an epoll loop of the application? If so, let
+        // them process the acks that will lift the suspension.
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+        if (ctx->event_wait_threads || !ctx->epoll_fd_owned) {
+#else
+        if (ctx->event_wait_threads) {
+#endif
+            _dstc_flow_wait(ctx, wait_msec);
+            continue;
+        }
+
+        // Process events ourselves, observing DSTC timeouts.
+        // Group context timeouts are retrieved without holding ctx.
         _dstc_unlock_context(ctx);
-        return ETIME;
+        dstc_timeout = _dstc_get_timeout_msec_rel(ctx, now);
+        _dstc_lock_context(ctx);
+        if (dstc_timeout != -1 && (wait_msec == -1 || dstc_timeout < wait_msec))
+            wait_msec = dstc_timeout;
+
+        if (_dstc_process_single_event(ctx, wait_msec) == ETIME)
+            _dstc_process_timeout(ctx);
     }
 
-    // We have an actual timeout value
-    // Adjust absolute time to the time
-    // when we need the mutex lock to stop
-    // waiting for acquisition.
-    //
-    abs_time.tv_nsec += timeout_rel * 1000000;
-    abs_time.tv_sec += abs_time.tv_nsec / 1000000000;
-    abs_time.tv_nsec = abs_time.tv_nsec % 1000000000;
+    _dstc_unlock_context(ctx);
+    return res;
+}
 
-    // Lock with the given timeout.
-    lock_res = _dstc_lock_and_init_context_timeout(ctx, &abs_time);
+// ctx must be non-null
+static int _dstc_setup_executor(dstc_context_t* ctx,
+                                uint32_t thread_count,
+                                int ordering,
+                                uint32_t max_packets)
+{
+    dstc_exec_worker_t* worker = 0;
+    uint32_t ind = 0;
+    int res = 0;
 
-    // Did we time out?
-    if (lock_res == ETIME) {
-        _dstc_process_timeout(ctx);
+    if (!thread_count ||
+        (ordering != DSTC_EXECUTOR_ORDER_FUNCTION &&
+         ordering != DSTC_EXECUTOR_ORDER_NODE &&
+         ordering != DSTC_EXECUTOR_UNORDERED))
+        return EINVAL;
+
+    _dstc_lock_context(ctx);
+    if (ctx->exec_worker_count) {
         _dstc_unlock_context(ctx);
-        return ETIME;
+        return EBUSY;
     }
 
-    // Did we not get the lock immediately, and had to wait for it?
-    // If so recalcuate how much time we have left.
-    if (lock_res != ENOTBLK)
-        timeout_rel = next_dstc_timeout_abs - dstc_msec_monotonic_timestamp();
+    worker = (dstc_exec_worker_t*) calloc(thread_count, sizeof(dstc_exec_worker_t));
+    if (!worker) {
+        RMC_LOG_FATAL("Out of memory trying to setup %d executor workers", thread_count);
+        exit(255);
+    }
 
-    if (timeout_rel < 0)
-        timeout_rel = 0;
-    retval = _dstc_process_single_event(ctx, timeout_rel);
+    pthread_mutex_lock(&ctx->exec_lock);
+    ctx->exec_worker = worker;
+    ctx->exec_ordering = ordering;
+    ctx->exec_max_packets = max_packets?max_packets:DSTC_EXECUTOR_DEFAULT_MAX_PACKETS;
+    ctx->exec_next_worker = 0;
 
-    // Did we time out?
-    if (retval == ETIME)
-        _dstc_process_timeout(ctx);
+    for(ind = 0; ind < thread_count; ++ind) {
+        worker[ind].ctx = ctx;
+        pthread_cond_init(&worker[ind].cond, 0);
+
+        res = pthread_create(&worker[ind].thread, 0, _dstc_executor_worker, &worker[ind]);
+        if (res) {
+            RMC_LOG_FATAL("pthread_create(): %s", strerror(res));
+            exit(255);
+        }
+    }
+
+    // Enable the executor once all worker thread IDs are known.
+    ctx->exec_worker_count = thread_count;
+    pthread_mutex_unlock(&ctx->exec_lock);
 
     _dstc_unlock_context(ctx);
-    return retval;
+    return 0;
 }
 
-int dstc_process_timeout(void)
+int dstc_setup_executor(uint32_t thread_count,
+                        int ordering,
+                        uint32_t max_packets)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
-    int res = 0;
+    dstc_context_t* ctx = _dstc_root_context();
+    uint32_t ind = 0;
+    int res = _dstc_setup_executor(ctx, thread_count, ordering, max_packets);
 
-   _dstc_lock_and_init_context(ctx);
+    // Group contexts get workers of their own. Those created later
+    // are given workers when they are setup.
+    for(ind = 1; !res && ind < ctx->group_count; ++ind)
+        if (ctx->group_ctx[ind])
+            _dstc_setup_executor(ctx->group_ctx[ind], thread_count, ordering, max_packets);
 
-    res = _dstc_process_timeout(ctx);
-    _dstc_unlock_context(ctx);
     return res;
 }
 
-void dstc_buffer_client_calls(void)
+// ctx must be non-null and not locked by the calling thread
+static void _dstc_shutdown_executor(dstc_context_t* ctx)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
-    _dstc_lock_and_init_context(ctx);
-    ctx->pub_is_buffering = 1;
-    _dstc_unlock_context(ctx);
-}
+    dstc_exec_worker_t* worker = 0;
+    uint32_t count = 0;
+    uint32_t ind = 0;
 
-void dstc_flush_client_calls(void)
-{
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    // New calls are executed directly once exec_worker_count is 0.
+    _dstc_lock_context(ctx);
+    pthread_mutex_lock(&ctx->exec_lock);
+    worker = ctx->exec_worker;
+    count = ctx->exec_worker_count;
+    ctx->exec_worker_count = 0;
+    ctx->exec_stopping = 1;
 
-    _dstc_lock_and_init_context(ctx);
+    for(ind = 0; ind < count; ++ind)
+        pthread_cond_signal(&worker[ind].cond);
 
-    // Dump buffer into RMC
-    _queue_pending_calls(ctx);
+    pthread_cond_broadcast(&ctx->exec_space_cond);
+    pthread_mutex_unlock(&ctx->exec_lock);
+    _dstc_unlock_context(ctx);
+
+    // Workers need the context lock to finish their calls.
+    for(ind = 0; ind < count; ++ind) {
+        pthread_join(worker[ind].thread, 0);
+        pthread_cond_destroy(&worker[ind].cond);
+    }
+
+    _dstc_lock_context(ctx);
+    pthread_mutex_lock(&ctx->exec_lock);
+    ctx->exec_worker = 0;
+    ctx->exec_stopping = 0;
+    pthread_mutex_unlock(&ctx->exec_lock);
+    free(worker);
+
+    if (ctx->exec_pending) {
+        ctx->exec_pending = 0;
+        dstc_process_incoming(ctx->sub_ctx);
+    }
     _dstc_unlock_context(ctx);
 }
 
-void dstc_unbuffer_client_calls(void)
+void dstc_shutdown_executor(void)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    dstc_context_t* ctx = _dstc_root_context();
+    uint32_t ind = 0;
 
-    _dstc_lock_and_init_context(ctx);
-    ctx->pub_is_buffering = 0;
-    // Dump buffer into RMC
-    _queue_pending_calls(ctx);
-    _dstc_unlock_context(ctx);
+    _dstc_shutdown_executor(ctx);
+    for(ind = 1; ind < ctx->group_count; ++ind)
+        if (ctx->group_ctx[ind])
+            _dstc_shutdown_executor(ctx->group_ctx[ind]);
 }
 
 
 uint32_t dstc_get_socket_count(void)
 {
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    dstc_context_t* ctx = _dstc_current_context();
     uint32_t res = 0;
 
     _dstc_lock_and_init_context(ctx);
@@ -1366,9 +6124,45 @@ uint32_t dstc_get_socket_count(void)
 }
 
 
+void dstc_get_stats(dstc_stats_t* stats)
+{
+    dstc_context_t* ctx = _dstc_current_context();
+
+    _dstc_lock_context(ctx);
+    stats->pub_pool_allocated = ctx->pub_pool_allocated;
+    stats->pub_pool_in_use = ctx->pub_pool_in_use;
+    stats->pub_pool_high_water = ctx->pub_pool_high_water;
+    stats->pub_pool_reused = ctx->pub_pool_reused;
+    stats->pub_packets_queued = ctx->pub_packets_queued;
+    stats->pub_flush_bytes = ctx->pub_flush_bytes;
+    stats->pub_flush_window_changes = ctx->pub_flush_window_changes;
+    stats->pub_flush_rate = ctx->pub_flush_rate;
+    stats->pub_flush_latency_usec = ctx->pub_flush_latency_usec;
+    stats->pub_suspended_count = ctx->pub_suspended_count;
+    stats->pub_queue_len = ctx->pub_queue_len;
+    stats->pub_queue_bytes = ctx->pub_queue_bytes;
+    stats->pub_queue_high_water = ctx->pub_queue_high_water;
+    stats->pub_queue_budget_exhausted = ctx->pub_queue_budget_exhausted;
+    stats->pub_compact_calls = ctx->pub_compact_calls;
+    stats->pub_direct_callbacks = ctx->pub_direct_callbacks;
+    stats->sub_pool_in_use = ctx->sub_pool_in_use;
+    stats->sub_pool_heap_allocs = ctx->sub_pool_heap_allocs;
+    stats->sub_pool_reused = ctx->sub_pool_reused;
+    stats->sub_batches = ctx->sub_batches;
+    stats->sub_batched_calls = ctx->sub_batched_calls;
+    stats->sub_packets_skipped = ctx->sub_packets_skipped;
+
+    pthread_mutex_lock(&ctx->exec_lock);
+    stats->exec_calls = ctx->exec_calls;
+    stats->exec_stolen = ctx->exec_stolen;
+    stats->exec_stalls = ctx->exec_stalls;
+    pthread_mutex_unlock(&ctx->exec_lock);
+    _dstc_unlock_context(ctx);
+}
+
 rmc_node_id_t dstc_get_node_id(void)
 {
-    dstc_context_t* ctx = &_dstc_default_context;
+    dstc_context_t* ctx = _dstc_current_context();
     rmc_node_id_t res = 0;
     _dstc_lock_and_init_context(ctx);
 
@@ -1378,7 +6172,103 @@ rmc_node_id_t dstc_get_node_id(void)
     return res;
 }
 
-int dstc_setup_epoll(int epoll_fd_arg)
+// Read the function to group map in path, if set, and spread the
+// functions of ctx across group_count multicast groups once it is
+// setup. See dstc_setup_groups().
+//
+// ctx must be non-null and locked
+static int _dstc_setup_groups(dstc_context_t* ctx,
+                              uint32_t group_count,
+                              char* path)
+{
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+    uint32_t max_group = 0;
+    uint32_t line_no = 0;
+    char line[512];
+    FILE* file = 0;
+
+    if (group_count > DSTC_MAX_GROUPS || (!group_count && !path))
+        return EINVAL;
+
+    if (path && !(file = fopen(path, "r"))) {
+        int res = errno;
+
+        RMC_LOG_ERROR("Could not open multicast group map [%s]: %s", path, strerror(res));
+        return res;
+    }
+
+    ctx->group_map_ind = 0;
+    while(file && fgets(line, sizeof(line), file)) {
+        char name[256];
+        unsigned int group = 0;
+        int fields = sscanf(line, " %255s %u", name, &group);
+
+        ++line_no;
+
+        // Skip blank lines and comments.
+        if (fields < 1 || name[0] == '#')
+            continue;
+
+        if (fields != 2 || group >= (group_count?group_count:DSTC_MAX_GROUPS)) {
+            RMC_LOG_ERROR("%s:%d: Expected function name and group below %d",
+                          path, line_no, group_count?group_count:DSTC_MAX_GROUPS);
+            ctx->group_map_ind = 0;
+            fclose(file);
+            return EINVAL;
+        }
+
+        if (ctx->group_map_ind == ctx->group_map_size) {
+            uint32_t new_size = ctx->group_map_size?(ctx->group_map_size * 2):SYMTAB_SIZE;
+            dstc_group_map_t* new_map = realloc(ctx->group_map,
+                                                new_size * sizeof(dstc_group_map_t));
+
+            if (!new_map) {
+                RMC_LOG_FATAL("Out of memory trying to map function [%s] to group %d",
+                              name, group);
+                exit(255);
+            }
+            ctx->group_map = new_map;
+            ctx->group_map_size = new_size;
+        }
+
+        strcpy(ctx->group_map[ctx->group_map_ind].func_name, name);
+        ctx->group_map[ctx->group_map_ind].group = group;
+        ctx->group_map_ind++;
+
+        if (group > max_group)
+            max_group = group;
+    }
+
+    if (file)
+        fclose(file);
+
+    ctx->group_count = group_count?group_count:(max_group + 1);
+    RMC_LOG_INFO("Functions spread across %d multicast groups. %d mapped by [%s]",
+                 ctx->group_count, ctx->group_map_ind, path?path:"");
+    return 0;
+#else
+    return ENOTSUP;
+#endif
+}
+
+int dstc_setup_groups(uint32_t group_count, char* group_map_file)
+{
+    dstc_context_t* ctx = _dstc_current_context();
+    int res = 0;
+
+    if (_dstc_context_initialized(ctx))
+        return EBUSY;
+
+    _dstc_lock_context(ctx);
+    res = _dstc_setup_groups(ctx, group_count, group_map_file);
+    _dstc_unlock_context(ctx);
+    return res;
+}
+
+// Setup ctx using the DSTC_ENV_XXX environment variables.
+//
+// ctx must be non-null
+static int _dstc_setup_env(dstc_context_t* ctx, int epoll_fd_arg)
 {
     char* node_id = getenv(DSTC_ENV_NODE_ID);
     char* max_dstc_nodes = getenv(DSTC_ENV_MAX_NODES);
@@ -1389,6 +6279,8 @@ int dstc_setup_epoll(int epoll_fd_arg)
     char *control_listen_port = getenv(DSTC_ENV_CONTROL_LISTEN_PORT);
     char *mcast_ttl = getenv(DSTC_ENV_MCAST_TTL);
     char *log_level = getenv(DSTC_ENV_LOG_LEVEL);
+    char *group_count = getenv(DSTC_ENV_MCAST_GROUP_COUNT);
+    char *group_map = getenv(DSTC_ENV_MCAST_GROUP_MAP);
     int res = 0;
 
     rmc_set_log_level(log_level?atoi(log_level):RMC_LOG_LEVEL_ERROR);
@@ -1401,10 +6293,20 @@ int dstc_setup_epoll(int epoll_fd_arg)
     RMC_LOG_COMMENT("%s: %s", DSTC_ENV_MCAST_TTL, mcast_ttl?mcast_ttl:"[not set]");
     RMC_LOG_COMMENT("%s: %s", DSTC_ENV_CONTROL_LISTEN_IFACE, control_listen_iface_addr?control_listen_iface_addr:"[not set]");
     RMC_LOG_COMMENT("%s: %s", DSTC_ENV_CONTROL_LISTEN_PORT, control_listen_port?control_listen_port:"[not set]");
-
-    dstc_context_t* ctx = &_dstc_default_context;
+    RMC_LOG_COMMENT("%s: %s", DSTC_ENV_MCAST_GROUP_COUNT, group_count?group_count:"[not set]");
+    RMC_LOG_COMMENT("%s: %s", DSTC_ENV_MCAST_GROUP_MAP, group_map?group_map:"[not set]");
 
     _dstc_lock_context(ctx);
+
+    // Groups setup by dstc_setup_groups() take precedence.
+    if ((group_count || group_map) && !ctx->group_count &&
+        (res = _dstc_setup_groups(ctx,
+                                  (group_count?atoi(group_count):0),
+                                  group_map))) {
+        _dstc_unlock_context(ctx);
+        return res;
+    }
+
     res =  dstc_setup_internal(ctx,
                                (node_id?((rmc_node_id_t) strtoul(node_id, 0, 0)):0),
                                (max_dstc_nodes?atoi(max_dstc_nodes):DEFAULT_MAX_DSTC_NODES),
@@ -1421,15 +6323,34 @@ int dstc_setup_epoll(int epoll_fd_arg)
 }
 
 
-int dstc_setup(void)
+// Setup ctx using the DSTC_ENV_XXX environment variables and an
+// epoll descriptor of its own.
+//
+// ctx must be non-null
+static int _dstc_setup_default(dstc_context_t* ctx)
 {
 #if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
-    return dstc_setup_epoll(epoll_create(1));
+    int res = _dstc_setup_env(ctx, epoll_create(1));
+
+    if (!res)
+        ctx->epoll_fd_owned = 1;
+
+    return res;
 #else
-    return dstc_setup_epoll(-1);
+    return _dstc_setup_env(ctx, -1);
 #endif
 }
 
+int dstc_setup_epoll(int epoll_fd_arg)
+{
+    return _dstc_setup_env(_dstc_current_context(), epoll_fd_arg);
+}
+
+int dstc_setup(void)
+{
+    return _dstc_setup_default(_dstc_current_context());
+}
+
 int dstc_setup2(int epoll_fd_arg, // Ignored by non Android/Linux use
                 rmc_node_id_t node_id,
                 int max_dstc_nodes,
@@ -1441,7 +6362,7 @@ int dstc_setup2(int epoll_fd_arg, // Ignored by non Android/Linux use
                 int control_listen_port,
                 int log_level)
 {
-    dstc_context_t* ctx = &_dstc_default_context;
+    dstc_context_t* ctx = _dstc_current_context();
     int res = 0;
 
     if (_dstc_context_initialized(ctx))
@@ -1467,6 +6388,144 @@ int dstc_setup2(int epoll_fd_arg, // Ignored by non Android/Linux use
                               -1
 #endif
         );
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+    if (!res && epoll_fd_arg == -1)
+        ctx->epoll_fd_owned = 1;
+#endif
     _dstc_unlock_context(ctx);
     return res;
 }
+
+struct dstc_context* dstc_create_context(void)
+{
+    dstc_context_t* ctx = 0;
+
+    _dstc_lock_context(&_dstc_default_context);
+    ctx = _dstc_create_context_from(&_dstc_default_context);
+    _dstc_unlock_context(&_dstc_default_context);
+
+    return ctx;
+}
+
+struct dstc_context* dstc_use_context(struct dstc_context* ctx)
+{
+    dstc_context_t* prev_ctx = _dstc_current_context();
+
+    _dstc_thread_context = (ctx == &_dstc_default_context)?0:ctx;
+    return prev_ctx;
+}
+
+struct dstc_context* dstc_current_context(void)
+{
+    return _dstc_current_context();
+}
+
+static void _dstc_free_packet_list(dstc_packet_buffer_t* buf)
+{
+    while(buf) {
+        dstc_packet_buffer_t* next = buf->next_free;
+
+        free(buf);
+        buf = next;
+    }
+}
+
+void dstc_destroy_context(struct dstc_context* ctx)
+{
+    uint32_t ind = 0;
+
+    if (!ctx || ctx == &_dstc_default_context)
+        return;
+
+    // Group contexts go with the context that created them.
+    for(ind = 1; ind < ctx->group_count; ++ind)
+        if (ctx->group_ctx[ind])
+            dstc_destroy_context(ctx->group_ctx[ind]);
+
+    _dstc_shutdown_executor(ctx);
+
+    if (_dstc_thread_context == ctx)
+        _dstc_thread_context = 0;
+
+    _dstc_lock_context(ctx);
+    if (_dstc_context_initialized(ctx)) {
+        // Inbound and published packets still held by RMC are
+        // handed back to the pools when the contexts are deactivated.
+        // Deactivation closes the RMC descriptors, removing them from
+        // the poll set, but leaves the contexts allocated by
+        // rmc_[pub|sub]_init_context() to us.
+        rmc_sub_deactivate_context(ctx->sub_ctx);
+        rmc_pub_deactivate_context(ctx->pub_ctx);
+        free(ctx->sub_ctx);
+        free(ctx->pub_ctx);
+        ctx->sub_ctx = 0;
+        ctx->pub_ctx = 0;
+
+#if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
+        if (ctx->epoll_fd_owned)
+            close(ctx->epoll_fd);
+
+        close(ctx->wake_fd[0]);
+#else
+        // Closes wake_fd[0] as well.
+        _dstc_poll_close_all(ctx);
+#endif
+        if (ctx->wake_fd[1] != ctx->wake_fd[0])
+            close(ctx->wake_fd[1]);
+
+        ctx->wake_fd[0] = -1;
+        ctx->wake_fd[1] = -1;
+
+        while(ctx->thread_buffer) {
+            dstc_thread_buffer_t* tb = ctx->thread_buffer;
+
+            ctx->thread_buffer = tb->next;
+            pthread_mutex_destroy(&tb->lock);
+            free(tb);
+        }
+        pthread_key_delete(ctx->thread_buffer_key);
+    }
+
+    if (ctx->flow_fd[0] != -1)
+        close(ctx->flow_fd[0]);
+
+    if (ctx->flow_fd[1] != -1 && ctx->flow_fd[1] != ctx->flow_fd[0])
+        close(ctx->flow_fd[1]);
+
+    // Calls not yet handed over to RMC are discarded.
+    if (ctx->pub_buffer)
+        free(DSTC_PACKET_BUFFER(ctx->pub_buffer));
+
+    _dstc_free_packet_list(ctx->pub_queue_head);
+    _dstc_free_packet_list(ctx->pub_pool_free);
+    for(ind = 0; ind < DSTC_RX_POOL_CLASS_COUNT; ++ind)
+        _dstc_free_packet_list(ctx->sub_pool_free[ind]);
+
+    while(ctx->exec_call_free) {
+        dstc_exec_call_t* call = ctx->exec_call_free;
+
+        ctx->exec_call_free = call->next;
+        free(call);
+    }
+
+    for(ind = 0; ind < ctx->server_func_ind; ++ind)
+        free(ctx->server_func[ind].func_name);
+
+    for(ind = 0; ind < ctx->publisher_ind; ++ind)
+        free(ctx->publisher[ind].func);
+
+    free(ctx->server_func);
+    free(ctx->server_func_hash);
+    free(ctx->publisher);
+    free(ctx->remote_node);
+    free(ctx->callback_slot);
+    free(ctx->reply_buffer);
+    free(ctx->group_map);
+    _dstc_unlock_context(ctx);
+
+    pthread_cond_destroy(&ctx->flow_cond);
+    pthread_cond_destroy(&ctx->exec_space_cond);
+    pthread_mutex_destroy(&ctx->exec_lock);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
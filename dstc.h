@@ -10,6 +10,7 @@
 #define __DSTC_H__
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <reliable_multicast.h>
 #include <pthread.h>
 
@@ -29,6 +30,16 @@ extern "C" {
 
 typedef intptr_t dstc_callback_t;
 
+// Set in callback references whose callback can be invoked by a
+// reply sent directly to the node that made the call, instead of
+// being multicast to all nodes.
+#define DSTC_CALLBACK_REF_TARGETED (1ULL << 63)
+
+// Set, together with DSTC_CALLBACK_REF_TARGETED, in callback
+// references handed to server functions that also identify the
+// calling node. See dstc_import_callback_ref().
+#define DSTC_CALLBACK_REF_REPLY (1ULL << 62)
+
 // Internal callback
 // callback_ref is not used by DSTC C-implementation, but is there
 // to help python and other languages map the callback reference
@@ -39,6 +50,23 @@ typedef void (*dstc_internal_dispatch_t)(dstc_callback_t callback_ref,
                                          uint8_t* payload,
                                          uint16_t payload_len);
 
+// A call to a DSTC_SERVER_BATCH() function, handed over together with
+// the directly following calls to the same function in the packet.
+typedef struct dstc_batch_call {
+    uint8_t* payload;
+    uint16_t payload_len;
+} dstc_batch_call_t;
+
+typedef void (*dstc_internal_batch_dispatch_t)(rmc_node_id_t node_id,
+                                               dstc_batch_call_t* calls,
+                                               uint32_t count);
+
+// Max number of calls handed over to a DSTC_SERVER_BATCH() function
+// at once, and the max stack space used by the arrays its arguments
+// are decoded into. Batches that do not fit are split up.
+#define DSTC_BATCH_MAX_CALLS 256
+#define DSTC_BATCH_STACK_SIZE 16384
+
 
 // Single context
 struct dstc_context;
@@ -57,6 +85,63 @@ extern int dstc_setup(void);
 
 extern int dstc_setup_epoll(int epollfd);
 
+// Independent contexts.
+//
+// All DSTC functions, including the dstc_[name]() functions generated
+// by DSTC_CLIENT() and DSTC_SERVER_CALLBACK(), operate on the context
+// bound to the calling thread by dstc_use_context(). Threads that
+// have not bound a context use the default context.
+//
+// A context has its own RMC publisher and subscriber, epoll
+// descriptor, buffers and lock. Server functions and callbacks are
+// invoked with their context bound, so calls made from them go out
+// through the context that received the call.
+//
+// Create a new context, inheriting all DSTC_CLIENT(), DSTC_SERVER()
+// and DSTC_CLIENT_CALLBACK() functions registered so far.
+// The context is setup by the first DSTC call made while it is
+// bound, or explicitly by dstc_setup(), dstc_setup2() or
+// dstc_setup_epoll().
+extern struct dstc_context* dstc_create_context(void);
+
+// Bind ctx to the calling thread, or bind the default context if
+// ctx is 0. Returns the previously bound context.
+extern struct dstc_context* dstc_use_context(struct dstc_context* ctx);
+
+// Return the context bound to the calling thread.
+extern struct dstc_context* dstc_current_context(void);
+
+// Multicast group partitioning.
+//
+// Spread the functions of the current context across group_count
+// multicast groups, so that each node only receives the traffic of
+// the groups carrying functions it serves or calls. Group N uses the
+// multicast address and port of the context plus N. Functions listed
+// in group_map_file, one "function_name group" pair per line, are
+// carried by the given group. All other functions are carried by the
+// hash of their name modulo group_count. If group_count is 0, it is
+// set to the highest group in group_map_file plus one.
+// All nodes must use the same group setup.
+//
+// Must be called before the context is setup. The
+// DSTC_MCAST_GROUP_COUNT and DSTC_MCAST_GROUP_MAP environment
+// variables have the same effect for contexts setup from the
+// environment.
+//
+// Returns EINVAL if group_count is above DSTC_MAX_GROUPS or the map
+// file is malformed, the errno value of fopen() if the map file
+// cannot be opened, EBUSY if the context is already setup, and
+// ENOTSUP when built with USE_POLL.
+#define DSTC_MAX_GROUPS 16
+extern int dstc_setup_groups(uint32_t group_count, char* group_map_file);
+
+// Stop the executor of a context created by dstc_create_context(),
+// close its connections and free it. Calls not yet sent are
+// discarded. ctx must not be in use by any other thread, and must
+// not be destroyed from a server function. If ctx is bound to the
+// calling thread, the thread reverts to the default context.
+extern void dstc_destroy_context(struct dstc_context* ctx);
+
 
 // Start buffering outbound calls into larger packets.
 // Packets will be sent either when the outbound buffer is full (63KB), or
@@ -77,10 +162,74 @@ extern int dstc_setup_epoll(int epollfd);
 // Invoke dstc_flush_client_calls() to transmit buffered client calls
 // without disabling buffered mode.
 //
+// In buffered mode, each thread collects its DSTC_CLIENT() calls in
+// a buffer of its own, which is moved into the outbound packet
+// when it is full, when calls are flushed, or when the thread
+// exits. Calls made by a single thread are always sent in order.
+//
 extern void dstc_buffer_client_calls(void);
+
+// Start buffering outbound calls as dstc_buffer_client_calls() does,
+// but queue the buffered calls automatically once flush_bytes bytes of
+// calls have been buffered, or max_hold_usec microseconds after the
+// first of them was made, whichever comes first.
+// The timer is driven by dstc_process_events(), whose timeout is
+// shortened accordingly. A thread already waiting in
+// dstc_process_events() is woken up when a call made by another
+// thread starts the timer. Applications running their own event loop
+// should call dstc_get_timeout_msec_rel() again after each event.
+// Set flush_bytes to 0 to only queue full packets, and max_hold_usec
+// to 0 to disable the timer.
+extern void dstc_buffer_client_calls_timed(uint32_t max_hold_usec,
+                                           uint32_t flush_bytes);
+
+// Start buffering outbound calls with a flush threshold that adapts
+// to the load. While few packets are in flight, calls are sent as
+// soon as they are made. As packets back up in RMC, the threshold
+// grows towards full packets, as far as the rate of calls fills them
+// within half of max_hold_usec. It shrinks again once traffic drains,
+// or once calls wait longer than that. Calls are never held longer
+// than max_hold_usec microseconds. Set max_hold_usec to 0 for the
+// default.
+extern void dstc_buffer_client_calls_adaptive(uint32_t max_hold_usec);
 extern void dstc_flush_client_calls(void);
 extern void dstc_unbuffer_client_calls(void);
 
+// Ordering policies for dstc_setup_executor()
+//
+// Calls to the same server function are executed in the order they
+// were received.
+#define DSTC_EXECUTOR_ORDER_FUNCTION 0
+
+// Calls from the same client node are executed in the order they
+// were received.
+#define DSTC_EXECUTOR_ORDER_NODE 1
+
+// No ordering. Idle workers steal calls queued to busy workers.
+#define DSTC_EXECUTOR_UNORDERED 2
+
+// Execute incoming server function calls on thread_count worker
+// threads instead of on the thread calling dstc_process_events().
+// Callbacks are still executed by the thread calling
+// dstc_process_events().
+//
+// max_packets is the max number of received packets whose calls can
+// wait for workers at once. Set to 0 for the default. Once reached,
+// dstc_process_events() blocks until workers catch up, which will
+// in turn make RMC suspend traffic from the clients.
+//
+// Returns EINVAL if thread_count is 0 or ordering is not a
+// DSTC_EXECUTOR_XXX policy, or EBUSY if the executor is already
+// running.
+//
+extern int dstc_setup_executor(uint32_t thread_count,
+                               int ordering,
+                               uint32_t max_packets);
+
+// Wait for all queued calls to be executed and stop the worker
+// threads. Must not be called from a server function.
+extern void dstc_shutdown_executor(void);
+
 // DSTC_EVENT_FLAG is used to determine if the .data returned with
 // a returned (epoll or poll) event is to be processed by DSTC, or if
 // the event was supplied by the calling code outside DSTC.
@@ -109,18 +258,213 @@ extern msec_timestamp_t dstc_msec_monotonic_timestamp(void);
 // Return the number of milliseconds until the next timeout.
 extern int dstc_get_timeout_msec_rel(void);
 
+// Outbound flow control.
+//
+// Client calls return EBUSY when RMC has suspended outbound traffic
+// since too many packets are waiting to be acknowledged by the
+// subscribers. Instead of spinning on dstc_process_events() until
+// the call goes through, a thread can block until capacity returns.
+//
+// dstc_wait_for_capacity() returns 0 once outbound traffic is not
+// suspended, or ETIME if timeout_msec milliseconds pass first. Set
+// timeout_msec to -1 to wait forever. If no other thread is waiting
+// in dstc_process_events(), the calling thread processes events
+// itself while it waits. If the epoll descriptor was supplied by
+// the application through dstc_setup_epoll(), the application's
+// event loop is relied on to process events instead.
+// dstc_wait_for_capacity_until() takes an absolute deadline from
+// dstc_msec_monotonic_timestamp() instead, or 0 to wait forever.
+// Both return EDEADLK if called from within a DSTC callback that
+// holds the context lock.
+//
+// DSTC_CLIENT() also generates dstc_[name]_wait(), which takes a
+// timeout in milliseconds followed by the arguments of dstc_[name](),
+// and waits for capacity as needed to queue the call.
+//
+// dstc_get_flow_control_fd() returns a descriptor that is readable
+// while outbound traffic is not suspended, to be added to an
+// external epoll or poll loop. The descriptor is owned by DSTC and
+// must not be read or closed by the application. Returns -1 on
+// failure.
+//
+// dstc_set_flow_control_callback() installs a callback that is
+// invoked with suspended set to 1 when outbound traffic is suspended
+// and with 0 when it resumes. The callback is invoked with the
+// context lock held and must not make any DSTC calls.
+//
+// If functions are spread across multicast groups by
+// dstc_setup_groups(), traffic is reported as suspended while it is
+// suspended in any of the groups.
+extern int dstc_wait_for_capacity(int timeout_msec);
+extern int dstc_wait_for_capacity_until(msec_timestamp_t deadline);
+extern int dstc_get_flow_control_fd(void);
+extern void dstc_set_flow_control_callback(void (*callback)(uint8_t suspended));
+
+// Set the max number of bytes of calls that can be held in full
+// packets waiting for RMC to resume suspended traffic. Calls are
+// only refused with EBUSY once the outbound queue has reached this
+// budget. The queued packets are sent in order as traffic resumes.
+// Set to 0 to refuse calls as soon as the packet being filled is
+// full. Default is four full packets.
+extern void dstc_set_queue_budget(uint32_t max_bytes);
+
+// Run time statistics, retrieved by dstc_get_stats()
+typedef struct {
+    // Outbound packet buffers allocated from the heap.
+    uint32_t pub_pool_allocated;
+
+    // Outbound packet buffers currently being filled or in flight.
+    uint32_t pub_pool_in_use;
+
+    // Highest number of outbound packet buffers in use at once.
+    uint32_t pub_pool_high_water;
+
+    // Number of times a packet buffer was recycled instead of
+    // being allocated.
+    uint64_t pub_pool_reused;
+
+    // Number of packets handed over to RMC.
+    uint64_t pub_packets_queued;
+
+    // Number of buffered bytes that triggers a flush, or 0 if
+    // calls are only flushed in full packets.
+    uint32_t pub_flush_bytes;
+
+    // Number of times the flush threshold has been adjusted in
+    // adaptive mode.
+    uint64_t pub_flush_window_changes;
+
+    // Average rate of calls sent, in bytes per second, and average
+    // time calls waited to be sent, in adaptive mode.
+    uint64_t pub_flush_rate;
+    uint32_t pub_flush_latency_usec;
+
+    // Number of times RMC has suspended outbound traffic.
+    uint64_t pub_suspended_count;
+
+    // Number of full packets, and the bytes of calls they hold,
+    // currently waiting for RMC to resume traffic.
+    uint32_t pub_queue_len;
+    uint32_t pub_queue_bytes;
+
+    // Highest number of packets waiting for RMC at once.
+    uint32_t pub_queue_high_water;
+
+    // Number of times a call was refused with EBUSY since the
+    // outbound queue had reached its budget.
+    uint64_t pub_queue_budget_exhausted;
+
+    // Number of calls sent in compact blocks.
+    uint64_t pub_compact_calls;
+
+    // Number of callbacks sent directly to the calling node instead
+    // of being multicast.
+    uint64_t pub_direct_callbacks;
+
+    // Number of inbound payload buffers currently held by RMC or
+    // being dispatched.
+    uint32_t sub_pool_in_use;
+
+    // Number of inbound payload buffers allocated from the heap.
+    // Stays flat once the receive pool has warmed up.
+    uint64_t sub_pool_heap_allocs;
+
+    // Number of inbound payload buffers recycled instead of being
+    // allocated, i.e. heap allocations avoided.
+    uint64_t sub_pool_reused;
+
+    // Number of batches of consecutive calls handed to
+    // DSTC_SERVER_BATCH() functions, and the calls they held.
+    uint64_t sub_batches;
+    uint64_t sub_batched_calls;
+
+    // Number of received packets skipped since their filter showed
+    // no calls to our server functions.
+    uint64_t sub_packets_skipped;
+
+    // Number of calls handed over to executor workers.
+    uint64_t exec_calls;
+
+    // Number of calls executed by another worker than the one they
+    // were queued to.
+    uint64_t exec_stolen;
+
+    // Number of times incoming packets had to wait for executor
+    // workers to catch up.
+    uint64_t exec_stalls;
+} dstc_stats_t;
+
+extern void dstc_get_stats(dstc_stats_t* stats);
+
 extern rmc_node_id_t dstc_get_node_id(void);
 extern uint8_t dstc_remote_function_available(void* func_ptr);
 extern uint8_t dstc_remote_function_available_by_name(char* func_name);
 extern void dstc_cancel_callback(dstc_internal_dispatch_t callback);
 
+// Anycast policies of a DSTC_CLIENT() function, set with
+// dstc_set_anycast_policy(). With any policy but DSTC_ANYCAST_NONE,
+// each dstc_[name]() call is sent to a single one of the servers of
+// the function, as if made through dstc_[name]_to().
+//
+// Call all servers of the function. The default.
+#define DSTC_ANYCAST_NONE 0
+
+// Call the servers one after the other.
+#define DSTC_ANYCAST_ROUND_ROBIN 1
+
+// Call the server with the fewest callbacks passed to it in earlier
+// calls that have not been invoked or cancelled yet.
+#define DSTC_ANYCAST_LEAST_OUTSTANDING 2
+
+// Hash the first argument of each call onto the servers, keeping
+// calls with the same first argument on the same server. See
+// dstc_anycast_node() for how keys move when servers come and go.
+// Functions without arguments, or with a callback as first
+// argument, send all calls to the same server.
+#define DSTC_ANYCAST_KEY_HASH 3
+
+// Set the anycast policy of the dstc_[name] function func_ptr in the
+// current context.
+// Only servers supporting targeted calls are picked. If none of the
+// servers do, calls are sent to all of them.
+// Returns ENOENT if func_ptr is not a DSTC_CLIENT() function, and
+// EINVAL if policy is not a DSTC_ANYCAST_XXX value.
+extern int dstc_set_anycast_policy(void* func_ptr, uint8_t policy);
+
+// Return the server of the dstc_[name] function func_ptr that key
+// maps to, for use with dstc_[name]_to(). The same key maps to the
+// same server as long as it serves the function, and only the keys
+// of a server that goes away, or a share of keys for a server that
+// comes up, are moved.
+// Returns 0 if no server supporting targeted calls serves the
+// function.
+extern rmc_node_id_t dstc_anycast_node(void* func_ptr, uint64_t key);
+
+// Cancel a single pending callback by the reference returned by
+// DSTC_CLIENT_CALLBACK_ARG().
+// Returns ENOENT if the callback has already been invoked or cancelled.
+extern int dstc_cancel_callback_ref(dstc_callback_t callback_ref);
+
+// Return the user data provided to DSTC_CLIENT_CALLBACK_ARG_USER_DATA()
+// for a callback reference. Only valid until the callback has
+// returned.
+extern void* dstc_callback_user_data(dstc_callback_t callback_ref);
+
 
 //
 // Functions used by DSTC_ macros
 //
 extern dstc_callback_t dstc_activate_callback(struct dstc_context*,
-                                              dstc_callback_t,
-                                              dstc_internal_dispatch_t);
+                                              dstc_internal_dispatch_t,
+                                              void*);
+
+extern dstc_callback_t dstc_import_callback_ref(struct dstc_context*,
+                                                rmc_node_id_t,
+                                                dstc_callback_t);
+
+extern dstc_callback_t dstc_export_callback_ref(dstc_callback_t);
+
+extern void dstc_drop_misaligned_call(rmc_node_id_t);
 
 extern void dstc_register_callback_client(struct dstc_context*,
                                           char*,
@@ -130,17 +474,65 @@ extern void dstc_register_callback_server(struct dstc_context*,
                                           dstc_callback_t,
                                           dstc_internal_dispatch_t);
 
-extern void dstc_register_client_function(struct dstc_context*, char*, void *);
+extern uint32_t dstc_register_client_function(struct dstc_context*, char*, void *);
 
 extern void dstc_register_server_function(struct dstc_context*,
                                           char*,
                                           dstc_internal_dispatch_t);
 
+extern void dstc_register_server_batch_function(struct dstc_context*,
+                                                char*,
+                                                dstc_internal_dispatch_t,
+                                                dstc_internal_batch_dispatch_t);
+
 extern int dstc_queue_func(struct dstc_context*  ctx,
                            char* name,
                            uint8_t* arg_buf,
                            uint32_t arg_sz);
 
+extern int dstc_queue_client_func(struct dstc_context*  ctx,
+                                  uint32_t client_func_id,
+                                  char* name,
+                                  uint8_t* arg_buf,
+                                  uint32_t arg_sz);
+
+extern int dstc_reserve_client_func(struct dstc_context*  ctx,
+                                    uint32_t client_func_id,
+                                    char* name,
+                                    const void* key,
+                                    uint32_t key_len,
+                                    uint32_t arg_sz,
+                                    uint8_t** arg_buf);
+
+extern int dstc_reserve_targeted_client_func(struct dstc_context*  ctx,
+                                             rmc_node_id_t node_id,
+                                             uint32_t client_func_id,
+                                             char* name,
+                                             uint32_t arg_sz,
+                                             uint8_t** arg_buf);
+
+extern int dstc_reserve_callback(struct dstc_context*  ctx,
+                                 dstc_callback_t addr,
+                                 uint32_t arg_sz,
+                                 uint8_t** arg_buf);
+
+extern void dstc_commit_call(struct dstc_context*  ctx);
+
+extern struct dstc_context* dstc_bulk_begin(struct dstc_context*  ctx);
+
+extern struct dstc_context* dstc_bulk_begin_client_func(struct dstc_context*  ctx,
+                                                        uint32_t client_func_id);
+
+extern int dstc_bulk_reserve_client_func(struct dstc_context*  ctx,
+                                         uint32_t client_func_id,
+                                         char* name,
+                                         const void* key,
+                                         uint32_t key_len,
+                                         uint32_t arg_sz,
+                                         uint8_t** arg_buf);
+
+extern void dstc_bulk_end(struct dstc_context*  ctx);
+
 extern int dstc_queue_callback(struct dstc_context*  ctx,
                                dstc_callback_t addr,
                                uint8_t* arg_buf,
@@ -216,8 +608,8 @@ typedef struct {
 #define DSTC_DECL_STRING_ARG DSTC,
 
 // Tag for dynamic data magic cookie: "DSTC" = 0x44535443
-// Used by DESERIALIZE_ARGUMENT and SERIALIZE_ARGUMENT
-// to detect dynamic data arguments
+// Dynamic data arguments are detected by their DSTC type name
+// at compile time, see _DSTC_ARG_KIND().
 //#define DSTC_DYNARG_TAG 0x43545344
 #define DSTC_DYNARG_TAG 0x43545344
 
@@ -244,8 +636,8 @@ typedef dstc_dynamic_data_t dstc_string_t;
 //
 
 // Tag for function pointer argument. "CBCK" = 0x4342434B
-// Used by DESERIALIZE_ARGUMENT and SERIALIZE_ARGUMENT
-// to detect callback function arguments
+// Callback arguments are detected by their CBCK type name
+// at compile time, see _DSTC_ARG_KIND().
 //
 #define DSTC_CALLBACK_TAG 0x4B434243
 
@@ -261,7 +653,7 @@ typedef dstc_callback_t CBCK;
 // For now, we'll just silence the warning.
 
 
-#define DSTC_CLIENT_CALLBACK(_func, ...)                                \
+#define _DSTC_CLIENT_CALLBACK(_func, _mode, ...)                        \
     static void _dstc_cb_##_func(dstc_callback_t callback_ref,          \
                                  rmc_node_id_t node_id,                 \
                                  uint8_t *func_name,                    \
@@ -271,21 +663,63 @@ typedef dstc_callback_t CBCK;
         (void) func_name;                                               \
         (void) callback_ref;                                            \
         (void) node_id;                                                 \
-        DECLARE_VARIABLES(__VA_ARGS__);                                 \
-        DESERIALIZE_ARGUMENTS(__VA_ARGS__);                             \
-        (*_func)(LIST_ARGUMENTS(__VA_ARGS__));                          \
+        DECLARE_##_mode##VARIABLES(__VA_ARGS__);                        \
+        DESERIALIZE_##_mode##ARGUMENTS(__VA_ARGS__);                    \
+        (*_func)(LIST_##_mode##ARGUMENTS(__VA_ARGS__));                 \
+        return;                                                         \
+    }                                                                   \
+
+#define DSTC_CLIENT_CALLBACK(_func, ...)                                \
+    _DSTC_CLIENT_CALLBACK(_func, , __VA_ARGS__)
+
+// Same as DSTC_CLIENT_CALLBACK(), but for callbacks invoked through a
+// DSTC_SERVER_CALLBACK_ALIGNED()-generated function. Array arguments
+// are passed as for DSTC_SERVER_ALIGNED().
+#define DSTC_CLIENT_CALLBACK_ALIGNED(_func, ...)                        \
+    _DSTC_CLIENT_CALLBACK(_func, ALIGNED_, __VA_ARGS__)
+
+// Same as DSTC_CLIENT_CALLBACK(), but _func receives the user data
+// provided to DSTC_CLIENT_CALLBACK_ARG_USER_DATA() as its first argument.
+// void _func(void* user_data, ...);
+#define _DSTC_CLIENT_CALLBACK_USER_DATA(_func, _mode, ...)              \
+    static void _dstc_cb_##_func(dstc_callback_t callback_ref,          \
+                                 rmc_node_id_t node_id,                 \
+                                 uint8_t *func_name,                    \
+                                 uint8_t* payload,                      \
+                                 uint16_t payload_len)                  \
+    {                                                                   \
+        (void) func_name;                                               \
+        (void) node_id;                                                 \
+        DECLARE_##_mode##VARIABLES(__VA_ARGS__);                        \
+        DESERIALIZE_##_mode##ARGUMENTS(__VA_ARGS__);                    \
+        (*_func)(dstc_callback_user_data(callback_ref)                  \
+                 LIST_NEXT_##_mode##ARGUMENTS(__VA_ARGS__));            \
         return;                                                         \
     }                                                                   \
 
+#define DSTC_CLIENT_CALLBACK_USER_DATA(_func, ...)                      \
+    _DSTC_CLIENT_CALLBACK_USER_DATA(_func, , __VA_ARGS__)
+
+#define DSTC_CLIENT_CALLBACK_USER_DATA_ALIGNED(_func, ...)              \
+    _DSTC_CLIENT_CALLBACK_USER_DATA(_func, ALIGNED_, __VA_ARGS__)
+
 // Null callback that will generate a no-op on when invoked on the
 // server.
 #define DSTC_CLIENT_CALLBACK_ARG_NULL ((dstc_callback_t) 0)
 
+// Each use generates a new callback reference, allowing several
+// calls with the same callback function to be pending at once.
 #define DSTC_CLIENT_CALLBACK_ARG(_func)         \
     dstc_activate_callback(                     \
         0,                                      \
-        (dstc_callback_t) _func,                \
-        _dstc_cb_##_func)                       \
+        _dstc_cb_##_func,                       \
+        0)                                      \
+
+#define DSTC_CLIENT_CALLBACK_ARG_USER_DATA(_func, _user_data)   \
+    dstc_activate_callback(                                     \
+        0,                                                      \
+        _dstc_cb_##_func,                                       \
+        (void*) (_user_data))                                   \
 
 
 // Thanks to https://codecraft.co/2014/11/25/variadic-macros-tricks for
@@ -362,66 +796,292 @@ typedef dstc_callback_t CBCK;
                  _LE4,  _ERR, _LE2, _LE0)(_call, ##__VA_ARGS__)
 
 
-#define SERIALIZE_ARGUMENT(arg_id, type, size)                          \
-    switch(*(uint32_t*) #type) {                                        \
-    case DSTC_DYNARG_TAG: {                                             \
-        dstc_dynamic_data_t* tmp = (dstc_dynamic_data_t*) &_a##arg_id;  \
-                                                                        \
-        memcpy(payload, (void*) &tmp->length, sizeof(uint16_t));        \
-        payload += sizeof(uint16_t);                                    \
-                                                                        \
-        memcpy((void*) payload, tmp->data, (size_t) tmp->length);        \
-        payload += tmp->length;                                        \
-        break;                                                          \
-    }                                                                   \
-    case DSTC_CALLBACK_TAG:                                             \
+// Resolve the kind of an argument at compile time, so that each
+// signature only gets the serialization code its arguments need:
+// DYNAMIC for DSTC, CALLBACK for CBCK, SCALAR for any other type
+// without size, and ARRAY for any other type with a size such as [32].
+//
+// The type name is pasted onto _DSTC_ARG_KIND_PROBE_, which only
+// expands, into an extra leading argument, for DSTC and CBCK. An
+// empty size leaves _DSTC_SCALAR_PROBE followed by (), which expands
+// the same way.
+#define _DSTC_SECOND(...) _DSTC_SECOND_(__VA_ARGS__)
+#define _DSTC_SECOND_(_first, _second, ...) _second
+#define _DSTC_CAT(_a, _b) _DSTC_CAT_(_a, _b)
+#define _DSTC_CAT_(_a, _b) _a##_b
+
+#define _DSTC_ARG_KIND_PROBE_DSTC ~, DYNAMIC,
+#define _DSTC_ARG_KIND_PROBE_CBCK ~, CALLBACK,
+#define _DSTC_SCALAR_PROBE() ~, SCALAR,
+#define _DSTC_FIXED_KIND(size) _DSTC_SECOND(_DSTC_SCALAR_PROBE size (), ARRAY, ~)
+#define _DSTC_ARG_KIND(type, size) \
+    _DSTC_SECOND(_DSTC_ARG_KIND_PROBE_##type, _DSTC_FIXED_KIND(size), ~)
+
+// Expand to _macro_DYNAMIC, _macro_CALLBACK, _macro_SCALAR, or
+// _macro_ARRAY, depending on the argument kind.
+#define _DSTC_ARG_DISPATCH(_macro, arg_id, type, size) \
+    _DSTC_CAT(_macro##_, _DSTC_ARG_KIND(type, size))(arg_id, type, size)
+
+
+// Dynamic data is serialized as a 16 bit length followed by the data.
+#define SERIALIZE_ARGUMENT_DYNAMIC(arg_id, type, size)                  \
+    memcpy(payload, (void*) &_a##arg_id.length, sizeof(uint16_t));      \
+    payload += sizeof(uint16_t);                                        \
+    memcpy((void*) payload, _a##arg_id.data, (size_t) _a##arg_id.length); \
+    payload += _a##arg_id.length;
+
+// A reference received by a server function is passed on as it was
+// sent by its client, leaving replies from other nodes multicast.
+#define SERIALIZE_ARGUMENT_CALLBACK(arg_id, type, size)                 \
+    if ((uint64_t) _a##arg_id & DSTC_CALLBACK_REF_REPLY) {              \
+        dstc_callback_t _ref = dstc_export_callback_ref(_a##arg_id);    \
+        memcpy(payload, (void*) &_ref, sizeof(dstc_callback_t));        \
+    } else                                                              \
         memcpy(payload, (void*) &_a##arg_id, sizeof(dstc_callback_t));  \
-        payload += sizeof(dstc_callback_t);                             \
-        break;                                                          \
-                                                                        \
-    default:                                                            \
-        if (sizeof(type size ) == sizeof(type))                         \
-            memcpy((void*) payload, (void*) &_a##arg_id, sizeof(type size)); \
-        else {                                                          \
-            void **tmp =  (void**) &_a##arg_id;                         \
-            memcpy((void*) payload, *tmp, sizeof(type size));           \
-        }                                                               \
-        payload += sizeof(type size);                                   \
-    }
+    payload += sizeof(dstc_callback_t);
+
+#define SERIALIZE_ARGUMENT_SCALAR(arg_id, type, size)                   \
+    memcpy((void*) payload, (void*) &_a##arg_id, sizeof(type));         \
+    payload += sizeof(type);
+
+// Array arguments are passed as a pointer to their first element.
+#define SERIALIZE_ARGUMENT_ARRAY(arg_id, type, size)                    \
+    memcpy((void*) payload, (void*) _a##arg_id, sizeof(type size));     \
+    payload += sizeof(type size);
 
+#define SERIALIZE_ARGUMENT(arg_id, type, size)                          \
+    _DSTC_ARG_DISPATCH(SERIALIZE_ARGUMENT, arg_id, type, size)
+
+
+// The data of a dynamic argument points into the payload, and is
+// only valid until the server function returns.
+#define DESERIALIZE_ARGUMENT_DYNAMIC(arg_id, type, size)                \
+    memcpy((void*) &_a##arg_id.length, payload, sizeof(uint16_t));      \
+    payload += sizeof(uint16_t);                                        \
+    _a##arg_id.data = payload;                                          \
+    payload += _a##arg_id.length;
+
+// Targeted references are tagged with the calling node, which is
+// where replies through them are sent.
+#define DESERIALIZE_ARGUMENT_CALLBACK(arg_id, type, size)               \
+    memcpy((void*)&_a##arg_id, payload, sizeof(dstc_callback_t));       \
+    if ((uint64_t) _a##arg_id & DSTC_CALLBACK_REF_TARGETED)             \
+        _a##arg_id = dstc_import_callback_ref(0, node_id, _a##arg_id);  \
+    payload += sizeof(dstc_callback_t);
+
+#define DESERIALIZE_ARGUMENT_SCALAR(arg_id, type, size)                 \
+    memcpy((void*) &_a##arg_id, (void*) payload, sizeof(type));         \
+    payload += sizeof(type);
+
+#define DESERIALIZE_ARGUMENT_ARRAY(arg_id, type, size)                  \
+    memcpy((void*) _a##arg_id, (void*) payload, sizeof(type size));     \
+    payload += sizeof(type size);
 
 #define DESERIALIZE_ARGUMENT(arg_id, type, size)                        \
-    switch(*(uint32_t*) #type) {                                        \
-    case DSTC_DYNARG_TAG: {                                             \
-        dstc_dynamic_data_t* tmp = (dstc_dynamic_data_t*) &_a##arg_id;  \
-                                                                        \
-        memcpy((void*) &tmp->length, payload, sizeof(uint16_t));        \
-        payload += sizeof(uint16_t);                                    \
-                                                                        \
-        tmp->data = payload;                                            \
-        payload += tmp->length;                                         \
-        break;                                                          \
-    }                                                                   \
-    case DSTC_CALLBACK_TAG:                                             \
-        memcpy((void*)&_a##arg_id, payload, sizeof(dstc_callback_t));   \
-        payload += sizeof(dstc_callback_t);                             \
-        break;                                                          \
-                                                                        \
-    default:                                                            \
-        if (sizeof(type size) == sizeof(type))                          \
-            memcpy((void*) &_a##arg_id, (void*) payload, sizeof(type size)); \
-        else                                                            \
-            memcpy((void*) _a_ptr##arg_id, (void*) payload, sizeof(type size)); \
-        payload += sizeof(type size);                                   \
-    }
+    _DSTC_ARG_DISPATCH(DESERIALIZE_ARGUMENT, arg_id, type, size)
 
 
 #define DECLARE_ARGUMENT(arg_id, type, size) type _a##arg_id size
 #define LIST_ARGUMENT(arg_id, type, size) _a##arg_id
-#define DECLARE_VARIABLE(arg_id, type, size) type _a##arg_id size ; type *_a_ptr##arg_id = (type*) &_a##arg_id;
-#define SIZE_ARGUMENT(arg_id, type, size) ((* (uint32_t*) #type == DSTC_DYNARG_TAG)? \
-                                           (sizeof(uint32_t) + dstc_dyndata_length((dstc_dynamic_data_t*) &_a##arg_id)): \
-                                           sizeof(type size)) +
+#define LIST_NEXT_ARGUMENT(arg_id, type, size) , _a##arg_id
+#define DECLARE_NEXT_ARGUMENT(arg_id, type, size) , type _a##arg_id size
+#define DECLARE_BULK_ARGUMENT(arg_id, type, size) , type (*_a##arg_id) size
+#define LIST_BULK_ARGUMENT(arg_id, type, size) , _a##arg_id[_ind]
+#define DECLARE_VARIABLE(arg_id, type, size) type _a##arg_id size ;
+
+// Signatures without dynamic data arguments sum up to a compile time
+// constant.
+#define SIZE_ARGUMENT_DYNAMIC(arg_id, type, size) \
+    (sizeof(uint16_t) + dstc_dyndata_length(&_a##arg_id)) +
+#define SIZE_ARGUMENT_CALLBACK(arg_id, type, size) sizeof(dstc_callback_t) +
+#define SIZE_ARGUMENT_SCALAR(arg_id, type, size) sizeof(type) +
+#define SIZE_ARGUMENT_ARRAY(arg_id, type, size) sizeof(type size) +
+#define SIZE_ARGUMENT(arg_id, type, size)                               \
+    _DSTC_ARG_DISPATCH(SIZE_ARGUMENT, arg_id, type, size)
+
+// The first argument of a call is its anycast key, hashed by
+// DSTC_ANYCAST_KEY_HASH. ANYCAST_KEY_ARGUMENTS() expands to a pointer
+// to the key and its length in bytes, which are 0 for functions
+// without arguments or with a callback as first argument.
+#define ANYCAST_KEY_ARGUMENT_DYNAMIC(arg_id, type, size) \
+    (const void*) _a##arg_id.data, (uint32_t) _a##arg_id.length
+#define ANYCAST_KEY_ARGUMENT_CALLBACK(arg_id, type, size) 0, 0
+#define ANYCAST_KEY_ARGUMENT_SCALAR(arg_id, type, size) \
+    (const void*) &_a##arg_id, (uint32_t) sizeof(type)
+#define ANYCAST_KEY_ARGUMENT_ARRAY(arg_id, type, size) \
+    (const void*) _a##arg_id, (uint32_t) sizeof(type size)
+#define ANYCAST_KEY_ARGUMENT(arg_id, type, size)                        \
+    _DSTC_ARG_DISPATCH(ANYCAST_KEY_ARGUMENT, arg_id, type, size)
+
+// Arguments are numbered from the last one, making the first of N
+// arguments number N.
+#define _KE0(_call) 0, 0
+#define _KE2(_call, type, size, ...) _call(1, type, size)
+#define _KE4(_call, type, size, ...) _call(2, type, size)
+#define _KE6(_call, type, size, ...) _call(3, type, size)
+#define _KE8(_call, type, size, ...) _call(4, type, size)
+#define _KE10(_call, type, size, ...) _call(5, type, size)
+#define _KE12(_call, type, size, ...) _call(6, type, size)
+#define _KE14(_call, type, size, ...) _call(7, type, size)
+#define _KE16(_call, type, size, ...) _call(8, type, size)
+#define _KE18(_call, type, size, ...) _call(9, type, size)
+#define _KE20(_call, type, size, ...) _call(10, type, size)
+#define _KE22(_call, type, size, ...) _call(11, type, size)
+#define _KE24(_call, type, size, ...) _call(12, type, size)
+#define _KE26(_call, type, size, ...) _call(13, type, size)
+#define _KE28(_call, type, size, ...) _call(14, type, size)
+#define _KE30(_call, type, size, ...) _call(15, type, size)
+#define _KE32(_call, type, size, ...) _call(16, type, size)
+
+#define FOR_FIRST_VARIADIC_MACRO(_call, ...)                            \
+    _GET_NTH_ARG(__VA_ARGS__,                                           \
+                 _KE32, _ERR, _KE30, _ERR,                              \
+                 _KE28, _ERR, _KE26, _ERR,                              \
+                 _KE24, _ERR, _KE22, _ERR,                              \
+                 _KE20, _ERR, _KE18, _ERR,                              \
+                 _KE16, _ERR, _KE14, _ERR,                              \
+                 _KE12, _ERR, _KE10, _ERR,                              \
+                 _KE8,  _ERR, _KE6,  _ERR,                              \
+                 _KE4,  _ERR, _KE2, _KE0)(_call, ##__VA_ARGS__)
+
+
+// Aligned layout, used by DSTC_CLIENT_ALIGNED() and
+// DSTC_SERVER_ALIGNED(). Each argument is padded to the natural
+// alignment of its type, and array arguments are passed to the server
+// function as pointers straight into the received packet instead of
+// being copied out.
+//
+// The arguments start with a byte holding the number of padding
+// bytes that follow it, which place the start of the arguments,
+// _base, at an offset in the packet aligned to _DSTC_ARGS_ALIGNMENT.
+// Packets are received in buffers aligned at least as much, and
+// calls moved to another packet keep their offset modulo
+// _DSTC_ARGS_ALIGNMENT, so the receiver uses the arguments where they
+// are. Padding of each argument is computed from its offset from
+// _base. Arguments with a larger alignment are not supported.
+//
+// Dynamic data is aligned to _DSTC_DYNAMIC_ALIGNMENT, allowing it to
+// hold an array of structs.
+#define _DSTC_DYNAMIC_ALIGNMENT 8
+#define _DSTC_ARGS_ALIGNMENT 8
+#define _DSTC_ALIGN_PTR(_ptr, _align)                                   \
+    (_base + (((uintptr_t) ((_ptr) - _base) + (_align) - 1) & ~((uintptr_t) (_align) - 1)))
+
+// Zero the padding, so that no stale data is sent.
+#define _DSTC_PAD_PAYLOAD(_align)                                       \
+    {                                                                   \
+        uint8_t* _aligned = _DSTC_ALIGN_PTR(payload, _align);           \
+        while(payload < _aligned)                                       \
+            *payload++ = 0;                                             \
+    }
+
+#define SERIALIZE_ALIGNED_ARGUMENT_DYNAMIC(arg_id, type, size)          \
+    _DSTC_PAD_PAYLOAD(__alignof__(uint16_t));                           \
+    memcpy(payload, (void*) &_a##arg_id.length, sizeof(uint16_t));      \
+    payload += sizeof(uint16_t);                                        \
+    _DSTC_PAD_PAYLOAD(_DSTC_DYNAMIC_ALIGNMENT);                         \
+    memcpy((void*) payload, _a##arg_id.data, (size_t) _a##arg_id.length); \
+    payload += _a##arg_id.length;
+
+#define SERIALIZE_ALIGNED_ARGUMENT_CALLBACK(arg_id, type, size)         \
+    _DSTC_PAD_PAYLOAD(__alignof__(dstc_callback_t));                    \
+    SERIALIZE_ARGUMENT_CALLBACK(arg_id, type, size)
+
+#define SERIALIZE_ALIGNED_ARGUMENT_SCALAR(arg_id, type, size)           \
+    _DSTC_PAD_PAYLOAD(__alignof__(type));                               \
+    SERIALIZE_ARGUMENT_SCALAR(arg_id, type, size)
+
+#define SERIALIZE_ALIGNED_ARGUMENT_ARRAY(arg_id, type, size)            \
+    _DSTC_PAD_PAYLOAD(__alignof__(type));                               \
+    SERIALIZE_ARGUMENT_ARRAY(arg_id, type, size)
+
+#define SERIALIZE_ALIGNED_ARGUMENT(arg_id, type, size)                  \
+    _DSTC_ARG_DISPATCH(SERIALIZE_ALIGNED_ARGUMENT, arg_id, type, size)
+
+
+#define DESERIALIZE_ALIGNED_ARGUMENT_DYNAMIC(arg_id, type, size)        \
+    payload = _DSTC_ALIGN_PTR(payload, __alignof__(uint16_t));          \
+    memcpy((void*) &_a##arg_id.length, payload, sizeof(uint16_t));      \
+    payload = _DSTC_ALIGN_PTR(payload + sizeof(uint16_t), _DSTC_DYNAMIC_ALIGNMENT); \
+    _a##arg_id.data = payload;                                          \
+    payload += _a##arg_id.length;
+
+#define DESERIALIZE_ALIGNED_ARGUMENT_CALLBACK(arg_id, type, size)       \
+    payload = _DSTC_ALIGN_PTR(payload, __alignof__(dstc_callback_t));   \
+    DESERIALIZE_ARGUMENT_CALLBACK(arg_id, type, size)
+
+#define DESERIALIZE_ALIGNED_ARGUMENT_SCALAR(arg_id, type, size)         \
+    payload = _DSTC_ALIGN_PTR(payload, __alignof__(type));              \
+    DESERIALIZE_ARGUMENT_SCALAR(arg_id, type, size)
+
+// Array arguments are not copied. The pointer passed to the server
+// function points into the payload, and is only valid until the
+// server function returns.
+#define DESERIALIZE_ALIGNED_ARGUMENT_ARRAY(arg_id, type, size)          \
+    payload = _DSTC_ALIGN_PTR(payload, __alignof__(type));              \
+    _a##arg_id = (type (*) size) payload;                               \
+    payload += sizeof(type size);
+
+#define DESERIALIZE_ALIGNED_ARGUMENT(arg_id, type, size)                \
+    _DSTC_ARG_DISPATCH(DESERIALIZE_ALIGNED_ARGUMENT, arg_id, type, size)
+
+
+#define DECLARE_ALIGNED_VARIABLE_DYNAMIC DECLARE_VARIABLE
+#define DECLARE_ALIGNED_VARIABLE_CALLBACK DECLARE_VARIABLE
+#define DECLARE_ALIGNED_VARIABLE_SCALAR DECLARE_VARIABLE
+#define DECLARE_ALIGNED_VARIABLE_ARRAY(arg_id, type, size) type (*_a##arg_id) size ;
+#define DECLARE_ALIGNED_VARIABLE(arg_id, type, size)                    \
+    _DSTC_ARG_DISPATCH(DECLARE_ALIGNED_VARIABLE, arg_id, type, size)
+
+#define LIST_ALIGNED_ARGUMENT_DYNAMIC LIST_ARGUMENT
+#define LIST_ALIGNED_ARGUMENT_CALLBACK LIST_ARGUMENT
+#define LIST_ALIGNED_ARGUMENT_SCALAR LIST_ARGUMENT
+#define LIST_ALIGNED_ARGUMENT_ARRAY(arg_id, type, size) *_a##arg_id
+#define LIST_ALIGNED_ARGUMENT(arg_id, type, size)                       \
+    _DSTC_ARG_DISPATCH(LIST_ALIGNED_ARGUMENT, arg_id, type, size)
+#define LIST_NEXT_ALIGNED_ARGUMENT(arg_id, type, size) , LIST_ALIGNED_ARGUMENT(arg_id, type, size)
+
+// The padding needed depends on the sizes of dynamic data arguments,
+// so the worst case is reserved.
+#define SIZE_ALIGNED_ARGUMENT_DYNAMIC(arg_id, type, size)               \
+    (__alignof__(uint16_t) - 1 + sizeof(uint16_t) +                     \
+     _DSTC_DYNAMIC_ALIGNMENT - 1 + dstc_dyndata_length(&_a##arg_id)) +
+#define SIZE_ALIGNED_ARGUMENT_CALLBACK(arg_id, type, size)              \
+    __alignof__(dstc_callback_t) - 1 + sizeof(dstc_callback_t) +
+#define SIZE_ALIGNED_ARGUMENT_SCALAR(arg_id, type, size) __alignof__(type) - 1 + sizeof(type) +
+#define SIZE_ALIGNED_ARGUMENT_ARRAY(arg_id, type, size) __alignof__(type) - 1 + sizeof(type size) +
+#define SIZE_ALIGNED_ARGUMENT(arg_id, type, size)                       \
+    _DSTC_ARG_DISPATCH(SIZE_ALIGNED_ARGUMENT, arg_id, type, size)
+
+
+// Batch layout, used by DSTC_SERVER_BATCH(). The arguments of call
+// _batch are decoded into element _batch of one array per argument.
+#define DESERIALIZE_BATCH_ARGUMENT_DYNAMIC(arg_id, type, size)          \
+    memcpy((void*) &_a##arg_id[_batch].length, payload, sizeof(uint16_t)); \
+    payload += sizeof(uint16_t);                                        \
+    _a##arg_id[_batch].data = payload;                                  \
+    payload += _a##arg_id[_batch].length;
+
+#define DESERIALIZE_BATCH_ARGUMENT_CALLBACK(arg_id, type, size)         \
+    memcpy((void*) &_a##arg_id[_batch], payload, sizeof(dstc_callback_t)); \
+    if ((uint64_t) _a##arg_id[_batch] & DSTC_CALLBACK_REF_TARGETED)     \
+        _a##arg_id[_batch] = dstc_import_callback_ref(0, node_id,       \
+                                                      _a##arg_id[_batch]); \
+    payload += sizeof(dstc_callback_t);
+
+#define DESERIALIZE_BATCH_ARGUMENT_SCALAR(arg_id, type, size)           \
+    memcpy((void*) &_a##arg_id[_batch], (void*) payload, sizeof(type)); \
+    payload += sizeof(type);
+
+#define DESERIALIZE_BATCH_ARGUMENT_ARRAY(arg_id, type, size)            \
+    memcpy((void*) _a##arg_id[_batch], (void*) payload, sizeof(type size)); \
+    payload += sizeof(type size);
+
+#define DESERIALIZE_BATCH_ARGUMENT(arg_id, type, size)                  \
+    _DSTC_ARG_DISPATCH(DESERIALIZE_BATCH_ARGUMENT, arg_id, type, size)
+
+#define DECLARE_BATCH_VARIABLE(arg_id, type, size) type _a##arg_id[_capacity] size ;
+#define SIZE_BATCH_ARGUMENT(arg_id, type, size) sizeof(type size) +
 
 
 #define SERIALIZE_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(SERIALIZE_ARGUMENT, ##__VA_ARGS__)
@@ -430,6 +1090,55 @@ typedef dstc_callback_t CBCK;
 #define LIST_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO_ELEM(LIST_ARGUMENT, ##__VA_ARGS__)
 #define DECLARE_VARIABLES(...) FOR_EACH_VARIADIC_MACRO(DECLARE_VARIABLE, ##__VA_ARGS__)
 #define SIZE_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(SIZE_ARGUMENT, ##__VA_ARGS__) 0
+#define LIST_NEXT_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(LIST_NEXT_ARGUMENT, ##__VA_ARGS__)
+#define DECLARE_NEXT_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(DECLARE_NEXT_ARGUMENT, ##__VA_ARGS__)
+#define DECLARE_BULK_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(DECLARE_BULK_ARGUMENT, ##__VA_ARGS__)
+#define LIST_BULK_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(LIST_BULK_ARGUMENT, ##__VA_ARGS__)
+#define ANYCAST_KEY_ARGUMENTS(...) FOR_FIRST_VARIADIC_MACRO(ANYCAST_KEY_ARGUMENT, ##__VA_ARGS__)
+
+// Expects arg_sz to hold the size reserved by SIZE_ALIGNED_ARGUMENTS(),
+// and zeroes the part of it left unused by padding.
+#define SERIALIZE_ALIGNED_ARGUMENTS(...)                                \
+    {                                                                   \
+        uint8_t* _base = (uint8_t*) (((uintptr_t) payload + _DSTC_ARGS_ALIGNMENT) & \
+                                     ~((uintptr_t) _DSTC_ARGS_ALIGNMENT - 1)); \
+        uint8_t* _payload_end = payload + arg_sz;                       \
+        *payload = (uint8_t) (_base - payload - 1);                     \
+        while(++payload < _base)                                        \
+            *payload = 0;                                               \
+        FOR_EACH_VARIADIC_MACRO(SERIALIZE_ALIGNED_ARGUMENT, ##__VA_ARGS__) \
+        for(uint8_t* _pad = payload; _pad < _payload_end; ++_pad)      \
+            *_pad = 0;                                                  \
+    }
+// Drops the call if the arguments are not aligned in memory, which
+// only happens if they were not sent by a DSTC_CLIENT_ALIGNED()
+// function.
+#define DESERIALIZE_ALIGNED_ARGUMENTS(...)                              \
+    uint8_t* _base = payload + 1 + *payload;                            \
+    if ((uintptr_t) _base & (_DSTC_ARGS_ALIGNMENT - 1)) {               \
+        dstc_drop_misaligned_call(node_id);                             \
+        return;                                                         \
+    }                                                                   \
+    payload = _base;                                                    \
+    FOR_EACH_VARIADIC_MACRO(DESERIALIZE_ALIGNED_ARGUMENT, ##__VA_ARGS__)
+#define LIST_ALIGNED_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO_ELEM(LIST_ALIGNED_ARGUMENT, ##__VA_ARGS__)
+#define LIST_NEXT_ALIGNED_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(LIST_NEXT_ALIGNED_ARGUMENT, ##__VA_ARGS__)
+#define DECLARE_ALIGNED_VARIABLES(...) FOR_EACH_VARIADIC_MACRO(DECLARE_ALIGNED_VARIABLE, ##__VA_ARGS__)
+// Reserves the padding count and the padding that aligns _base.
+#define SIZE_ALIGNED_ARGUMENTS(...)                                     \
+    FOR_EACH_VARIADIC_MACRO(SIZE_ALIGNED_ARGUMENT, ##__VA_ARGS__) _DSTC_ARGS_ALIGNMENT
+#define DESERIALIZE_BATCH_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(DESERIALIZE_BATCH_ARGUMENT, ##__VA_ARGS__)
+#define DECLARE_BATCH_VARIABLES(...) FOR_EACH_VARIADIC_MACRO(DECLARE_BATCH_VARIABLE, ##__VA_ARGS__)
+
+// Number of calls decoded at once by a DSTC_SERVER_BATCH() function,
+// keeping its argument arrays within DSTC_BATCH_STACK_SIZE bytes.
+#define _DSTC_BATCH_CALL_SIZE(...)                                      \
+    (FOR_EACH_VARIADIC_MACRO(SIZE_BATCH_ARGUMENT, ##__VA_ARGS__) 1)
+#define _DSTC_BATCH_CAPACITY(...)                                       \
+    ((DSTC_BATCH_STACK_SIZE / _DSTC_BATCH_CALL_SIZE(__VA_ARGS__) > DSTC_BATCH_MAX_CALLS)? \
+     DSTC_BATCH_MAX_CALLS:                                              \
+     (DSTC_BATCH_STACK_SIZE / _DSTC_BATCH_CALL_SIZE(__VA_ARGS__))?      \
+     (DSTC_BATCH_STACK_SIZE / _DSTC_BATCH_CALL_SIZE(__VA_ARGS__)):1)
 
 // Used by SIZE_ARGUMENT in order to avoid type punting warning
 // that is emitted if we put casting and member reference
@@ -443,41 +1152,149 @@ static inline uint16_t dstc_dyndata_length(dstc_dynamic_data_t* dyndata)
 // Create client function that serializes and writes to descriptor.
 // If the reliable multicast system has not been started when the
 // client call is made, it is will be done through dstc_setup()
-#define DSTC_CLIENT(name, ...)                                          \
+// _dstc_client_id_[name] is the function ID assigned by
+// dstc_register_client_function(), allowing calls to be sent
+// without the function name once negotiated with the remote nodes.
+//
+// A bulk variant, dstc_[name]_bulk(), is also generated. It takes a
+// call count followed by one array per argument, holding the
+// argument of each call, and queues all calls under a single context
+// lock. For DSTC_CLIENT(set_value, int,, char, [32]) it is declared as:
+//
+//   int dstc_set_value_bulk(uint32_t count, int* a, char (*b)[32]);
+//
+// The number of calls queued is returned. If fewer than count,
+// outbound traffic is suspended, or the next call failed, and the
+// application should process events before queueing the remaining
+// calls. If the first call fails for any other reason than suspended
+// traffic, the negative error is returned instead, such as -EMSGSIZE
+// for a call too large to fit in a packet.
+//
+// A waiting variant, dstc_[name]_wait(), takes a timeout in
+// milliseconds followed by the arguments of dstc_[name](). If
+// outbound traffic is suspended, it blocks in
+// dstc_wait_for_capacity_until() until the call can be queued, and
+// returns ETIME if the timeout expires first. -1 waits forever.
+//
+// A targeted variant, dstc_[name]_to(), takes the node ID of a
+// remote node serving the function followed by the arguments of
+// dstc_[name](). Only that node dispatches the call. ENOENT is
+// returned if the node does not serve the function, and ENOTSUP if
+// it runs a DSTC version without support for targeted calls.
+#define _DSTC_CLIENT(name, _mode, ...)                                  \
+    static uint32_t _dstc_client_id_##name = UINT32_MAX;                \
+    static int _dstc_bulk_queue_##name(struct dstc_context* _ctx        \
+                                       DECLARE_NEXT_ARGUMENTS(__VA_ARGS__))\
+    {                                                                   \
+        uint32_t arg_sz = SIZE_##_mode##ARGUMENTS(__VA_ARGS__);         \
+        uint8_t *payload = 0;                                           \
+        int _res = dstc_bulk_reserve_client_func(_ctx, _dstc_client_id_##name, \
+                                                 (char*) #name,         \
+                                                 ANYCAST_KEY_ARGUMENTS(__VA_ARGS__), \
+                                                 arg_sz, &payload);     \
+        if (_res)                                                       \
+            return _res;                                                \
+        SERIALIZE_##_mode##ARGUMENTS(__VA_ARGS__);                      \
+        return 0;                                                       \
+    }                                                                   \
+    int dstc_##name##_bulk(uint32_t count                               \
+                           DECLARE_BULK_ARGUMENTS(__VA_ARGS__))         \
+    {                                                                   \
+        struct dstc_context* _ctx =                                     \
+            dstc_bulk_begin_client_func(0, _dstc_client_id_##name);     \
+        uint32_t _ind = 0;                                              \
+        int _res = 0;                                                   \
+                                                                        \
+        while(_ind < count &&                                           \
+              !(_res = _dstc_bulk_queue_##name(_ctx LIST_BULK_ARGUMENTS(__VA_ARGS__)))) \
+            ++_ind;                                                     \
+                                                                        \
+        dstc_bulk_end(_ctx);                                            \
+        if (!_ind && _res && _res != EBUSY)                             \
+            return -_res;                                               \
+        return _ind;                                                    \
+    }                                                                   \
     int dstc_##name(DECLARE_ARGUMENTS(__VA_ARGS__))                     \
     {                                                                   \
         extern uint16_t dstc_dyndata_length(dstc_dynamic_data_t*);      \
-        uint32_t arg_sz = SIZE_ARGUMENTS(__VA_ARGS__);                  \
-        uint8_t arg_buf[arg_sz];                                        \
-        uint8_t *payload = arg_buf;                                     \
-        (void) payload;                                                 \
-        SERIALIZE_ARGUMENTS(__VA_ARGS__);                               \
-        return dstc_queue_func(0, (char*) #name, arg_buf, arg_sz);      \
+        uint32_t arg_sz = SIZE_##_mode##ARGUMENTS(__VA_ARGS__);         \
+        uint8_t *payload = 0;                                           \
+        int _res = dstc_reserve_client_func(0, _dstc_client_id_##name,  \
+                                            (char*) #name,              \
+                                            ANYCAST_KEY_ARGUMENTS(__VA_ARGS__), \
+                                            arg_sz, &payload);          \
+        if (_res)                                                       \
+            return _res;                                                \
+        SERIALIZE_##_mode##ARGUMENTS(__VA_ARGS__);                      \
+        dstc_commit_call(0);                                            \
+        return 0;                                                       \
+    }                                                                   \
+    int dstc_##name##_to(rmc_node_id_t _node_id                         \
+                         DECLARE_NEXT_ARGUMENTS(__VA_ARGS__))           \
+    {                                                                   \
+        extern uint16_t dstc_dyndata_length(dstc_dynamic_data_t*);      \
+        uint32_t arg_sz = SIZE_##_mode##ARGUMENTS(__VA_ARGS__);         \
+        uint8_t *payload = 0;                                           \
+        int _res = dstc_reserve_targeted_client_func(0, _node_id,       \
+                                                     _dstc_client_id_##name, \
+                                                     (char*) #name, arg_sz, &payload); \
+        if (_res)                                                       \
+            return _res;                                                \
+        SERIALIZE_##_mode##ARGUMENTS(__VA_ARGS__);                      \
+        dstc_commit_call(0);                                            \
+        return 0;                                                       \
+    }                                                                   \
+    int dstc_##name##_wait(int _timeout_msec                            \
+                           DECLARE_NEXT_ARGUMENTS(__VA_ARGS__))         \
+    {                                                                   \
+        msec_timestamp_t _deadline = (_timeout_msec == -1)?0:           \
+            dstc_msec_monotonic_timestamp() + _timeout_msec;            \
+        int _res = 0;                                                   \
+                                                                        \
+        while((_res = dstc_##name(LIST_ARGUMENTS(__VA_ARGS__))) == EBUSY) { \
+            _res = dstc_wait_for_capacity_until(_deadline);             \
+            if (_res)                                                   \
+                return _res;                                            \
+        }                                                               \
+        return _res;                                                    \
     }                                                                   \
     void __attribute__((constructor)) _dstc_register_client_##name()    \
     {                                                                   \
         char name_arr[] = #name;                                        \
-        dstc_register_client_function(0, name_arr, (void*)  dstc_##name); \
+        _dstc_client_id_##name =                                        \
+            dstc_register_client_function(0, name_arr, (void*)  dstc_##name); \
     }
 
+#define DSTC_CLIENT(name, ...)                                          \
+    _DSTC_CLIENT(name, , __VA_ARGS__)
+
+// Same as DSTC_CLIENT(), but with arguments laid out as expected by
+// DSTC_SERVER_ALIGNED(). The server must be declared with the same
+// arguments using DSTC_SERVER_ALIGNED().
+#define DSTC_CLIENT_ALIGNED(name, ...)                                  \
+    _DSTC_CLIENT(name, ALIGNED_, __VA_ARGS__)
+
 // Create callback function that serializes and writes to descriptor.
 // If the reliable multicast system has not been started when the
 // client call is made, it is will be done through dstc_setup()
 // If cb_ref is zero, then a null callback function pointer was
 // passed on the client side as a callback argument. In that case.
 // Do not do any callbacks.
-#define DSTC_SERVER_CALLBACK(name, ...)                                 \
+#define _DSTC_SERVER_CALLBACK(name, _mode, ...)                         \
     int dstc_##name(dstc_callback_t cb_ref, DECLARE_ARGUMENTS(__VA_ARGS__)) { \
-        uint32_t arg_sz = SIZE_ARGUMENTS(__VA_ARGS__);                  \
-        uint8_t arg_buf[arg_sz];                                        \
-        uint8_t *payload = arg_buf;                                     \
-        (void) payload;                                                 \
+        uint32_t arg_sz = SIZE_##_mode##ARGUMENTS(__VA_ARGS__);         \
+        uint8_t *payload = 0;                                           \
+        int _res = 0;                                                   \
                                                                         \
         if (!cb_ref)                                                    \
             return 0;                                                   \
                                                                         \
-        SERIALIZE_ARGUMENTS(__VA_ARGS__);                               \
-        return dstc_queue_callback(0, cb_ref, arg_buf, arg_sz);         \
+        _res = dstc_reserve_callback(0, cb_ref, arg_sz, &payload);      \
+        if (_res)                                                       \
+            return _res;                                                \
+        SERIALIZE_##_mode##ARGUMENTS(__VA_ARGS__);                      \
+        dstc_commit_call(0);                                            \
+        return 0;                                                       \
     }                                                                   \
     void __attribute__((constructor)) _dstc_register_callback_##name()  \
     {                                                                   \
@@ -485,13 +1302,21 @@ static inline uint16_t dstc_dyndata_length(dstc_dynamic_data_t* dyndata)
         dstc_register_callback_client(0, name_array, (void*) dstc_##name); \
     }
 
+#define DSTC_SERVER_CALLBACK(name, ...)                                 \
+    _DSTC_SERVER_CALLBACK(name, , __VA_ARGS__)
+
+// Same as DSTC_SERVER_CALLBACK(), but for callbacks declared with
+// DSTC_CLIENT_CALLBACK_ALIGNED().
+#define DSTC_SERVER_CALLBACK_ALIGNED(name, ...)                         \
+    _DSTC_SERVER_CALLBACK(name, ALIGNED_, __VA_ARGS__)
+
 
 
 // Generate server function that receives serialized data on
 // descriptor and invokes he local function.
 // If the socket has not been setup when the client call is made,
 // it is will be done through dstc_net_client.c:dstc_setup_mcast_sub()
-#define DSTC_SERVER_INTERNAL(name, ...)                                 \
+#define _DSTC_SERVER_INTERNAL(name, _mode, ...)                         \
     void dstc_server_##name(intptr_t unused,                            \
                             rmc_node_id_t node_id,                      \
                             uint8_t* func_name,                         \
@@ -500,9 +1325,9 @@ static inline uint16_t dstc_dyndata_length(dstc_dynamic_data_t* dyndata)
     {                                                                   \
         (void) func_name;                                               \
         (void) unused;                                                  \
-        DECLARE_VARIABLES(__VA_ARGS__);                                 \
-        DESERIALIZE_ARGUMENTS(__VA_ARGS__);                             \
-        name(LIST_ARGUMENTS(__VA_ARGS__));                              \
+        DECLARE_##_mode##VARIABLES(__VA_ARGS__);                        \
+        DESERIALIZE_##_mode##ARGUMENTS(__VA_ARGS__);                    \
+        name(LIST_##_mode##ARGUMENTS(__VA_ARGS__));                     \
         return;                                                         \
     }                                                                   \
     void __attribute__((constructor)) _dstc_register_server_##name()    \
@@ -511,10 +1336,83 @@ static inline uint16_t dstc_dyndata_length(dstc_dynamic_data_t* dyndata)
         dstc_register_server_function(0, name_array, dstc_server_##name); \
     }
 
+#define DSTC_SERVER_INTERNAL(name, ...)                                 \
+    _DSTC_SERVER_INTERNAL(name, , __VA_ARGS__)
+
 #define DSTC_SERVER(name, ...)                          \
     extern void name(DECLARE_ARGUMENTS(__VA_ARGS__));   \
     static DSTC_SERVER_INTERNAL(name, __VA_ARGS__)      \
 
+// Same as DSTC_SERVER(), but the server function is handed all
+// directly following calls to it in a received packet at once, with
+// one array per argument holding the argument of each call, as taken
+// by the dstc_[name]_bulk() client function. For
+// DSTC_SERVER_BATCH(set_value, int,, char, [32]) it is declared as:
+//
+//   void set_value(uint32_t count, int* a, char (*b)[32]);
+//
+// Calls are made by a DSTC_CLIENT()-generated function, and are
+// batched when several of them end up in the same packet, as in
+// buffered mode. Large batches are split into several invocations,
+// as set by DSTC_BATCH_MAX_CALLS and DSTC_BATCH_STACK_SIZE. Calls run
+// by the executor are handed over one by one.
+#define DSTC_SERVER_BATCH(name, ...)                                    \
+    extern void name(uint32_t count DECLARE_BULK_ARGUMENTS(__VA_ARGS__)); \
+    static void dstc_server_batch_##name(rmc_node_id_t node_id,         \
+                                         dstc_batch_call_t* calls,      \
+                                         uint32_t count)                \
+    {                                                                   \
+        enum { _capacity = _DSTC_BATCH_CAPACITY(__VA_ARGS__) };         \
+        DECLARE_BATCH_VARIABLES(__VA_ARGS__);                           \
+        uint32_t _ind = 0;                                              \
+                                                                        \
+        (void) node_id;                                                 \
+        while(_ind < count) {                                           \
+            uint32_t _batch = 0;                                        \
+                                                                        \
+            while(_ind < count && _batch < _capacity) {                 \
+                uint8_t* payload = calls[_ind].payload;                 \
+                                                                        \
+                (void) payload;                                         \
+                DESERIALIZE_BATCH_ARGUMENTS(__VA_ARGS__);               \
+                ++_batch;                                               \
+                ++_ind;                                                 \
+            }                                                           \
+            name(_batch LIST_NEXT_ARGUMENTS(__VA_ARGS__));              \
+        }                                                               \
+    }                                                                   \
+    static void dstc_server_##name(intptr_t unused,                     \
+                                   rmc_node_id_t node_id,               \
+                                   uint8_t* func_name,                  \
+                                   uint8_t* payload,                    \
+                                   uint16_t payload_len)                \
+    {                                                                   \
+        dstc_batch_call_t _call = { payload, payload_len };             \
+                                                                        \
+        (void) func_name;                                               \
+        (void) unused;                                                  \
+        dstc_server_batch_##name(node_id, &_call, 1);                   \
+    }                                                                   \
+    void __attribute__((constructor)) _dstc_register_server_##name()    \
+    {                                                                   \
+        char name_array[] = #name;                                      \
+        dstc_register_server_batch_function(0, name_array,              \
+                                            dstc_server_##name,         \
+                                            dstc_server_batch_##name);  \
+    }
+
+// Same as DSTC_SERVER(), but for calls made through a
+// DSTC_CLIENT_ALIGNED()-generated function. Array arguments point
+// into the received packet instead of being copied, and are only
+// valid until the server function returns. Declare them const, as in
+// DSTC_SERVER_ALIGNED(chat, const char, [512]), to have them passed
+// as const pointers. A struct argument declared as a one element
+// array, as in DSTC_SERVER_ALIGNED(update, const struct state, [1]),
+// is passed the same way.
+#define DSTC_SERVER_ALIGNED(name, ...)                          \
+    extern void name(DECLARE_ARGUMENTS(__VA_ARGS__));           \
+    static _DSTC_SERVER_INTERNAL(name, ALIGNED_, __VA_ARGS__)   \
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,33 +16,321 @@
 
 #include <pthread.h>
 
-// FIXME: Hash table for both local and remote func
+// FIXME: Hash table for remote and client func
 #define SYMTAB_SIZE 128
 
+// Initial number of server function slots, and smallest
+// open addressing index to build for them.
+#define SERVER_FUNC_INITIAL_SIZE 32
+#define SERVER_FUNC_HASH_MIN_SIZE 64
 
 // A local DSTC_SERVER-registered name / func ptr combination
+// name_hash is the dstc_hash_name() value of func_name, calculated
+// once at registration time.
+// batch_func is set for DSTC_SERVER_BATCH-registered functions, and
+// is used instead of server_func to dispatch consecutive calls.
+// group is the multicast group carrying calls to the function. See
+// dstc_setup_groups(). The function is only served by the context
+// of that group.
 //
 typedef struct  {
-    char func_name[256];
+    char* func_name;
+    uint32_t name_hash;
     dstc_internal_dispatch_t server_func;
+    dstc_internal_batch_dispatch_t batch_func;
+    uint8_t group;
 } dstc_server_func_t;
 
 
+// Capability flags sent by a node together with each function
+// it registers with a remote node.
+// Nodes running older DSTC versions send 0.
+//
+// Node can dispatch DSTC_RECORD_FUNC_ID calls.
+#define DSTC_CAP_FUNC_ID 0x01
+
+// Node can dispatch calls in DSTC_RECORD_COMPACT blocks of
+// version DSTC_COMPACT_VERSION.
+#define DSTC_CAP_COMPACT 0x02
+
+// Node can dispatch DSTC_RECORD_TARGET calls.
+#define DSTC_CAP_TARGET 0x04
+
+#define DSTC_LOCAL_CAPABILITIES (DSTC_CAP_FUNC_ID | DSTC_CAP_COMPACT | DSTC_CAP_TARGET)
+
 // Remote nodes and their registered functions
+// address and port identify the control connection the function
+// was registered over, and are used to unregister the node once it
+// disconnects.
+// outstanding is the number of pending callbacks passed to the node
+// in targeted calls to the function. See dstc_callback_slot_t.
 typedef struct {
     rmc_node_id_t node_id;
+    uint8_t caps;   // DSTC_CAP_XXX flags sent by node.
+    uint32_t address;
+    uint16_t port;
+    uint32_t outstanding;
     char func_name[256];
 } dstc_remote_node_t;
 
 
+// Function ID state of a DSTC_CLIENT-registered function.
+//
+// At least one remote node serving the function does not support
+// function IDs, or no node serves it. Calls are sent by name.
+#define DSTC_FUNC_ID_NONE 0
+
+// All remote nodes serving the function support function IDs, but
+// at least one of them has not yet seen a DSTC_RECORD_BIND for it.
+// The next call will be preceeded by a bind record.
+#define DSTC_FUNC_ID_BIND_PENDING 1
+
+// All remote nodes serving the function have been sent a bind
+// record. Calls are sent by function ID.
+#define DSTC_FUNC_ID_BOUND 2
+
 // A local DSTC_CLIENT- registered name / func ptr combination.
+// The function ID sent on the wire is the index of the function in
+// dstc_context_t::client_func.
+// compact is set if all remote nodes serving the function support
+// DSTC_CAP_COMPACT, in which case buffered calls by function ID are
+// sent in DSTC_RECORD_COMPACT blocks.
+// anycast is the DSTC_ANYCAST_XXX policy set by
+// dstc_set_anycast_policy(). anycast_last is the remote_node index
+// of the server picked for the last call, from which the search for
+// the next one starts.
+// group is the multicast group carrying calls to the function, set
+// when the context is setup. See dstc_setup_groups().
+// id_state, compact and anycast are read without the context lock
+// by threads staging calls, and are updated with atomic stores.
 //
 typedef struct {
     char func_name[256];
     void *client_func;
+    uint8_t id_state;  // DSTC_FUNC_ID_XXX
+    uint8_t compact;
+    uint8_t anycast;   // DSTC_ANYCAST_XXX
+    uint32_t anycast_last;
+    uint64_t filter;   // DSTC_FILTER_NAME_BIT() of func_name
+    uint8_t group;
 } dstc_client_func_t;
 
+// A function assigned to a multicast group by the group map file
+// given to dstc_setup_groups().
+typedef struct {
+    char func_name[256];
+    uint8_t group;
+} dstc_group_map_t;
+
+
+// Function IDs bound by a remote publisher through DSTC_RECORD_BIND
+// records.
+// func[func_id] is the server_func index + 1 that the publisher's
+// function ID maps to, or 0 if unbound or not served locally.
+// address and port identify the node's control connection, once it
+// has sent us a control message, and are used to release the entry
+// when the node disconnects.
+//
+typedef struct {
+    rmc_node_id_t node_id;
+    uint32_t address;
+    uint16_t port;
+    uint32_t func_size;
+    uint32_t* func;
+} dstc_publisher_t;
+
+
+
+// A pending callback activated by dstc_activate_callback().
+// The callback reference passed to the remote node encodes the
+// slot index and its generation, which is bumped each time the
+// slot is released. Replies carrying an old generation are stale
+// and will be ignored.
+//
+// A callback passed in a targeted call is counted as outstanding
+// with the remote_node entry it was sent to until the slot is
+// released. remote_node_id tells if the entry has since been reused
+// by another node.
+//
+typedef struct {
+    dstc_internal_dispatch_t callback; // 0 if slot is free or consumed
+    void* user_data;
+    uint32_t generation;
+    uint32_t next_free;  // Index + 1 of next free slot. 0 = end of list
+    uint32_t remote_ind; // remote_node index + 1. 0 = not counted
+    rmc_node_id_t remote_node_id;
+} dstc_callback_slot_t;
+
+// Bits 62 and 63 of callback references are DSTC_CALLBACK_REF_REPLY
+// and DSTC_CALLBACK_REF_TARGETED.
+#define DSTC_CALLBACK_GENERATION_MASK 0x3FFFFFFF
+#define DSTC_CALLBACK_REF(_generation, _slot)                   \
+    ((dstc_callback_t) (((uint64_t) (_generation) << 32) | ((uint64_t) (_slot) + 1)))
+#define DSTC_CALLBACK_REF_SLOT(_ref) ((uint32_t) ((uint64_t) (_ref) & 0xFFFFFFFF) - 1)
+#define DSTC_CALLBACK_REF_GENERATION(_ref) \
+    ((uint32_t) ((uint64_t) (_ref) >> 32) & DSTC_CALLBACK_GENERATION_MASK)
+
+// A DSTC_CALLBACK_REF_REPLY reference carries the index of the
+// calling node in dstc_context_t::reply_node in bits 22-31 of its
+// slot, and the reuse count of that reply_node slot in bits 16-21.
+// Only slots below DSTC_CALLBACK_TARGETED_SLOTS are handed out as
+// DSTC_CALLBACK_REF_TARGETED references, leaving room for both.
+#define DSTC_CALLBACK_REF_NODE_SHIFT 22
+#define DSTC_CALLBACK_REF_NODE_COUNT 1024
+#define DSTC_CALLBACK_REF_NODE_MASK \
+    ((uint64_t) (DSTC_CALLBACK_REF_NODE_COUNT - 1) << DSTC_CALLBACK_REF_NODE_SHIFT)
+#define DSTC_CALLBACK_REF_NODE(_ref) \
+    ((uint32_t) (((uint64_t) (_ref) & DSTC_CALLBACK_REF_NODE_MASK) >> DSTC_CALLBACK_REF_NODE_SHIFT))
+#define DSTC_CALLBACK_REF_REUSE_SHIFT 16
+#define DSTC_CALLBACK_REF_REUSE_COUNT 64
+#define DSTC_CALLBACK_REF_REUSE_MASK \
+    ((uint64_t) (DSTC_CALLBACK_REF_REUSE_COUNT - 1) << DSTC_CALLBACK_REF_REUSE_SHIFT)
+#define DSTC_CALLBACK_REF_REUSE(_ref) \
+    ((uint32_t) (((uint64_t) (_ref) & DSTC_CALLBACK_REF_REUSE_MASK) >> DSTC_CALLBACK_REF_REUSE_SHIFT))
+#define DSTC_CALLBACK_TARGETED_SLOTS ((1 << DSTC_CALLBACK_REF_REUSE_SHIFT) - 1)
+
+// Nodes are looked up in reply_node through an open addressing
+// table of DSTC_REPLY_NODE_HASH_SIZE entries, keeping it at most half
+// full.
+#define DSTC_REPLY_NODE_HASH_BITS 11
+#define DSTC_REPLY_NODE_HASH_SIZE (1 << DSTC_REPLY_NODE_HASH_BITS)
+#define DSTC_REPLY_NODE_HASH(_node_id) \
+    (((uint32_t) (_node_id) * 2654435761U) >> (32 - DSTC_REPLY_NODE_HASH_BITS))
+#define DSTC_CALLBACK_REF_IS_REPLY(_ref)                                \
+    (((uint64_t) (_ref) & (DSTC_CALLBACK_REF_TARGETED | DSTC_CALLBACK_REF_REPLY)) == \
+     (DSTC_CALLBACK_REF_TARGETED | DSTC_CALLBACK_REF_REPLY))
+
+
+// Outbound packet buffer, recycled through
+// dstc_context_t::pub_pool_free once RMC has confirmed delivery of the
+// packet. payload is cache line aligned and holds RMC_MAX_PAYLOAD bytes.
+// len is only used by outbound packets waiting in the outbound queue.
+//
+// Inbound packets use the same layout. ref_count and exec_reserved
+// are only used by inbound packets, which are kept until all their
+// calls have been executed.
+//
+#define DSTC_CACHE_LINE_SIZE 64
+
+typedef struct dstc_packet_buffer {
+    struct dstc_packet_buffer* next_free;
+    uint32_t len;
+    uint32_t ref_count;
+    uint8_t exec_reserved;
+    uint8_t payload[] __attribute__((aligned(DSTC_CACHE_LINE_SIZE)));
+} dstc_packet_buffer_t;
+
+#define DSTC_PACKET_BUFFER(_payload) \
+    ((dstc_packet_buffer_t*) ((uint8_t*) (_payload) - offsetof(dstc_packet_buffer_t, payload)))
+
+// Number of packet buffers to allocate when the context is setup.
+#define DSTC_PACKET_POOL_PREALLOC 16
+
+// Inbound payloads are allocated by RMC through the hooks provided to
+// rmc_sub_init_context(), and recycled through per size class free
+// lists in dstc_context_t::sub_pool_free. Size class N holds payloads
+// of up to DSTC_RX_POOL_MIN_SIZE << N bytes, covering RMC_MAX_PAYLOAD.
+#define DSTC_RX_POOL_MIN_SIZE 256
+#define DSTC_RX_POOL_CLASS_COUNT 9
+
+// Adaptive batching, see dstc_buffer_client_calls_adaptive().
+// The flush threshold is doubled each time a packet is queued while
+// more than DSTC_ADAPTIVE_BUSY_PACKETS earlier packets are in flight,
+// as long as calls come in fast enough to fill it within half the
+// hold time. It is halved each time a packet is queued with none in
+// flight, or after calls have waited more than half the hold time,
+// or by the flush timer. The rate and waiting time are averaged over
+// about DSTC_ADAPTIVE_SAMPLES packets. At DSTC_ADAPTIVE_MIN_WINDOW,
+// every call is queued as soon as it is made.
+#define DSTC_ADAPTIVE_MIN_WINDOW 1
+#define DSTC_ADAPTIVE_BUSY_PACKETS 4
+#define DSTC_ADAPTIVE_SAMPLES 4
+#define DSTC_ADAPTIVE_DEFAULT_HOLD_USEC 2000
+
+// Calls made in buffered mode are staged in a buffer owned by the
+// calling thread, without taking the context lock. Staged calls are
+// merged into the payload buffer when the thread buffer is full, or
+// when calls are flushed.
+#define DSTC_THREAD_BUFFER_SIZE 16384
+
+typedef struct dstc_thread_buffer {
+    struct dstc_thread_buffer* next;
+    struct dstc_context* ctx;
+
+    // Held by the owning thread while a call is staged, and by
+    // other threads while merging the buffer. Always taken after
+    // the context lock, never before.
+    pthread_mutex_t lock;
+    uint32_t ind;
+
+    // Offset + 1 of the DSTC_RECORD_COMPACT block that staged calls
+    // are added to, or 0 if none.
+    uint32_t block_ind;
+
+    // Set while the owning thread holds lock between
+    // dstc_reserve_client_func() and dstc_commit_call().
+    uint8_t reserved;
+
+    // Set once the owning thread has exited. The buffer is freed
+    // once its calls have been merged.
+    uint8_t orphaned;
+
+    // Time by which the staged calls are to be queued with RMC,
+    // set when the first call is staged while a flush timer is
+    // set. 0 if not set.
+    usec_timestamp_t flush_deadline;
+
+    // Filter bits of the staged calls. See dstc_context_t::pub_filter.
+    uint64_t filter;
+
+    // dstc_context_t::func_id_gen when the staged calls were encoded.
+    uint32_t func_id_gen;
+    uint8_t data[DSTC_THREAD_BUFFER_SIZE] __attribute__((aligned(DSTC_CACHE_LINE_SIZE)));
+} dstc_thread_buffer_t;
 
+// Server function call handed over to an executor worker thread by
+// dstc_process_function_call().
+typedef struct dstc_exec_call {
+    struct dstc_exec_call* next;
+    dstc_internal_dispatch_t server_func;
+    rmc_node_id_t node_id;
+    uint8_t* name;
+    uint8_t* payload;
+    uint16_t payload_len;
+
+    // Inbound packet holding the call, released once the call
+    // has been executed.
+    uint8_t* packet;
+    payload_len_t packet_len;
+} dstc_exec_call_t;
+
+// Server function call collected by _dstc_dispatch_run() from
+// consecutive records in an inbound packet.
+typedef struct {
+    dstc_internal_dispatch_t server_func;
+    rmc_node_id_t node_id;
+    uint8_t* name;
+    uint8_t* payload;
+    uint16_t payload_len;
+} dstc_run_call_t;
+
+// Max number of calls invoked by _dstc_dispatch_run() under a
+// single release of the context lock.
+#define DSTC_DISPATCH_RUN_SIZE 64
+
+typedef struct dstc_exec_worker {
+    struct dstc_context* ctx;
+    pthread_t thread;
+    pthread_cond_t cond;
+
+    // Calls queued to this worker, in execution order.
+    dstc_exec_call_t* head;
+    dstc_exec_call_t* tail;
+} dstc_exec_worker_t;
+
+// Default max number of inbound packets with calls waiting for
+// executor workers.
+#define DSTC_EXECUTOR_DEFAULT_MAX_PACKETS 64
 
 // If we use poll(2) instead of epoll(2), which is Linux specific,
 // We need a hash table to quickly map a file descriptor with a hit
@@ -61,15 +349,43 @@ typedef struct  {
 // Single context
 typedef struct dstc_context {
     pthread_mutex_t lock;
+    // Number of times lock is recursively held by its owner.
+    // Only accessed while lock is held.
+    uint32_t lock_depth;
+
+    // Thread currently dispatching incoming calls, and its
+    // recursion depth. Incoming packets are only dispatched by
+    // one thread at a time in order to keep per-publisher
+    // ordering while lock is released during dispatch.
+    pthread_t dispatch_thread;
+    uint32_t dispatch_depth;
+
     // All remote nodes and their functions that can be called
-    // through DSTC_CLIENT-registered functions
+    // through DSTC_CLIENT-registered functions.
+    // Grown as remote nodes register their functions.
     // FIXME: Hash table
-    dstc_remote_node_t remote_node[SYMTAB_SIZE];
+    dstc_remote_node_t* remote_node;
     uint32_t remote_node_ind;
+    uint32_t remote_node_size;
 
     // All currently active local callback functions passed
     // to DSTC_CLIENT-registered call by the application.
-    // FIXME: Hash table
+    // Grown as needed. callback_slot_free is the index + 1 of
+    // the first free slot, or 0 if all slots up to
+    // callback_slot_ind are in use.
+    dstc_callback_slot_t* callback_slot;
+    uint32_t callback_slot_ind;
+    uint32_t callback_slot_size;
+    uint32_t callback_slot_free;
+
+    // Index + 1 of the slot last activated by
+    // dstc_activate_callback(), which is usually an argument of the
+    // call about to be made. 0 once the slot has been counted as
+    // outstanding with the node of a targeted call.
+    uint32_t callback_slot_last;
+
+    // Callbacks with application-provided references registered
+    // through dstc_register_callback_server().
     struct {
         dstc_internal_dispatch_t callback;
         dstc_callback_t callback_ref;
@@ -79,6 +395,9 @@ typedef struct dstc_context {
 
 #if (defined(__linux__) || defined(__ANDROID__)) && !defined(USE_POLL)
     int epoll_fd;
+    // Set if epoll_fd was created by DSTC, in which case it is
+    // closed by dstc_destroy_context().
+    uint8_t epoll_fd_owned;
 #else
     poll_elem_t poll_elem_array[DSTC_MAX_CONNECTIONS];
     poll_elem_t* poll_hash;
@@ -94,21 +413,270 @@ typedef struct dstc_context {
     dstc_client_func_t client_func[SYMTAB_SIZE] ;
     uint32_t client_func_ind;
 
+    // Bumped whenever the id_state or compact flag of a client
+    // function changes in a way that remote nodes may no longer
+    // resolve calls encoded before. Thread buffers record the value
+    // their calls were staged with. See _dstc_thread_buffer_merge().
+    uint32_t func_id_gen;
+
     uint32_t client_callback_count;
 
-    // All local server functions that can be called by remote nodes
-    // FIXME: Hash table
-    dstc_server_func_t server_func[SYMTAB_SIZE];
+    // All local server functions that can be called by remote nodes.
+    // server_func is grown as DSTC_SERVER() constructor functions
+    // register their functions.
+    dstc_server_func_t* server_func;
     uint32_t server_func_ind;
+    uint32_t server_func_size;
+
+    // Function ID bindings of all remote nodes publishing calls to us.
+    // publisher_cache is the last publisher looked up, since all calls
+    // in a packet are sent by the same node.
+    dstc_publisher_t* publisher;
+    uint32_t publisher_ind;
+    uint32_t publisher_size;
+    dstc_publisher_t* publisher_cache;
+
+    // Open addressing index into server_func, built by
+    // _dstc_build_server_func_index() when the context is setup.
+    // Each element is the server_func index + 1 of a function, with 0
+    // marking an empty slot. Size is always a power of two.
+    uint32_t* server_func_hash;
+    uint32_t server_func_hash_mask;
+
+    // DSTC_FILTER_NAME_BIT() of all server functions, set together
+    // with server_func_hash. Packets whose filter record has none of
+    // these bits set, nor DSTC_FILTER_CALLBACK while callbacks are in
+    // use, are skipped. See _dstc_packet_skippable().
+    uint64_t sub_filter;
+    uint64_t sub_packets_skipped;
 
     rmc_sub_context_t* sub_ctx;
     rmc_pub_context_t* pub_ctx;
-    uint8_t pub_buffer[RMC_MAX_PAYLOAD];
+    // Packet buffer that calls are currently queued to, taken from
+    // the packet buffer pool. 0 if no calls are queued.
+    // Handed over to RMC by _queue_pending_calls(), and returned to
+    // the pool through free_published_packets().
+    uint8_t* pub_buffer;
     uint32_t pub_buffer_ind;
+
+    // Set if pub_buffer starts with a DSTC_RECORD_FILTER record, which
+    // is written from pub_filter, the filter bits of all records
+    // stored after it, once the buffer is queued.
+    uint8_t pub_filter_record;
+    uint64_t pub_filter;
+
+    // Offset + 1 of the DSTC_RECORD_COMPACT block that calls are
+    // added to in pub_buffer, or 0 if none. The block is closed as
+    // soon as any other record is stored after it.
+    uint32_t pub_block_ind;
+    uint64_t pub_compact_calls;
+
+    // Callback replies to reply_node_id, sent to it directly as a
+    // single control message by _dstc_flush_replies(). The buffer is
+    // allocated on first use and holds DSTC_REPLY_BUFFER_SIZE bytes,
+    // starting with DSTC_REPLY_HEADER_LEN bytes of control message
+    // header. reply_ind is 0 if there are no pending replies.
+    uint8_t* reply_buffer;
+    uint32_t reply_ind;
+    uint32_t reply_count;
+    rmc_node_id_t reply_node_id;
+    uint8_t reply_reserved;
+    uint64_t pub_direct_callbacks;
+
+    // Nodes that callback references handed to server functions
+    // refer to. See dstc_import_callback_ref().
+    // reply_node[ind] is 0 if the slot has been released. Released
+    // slots are linked, oldest first, through reply_node_next, from
+    // reply_node_free_head to reply_node_free_tail, as index + 1.
+    // reply_node_hash holds the index + 1 of each node in reply_node,
+    // or 0 for an empty entry. reply_node_ind is the number of slots
+    // ever used.
+    // reply_node_reuse counts, modulo DSTC_CALLBACK_REF_REUSE_COUNT,
+    // the times each slot has been released. References carry the
+    // count of their slot, so that replies through references to a
+    // released node are never sent to a node now holding the slot.
+    rmc_node_id_t reply_node[DSTC_CALLBACK_REF_NODE_COUNT];
+    uint8_t reply_node_reuse[DSTC_CALLBACK_REF_NODE_COUNT];
+    uint16_t reply_node_next[DSTC_CALLBACK_REF_NODE_COUNT];
+    uint16_t reply_node_hash[DSTC_REPLY_NODE_HASH_SIZE];
+    uint32_t reply_node_ind;
+    uint16_t reply_node_free_head;
+    uint16_t reply_node_free_tail;
+
+    // Full packet buffers waiting to be handed over to RMC while
+    // traffic is suspended, oldest first, linked through next_free
+    // and with their length in len. Drained by
+    // _dstc_drain_pub_queue() as traffic resumes. The bytes of calls
+    // held by the queue are limited to pub_queue_budget.
+    dstc_packet_buffer_t* pub_queue_head;
+    dstc_packet_buffer_t* pub_queue_tail;
+    uint32_t pub_queue_len;
+    uint32_t pub_queue_bytes;
+    uint32_t pub_queue_budget;
+    uint32_t pub_queue_high_water;
+    uint64_t pub_queue_budget_exhausted;
+
+    // Packet buffer pool. Buffers are allocated as needed, up to
+    // the number of packets that can be in flight before RMC
+    // suspends traffic plus those in the outbound queue, and are
+    // never returned to the heap.
+    dstc_packet_buffer_t* pub_pool_free;
+    uint32_t pub_pool_allocated;
+    uint32_t pub_pool_in_use;
+    uint32_t pub_pool_high_water;
+    uint64_t pub_pool_reused;
+    uint64_t pub_packets_queued;
     uint8_t pub_is_buffering;
+
+    // Flush timer of buffered mode, set by
+    // dstc_buffer_client_calls_timed(). Buffered calls are queued
+    // with RMC once pub_flush_bytes have been collected, or
+    // pub_flush_usec after the first of them was made. 0 if not set.
+    // pub_flush_deadline is the time by which the payload buffer is
+    // to be queued, or 0 if not set.
+    uint32_t pub_flush_usec;
+    uint32_t pub_flush_bytes;
+    usec_timestamp_t pub_flush_deadline;
+
+    // Set by dstc_buffer_client_calls_adaptive(), in which case
+    // pub_flush_bytes is adjusted by _dstc_adapt_flush_window().
+    // pub_flush_rate is the average rate of calls queued, in bytes
+    // per second, and pub_flush_latency_usec the average time calls
+    // waited to be queued. pub_last_queue_usec is the time the last
+    // packet was queued. See _dstc_sample_flush().
+    uint8_t pub_flush_adaptive;
+    uint64_t pub_flush_window_changes;
+    uint64_t pub_flush_rate;
+    uint32_t pub_flush_latency_usec;
+    usec_timestamp_t pub_last_queue_usec;
+
+    // Outbound flow control. pub_suspended mirrors RMC traffic
+    // suspension and is updated by _dstc_update_flow_control(),
+    // which signals flow_fd, flow_cond and flow_control_cb on each
+    // transition. flow_fd[0] is readable while traffic is not
+    // suspended. Both are -1 until dstc_get_flow_control_fd() is
+    // called, and refer to the same eventfd on Linux.
+    // group_suspended has bit N set while traffic of group context N
+    // is suspended. flow_suspended is the state last notified, set
+    // while traffic of the context or any of its group contexts is
+    // suspended. Group contexts notify their root context only.
+    uint8_t pub_suspended;
+    uint64_t pub_suspended_count;
+    uint32_t group_suspended;
+    uint8_t flow_suspended;
+    int flow_fd[2];
+    void (*flow_control_cb)(uint8_t suspended);
+
+    // Threads blocked in dstc_wait_for_capacity() on flow_cond, and
+    // threads waiting for events in _dstc_process_single_event().
+    pthread_cond_t flow_cond;
+    uint32_t flow_waiters;
+    uint32_t event_wait_threads;
+
+    // Part of the event set, and made readable by
+    // _dstc_wake_event_waiters() once calls get a flush deadline,
+    // which may be earlier than the timeout that threads already
+    // waiting for events use. Drained by _dstc_wake_fd_drain() once
+    // reported. Created by dstc_setup_internal(), and refer to the
+    // same eventfd on Linux.
+    int wake_fd[2];
+
+    // Inbound payload buffer pool, one free list per size class.
+    // Buffers are allocated from the heap only when the free list
+    // of their size class is empty, and are never returned to the
+    // heap. The number of buffers is bounded by the packets that
+    // publishers can have in flight before RMC suspends them.
+    dstc_packet_buffer_t* sub_pool_free[DSTC_RX_POOL_CLASS_COUNT];
+    uint32_t sub_pool_in_use;
+    uint64_t sub_pool_heap_allocs;
+    uint64_t sub_pool_reused;
+
+    // Number of batches handed to DSTC_SERVER_BATCH functions, and
+    // the calls they held.
+    uint64_t sub_batches;
+    uint64_t sub_batched_calls;
+
+    // Nesting depth of dstc_bulk_begin() calls. Calls queued
+    // while non-zero are collected as in buffered mode, and
+    // queued with RMC by the outermost dstc_bulk_end().
+    uint32_t pub_bulk_depth;
+
+    // Buffers of all threads that have staged calls. The buffer of
+    // the calling thread is found through thread_buffer_key, which
+    // is created when the context is setup.
+    dstc_thread_buffer_t* thread_buffer;
+    pthread_key_t thread_buffer_key;
+
+    // Set if staged calls could not be merged when leaving buffered
+    // mode since RMC traffic was suspended.
+    uint8_t thread_buffer_stranded;
+
+    // Executor running server functions on worker threads, setup by
+    // dstc_setup_executor(). Disabled while exec_worker_count is 0.
+    // exec_lock protects the worker queues, exec_call_free,
+    // exec_packets and the exec_ counters. It is always taken after
+    // lock, never before.
+    pthread_mutex_t exec_lock;
+    pthread_cond_t exec_space_cond;
+    dstc_exec_worker_t* exec_worker;
+    uint32_t exec_worker_count;
+    uint32_t exec_next_worker;
+    int exec_ordering;
+    uint8_t exec_stopping;
+
+    // Set, under lock, when a worker thread dispatching incoming
+    // packets had to leave them in RMC since the executor was full.
+    // They are picked up by the next worker that executes a call.
+    uint8_t exec_pending;
+    dstc_exec_call_t* exec_call_free;
+
+    // Number of inbound packets with calls not yet executed.
+    uint32_t exec_packets;
+    uint32_t exec_max_packets;
+    uint64_t exec_calls;
+    uint64_t exec_stolen;
+    uint64_t exec_stalls;
+
+    // Functions spread across group_count multicast groups by
+    // dstc_setup_groups(), or 0 if all calls go through a single
+    // group. Group 0 is carried by the context itself. Each other
+    // group carrying any of its functions gets a group context in
+    // group_ctx[], created when the context is setup, with its own
+    // publisher and subscriber on the following group address and
+    // port.
+    // Group contexts have group_root set to the context that created
+    // them, and group set to the group they carry. They lock their
+    // root context to invoke callbacks, so a root context is never
+    // held while one of its group contexts is locked.
+    uint32_t group_count;
+    uint8_t group;
+    struct dstc_context* group_root;
+    struct dstc_context* group_ctx[DSTC_MAX_GROUPS];
+    dstc_group_map_t* group_map;
+    uint32_t group_map_ind;
+    uint32_t group_map_size;
 } dstc_context_t;
 
 
+// Number of records in an inbound packet indexed at a time before
+// they are dispatched. Runs and batches of calls never extend past
+// the records indexed together.
+#define DSTC_CALL_INDEX_SIZE 1024
+
+// Record located in an inbound packet by _dstc_index_calls().
+// type is the DSTC_RECORD_XXX type of the record, or the first
+// character of the function name of a call by name.
+// For DSTC_RECORD_FUNC_ID calls, func_id is the function ID and
+// payload holds the function arguments. For all other records,
+// payload is the entire record payload, starting with its type.
+typedef struct {
+    uint8_t* payload;
+    rmc_node_id_t node_id;
+    uint16_t payload_len;
+    uint16_t func_id;
+    uint8_t type;
+} dstc_record_t;
+
 typedef struct  __attribute__((packed))
 dstc_header {
     rmc_node_id_t node_id;         // 4 bytes  Publisher Node ID
@@ -116,10 +684,103 @@ dstc_header {
     uint8_t payload[];             // Function name fllowed by \0 and function args.
 } dstc_header_t;
 
+// The first payload byte of a call identifies its record type.
+// Any value not listed below is the first character of a function
+// name, followed by the rest of the name, \0, and function args.
+//
+// Callback: [0x00][callback_ref: 8 bytes][args]
+//
+// Callback replies sent directly to a node are carried by a control
+// message with an empty function name, followed by their records:
+// [node_id: 4 bytes][0x00][records]
+#define DSTC_RECORD_CALLBACK 0x00
+#define DSTC_REPLY_HEADER_LEN (sizeof(rmc_node_id_t) + 1)
+#define DSTC_REPLY_BUFFER_SIZE 4096
+
+// Number of callback records in a control message indexed at a time.
+#define DSTC_REPLY_INDEX_SIZE 64
+
+// Function ID call: [0x01][func_id: 2 bytes][args]
+// func_id must have been bound by a prior DSTC_RECORD_BIND record
+// from the same publisher.
+#define DSTC_RECORD_FUNC_ID 0x01
+
+// Bind a function ID to a function name: [0x02][func_id: 2 bytes][name\0]
+#define DSTC_RECORD_BIND 0x02
+
+// Block of calls by function ID, sharing the node ID and record
+// header of the block:
+// [0x03][version: 1 byte][call count: 2 bytes][call]...
+// Each call is [length: varint][func_id: varint][args], with length
+// covering func_id and args. Varints are little endian base 128.
+// Only sent to nodes announcing DSTC_CAP_COMPACT. Older nodes see a
+// call to an unknown function, and ignore the entire block.
+#define DSTC_RECORD_COMPACT 0x03
+#define DSTC_COMPACT_VERSION 1
+#define DSTC_COMPACT_HEADER_LEN (1 + 1 + sizeof(uint16_t))
+
+// Max number of calls in a compact block. Blocks are indexed in one
+// go by the receiver, and must fit in DSTC_CALL_INDEX_SIZE records.
+#define DSTC_COMPACT_MAX_CALLS DSTC_CALL_INDEX_SIZE
+
+// Max length of a varint encoding a 16 bit value.
+#define DSTC_VARINT_MAX_LEN 3
+
+// Largest arguments of a call that fits in a compact block in an
+// otherwise empty packet.
+#define DSTC_COMPACT_MAX_ARG_SIZE                                       \
+    (RMC_MAX_PAYLOAD - sizeof(dstc_header_t) - DSTC_COMPACT_HEADER_LEN - 2 * DSTC_VARINT_MAX_LEN)
+
+// Call addressed to a single node:
+// [0x04][target node_id: 4 bytes][call]
+// call is a call by name or a DSTC_RECORD_FUNC_ID call, without a
+// header of its own. All other nodes drop the record from its target
+// node ID alone.
+// Only sent to nodes announcing DSTC_CAP_TARGET. Older nodes see a
+// call to an unknown function, and ignore it.
+#define DSTC_RECORD_TARGET 0x04
+#define DSTC_TARGET_HEADER_LEN (1 + sizeof(rmc_node_id_t))
+
+// Filter of the calls in a packet:
+// [0x05][0x00][filter: 8 bytes]
+// Only sent as the first record of a packet. Each call sets the
+// DSTC_FILTER_NAME_BIT() of its function name, and each callback
+// sets DSTC_FILTER_CALLBACK. Receivers skip packets whose filter has
+// none of the bits of their own functions set, without looking at
+// any other record. Packets with no filter record are always
+// processed.
+// Older nodes see a call to the unknown function "\x05", and ignore
+// it.
+#define DSTC_RECORD_FILTER 0x05
+#define DSTC_FILTER_RECORD_LEN (sizeof(dstc_header_t) + 2 + sizeof(uint64_t))
+#define DSTC_FILTER_CALLBACK (1ULL << 63)
+#define DSTC_FILTER_NAME_BIT(_name_hash) (1ULL << ((_name_hash) % 63))
+
+// Filler keeping the records that follow it at the same offset,
+// modulo DSTC_RECORD_ALIGNMENT, as in the buffer they were moved from:
+// [0x06][zero bytes]
+// The arguments of DSTC_CLIENT_ALIGNED() calls are aligned to their
+// offset in the buffer they were serialized into.
+// Older nodes see a call to the unknown function "\x06", and ignore
+// it.
+#define DSTC_RECORD_PAD 0x06
+#define DSTC_RECORD_ALIGNMENT _DSTC_ARGS_ALIGNMENT
+#define DSTC_PAD_RECORD_MIN_LEN (sizeof(dstc_header_t) + 1)
+
+// Function names are C identifiers, and never start with a control
+// character. Record types are kept below DSTC_RECORD_NAME_MIN.
+#define DSTC_RECORD_NAME_MIN 0x20
+
+// Record is a call to a server function, by ID or by name, with no
+// other side effect on the context.
+#define DSTC_RECORD_IS_CALL(_type) \
+    ((_type) == DSTC_RECORD_FUNC_ID || (_type) >= DSTC_RECORD_NAME_MIN)
+
 #define DEFAULT_MCAST_GROUP_ADDRESS "239.40.41.42" // Completely made up
 #define DEFAULT_MCAST_GROUP_PORT 4723 // Completely made up
 #define DEFAULT_MCAST_TTL 1
 #define DEFAULT_MAX_DSTC_NODES 32
+#define DEFAULT_PUB_QUEUE_BUDGET (4 * RMC_MAX_PAYLOAD)
 
 // Environment variables that affect DSTC setup
 #define DSTC_ENV_NODE_ID "DSTC_NODE_ID"
@@ -131,12 +792,23 @@ dstc_header {
 #define DSTC_ENV_CONTROL_LISTEN_IFACE "DSTC_CONTROL_LISTEN_IFACE"
 #define DSTC_ENV_CONTROL_LISTEN_PORT "DSTC_CONTROL_LISTEN_PORT"
 #define DSTC_ENV_LOG_LEVEL "DSTC_LOG_LEVEL"
+#define DSTC_ENV_MCAST_GROUP_COUNT "DSTC_MCAST_GROUP_COUNT"
+#define DSTC_ENV_MCAST_GROUP_MAP "DSTC_MCAST_GROUP_MAP"
 
 
 #define USER_DATA_INDEX_MASK 0x00007FFF
 #define USER_DATA_PUB_FLAG   0x00008000
 #define IS_PUB(_user_data) (((_user_data) & USER_DATA_PUB_FLAG)?1:0)
 
+// Set for the epoll descriptor of a group context, added to the
+// epoll descriptor of its root context with the group as index.
+#define USER_DATA_GROUP_FLAG 0x00010000
+#define IS_GROUP(_user_data) (((_user_data) & USER_DATA_GROUP_FLAG)?1:0)
+
+// Set for wake_fd[0] of a context.
+#define USER_DATA_WAKE_FLAG 0x00020000
+#define IS_WAKE(_user_data) (((_user_data) & USER_DATA_WAKE_FLAG)?1:0)
+
 extern void poll_add_pub(user_data_t user_data,
                          int descriptor,
                          rmc_index_t index,
@@ -162,9 +834,28 @@ extern void poll_remove(user_data_t user_data,
                         int descriptor,
                         rmc_index_t index);
 
+extern void poll_add_wake(user_data_t user_data,
+                          int descriptor);
+
 extern int _dstc_process_single_event(dstc_context_t* ctx,
                                       int timeout_msec);
 
+#if (!defined(__linux__) && !defined(__ANDROID__)) || defined(USE_POLL)
+extern void _dstc_poll_close_all(dstc_context_t* ctx);
+#endif
+
+extern void _dstc_resume_pending_calls(dstc_context_t* ctx);
+
+extern void _dstc_wake_fd_drain(dstc_context_t* ctx);
+
+extern void _dstc_process_group_events(dstc_context_t* ctx,
+                                       uint32_t group,
+                                       uint8_t timeout);
+
+// Returns the context bound to the calling thread by
+// dstc_use_context(), or the default context.
+extern dstc_context_t* _dstc_current_context(void);
+
 
 #define _dstc_lock_context(ctx) __dstc_lock_context(ctx, __LINE__)
 #define _dstc_unlock_context(ctx) __dstc_unlock_context(ctx, __LINE__)
@@ -59,6 +59,13 @@ void poll_add_pub(user_data_t user_data,
     poll_add(user_data, descriptor, TO_POLL_EVENT_USER_DATA(index, 1), action);
 }
 
+// Add wake_fd[0] of a context to its event set.
+void poll_add_wake(user_data_t user_data,
+                   int descriptor)
+{
+    poll_add(user_data, descriptor, USER_DATA_WAKE_FLAG, RMC_POLLREAD);
+}
+
 static void poll_modify(user_data_t user_data,
                         int descriptor,
                         uint32_t event_user_data,
@@ -143,6 +150,19 @@ static void _dstc_process_epoll_result(dstc_context_t* ctx,
     rmc_index_t c_ind = (rmc_index_t) FROM_POLL_EVENT_USER_DATA(event->data.u32);
     int is_pub = IS_PUB(event->data.u32);
 
+    // Another thread has set a flush deadline. Have the caller
+    // return, and wait again with a timeout that observes it.
+    if (IS_WAKE(event->data.u32)) {
+        _dstc_wake_fd_drain(ctx);
+        return;
+    }
+
+    // The epoll descriptor of a group context has events pending.
+    if (IS_GROUP(event->data.u32)) {
+        _dstc_process_group_events(ctx, c_ind, 0);
+        return;
+    }
+
     RMC_LOG_INDEX_DEBUG(c_ind, "%s: %s%s%s",
                         (is_pub?"pub":"sub"),
                         ((event->events & EPOLLIN)?" read":""),
@@ -151,9 +171,11 @@ static void _dstc_process_epoll_result(dstc_context_t* ctx,
 
 
     if (event->events & EPOLLIN) {
-        if (is_pub)
+        if (is_pub) {
             rmc_pub_read(ctx->pub_ctx, c_ind, &op_res);
-        else
+            // Acks may have lifted a traffic suspension.
+            _dstc_resume_pending_calls(ctx);
+        } else
             rmc_sub_read(ctx->sub_ctx, c_ind, &op_res);
     }
 
@@ -176,6 +198,7 @@ int _dstc_process_single_event(dstc_context_t* ctx, int timeout_msec)
     int nfds = 0;
     int fd = ctx->epoll_fd;
 
+    ctx->event_wait_threads++;
     _dstc_unlock_context(ctx);
     do {
         errno = 0;
@@ -185,6 +208,12 @@ int _dstc_process_single_event(dstc_context_t* ctx, int timeout_msec)
                           timeout_msec);
     } while(nfds == -1 && errno == EINTR);
     _dstc_lock_context(ctx);
+    ctx->event_wait_threads--;
+
+    // Let threads blocked in dstc_wait_for_capacity() take over
+    // waiting for events.
+    if (ctx->flow_waiters)
+        pthread_cond_broadcast(&ctx->flow_cond);
 
     if (nfds == -1) {
         RMC_LOG_FATAL("epoll_wait(%d): %s",  fd, strerror(errno));
@@ -206,10 +235,7 @@ int _dstc_process_single_event(dstc_context_t* ctx, int timeout_msec)
 void dstc_process_epoll_result(struct epoll_event* event)
 
 {
-    extern dstc_context_t _dstc_default_context;
-
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    dstc_context_t* ctx = _dstc_current_context();
 
     _dstc_lock_and_init_context(ctx);
     _dstc_process_epoll_result(ctx, event);
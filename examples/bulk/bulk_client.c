@@ -0,0 +1,92 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Publish sensor samples in bulk through the dstc_[name]_bulk()
+// function generated by DSTC_CLIENT().
+//
+
+#include "dstc.h"
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rmc_log.h"
+
+#define SAMPLES_PER_TICK 256
+#define SAMPLE_COUNT (SAMPLES_PER_TICK * 20000)
+
+// Generates both dstc_sample() and dstc_sample_bulk()
+DSTC_CLIENT(sample, int,, double, [3])
+
+int main(int argc, char* argv[])
+{
+    int seq[SAMPLES_PER_TICK];
+    double value[SAMPLES_PER_TICK][3];
+    int sent = 0;
+    int ind = 0;
+    usec_timestamp_t start_ts = 0;
+    usec_timestamp_t stop_ts = 0;
+
+    // Wait for function to become available on one or more servers.
+    while(!dstc_remote_function_available(dstc_sample))
+        dstc_process_events(-1);
+
+    start_ts = rmc_usec_monotonic_timestamp();
+    while(sent < SAMPLE_COUNT) {
+        int queued = 0;
+
+        // Fill out a tick's worth of samples.
+        for(ind = 0; ind < SAMPLES_PER_TICK; ++ind) {
+            seq[ind] = sent + ind;
+            value[ind][0] = seq[ind];
+            value[ind][1] = seq[ind] * 2.0;
+            value[ind][2] = seq[ind] * 3.0;
+        }
+
+        // Queue all samples under a single lock.
+        // If traffic is suspended, process events and queue the
+        // samples that did not make it.
+        ind = 0;
+        while(ind < SAMPLES_PER_TICK) {
+            queued = dstc_sample_bulk(SAMPLES_PER_TICK - ind, &seq[ind], &value[ind]);
+            if (queued < 0) {
+                printf("dstc_sample_bulk(): %s\n", strerror(-queued));
+                exit(255);
+            }
+            ind += queued;
+
+            if (ind < SAMPLES_PER_TICK)
+                dstc_process_events(1);
+        }
+
+        sent += SAMPLES_PER_TICK;
+        if (sent % (SAMPLES_PER_TICK * 1000) == 0)
+            printf("Client sample: %d\n", sent);
+    }
+    stop_ts = rmc_usec_monotonic_timestamp();
+
+    printf("Queued %d samples in %.2f sec -> %.2f samples/sec\n",
+           sent,
+           (stop_ts - start_ts) / 1000000.0,
+           sent / ((stop_ts - start_ts) / 1000000.0));
+
+    puts("Client telling server to exit");
+    seq[0] = -1;
+    while(dstc_sample_bulk(1, seq, value) != 1)
+        dstc_process_events(0);
+
+    // Process events until there are no more.
+    msec_timestamp_t ts = dstc_msec_monotonic_timestamp();
+    msec_timestamp_t timeout = ts + 2000;
+    while(ts < timeout) {
+        dstc_process_events(timeout - ts);
+        ts = dstc_msec_monotonic_timestamp();
+    }
+
+    puts("Client exiting");
+    exit(0);
+}
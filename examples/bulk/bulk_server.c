@@ -0,0 +1,61 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Receive sensor samples published in bulk by bulk_client.c
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include <errno.h>
+
+// Consecutive calls in a packet, as sent by dstc_sample_bulk(), are
+// handed over at once, with one array per argument.
+DSTC_SERVER_BATCH(sample, int,, double, [3])
+
+usec_timestamp_t start_ts = 0;
+
+void sample(uint32_t count, int* seq, double (*value)[3])
+{
+    static int last_seq = -1;
+    uint32_t ind = 0;
+
+    if (start_ts == 0)
+        start_ts = rmc_usec_monotonic_timestamp();
+
+    for(ind = 0; ind < count; ++ind) {
+        if (seq[ind] == -1) {
+            usec_timestamp_t stop_ts = rmc_usec_monotonic_timestamp();
+            printf("Processed %d samples in %.2f sec -> %.2f samples/sec\n",
+                   last_seq + 1,
+                   (stop_ts - start_ts) / 1000000.0,
+                   (last_seq + 1) / ((stop_ts - start_ts) / 1000000.0));
+
+            dstc_process_events(0);
+            exit(0);
+        }
+
+        // Check that we got the expected sample.
+        if (seq[ind] != last_seq + 1 ||
+            value[ind][0] != seq[ind] ||
+            value[ind][1] != seq[ind] * 2.0 ||
+            value[ind][2] != seq[ind] * 3.0) {
+            printf("Integrity failure! Want sample %d Got sample %d [%f %f %f]\n",
+                   last_seq + 1, seq[ind], value[ind][0], value[ind][1], value[ind][2]);
+            exit(255);
+        }
+        last_seq = seq[ind];
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    // Process incoming events forever
+    while(1)
+        dstc_process_events(-1);
+}
@@ -0,0 +1,103 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Pipeline many outstanding calls using the same callback function,
+// each with its own user data.
+//
+
+#include <stdlib.h>
+#include "dstc.h"
+#include "rmc_log.h"
+#include <errno.h>
+
+#define CALL_COUNT 10000
+
+DSTC_CLIENT(double_value, int,, DSTC_DECL_CALLBACK_ARG);
+
+static int expected[CALL_COUNT];
+static int received[CALL_COUNT];
+static int callback_count = 0;
+
+//
+// Invoked once for each call to dstc_double_value() below.
+// user_data is the pointer provided to
+// DSTC_CLIENT_CALLBACK_ARG_USER_DATA() for the call that the
+// server responded to.
+//
+void double_value_callback(void* user_data, int value)
+{
+    int* exp = (int*) user_data;
+    int ind = exp - expected;
+
+    if (value != *exp) {
+        printf("Error: callback [%d] expected %d, got %d\n", ind, *exp, value);
+        exit(255);
+    }
+
+    if (received[ind]) {
+        printf("Error: callback [%d] invoked twice\n", ind);
+        exit(255);
+    }
+
+    received[ind] = 1;
+    ++callback_count;
+}
+
+DSTC_CLIENT_CALLBACK_USER_DATA(double_value_callback, int,);
+
+
+int main(int argc, char* argv[])
+{
+    int ind = 0;
+    msec_timestamp_t start = 0;
+    msec_timestamp_t timeout = 0;
+
+    // Wait for function to become available on one or more servers.
+    while(!dstc_remote_function_available(dstc_double_value))
+        dstc_process_events(-1);
+
+    start = dstc_msec_monotonic_timestamp();
+
+    // Have all calls outstanding at once.
+    for(ind = 0; ind < CALL_COUNT; ++ind) {
+        expected[ind] = ind * 2;
+
+        while(dstc_double_value(ind, DSTC_CLIENT_CALLBACK_ARG_USER_DATA(double_value_callback,
+                                                                          &expected[ind])) == EBUSY)
+            dstc_process_events(0);
+    }
+
+    timeout = dstc_msec_monotonic_timestamp() + 10000;
+    while(callback_count < CALL_COUNT && dstc_msec_monotonic_timestamp() < timeout)
+        dstc_process_events(10);
+
+    if (callback_count != CALL_COUNT) {
+        printf("Error: got %d callbacks, expected %d\n", callback_count, CALL_COUNT);
+        exit(255);
+    }
+
+    printf("%d pipelined callbacks in %ld msec\n",
+           CALL_COUNT, (long) (dstc_msec_monotonic_timestamp() - start));
+
+    // Send -1 to trigger server exit.
+    while(dstc_double_value(-1, DSTC_CLIENT_CALLBACK_ARG_NULL) == EBUSY)
+        dstc_process_events(0);
+
+    // Process events until the exit call has been delivered.
+    timeout = dstc_msec_monotonic_timestamp() + 500;
+    while(dstc_msec_monotonic_timestamp() < timeout)
+        dstc_process_events(timeout - dstc_msec_monotonic_timestamp());
+
+    // Stale replies sent by the server must not have been delivered.
+    if (callback_count != CALL_COUNT) {
+        printf("Error: got %d callbacks after stale replies, expected %d\n",
+               callback_count, CALL_COUNT);
+        exit(255);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Server side of the pipelined callback example.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include "rmc_log.h"
+#include <errno.h>
+
+DSTC_SERVER(double_value, int,, DSTC_DECL_CALLBACK_ARG)
+
+DSTC_SERVER_CALLBACK(callback_ref, int,);
+
+void double_value(int value, dstc_callback_t callback_ref)
+{
+    if (value == -1) {
+        puts("double_value(-1): Got exit signal.");
+        while(dstc_process_events(0) != ETIME)
+            ;
+        exit(0);
+    }
+
+    while(dstc_callback_ref(callback_ref, value + value) == EBUSY)
+        dstc_process_events(0);
+
+    // Reply a second time to every tenth call with a bogus
+    // value. The client must detect it as a stale reply and
+    // never invoke the callback.
+    if (value % 10 == 0)
+        while(dstc_callback_ref(callback_ref, -1) == EBUSY)
+            dstc_process_events(0);
+}
+
+int main(int argc, char* argv[])
+{
+    // Process incoming events for ever
+    while(1)
+        dstc_process_events(-1);
+
+    exit(0);
+}
@@ -23,14 +23,18 @@ char g_username[128];
 // A call to dstc_message will trigger a call to
 // chat_message() in all nodes that have loaded this library.
 //
-DSTC_CLIENT(chat_message, char, [128], char, [512])
+// The aligned variant pads each argument to its natural alignment,
+// allowing the server side to pass username and buf as pointers
+// straight into the received packet instead of copying them.
+//
+DSTC_CLIENT_ALIGNED(chat_message, const char, [128], const char, [512])
 
 // Generate deserializer for multicast packets sent by dstc_chat_message()
 // above.
 // The deserializer decodes the incoming data and calls the
 // chat_message() function in this file.
 //
-DSTC_SERVER(chat_message, char, [128], char, [512])
+DSTC_SERVER_ALIGNED(chat_message, const char, [128], const char, [512])
 
 //
 // Handle keyboard input on stdin.  called by dstc_node since init()
@@ -48,7 +52,7 @@ static void handle_keyboard()
 
     // Distribute the input.
     // dstc_char_message() is the client side of chat_message() that
-    // is generated by the DSTC_CLIENT() macro.
+    // is generated by the DSTC_CLIENT_ALIGNED() macro.
     //
     // dstc_chat_message() will:
     // 1. serialize username and buf
@@ -64,9 +68,9 @@ static void handle_keyboard()
 
 //
 // Process an incoming message with a message() function call.
-// Invoked by deserilisation code generated by DSTC_SERVER() above.
+// Invoked by deserilisation code generated by DSTC_SERVER_ALIGNED() above.
 //
-void chat_message(char username[128], char buf[512])
+void chat_message(const char username[128], const char buf[512])
 {
     printf("\r[%s]: %s\n", username, buf);
     printf("> ");
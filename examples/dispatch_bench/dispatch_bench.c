@@ -0,0 +1,106 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Benchmark of inbound dispatch of packets full of small calls.
+//
+// The calls are sent to ourselves in buffered mode, packing each
+// packet with several thousand calls, and are received through the
+// loopback of the multicast group. The receive rate is measured over
+// the time spent in dstc_process_events(), which is dominated by
+// dispatching the received calls. It is measured once for a
+// DSTC_SERVER() function, and once for a DSTC_SERVER_BATCH() function.
+//
+// Usage: dispatch_bench [calls]
+//
+
+#include "dstc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define DEFAULT_CALLS 10000000
+
+DSTC_CLIENT(small_call, int,)
+DSTC_SERVER(small_call, int,)
+
+DSTC_CLIENT(small_batch, int,)
+DSTC_SERVER_BATCH(small_batch, int,)
+
+static uint32_t received = 0;
+static uint64_t sink = 0;
+
+void small_call(int value)
+{
+    sink += value;
+    received++;
+}
+
+void small_batch(uint32_t count, int* value)
+{
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < count; ++ind)
+        sink += value[ind];
+
+    received += count;
+}
+
+static usec_timestamp_t process_usec = 0;
+
+// Process events, and add the time spent to process_usec.
+static void process_events(void)
+{
+    usec_timestamp_t start = rmc_usec_monotonic_timestamp();
+
+    dstc_process_events(-1);
+    process_usec += rmc_usec_monotonic_timestamp() - start;
+}
+
+static void report(const char* name, uint32_t calls, usec_timestamp_t usec)
+{
+    printf("%-12s %u calls, %.2f sec processing events -> %.0f calls/sec\n",
+           name, calls, usec / 1000000.0, calls / (usec / 1000000.0));
+}
+
+// Send calls calls through the given client function and wait for
+// all of them to be dispatched.
+#define RUN(name)                                                       \
+    {                                                                   \
+        uint32_t ind = 0;                                               \
+                                                                        \
+        received = 0;                                                   \
+        process_usec = 0;                                               \
+        dstc_buffer_client_calls();                                     \
+        for(ind = 0; ind < calls; ++ind)                                \
+            while(dstc_##name(ind) == EBUSY)                            \
+                process_events();                                       \
+        dstc_unbuffer_client_calls();                                   \
+                                                                        \
+        while(received < calls)                                         \
+            process_events();                                           \
+                                                                        \
+        report(#name, calls, process_usec);                             \
+    }
+
+int main(int argc, char* argv[])
+{
+    uint32_t calls = (argc > 1)?(uint32_t) atoi(argv[1]):DEFAULT_CALLS;
+    dstc_stats_t stats;
+
+    while(!dstc_remote_function_available(dstc_small_call) ||
+          !dstc_remote_function_available(dstc_small_batch))
+        dstc_process_events(-1);
+
+    RUN(small_call);
+    RUN(small_batch);
+
+    dstc_get_stats(&stats);
+    printf("%lu batches, %.1f calls per batch\n",
+           (unsigned long) stats.sub_batches,
+           stats.sub_batches?(double) stats.sub_batched_calls / stats.sub_batches:0.0);
+    printf("%lu calls sent in compact blocks\n",
+           (unsigned long) stats.pub_compact_calls);
+    exit(0);
+}
@@ -0,0 +1,58 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Client side of the dispatch cost benchmark.
+// See dispatch_stress_server.c for details.
+//
+
+#include "dstc.h"
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "rmc_log.h"
+
+#define CALL_COUNT 5000000
+
+DSTC_CLIENT(set_value, int,)
+
+int main(int argc, char* argv[])
+{
+    int val = 0;
+    // Wait for function to become available on one or more servers.
+    while(!dstc_remote_function_available(dstc_set_value))
+        dstc_process_events(-1);
+
+    // Move into buffered mode to transmit 63K UDP packets, making
+    // the server spend its time on dispatch rather than packet overhead.
+    dstc_buffer_client_calls();
+
+    while(val < CALL_COUNT) {
+        while (dstc_set_value(val) == EBUSY)
+            dstc_process_events(1);
+
+        if (val % 100000 == 0)
+            printf("Client value: %d\n", val);
+
+        ++val;
+    }
+
+    dstc_unbuffer_client_calls();
+    puts("Client telling server to exit");
+    while (dstc_set_value(-1) == EBUSY)
+        dstc_process_events(0);
+
+    // Process events until there are no more.
+    msec_timestamp_t ts = dstc_msec_monotonic_timestamp();
+    msec_timestamp_t timeout = ts + 2000;
+    while(ts < timeout) {
+        dstc_process_events(timeout - ts);
+        ts = dstc_msec_monotonic_timestamp();
+    }
+
+    puts("Client exiting");
+    exit(0);
+}
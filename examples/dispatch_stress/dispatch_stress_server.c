@@ -0,0 +1,97 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Measure incoming call dispatch cost against the number of
+// registered server functions.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include <errno.h>
+
+// Number of extra server functions to register unless
+// specified on the command line.
+#define DEFAULT_EXTRA_FUNCTIONS 1000
+
+// Generate deserializer for multicast packets sent by the client
+// The deserializer decodes the incoming data and calls the
+// set_value() function in this file.
+//
+// set_value is registered first, making it the last function a
+// linear scan over the registered functions would find.
+//
+DSTC_SERVER(set_value, int,)
+
+usec_timestamp_t start_ts = 0;
+int func_count = 0;
+
+// Dispatch function used by all extra functions. Never invoked
+// since the client only calls set_value().
+static void dummy_dispatch(dstc_callback_t callback_ref,
+                           rmc_node_id_t node_id,
+                           uint8_t *name,
+                           uint8_t* payload,
+                           uint16_t payload_len)
+{
+    printf("Dummy function %s called\n", name);
+    exit(255);
+}
+
+void set_value(int value)
+{
+    static int last_value = -1;
+
+    if (start_ts == 0)
+        start_ts = rmc_usec_monotonic_timestamp();
+
+    if (value == -1) {
+        usec_timestamp_t stop_ts = rmc_usec_monotonic_timestamp();
+        printf("%d registered functions: Processed %d calls in %.2f sec -> %.2f calls/sec, %.1f nsec/call\n",
+               func_count,
+               last_value,
+               (stop_ts - start_ts) / 1000000.0,
+               last_value / ((stop_ts - start_ts) / 1000000.0),
+               (stop_ts - start_ts) * 1000.0 / last_value);
+
+        dstc_process_events(0);
+        exit(0);
+    }
+
+    if (value % 100000 == 0)
+        printf("Server value: %d\n", value);
+
+    // Check that we got the expected value.
+    if (last_value != -1 && value != last_value + 1 ) {
+        printf("Integrity failure!  Want value %d Got value %d\n",
+               last_value +1 , value);
+        exit(255);
+    }
+    last_value = value;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int extra = (argc > 1)?atoi(argv[1]):DEFAULT_EXTRA_FUNCTIONS;
+    int ind = 0;
+
+    // Register the extra functions before the first call to
+    // dstc_process_events() sets up DSTC.
+    for(ind = 0; ind < extra; ++ind) {
+        char name[64];
+
+        sprintf(name, "dummy_function_%d", ind);
+        dstc_register_server_function(0, name, dummy_dispatch);
+    }
+    func_count = extra + 1;
+    printf("Registered %d server functions\n", func_count);
+
+    // Process incoming events forever
+    while(1)
+        dstc_process_events(-1);
+}
@@ -0,0 +1,62 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Send calls to four server functions, executed by worker threads
+// in executor_server.
+//
+
+#include "dstc.h"
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#define CALL_COUNT 20000
+
+DSTC_CLIENT(process0, int,)
+DSTC_CLIENT(process1, int,)
+DSTC_CLIENT(process2, int,)
+DSTC_CLIENT(process3, int,)
+
+int main(int argc, char* argv[])
+{
+    int val = 0;
+    msec_timestamp_t ts = 0;
+    msec_timestamp_t timeout = 0;
+
+    // Wait for functions to become available on one or more servers.
+    while(!dstc_remote_function_available(dstc_process3))
+        dstc_process_events(-1);
+
+    dstc_buffer_client_calls();
+
+    for(val = 0; val < CALL_COUNT; ++val) {
+        while (dstc_process0(val) == EBUSY)
+            dstc_process_events(1);
+
+        while (dstc_process1(val) == EBUSY)
+            dstc_process_events(1);
+
+        while (dstc_process2(val) == EBUSY)
+            dstc_process_events(1);
+
+        while (dstc_process3(val) == EBUSY)
+            dstc_process_events(1);
+    }
+
+    dstc_unbuffer_client_calls();
+
+    // Process events until all calls have been delivered.
+    ts = dstc_msec_monotonic_timestamp();
+    timeout = ts + 2000;
+    while(ts < timeout) {
+        dstc_process_events(timeout - ts);
+        ts = dstc_msec_monotonic_timestamp();
+    }
+
+    puts("Client exiting");
+    exit(0);
+}
@@ -0,0 +1,91 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Execute heavy server functions on a pool of worker threads,
+// checking that calls to each function are executed in order.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define FUNC_COUNT 4
+#define CALL_COUNT 20000
+#define WORKER_COUNT 4
+
+DSTC_SERVER(process0, int,)
+DSTC_SERVER(process1, int,)
+DSTC_SERVER(process2, int,)
+DSTC_SERVER(process3, int,)
+
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+static int call_count = 0;
+static int last_value[FUNC_COUNT] = { -1, -1, -1, -1 };
+
+// Simulate a handler that needs a fair amount of CPU.
+static void _process(int func, int value)
+{
+    volatile double acc = value;
+    int ind = 0;
+
+    for(ind = 0; ind < 5000; ++ind)
+        acc = acc * 1.0000001 + 1.0;
+
+    // Calls to the same function are never executed concurrently
+    // with DSTC_EXECUTOR_ORDER_FUNCTION.
+    if (value != last_value[func] + 1) {
+        printf("Integrity failure! Function %d want value %d Got value %d\n",
+               func, last_value[func] + 1, value);
+        exit(255);
+    }
+    last_value[func] = value;
+
+    pthread_mutex_lock(&count_lock);
+    ++call_count;
+    pthread_mutex_unlock(&count_lock);
+}
+
+void process0(int value) { _process(0, value); }
+void process1(int value) { _process(1, value); }
+void process2(int value) { _process(2, value); }
+void process3(int value) { _process(3, value); }
+
+int main(int argc, char* argv[])
+{
+    usec_timestamp_t start_ts = 0;
+    usec_timestamp_t stop_ts = 0;
+    dstc_stats_t stats;
+    int done = 0;
+
+    dstc_setup_executor(WORKER_COUNT, DSTC_EXECUTOR_ORDER_FUNCTION, 0);
+
+    while(!done) {
+        dstc_process_events(100);
+
+        pthread_mutex_lock(&count_lock);
+        if (call_count && !start_ts)
+            start_ts = rmc_usec_monotonic_timestamp();
+
+        done = (call_count == FUNC_COUNT * CALL_COUNT);
+        pthread_mutex_unlock(&count_lock);
+    }
+
+    stop_ts = rmc_usec_monotonic_timestamp();
+    dstc_shutdown_executor();
+    dstc_get_stats(&stats);
+
+    printf("Processed %d calls on %d workers in %.2f sec -> %.2f calls/sec\n",
+           FUNC_COUNT * CALL_COUNT,
+           WORKER_COUNT,
+           (stop_ts - start_ts) / 1000000.0,
+           FUNC_COUNT * CALL_COUNT / ((stop_ts - start_ts) / 1000000.0));
+
+    printf("Executor stalled %llu times\n", (unsigned long long) stats.exec_stalls);
+    exit(0);
+}
@@ -0,0 +1,84 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Spread functions across four multicast groups.
+// With no map file, temperature is carried by group 1, pressure by
+// group 2 and humidity by group 0, each on its own address and port.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include "rmc_log.h"
+#include <errno.h>
+
+#define CALL_COUNT 10000
+#define GROUP_COUNT 4
+
+DSTC_CLIENT(temperature, int,, DSTC_DECL_CALLBACK_ARG);
+DSTC_CLIENT(pressure, int,, DSTC_DECL_CALLBACK_ARG);
+DSTC_CLIENT(humidity, int,, DSTC_DECL_CALLBACK_ARG);
+
+static int callback_count = 0;
+
+void reading_callback(int value)
+{
+    ++callback_count;
+}
+
+DSTC_CLIENT_CALLBACK(reading_callback, int,);
+
+
+int main(int argc, char* argv[])
+{
+    int ind = 0;
+    int res = 0;
+    msec_timestamp_t timeout = 0;
+
+    // Must be done before the first DSTC call sets up the context.
+    res = dstc_setup_groups(GROUP_COUNT, 0);
+    if (res) {
+        printf("Error: dstc_setup_groups() returned %d\n", res);
+        exit(255);
+    }
+
+    while(!dstc_remote_function_available(dstc_temperature) ||
+          !dstc_remote_function_available(dstc_pressure) ||
+          !dstc_remote_function_available(dstc_humidity))
+        dstc_process_events(-1);
+
+    for(ind = 0; ind < CALL_COUNT; ++ind) {
+        while(dstc_temperature(ind, DSTC_CLIENT_CALLBACK_ARG(reading_callback)) == EBUSY)
+            dstc_process_events(0);
+
+        while(dstc_pressure(ind, DSTC_CLIENT_CALLBACK_ARG(reading_callback)) == EBUSY)
+            dstc_process_events(0);
+
+        while(dstc_humidity(ind, DSTC_CLIENT_CALLBACK_ARG(reading_callback)) == EBUSY)
+            dstc_process_events(0);
+    }
+
+    timeout = dstc_msec_monotonic_timestamp() + 10000;
+    while(callback_count < 3 * CALL_COUNT && dstc_msec_monotonic_timestamp() < timeout)
+        dstc_process_events(10);
+
+    if (callback_count != 3 * CALL_COUNT) {
+        printf("Error: got %d callbacks, expected %d\n", callback_count, 3 * CALL_COUNT);
+        exit(255);
+    }
+
+    printf("Got all %d callbacks across %d groups\n", callback_count, GROUP_COUNT);
+
+    // Send -1 to trigger server exit.
+    while(dstc_humidity(-1, DSTC_CLIENT_CALLBACK_ARG_NULL) == EBUSY)
+        dstc_process_events(0);
+
+    // Process events until the exit call has been delivered.
+    timeout = dstc_msec_monotonic_timestamp() + 500;
+    while(dstc_msec_monotonic_timestamp() < timeout)
+        dstc_process_events(timeout - dstc_msec_monotonic_timestamp());
+
+    exit(0);
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Server side of the multicast group example.
+//
+// Joins the groups carrying the functions it serves, and answers
+// each call through its callback.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include "rmc_log.h"
+#include <errno.h>
+
+#define GROUP_COUNT 4
+
+DSTC_SERVER(temperature, int,, DSTC_DECL_CALLBACK_ARG)
+DSTC_SERVER(pressure, int,, DSTC_DECL_CALLBACK_ARG)
+DSTC_SERVER(humidity, int,, DSTC_DECL_CALLBACK_ARG)
+
+DSTC_SERVER_CALLBACK(callback_ref, int,);
+
+static void reply(int value, dstc_callback_t callback_ref)
+{
+    while(dstc_callback_ref(callback_ref, value) == EBUSY)
+        dstc_process_events(0);
+}
+
+void temperature(int value, dstc_callback_t callback_ref)
+{
+    reply(value, callback_ref);
+}
+
+void pressure(int value, dstc_callback_t callback_ref)
+{
+    reply(value, callback_ref);
+}
+
+void humidity(int value, dstc_callback_t callback_ref)
+{
+    if (value == -1) {
+        puts("humidity(-1): Got exit signal.");
+        while(dstc_process_events(0) != ETIME)
+            ;
+        exit(0);
+    }
+
+    reply(value, callback_ref);
+}
+
+int main(int argc, char* argv[])
+{
+    int res = dstc_setup_groups(GROUP_COUNT, 0);
+
+    if (res) {
+        printf("Error: dstc_setup_groups() returned %d\n", res);
+        exit(255);
+    }
+
+    // Process incoming events for ever
+    while(1)
+        dstc_process_events(-1);
+
+    exit(0);
+}
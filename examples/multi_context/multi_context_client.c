@@ -0,0 +1,85 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Send calls through two independent contexts from a single thread,
+// switching between them with dstc_use_context().
+//
+
+#include "dstc.h"
+#include <rmc_log.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#define CONTEXT_COUNT 2
+#define CALL_COUNT 20000
+#define MCAST_GROUP "239.40.41.42"
+#define MCAST_PORT 4731
+
+DSTC_CLIENT(set_value, int, , int,)
+
+static struct dstc_context* context[CONTEXT_COUNT];
+
+// Process pending events on all contexts.
+static void process_all(void)
+{
+    struct dstc_context* prev_ctx = dstc_current_context();
+    int ind = 0;
+
+    for(ind = 0; ind < CONTEXT_COUNT; ++ind) {
+        dstc_use_context(context[ind]);
+        dstc_process_events(0);
+    }
+    dstc_use_context(prev_ctx);
+}
+
+int main(int argc, char* argv[])
+{
+    int ind = 0;
+    int val = 0;
+    msec_timestamp_t ts = 0;
+    msec_timestamp_t timeout = 0;
+
+    for(ind = 0; ind < CONTEXT_COUNT; ++ind) {
+        context[ind] = dstc_create_context();
+        dstc_use_context(context[ind]);
+        dstc_setup2(-1, 0, DSTC_MAX_CONNECTIONS,
+                    MCAST_GROUP, MCAST_PORT + ind,
+                    getenv("DSTC_MCAST_IFACE_ADDR"),
+                    1, 0, 0, RMC_LOG_LEVEL_ERROR);
+    }
+
+    // Wait for the function to become available through both contexts.
+    for(ind = 0; ind < CONTEXT_COUNT; ++ind) {
+        dstc_use_context(context[ind]);
+        while(!dstc_remote_function_available(dstc_set_value))
+            process_all();
+    }
+
+    for(val = 0; val < CALL_COUNT; ++val) {
+        for(ind = 0; ind < CONTEXT_COUNT; ++ind) {
+            dstc_use_context(context[ind]);
+            while (dstc_set_value(ind, val) == EBUSY)
+                process_all();
+        }
+    }
+
+    // Process events until all calls have been delivered.
+    ts = dstc_msec_monotonic_timestamp();
+    timeout = ts + 2000;
+    while(ts < timeout) {
+        process_all();
+        ts = dstc_msec_monotonic_timestamp();
+    }
+
+    dstc_use_context(0);
+    for(ind = 0; ind < CONTEXT_COUNT; ++ind)
+        dstc_destroy_context(context[ind]);
+
+    puts("Client exiting");
+    exit(0);
+}
@@ -0,0 +1,79 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Serve set_value() on two independent contexts, each on its own
+// multicast port and run by its own thread.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include <rmc_log.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define CONTEXT_COUNT 2
+#define CALL_COUNT 20000
+#define MCAST_GROUP "239.40.41.42"
+#define MCAST_PORT 4731
+
+DSTC_SERVER(set_value, int, , int,)
+
+static struct dstc_context* context[CONTEXT_COUNT];
+static int last_value[CONTEXT_COUNT] = { -1, -1 };
+
+void set_value(int context_ind, int value)
+{
+    // Each context only receives calls sent to its multicast port.
+    if (dstc_current_context() != context[context_ind]) {
+        printf("Integrity failure! Call for context %d received by another context\n",
+               context_ind);
+        exit(255);
+    }
+
+    if (value != last_value[context_ind] + 1) {
+        printf("Integrity failure! Context %d want value %d Got value %d\n",
+               context_ind, last_value[context_ind] + 1, value);
+        exit(255);
+    }
+    last_value[context_ind] = value;
+}
+
+static void* run_context(void* arg)
+{
+    int ind = (int) (intptr_t) arg;
+
+    dstc_use_context(context[ind]);
+    dstc_setup2(-1, 0, DSTC_MAX_CONNECTIONS,
+                MCAST_GROUP, MCAST_PORT + ind,
+                getenv("DSTC_MCAST_IFACE_ADDR"),
+                1, 0, 0, RMC_LOG_LEVEL_ERROR);
+
+    while(last_value[ind] < CALL_COUNT - 1)
+        dstc_process_events(100);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    pthread_t thread[CONTEXT_COUNT];
+    int ind = 0;
+
+    for(ind = 0; ind < CONTEXT_COUNT; ++ind) {
+        context[ind] = dstc_create_context();
+        pthread_create(&thread[ind], 0, run_context, (void*) (intptr_t) ind);
+    }
+
+    for(ind = 0; ind < CONTEXT_COUNT; ++ind) {
+        pthread_join(thread[ind], 0);
+        dstc_destroy_context(context[ind]);
+    }
+
+    puts("Server exiting");
+    exit(0);
+}
@@ -0,0 +1,158 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Microbenchmark of the argument serialization code generated by
+// DSTC_CLIENT() and DSTC_SERVER(), one signature shape at a time.
+//
+// Each shape is encoded with SIZE_ARGUMENTS() and
+// SERIALIZE_ARGUMENTS(), as done by the generated dstc_[name]()
+// client function, and decoded by the dstc_server_[name]() function
+// generated by DSTC_SERVER(). Shapes with an _aligned suffix use the
+// aligned layout of DSTC_CLIENT_ALIGNED() and DSTC_SERVER_ALIGNED()
+// instead. No network traffic is involved.
+//
+// Usage: serialize_bench [iterations]
+//
+
+#include "dstc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 10000000
+
+struct name_and_age {
+    char name[32];
+    int age;
+};
+
+// Checksum updated by all server functions, keeping the compiler
+// from optimizing away the decoding.
+static volatile uint64_t sink = 0;
+
+// Keep the compiler from hoisting encoding out of the loop, or
+// from merging successive iterations.
+#define BENCH_BARRIER() __asm__ volatile("" : : : "memory")
+
+// Generate an encoder and a decoder for the given signature.
+#define BENCH_SHAPE(name, ...)                                          \
+    DSTC_SERVER(name, __VA_ARGS__)                                      \
+    static uint32_t encode_##name(uint8_t* payload                      \
+                                  DECLARE_NEXT_ARGUMENTS(__VA_ARGS__))  \
+    {                                                                   \
+        uint8_t* start = payload;                                       \
+                                                                        \
+        if (SIZE_ARGUMENTS(__VA_ARGS__) > RMC_MAX_PAYLOAD)              \
+            return 0;                                                   \
+                                                                        \
+        SERIALIZE_ARGUMENTS(__VA_ARGS__);                               \
+        return (uint32_t) (payload - start);                            \
+    }
+
+// Same as BENCH_SHAPE(), but with the aligned layout.
+#define BENCH_ALIGNED_SHAPE(name, ...)                                  \
+    DSTC_SERVER_ALIGNED(name, __VA_ARGS__)                              \
+    static uint32_t encode_##name(uint8_t* payload                      \
+                                  DECLARE_NEXT_ARGUMENTS(__VA_ARGS__))  \
+    {                                                                   \
+        uint8_t* start = payload;                                       \
+        uint32_t arg_sz = SIZE_ALIGNED_ARGUMENTS(__VA_ARGS__);          \
+                                                                        \
+        if (arg_sz > RMC_MAX_PAYLOAD)                                   \
+            return 0;                                                   \
+                                                                        \
+        SERIALIZE_ALIGNED_ARGUMENTS(__VA_ARGS__);                       \
+        return (uint32_t) (payload - start);                            \
+    }
+
+BENCH_SHAPE(one_int, int,)
+BENCH_SHAPE(four_ints, int,, int,, int,, int,)
+BENCH_SHAPE(char_array, char, [32])
+BENCH_SHAPE(name_and_age, struct name_and_age,)
+BENCH_SHAPE(dynamic, DSTC_DECL_DYNAMIC_ARG)
+BENCH_SHAPE(callback, DSTC_DECL_CALLBACK_ARG, int,)
+BENCH_SHAPE(mixed, int,, char, [32], DSTC_DECL_DYNAMIC_ARG)
+BENCH_SHAPE(chat, char, [128], char, [512])
+BENCH_ALIGNED_SHAPE(chat_aligned, const char, [128], const char, [512])
+BENCH_ALIGNED_SHAPE(struct_aligned, int,, const struct name_and_age, [1])
+
+void one_int(int a) { sink += a; }
+void four_ints(int a, int b, int c, int d) { sink += a + b + c + d; }
+void char_array(char name[32]) { sink += name[0]; }
+void name_and_age(struct name_and_age na) { sink += na.age; }
+void dynamic(dstc_dynamic_data_t data) { sink += data.length; }
+void callback(dstc_callback_t cb, int a) { sink += cb + a; }
+void mixed(int a, char name[32], dstc_dynamic_data_t data) { sink += a + name[0] + data.length; }
+// The chat and struct shapes are not inlined, so that the copies made
+// by the packed layout are not optimized away.
+__attribute__((noinline)) void chat(char user[128], char msg[512]) { sink += user[0] + msg[0]; }
+__attribute__((noinline)) void chat_aligned(const char user[128], const char msg[512]) { sink += user[0] + msg[0]; }
+__attribute__((noinline)) void struct_aligned(int a, const struct name_and_age na[1]) { sink += a + na->age; }
+
+static uint64_t nsec_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char* shape, uint32_t len, uint32_t iterations,
+                   uint64_t encode_nsec, uint64_t decode_nsec)
+{
+    printf("%-14s %5u bytes  encode %6.2f nsec  decode %6.2f nsec\n",
+           shape, len,
+           (double) encode_nsec / iterations,
+           (double) decode_nsec / iterations);
+}
+
+// Encode iterations calls into payload, then decode the last one
+// iterations times. The arguments may refer to the loop index ind.
+#define RUN_SHAPE(name, ...)                                            \
+    {                                                                   \
+        uint64_t start = nsec_timestamp();                              \
+        uint64_t encode_nsec = 0;                                       \
+        uint32_t len = 0;                                               \
+        uint32_t ind = 0;                                               \
+                                                                        \
+        for(ind = 0; ind < iterations; ++ind) {                         \
+            len = encode_##name(payload, __VA_ARGS__);                  \
+            BENCH_BARRIER();                                            \
+        }                                                               \
+                                                                        \
+        encode_nsec = nsec_timestamp() - start;                         \
+        start = nsec_timestamp();                                       \
+        for(ind = 0; ind < iterations; ++ind) {                         \
+            dstc_server_##name(0, 0, 0, payload, len);                  \
+            BENCH_BARRIER();                                            \
+        }                                                               \
+                                                                        \
+        report(#name, len, iterations, encode_nsec,                     \
+               nsec_timestamp() - start);                               \
+    }
+
+int main(int argc, char* argv[])
+{
+    // Cache line aligned, as payload buffers are.
+    static uint8_t payload[RMC_MAX_PAYLOAD] __attribute__((aligned(64)));
+    uint32_t iterations = (argc > 1)?(uint32_t) atoi(argv[1]):DEFAULT_ITERATIONS;
+    struct name_and_age na = { "Bob Smith", 25 };
+    char name[32] = "Bob Smith";
+    char data[64] = "Dynamic data argument";
+    char user[128] = "Bob Smith";
+    char msg[512] = "Chat message argument";
+
+    RUN_SHAPE(one_int, ind);
+    RUN_SHAPE(four_ints, ind, 2, 3, 4);
+    RUN_SHAPE(char_array, name);
+    RUN_SHAPE(name_and_age, na);
+    RUN_SHAPE(dynamic, DSTC_DYNAMIC_ARG(data, sizeof(data)));
+    RUN_SHAPE(callback, (dstc_callback_t) 0x100000001, ind);
+    RUN_SHAPE(mixed, ind, name, DSTC_DYNAMIC_ARG(data, sizeof(data)));
+    RUN_SHAPE(chat, user, msg);
+    RUN_SHAPE(chat_aligned, user, msg);
+    RUN_SHAPE(struct_aligned, ind, &na);
+    exit(0);
+}
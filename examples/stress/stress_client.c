@@ -32,18 +32,11 @@ int main(int argc, char* argv[])
     dstc_buffer_client_calls();
     //
     // Pump as many calls as we can through the server.
-    // If we choke on EBUSY, process events until we have cleared
-    // the output queue enough to continue.
+    // If the output queue is full, dstc_set_value_wait() processes
+    // events until it has cleared enough to continue.
     //
     while(val < 10000000) {
-        // Pump out calls until we get EBUSY back.
-        //
-        // At that point, process events to actually send them
-        // over the wire until the dstc_set_value() call succeeeds.
-        while (dstc_set_value(val) == EBUSY) {
-            dstc_process_events(1);
-            continue;
-        }
+        dstc_set_value_wait(-1, val);
 
         if (val % 100000 == 0)
             printf("Client value: %d\n", val);
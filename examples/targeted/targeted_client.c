@@ -0,0 +1,91 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Address calls to a single server through dstc_[name]_to().
+// The server tells us its node ID when it comes up.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include "rmc_log.h"
+#include <errno.h>
+
+#define CALL_COUNT 10000
+
+DSTC_SERVER(shard_node, rmc_node_id_t,)
+
+DSTC_CLIENT(shard_put, int,, DSTC_DECL_CALLBACK_ARG);
+
+static rmc_node_id_t server_node_id = 0;
+static int callback_count = 0;
+
+void shard_node(rmc_node_id_t node_id)
+{
+    server_node_id = node_id;
+}
+
+void shard_put_callback(int value)
+{
+    if (value != callback_count) {
+        printf("Error: callback expected %d, got %d\n", callback_count, value);
+        exit(255);
+    }
+    ++callback_count;
+}
+
+DSTC_CLIENT_CALLBACK(shard_put_callback, int,);
+
+
+int main(int argc, char* argv[])
+{
+    int ind = 0;
+    int res = 0;
+    msec_timestamp_t timeout = 0;
+
+    // Wait for the server to tell us its node ID.
+    while(!server_node_id)
+        dstc_process_events(-1);
+
+    // We do not serve the function ourselves.
+    res = dstc_shard_put_to(dstc_get_node_id(), 0,
+                            DSTC_CLIENT_CALLBACK_ARG(shard_put_callback));
+    if (res != ENOENT) {
+        printf("Error: call to own node returned %d, expected ENOENT\n", res);
+        exit(255);
+    }
+
+    for(ind = 0; ind < CALL_COUNT; ++ind)
+        while((res = dstc_shard_put_to(server_node_id, ind,
+                                       DSTC_CLIENT_CALLBACK_ARG(shard_put_callback))) == EBUSY)
+            dstc_process_events(0);
+
+    if (res) {
+        printf("Error: dstc_shard_put_to() returned %d\n", res);
+        exit(255);
+    }
+
+    timeout = dstc_msec_monotonic_timestamp() + 10000;
+    while(callback_count < CALL_COUNT && dstc_msec_monotonic_timestamp() < timeout)
+        dstc_process_events(10);
+
+    if (callback_count != CALL_COUNT) {
+        printf("Error: got %d callbacks, expected %d\n", callback_count, CALL_COUNT);
+        exit(255);
+    }
+
+    printf("Got all %d callbacks from node [0x%X]\n", CALL_COUNT, server_node_id);
+
+    // Send -1 to trigger server exit.
+    while(dstc_shard_put_to(server_node_id, -1, DSTC_CLIENT_CALLBACK_ARG_NULL) == EBUSY)
+        dstc_process_events(0);
+
+    // Process events until the exit call has been delivered.
+    timeout = dstc_msec_monotonic_timestamp() + 500;
+    while(dstc_msec_monotonic_timestamp() < timeout)
+        dstc_process_events(timeout - dstc_msec_monotonic_timestamp());
+
+    exit(0);
+}
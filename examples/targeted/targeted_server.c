@@ -0,0 +1,50 @@
+// Copyright (C) 2019, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Server side of the targeted call example.
+//
+// Tells the client its node ID, and serves the calls addressed to it.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc.h"
+#include "rmc_log.h"
+#include <errno.h>
+
+DSTC_CLIENT(shard_node, rmc_node_id_t,)
+
+DSTC_SERVER(shard_put, int,, DSTC_DECL_CALLBACK_ARG)
+
+DSTC_SERVER_CALLBACK(callback_ref, int,);
+
+void shard_put(int value, dstc_callback_t callback_ref)
+{
+    if (value == -1) {
+        puts("shard_put(-1): Got exit signal.");
+        while(dstc_process_events(0) != ETIME)
+            ;
+        exit(0);
+    }
+
+    while(dstc_callback_ref(callback_ref, value) == EBUSY)
+        dstc_process_events(0);
+}
+
+int main(int argc, char* argv[])
+{
+    // Wait for the client to show up, and tell it our node ID.
+    while(!dstc_remote_function_available(dstc_shard_node))
+        dstc_process_events(-1);
+
+    while(dstc_shard_node(dstc_get_node_id()) == EBUSY)
+        dstc_process_events(0);
+
+    // Process incoming events for ever
+    while(1)
+        dstc_process_events(-1);
+
+    exit(0);
+}
@@ -31,31 +31,27 @@ void *t_exec(void* arg)
 
     //
     // Pump as many calls as we can through the server.
-    // If we choke on EBUSY, process events until we have cleared
-    // the output queue enough to continue.
+    // If the output queue is full, dstc_set_valueX_wait() blocks
+    // until it has cleared enough to continue, instead of spinning
+    // on EBUSY.
     //
     while(val < 1000000) {
 
         switch(ind) {
         case 1:
-            while (dstc_set_value1(val) == EBUSY)
-                dstc_process_events(0);
+            dstc_set_value1_wait(-1, val);
             break;
 
         case 2:
-            while (dstc_set_value2(val) == EBUSY)
-                dstc_process_events(0);
+            dstc_set_value2_wait(-1, val);
             break;
 
         case 3:
-            while (dstc_set_value3(val) == EBUSY)
-                dstc_process_events(0);
+            dstc_set_value3_wait(-1, val);
             break;
 
         case 4:
-            while (dstc_set_value4(val) == EBUSY)
-                dstc_process_events(0);
-
+            dstc_set_value4_wait(-1, val);
             break;
         default:
             printf("WUT %lu\n", ind);
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <rmc_log.h>  // From reliable multicast packet
 #include <errno.h>
+#include <unistd.h>
 #include "uthash.h"
 
 
@@ -95,6 +96,13 @@ void poll_add_pub(user_data_t user_data,
     poll_add(user_data, descriptor, TO_POLL_EVENT_USER_DATA(index, 1), action);
 }
 
+// Add wake_fd[0] of a context to its event set.
+void poll_add_wake(user_data_t user_data,
+                   int descriptor)
+{
+    poll_add(user_data, descriptor, USER_DATA_WAKE_FLAG, RMC_POLLREAD);
+}
+
 static void poll_modify(user_data_t user_data,
                         int descriptor,
                         uint32_t event_user_data,
@@ -185,6 +193,23 @@ void poll_remove(user_data_t user_data,
     _dstc_unlock_context(ctx);
 }
 
+// Close all descriptors left in the poll set of a context being
+// destroyed, and free the poll set hash table.
+//
+// ctx must be non-null and locked
+void _dstc_poll_close_all(dstc_context_t* ctx)
+{
+    poll_elem_t* pelem = 0;
+    poll_elem_t* tmp = 0;
+
+    HASH_ITER(hh, ctx->poll_hash, pelem, tmp) {
+        RMC_LOG_COMMENT("Closing descriptor %d left in poll set", pelem->pfd.fd);
+        HASH_DEL(ctx->poll_hash, pelem);
+        close(pelem->pfd.fd);
+        pelem->pfd.fd = -1;
+    }
+}
+
 
 
 static void _dstc_process_poll_result(dstc_context_t* ctx,
@@ -205,6 +230,13 @@ static void _dstc_process_poll_result(dstc_context_t* ctx,
     rmc_index_t c_ind = (rmc_index_t) FROM_POLL_EVENT_USER_DATA(pelem->user_data);
     int is_pub = IS_PUB(pelem->user_data);
 
+    // Another thread has set a flush deadline. Have the caller
+    // return, and wait again with a timeout that observes it.
+    if (IS_WAKE(pelem->user_data)) {
+        _dstc_wake_fd_drain(ctx);
+        return;
+    }
+
     RMC_LOG_INDEX_DEBUG(c_ind, "desc[%d/%d] ind[%d] user_data[%u] %s:%s%s%s",
                         event->fd,
                         pelem->pfd.fd,
@@ -217,9 +249,11 @@ static void _dstc_process_poll_result(dstc_context_t* ctx,
 
 
     if (event->revents & POLLIN) {
-        if (is_pub)
+        if (is_pub) {
             rmc_pub_read(ctx->pub_ctx, c_ind, &op_res);
-        else
+            // Acks may have lifted a traffic suspension.
+            _dstc_resume_pending_calls(ctx);
+        } else
             rmc_sub_read(ctx->sub_ctx, c_ind, &op_res);
     }
 
@@ -255,6 +289,7 @@ int _dstc_process_single_event(dstc_context_t* ctx, int timeout_msec)
         n_events++;
     }
 
+    ctx->event_wait_threads++;
     _dstc_unlock_context(ctx);
     do {
         errno = 0;
@@ -266,6 +301,12 @@ int _dstc_process_single_event(dstc_context_t* ctx, int timeout_msec)
         exit(255);
     }
     _dstc_lock_context(ctx);
+    ctx->event_wait_threads--;
+
+    // Let threads blocked in dstc_wait_for_capacity() take over
+    // waiting for events.
+    if (ctx->flow_waiters)
+        pthread_cond_broadcast(&ctx->flow_cond);
 
     // Timeout
     if (n_hits == 0)
@@ -290,9 +331,7 @@ int dstc_retrieve_pollfd_vector(struct pollfd* result,
 {
     int n_events = 0;
     poll_elem_t* iter;
-    extern dstc_context_t _dstc_default_context;
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    dstc_context_t* ctx = _dstc_current_context();
 
     _dstc_lock_and_init_context(ctx);
     iter = ctx->poll_hash;
@@ -318,9 +357,7 @@ int dstc_retrieve_pollfd_vector(struct pollfd* result,
 }
 void dstc_process_poll_result(struct pollfd* event)
 {
-    extern dstc_context_t _dstc_default_context;
-    // Prep for future, caller-provided contexct.
-    dstc_context_t* ctx = &_dstc_default_context;
+    dstc_context_t* ctx = _dstc_current_context();
 
     _dstc_lock_and_init_context(ctx);
     _dstc_process_poll_result(ctx, event);